@@ -0,0 +1,70 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* The runtime of programs compiled ahead of time by schemec
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "aot.h"
+#include "interpreter.h"
+#include "intern.h"
+#include "linkedlist.h"
+#include "output.h"
+#include "quicken.h"
+#include "reader.h"
+#include "talloc.h"
+#include "value.h"
+
+// Sets up output and the global frame for a compiled program
+void aotStart(const char *sources, size_t length) {
+    initOutput();
+    if (length > 0 && !unpackSources(sources, length)) {
+        printf("compiled program: source locations are malformed\n");
+        texit(1);
+    }
+    initInterpreter();
+}
+
+// Builds the count constants of a program and returns them in order
+Value **aotConstants(const AotConstant *constants, int count) {
+    Value **values = talloc(sizeof(Value *) * count);
+    int i;
+    for (i = 0; i < count; i++) {
+        const AotConstant *constant = constants + i;
+        Value *value = makeNull();
+        value->type = constant->type;
+        value->loc = constant->loc;
+        switch (constant->type) {
+            case INT_TYPE:
+                value->i = constant->i;
+                break;
+            case DOUBLE_TYPE:
+                value->d = constant->d;
+                break;
+            case BOOL_TYPE:
+                value->s = (char *)constant->s;
+                break;
+            case SYMBOL_TYPE:
+                // local variables are found by the address of their name
+                value->s = intern(constant->s, strlen(constant->s));
+                break;
+            case STR_TYPE:
+                value->str.chars = (char *)constant->s;
+                value->str.length = constant->i;
+                break;
+            case CONS_TYPE:
+                value->c.car = values[constant->car];
+                value->c.cdr = values[constant->cdr];
+                break;
+            default:
+                break;
+        }
+        values[i] = value;
+    }
+    return values;
+}
+
+// Returns a quickened reference to the variable symbol
+Quick *aotVariable(Value *symbol) {
+    return quickVariable(symbol)->quick;
+}
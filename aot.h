@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include "value.h"
+#include "quicken.h"
+
+#ifndef _AOT
+#define _AOT
+
+// The runtime of programs compiled to C by schemec (see schemec.c)
+
+// A value of a compiled program as the parser made it, kept in a table of
+// the program's constants. A list cell gives its car and cdr by their
+// indexes in the table, which are smaller than its own.
+struct AotConstant {
+    int type;
+    unsigned int loc;
+    // INT_TYPE: the integer; STR_TYPE: the length of the text between the
+    // quotes
+    int i;
+    double d;
+    // SYMBOL_TYPE: the name; BOOL_TYPE: "#t" or "#f"; STR_TYPE: the text
+    // with its quotes
+    const char *s;
+    int car;
+    int cdr;
+};
+
+typedef struct AotConstant AotConstant;
+
+// Sets up output and the global frame for a compiled program. sources is
+// the block packSources made of the sources it was compiled from, so that
+// errors are located in them as the interpreter would locate them.
+void aotStart(const char *sources, size_t length);
+
+// Builds the count constants of a program and returns them in order
+Value **aotConstants(const AotConstant *constants, int count);
+
+// Returns a quickened reference to the variable symbol
+Quick *aotVariable(Value *symbol);
+
+#endif
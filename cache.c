@@ -0,0 +1,651 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Cache files holding the parsed forms of source files, so that a source
+* that has not changed is not lexed and parsed again
+*/
+
+/*
+The cache of a.scm is a.scm.cache, next to it. It is only used if it was
+written by the same version of the cache layout from a source of the same
+length and hash, so an edited source is parsed again and its cache
+rewritten. A cache is written only once the whole source has been read
+without an error, to a temporary file that is then renamed over the old
+one.
+
+A cache file is a header, which also holds a hash of the rest of the file,
+followed by three arrays:
+
+    symbols  the names of the symbols used, as (start, length) in the text
+    nodes    the forms in preorder: a list is a node holding its number of
+             elements, followed by the nodes of the elements
+    text     the characters of names and strings (strings with their
+             quotes), each followed by a NUL
+
+Loading maps the file and builds every form of the source straight from the
+nodes, all in one allocation: each symbol is interned once, strings point
+into the mapping, and no text is lexed. The mapping stays until the program
+exits. Locations are kept relative to the start of the source, so errors in
+cached code are reported just as in parsed code.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "intern.h"
+#include "talloc.h"
+#include "value.h"
+
+// "SCMC", read as a little-endian word
+#define CACHE_MAGIC 0x434d4353
+
+#define CACHE_SUFFIX ".cache"
+
+// Kinds of node
+#define NODE_LIST 0
+#define NODE_EMPTY 1
+#define NODE_INT 2
+#define NODE_DOUBLE 3
+#define NODE_STRING 4
+#define NODE_SYMBOL 5
+#define NODE_TRUE 6
+#define NODE_FALSE 7
+
+// Nesting depth handled without allocating a stack
+#define CACHE_STACK_SIZE 64
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+    uint64_t formCount;
+    uint64_t nodeCount;
+    uint64_t cellCount;
+    uint64_t symbolCount;
+    uint64_t textLength;
+    uint64_t bodyHash;
+};
+
+typedef struct CacheHeader CacheHeader;
+
+// A name or string in the text
+struct CacheText {
+    uint32_t start;
+    uint32_t length;
+};
+
+typedef struct CacheText CacheText;
+
+// One datum. location is the datum's offset in the source plus one, or 0
+// if it has none.
+struct CacheNode {
+    uint32_t kind;
+    uint32_t location;
+    union {
+        uint64_t count;
+        uint64_t symbol;
+        int64_t i;
+        double d;
+        CacheText text;
+    };
+};
+
+typedef struct CacheNode CacheNode;
+
+struct CacheWriter {
+    char *cachePath;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+    unsigned int base;
+    uint64_t formCount;
+    uint64_t cellCount;
+    CacheNode *nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+    CacheText *symbols;
+    size_t symbolCount;
+    size_t symbolCapacity;
+    char *text;
+    size_t textLength;
+    size_t textCapacity;
+    // interned names and their symbol numbers, by address
+    char **names;
+    uint32_t *numbers;
+    size_t nameSlots;
+    int failed;
+};
+
+// A list being rebuilt: its first and last cells, the NULL that ends it,
+// how many elements are still to come, and the location of its first cell
+struct CacheList {
+    Value *head;
+    Value *tail;
+    Value *end;
+    uint64_t remaining;
+    unsigned int loc;
+};
+
+typedef struct CacheList CacheList;
+
+// A cache file that is mapped, kept until the program exits
+struct CacheMapping {
+    void *data;
+    size_t length;
+    struct CacheMapping *next;
+};
+
+typedef struct CacheMapping CacheMapping;
+
+int codeCache = 0;
+CacheMapping *cacheMappings = NULL;
+
+// Turns the use of cache files on or off for sources opened from now on
+void setCodeCache(int enabled){
+    codeCache = enabled;
+}
+
+// Returns 1 if sources are read through cache files
+int codeCacheEnabled(){
+    return codeCache;
+}
+
+// Unmaps every cache file; registered with atexit
+void releaseCacheMappings(){
+    while (cacheMappings != NULL){
+        CacheMapping *mapping = cacheMappings;
+        munmap(mapping->data, mapping->length);
+        cacheMappings = mapping->next;
+        free(mapping);
+    }
+}
+
+// Continues hash h over length bytes, a word at a time
+uint64_t hashCacheBytes(uint64_t h, const void *data, size_t length){
+    const char *text = data;
+    size_t i = 0;
+    for (; i + 8 <= length; i = i + 8){
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        h = (h ^ word) * 1099511628211ull;
+        h = h ^ (h >> 29);
+    }
+    for (; i < length; i++){
+        h = (h ^ (unsigned char)text[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Hashes the text of a source
+uint64_t hashSource(const char *text, size_t length){
+    return hashCacheBytes(14695981039346656037ull ^ length, text, length);
+}
+
+// Hashes the three arrays of a cache file, to catch a damaged file
+uint64_t hashBody(CacheText *symbols, CacheNode *nodes, char *text,
+                  CacheHeader *header){
+    uint64_t h = hashCacheBytes(14695981039346656037ull, symbols,
+                           sizeof(CacheText) * header->symbolCount);
+    h = hashCacheBytes(h, nodes, sizeof(CacheNode) * header->nodeCount);
+    return hashCacheBytes(h, text, header->textLength);
+}
+
+// Returns the name of the cache file of the source at path
+char *cachePathOf(char *path){
+    size_t length = strlen(path);
+    char *cachePath = malloc(length + sizeof(CACHE_SUFFIX));
+    memcpy(cachePath, path, length);
+    memcpy(cachePath + length, CACHE_SUFFIX, sizeof(CACHE_SUFFIX));
+    return cachePath;
+}
+
+// Returns the location of a node at offset location - 1 from base
+unsigned int nodeLocation(uint32_t location, unsigned int base){
+    if (location == 0 || base == 0 || location - 1 > UINT32_MAX - base){
+        return 0;
+    }
+    return base + location - 1;
+}
+
+// Returns 1 if a name or string lies inside the text
+int validText(CacheText text, uint64_t textLength){
+    return text.length < textLength && text.start < textLength - text.length;
+}
+
+// Builds the forms of a cache file from its nodes; returns NULL if the file
+// does not hold well-formed forms
+Value *decodeForms(char *data, CacheHeader *header, unsigned int base){
+    CacheText *symbols = (CacheText *)(data + sizeof(CacheHeader));
+    CacheNode *nodes = (CacheNode *)(symbols + header->symbolCount);
+    char *text = (char *)(nodes + header->nodeCount);
+    if (hashBody(symbols, nodes, text, header) != header->bodyHash){
+        return NULL;
+    }
+    char **names = talloc(sizeof(char *) * (header->symbolCount + 1));
+    uint64_t i;
+    for (i = 0; i < header->symbolCount; i++){
+        if (!validText(symbols[i], header->textLength)){
+            return NULL;
+        }
+        names[i] = intern(text + symbols[i].start, symbols[i].length);
+    }
+
+    // every node, list cell and cell of the list of forms, and its end
+    Value *values = talloc(sizeof(Value) * (header->nodeCount +
+                                            header->cellCount +
+                                            header->formCount + 1));
+    Value *cells = values + header->nodeCount;
+    Value *cellsEnd = cells + header->cellCount + header->formCount;
+    Value *formsEnd = cellsEnd;
+    formsEnd->type = NULL_TYPE;
+    formsEnd->loc = 0;
+    Value *forms = formsEnd;
+    Value *formsTail = NULL;
+
+    CacheList initial[CACHE_STACK_SIZE];
+    CacheList *stack = initial;
+    int capacity = CACHE_STACK_SIZE;
+    int depth = 0;
+    for (i = 0; i < header->nodeCount; i++){
+        CacheNode *node = nodes + i;
+        Value *datum = values + i;
+        datum->loc = nodeLocation(node->location, base);
+        switch (node->kind){
+            case NODE_LIST:
+                // the node's value is the NULL that ends the list
+                datum->type = NULL_TYPE;
+                if (node->count == 0){
+                    return NULL;
+                }
+                if (depth == capacity){
+                    CacheList *larger = talloc(sizeof(CacheList) *
+                                               capacity * 2);
+                    memcpy(larger, stack, sizeof(CacheList) * capacity);
+                    stack = larger;
+                    capacity = capacity * 2;
+                }
+                stack[depth].head = NULL;
+                stack[depth].tail = NULL;
+                stack[depth].end = datum;
+                stack[depth].remaining = node->count;
+                stack[depth].loc = datum->loc;
+                depth = depth + 1;
+                continue;
+            case NODE_EMPTY:
+                datum->type = NULL_TYPE;
+                break;
+            case NODE_INT:
+                datum->type = INT_TYPE;
+                datum->i = node->i;
+                break;
+            case NODE_DOUBLE:
+                datum->type = DOUBLE_TYPE;
+                datum->d = node->d;
+                break;
+            case NODE_STRING:
+                if (!validText(node->text, header->textLength) ||
+                    node->text.length == 0){
+                    return NULL;
+                }
+                datum->type = STR_TYPE;
+                datum->str.chars = text + node->text.start;
+                if (datum->str.chars[0] == '\"'){
+                    datum->str.length = node->text.length - 2;
+                } else {
+                    datum->str.length = 0;
+                }
+                break;
+            case NODE_SYMBOL:
+                if (node->symbol >= header->symbolCount){
+                    return NULL;
+                }
+                datum->type = SYMBOL_TYPE;
+                datum->s = names[node->symbol];
+                break;
+            case NODE_TRUE:
+                datum->type = BOOL_TYPE;
+                datum->s = "#t";
+                break;
+            case NODE_FALSE:
+                datum->type = BOOL_TYPE;
+                datum->s = "#f";
+                break;
+            default:
+                return NULL;
+        }
+
+        // append the datum, and every list it completes, to its parent
+        while (1){
+            if (cells == cellsEnd){
+                return NULL;
+            }
+            Value *cell = cells;
+            cells = cells + 1;
+            cell->type = CONS_TYPE;
+            cell->c.car = datum;
+            if (depth == 0){
+                cell->loc = 0;
+                cell->c.cdr = formsEnd;
+                if (formsTail == NULL){
+                    forms = cell;
+                } else {
+                    formsTail->c.cdr = cell;
+                }
+                formsTail = cell;
+                break;
+            }
+            CacheList *list = stack + depth - 1;
+            cell->c.cdr = list->end;
+            if (list->head == NULL){
+                cell->loc = list->loc;
+                list->head = cell;
+            } else {
+                cell->loc = datum->loc;
+                list->tail->c.cdr = cell;
+            }
+            list->tail = cell;
+            list->remaining = list->remaining - 1;
+            if (list->remaining > 0){
+                break;
+            }
+            datum = list->head;
+            depth = depth - 1;
+        }
+    }
+    if (depth > 0 || cells != cellsEnd){
+        return NULL;
+    }
+    return forms;
+}
+
+// Returns the list of the top-level forms of the source at path from its
+// cache file, or NULL if there is no cache made from exactly this text
+Value *loadCodeCache(char *path, const char *text, size_t length,
+                     unsigned int base){
+    char *cachePath = cachePathOf(path);
+    int fd = open(cachePath, O_RDONLY);
+    free(cachePath);
+    if (fd < 0){
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(CacheHeader)){
+        close(fd);
+        return NULL;
+    }
+    size_t size = info.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+        return NULL;
+    }
+
+    CacheHeader *header = (CacheHeader *)data;
+    Value *forms = NULL;
+    uint64_t arrays = size - sizeof(CacheHeader);
+    if (header->magic == CACHE_MAGIC && header->version == CACHE_VERSION &&
+        header->sourceLength == length &&
+        header->symbolCount <= arrays / sizeof(CacheText) &&
+        header->nodeCount <= arrays / sizeof(CacheNode) &&
+        header->formCount <= header->nodeCount &&
+        header->cellCount == header->nodeCount - header->formCount &&
+        header->symbolCount * sizeof(CacheText) +
+        header->nodeCount * sizeof(CacheNode) +
+        header->textLength == arrays &&
+        header->sourceHash == hashSource(text, length)){
+        forms = decodeForms(data, header, base);
+    }
+    if (forms == NULL){
+        munmap(data, size);
+        return NULL;
+    }
+    if (cacheMappings == NULL){
+        atexit(releaseCacheMappings);
+    }
+    CacheMapping *mapping = malloc(sizeof(CacheMapping));
+    mapping->data = data;
+    mapping->length = size;
+    mapping->next = cacheMappings;
+    cacheMappings = mapping;
+    return forms;
+}
+
+// Makes room for one more item of size bytes in a growing array
+void *reserve(void *array, size_t count, size_t *capacity, size_t size){
+    if (count == *capacity){
+        *capacity = *capacity == 0 ? 256 : *capacity * 2;
+        array = realloc(array, *capacity * size);
+    }
+    return array;
+}
+
+// Adds length characters to the text, followed by a NUL
+CacheText addText(CacheWriter *writer, const char *chars, size_t length){
+    CacheText text;
+    while (writer->textLength + length + 1 > writer->textCapacity){
+        writer->textCapacity = writer->textCapacity == 0 ?
+                               4096 : writer->textCapacity * 2;
+        writer->text = realloc(writer->text, writer->textCapacity);
+    }
+    if (writer->textLength + length + 1 > UINT32_MAX){
+        writer->failed = 1;
+        text.start = 0;
+        text.length = 0;
+        return text;
+    }
+    text.start = writer->textLength;
+    text.length = length;
+    memcpy(writer->text + writer->textLength, chars, length);
+    writer->text[writer->textLength + length] = '\0';
+    writer->textLength = writer->textLength + length + 1;
+    return text;
+}
+
+// Returns the number of an interned name, adding it to the symbols if new
+uint32_t symbolNumber(CacheWriter *writer, char *name){
+    if (2 * (writer->symbolCount + 1) > writer->nameSlots){
+        // rehash into a table twice the size
+        size_t slots = writer->nameSlots == 0 ? 256 : writer->nameSlots * 2;
+        char **names = calloc(slots, sizeof(char *));
+        uint32_t *numbers = malloc(sizeof(uint32_t) * slots);
+        size_t i;
+        for (i = 0; i < writer->nameSlots; i++){
+            if (writer->names[i] != NULL){
+                size_t slot = ((uintptr_t)writer->names[i] >> 3) & (slots - 1);
+                while (names[slot] != NULL){
+                    slot = (slot + 1) & (slots - 1);
+                }
+                names[slot] = writer->names[i];
+                numbers[slot] = writer->numbers[i];
+            }
+        }
+        free(writer->names);
+        free(writer->numbers);
+        writer->names = names;
+        writer->numbers = numbers;
+        writer->nameSlots = slots;
+    }
+    size_t slot = ((uintptr_t)name >> 3) & (writer->nameSlots - 1);
+    while (writer->names[slot] != NULL){
+        if (writer->names[slot] == name){
+            return writer->numbers[slot];
+        }
+        slot = (slot + 1) & (writer->nameSlots - 1);
+    }
+    writer->symbols = reserve(writer->symbols, writer->symbolCount,
+                              &writer->symbolCapacity, sizeof(CacheText));
+    writer->symbols[writer->symbolCount] = addText(writer, name,
+                                                   strlen(name));
+    writer->names[slot] = name;
+    writer->numbers[slot] = writer->symbolCount;
+    writer->symbolCount = writer->symbolCount + 1;
+    return writer->symbolCount - 1;
+}
+
+// Adds the node of one datum; a list's elements follow it
+void addNode(CacheWriter *writer, Value *datum){
+    writer->nodes = reserve(writer->nodes, writer->nodeCount,
+                            &writer->nodeCapacity, sizeof(CacheNode));
+    CacheNode *node = writer->nodes + writer->nodeCount;
+    writer->nodeCount = writer->nodeCount + 1;
+    node->location = 0;
+    if (datum->loc != 0 && writer->base != 0 && datum->loc >= writer->base){
+        node->location = datum->loc - writer->base + 1;
+    }
+    node->count = 0;
+    switch (datum->type){
+        case CONS_TYPE:{
+            Value *cell = datum;
+            node->kind = NODE_LIST;
+            while (cell->type == CONS_TYPE){
+                node->count = node->count + 1;
+                cell = cell->c.cdr;
+            }
+            writer->cellCount = writer->cellCount + node->count;
+            break;
+        }
+        case NULL_TYPE:
+            node->kind = NODE_EMPTY;
+            break;
+        case INT_TYPE:
+            node->kind = NODE_INT;
+            node->i = datum->i;
+            break;
+        case DOUBLE_TYPE:
+            node->kind = NODE_DOUBLE;
+            node->d = datum->d;
+            break;
+        case STR_TYPE:{
+            size_t length = datum->str.chars[0] == '\"' ?
+                            (size_t)datum->str.length + 2 :
+                            strlen(datum->str.chars);
+            node->kind = NODE_STRING;
+            node->text = addText(writer, datum->str.chars, length);
+            break;
+        }
+        case SYMBOL_TYPE:
+            node->kind = NODE_SYMBOL;
+            node->symbol = symbolNumber(writer, datum->s);
+            break;
+        case BOOL_TYPE:
+            node->kind = strcmp(datum->s, "#t") ? NODE_FALSE : NODE_TRUE;
+            break;
+        default:
+            // not something the parser makes
+            writer->failed = 1;
+            break;
+    }
+}
+
+// Starts collecting the forms of the source at path
+CacheWriter *startCodeCache(char *path, const char *text, size_t length,
+                            unsigned int base){
+    CacheWriter *writer = calloc(1, sizeof(CacheWriter));
+    writer->cachePath = cachePathOf(path);
+    writer->sourceHash = hashSource(text, length);
+    writer->sourceLength = length;
+    writer->base = base;
+    return writer;
+}
+
+// Adds the next top-level form of the source, walking nested lists with an
+// explicit stack of the rest of each enclosing list
+void addCacheForm(CacheWriter *writer, Value *form){
+    Value *initial[CACHE_STACK_SIZE];
+    Value **stack = initial;
+    int capacity = CACHE_STACK_SIZE;
+    int depth = 0;
+    writer->formCount = writer->formCount + 1;
+    addNode(writer, form);
+    if (form->type == CONS_TYPE){
+        stack[depth] = form;
+        depth = depth + 1;
+    }
+    while (depth > 0){
+        Value *rest = stack[depth - 1];
+        if (rest->type != CONS_TYPE){
+            depth = depth - 1;
+            continue;
+        }
+        Value *item = rest->c.car;
+        stack[depth - 1] = rest->c.cdr;
+        addNode(writer, item);
+        if (item->type == CONS_TYPE){
+            if (depth == capacity){
+                Value **larger = talloc(sizeof(Value *) * capacity * 2);
+                memcpy(larger, stack, sizeof(Value *) * capacity);
+                stack = larger;
+                capacity = capacity * 2;
+            }
+            stack[depth] = item;
+            depth = depth + 1;
+        }
+    }
+}
+
+// Writes all of length bytes at data to fd; returns 0 on failure
+int writeCacheData(int fd, const void *data, size_t length){
+    const char *bytes = data;
+    while (length > 0){
+        ssize_t count = write(fd, bytes, length);
+        if (count <= 0){
+            return 0;
+        }
+        bytes = bytes + count;
+        length = length - count;
+    }
+    return 1;
+}
+
+// Writes the cache file and frees the writer
+void finishCodeCache(CacheWriter *writer){
+    if (!writer->failed){
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = CACHE_MAGIC;
+        header.version = CACHE_VERSION;
+        header.sourceHash = writer->sourceHash;
+        header.sourceLength = writer->sourceLength;
+        header.formCount = writer->formCount;
+        header.nodeCount = writer->nodeCount;
+        header.cellCount = writer->cellCount;
+        header.symbolCount = writer->symbolCount;
+        header.textLength = writer->textLength;
+        header.bodyHash = hashBody(writer->symbols, writer->nodes,
+                                   writer->text, &header);
+
+        // write beside the old cache and rename over it, so a reader never
+        // sees half a file
+        size_t length = strlen(writer->cachePath);
+        char *temporary = malloc(length + 32);
+        snprintf(temporary, length + 32, "%s.%d", writer->cachePath,
+                 (int)getpid());
+        int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0){
+            int written =
+                writeCacheData(fd, &header, sizeof(header)) &&
+                writeCacheData(fd, writer->symbols,
+                               sizeof(CacheText) * writer->symbolCount) &&
+                writeCacheData(fd, writer->nodes,
+                               sizeof(CacheNode) * writer->nodeCount) &&
+                writeCacheData(fd, writer->text, writer->textLength);
+            close(fd);
+            if (!written || rename(temporary, writer->cachePath) < 0){
+                unlink(temporary);
+            }
+        }
+        free(temporary);
+    }
+    free(writer->cachePath);
+    free(writer->nodes);
+    free(writer->symbols);
+    free(writer->text);
+    free(writer->names);
+    free(writer->numbers);
+    free(writer);
+}
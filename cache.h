@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "value.h"
+
+#ifndef _CACHE
+#define _CACHE
+
+// The version of the cache layout, checked when a cache is loaded. A cache
+// is keyed only on its source, not on the interpreter that wrote it, so this
+// must be bumped by any change after which the same text would load as
+// different forms: to how the tokenizer or parser reads a token (such as how
+// string escapes are decoded or which numbers are read as integers), to the
+// node kinds, or to CacheHeader, CacheNode or CacheText
+#define CACHE_VERSION 2
+
+// Turns the use of cache files on or off for sources opened from now on
+void setCodeCache(int enabled);
+
+// Returns 1 if sources are read through cache files
+int codeCacheEnabled();
+
+// Returns the list of the top-level forms of the source at path, whose text
+// is length bytes at text and starts at location base, from its cache file,
+// or NULL if there is no cache made from exactly this text
+Value *loadCodeCache(char *path, const char *text, size_t length,
+                     unsigned int base);
+
+// Collects the forms of a source as they are parsed, to be written to its
+// cache file once all of them have been read
+typedef struct CacheWriter CacheWriter;
+
+// Starts collecting the forms of the source at path, whose text is length
+// bytes at text and starts at location base
+CacheWriter *startCodeCache(char *path, const char *text, size_t length,
+                            unsigned int base);
+
+// Adds the next top-level form of the source
+void addCacheForm(CacheWriter *writer, Value *form);
+
+// Writes the cache file, quietly doing nothing if it cannot be written, and
+// frees the writer
+void finishCodeCache(CacheWriter *writer);
+
+// Continues hash h over length bytes at data, a word at a time; also used to
+// check heap images
+uint64_t hashCacheBytes(uint64_t h, const void *data, size_t length);
+
+// Writes all of length bytes at data to fd; returns 0 on failure
+int writeCacheData(int fd, const void *data, size_t length);
+
+#endif
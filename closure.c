@@ -0,0 +1,264 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Flat closures: closures that keep only the bindings their bodies refer to
+*/
+
+/*
+A closure used to keep the frame it was made in, and with it every binding
+of every frame around that one, whether its body could refer to them or
+not. Looking a name up from the body walked all of those frames too.
+
+Now the first time a lambda is evaluated, the names its body could refer to
+outside its parameters are noted: every symbol in it but those in quotes
+and the special forms eval dispatches on. Each closure made from it keeps a
+frame of its own holding the local bindings of just those names, found the
+way lookUpSymbol would find them from where the closure is made, with the
+global frame as its parent. A closure whose body refers to no local binding
+keeps the global frame itself. Where each binding was found is noted, as
+quickened variables note it (see quicken.h), so the closures made from the
+lambda after the first take their bindings by place, and only search the
+frames again if a name is no longer there.
+
+The closure keeps the bindings themselves rather than copies of their
+values, so each is shared with the frame it came from: a set! on either
+side is seen by the other, as it was when the closure kept the whole frame.
+letrec fills in the bindings closures in its initial values refer to once
+they have all been evaluated, rather than replacing them.
+
+Names are only ever added to a local frame by let*, which adds its bindings
+to the frame around it while it evaluates them (see framesSettled), so a
+closure made while that is happening keeps its frame as before. So does
+one that refers to a binding whose value is a symbol, since lookUpSymbol
+goes on looking from the frame after the one holding it.
+*/
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "closure.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "optimize.h"
+#include "talloc.h"
+#include "value.h"
+
+// A lambda, by the address of its parts after the head, and the names its
+// body can refer to outside its parameters. Of those, count were bound
+// locally where a closure of it was last made, each name placed[i] found in
+// the frame depths[i] out from there at indexes[i] among its bindings, the
+// binding itself then being found[i]. count is -1 until a closure has been
+// made.
+struct FreeNames {
+    Value *lambda;
+    Value *names;
+    int count;
+    char **placed;
+    int *depths;
+    int *indexes;
+    Value **found;
+};
+
+typedef struct FreeNames FreeNames;
+
+// The lambdas seen, in an open-addressing table
+FreeNames *freeTable = NULL;
+int freeCapacity = 0;
+int freeCount = 0;
+
+// Returns the entry of lambda, adding it if add is 1, or NULL if it is not
+// there
+FreeNames *freeEntry(Value *lambda, int add) {
+    if (add && freeCount * 2 >= freeCapacity) {
+        FreeNames *old = freeTable;
+        int oldCapacity = freeCapacity;
+        freeCapacity = freeCapacity == 0 ? 256 : freeCapacity * 2;
+        freeTable = talloc(sizeof(FreeNames) * freeCapacity);
+        memset(freeTable, 0, sizeof(FreeNames) * freeCapacity);
+        freeCount = 0;
+        int i;
+        for (i = 0; i < oldCapacity; i++) {
+            if (old[i].lambda != NULL) {
+                *freeEntry(old[i].lambda, 1) = old[i];
+            }
+        }
+    }
+    if (freeCapacity == 0) {
+        return NULL;
+    }
+    size_t slot = (((uintptr_t) lambda >> 4) * 2654435761u) &
+                  (freeCapacity - 1);
+    while (freeTable[slot].lambda != NULL &&
+           freeTable[slot].lambda != lambda) {
+        slot = (slot + 1) & (freeCapacity - 1);
+    }
+    if (freeTable[slot].lambda == NULL) {
+        if (!add) {
+            return NULL;
+        }
+        freeTable[slot].lambda = lambda;
+        freeCount = freeCount + 1;
+    }
+    return &freeTable[slot];
+}
+
+// Adds to names each symbol in expr the body of a lambda with parameters
+// params could look up
+void collectNames(Value *expr, Value *params, Value **names) {
+    expr = writtenExpression(expr);
+    if (expr->type == SYMBOL_TYPE) {
+        if (!isNameIn(expr->s, params) && !isNameIn(expr->s, *names)) {
+            *names = cons(expr, *names);
+        }
+        return;
+    }
+    if (expr->type != CONS_TYPE) {
+        return;
+    }
+    Value *head = writtenExpression(car(expr));
+    if (head->type == SYMBOL_TYPE && isSpecialForm(head->s)) {
+        if (!strcmp(head->s, "quote")) {
+            return;
+        }
+    } else {
+        collectNames(head, params, names);
+    }
+    Value *rest = cdr(expr);
+    while (rest->type == CONS_TYPE) {
+        collectNames(car(rest), params, names);
+        rest = cdr(rest);
+    }
+}
+
+// Returns the entry of the lambda args, noting the names its body can refer
+// to outside its parameters the first time
+FreeNames *freeNames(Value *args) {
+    FreeNames *entry = freeEntry(args, 1);
+    if (entry->names == NULL) {
+        Value *params = makeNull();
+        Value *rest = car(args);
+        while (rest->type == CONS_TYPE && car(rest)->type == SYMBOL_TYPE) {
+            params = cons(car(rest), params);
+            rest = cdr(rest);
+        }
+        Value *names = makeNull();
+        rest = cdr(args);
+        while (rest->type == CONS_TYPE) {
+            collectNames(car(rest), params, &names);
+            rest = cdr(rest);
+        }
+        entry->names = names;
+        entry->count = -1;
+    }
+    return entry;
+}
+
+// Finds where each name of entry is bound locally from frame
+void placeNames(FreeNames *entry, Frame *frame) {
+    if (entry->count < 0) {
+        int length = properLength(entry->names);
+        entry->placed = talloc(sizeof(char *) * (length + 1));
+        entry->depths = talloc(sizeof(int) * (length + 1));
+        entry->indexes = talloc(sizeof(int) * (length + 1));
+        entry->found = talloc(sizeof(Value *) * (length + 1));
+    }
+    entry->count = 0;
+    Value *names = entry->names;
+    while (names->type == CONS_TYPE) {
+        Frame *current = frame;
+        int depth = 0;
+        int placed = 0;
+        while (current->parent != NULL && !placed) {
+            Value *bindings = current->bindings;
+            int index = 0;
+            while (bindings->type == CONS_TYPE) {
+                if (!strcmp(car(car(bindings))->s, car(names)->s)) {
+                    entry->placed[entry->count] = car(car(bindings))->s;
+                    entry->depths[entry->count] = depth;
+                    entry->indexes[entry->count] = index;
+                    entry->found[entry->count] = car(bindings);
+                    entry->count = entry->count + 1;
+                    placed = 1;
+                    break;
+                }
+                bindings = cdr(bindings);
+                index = index + 1;
+            }
+            current = current->parent;
+            depth = depth + 1;
+        }
+        names = cdr(names);
+    }
+}
+
+// Finds the bindings of the names of entry from frame where they were found
+// before, and returns 0 if one of them is no longer there
+int findPlaced(FreeNames *entry, Frame *frame) {
+    int i;
+    for (i = 0; i < entry->count; i++) {
+        Frame *current = frame;
+        int step;
+        for (step = 0; step < entry->depths[i]; step++) {
+            if (current->parent == NULL) {
+                return 0;
+            }
+            current = current->parent;
+        }
+        Value *bindings = current->bindings;
+        for (step = 0; step < entry->indexes[i] &&
+                       bindings->type == CONS_TYPE; step++) {
+            bindings = cdr(bindings);
+        }
+        if (current->parent == NULL || bindings->type != CONS_TYPE ||
+            car(car(bindings))->s != entry->placed[i]) {
+            return 0;
+        }
+        entry->found[i] = car(bindings);
+    }
+    return 1;
+}
+
+// Returns the number of local bindings seen from frame, counting no further
+// than one past most
+int localCount(Frame *frame, int most) {
+    int count = 0;
+    while (frame->parent != NULL && count <= most) {
+        Value *bindings = frame->bindings;
+        while (bindings->type == CONS_TYPE && count <= most) {
+            count = count + 1;
+            bindings = cdr(bindings);
+        }
+        frame = frame->parent;
+    }
+    return count;
+}
+
+// Returns the frame for a closure of the lambda args made in frame
+Frame *closureFrame(Value *args, Frame *frame) {
+    int i;
+    if (frame->parent == NULL || !framesSettled(frame, INT_MAX)) {
+        return frame;
+    }
+    FreeNames *entry = freeNames(args);
+    if (entry->count < 0 || !findPlaced(entry, frame)) {
+        placeNames(entry, frame);
+    }
+    for (i = 0; i < entry->count; i++) {
+        if (car(cdr(entry->found[i]))->type == SYMBOL_TYPE) {
+            return frame;
+        }
+    }
+    if (entry->count == 0) {
+        return globalEnvironment();
+    }
+    if (localCount(frame, entry->count) == entry->count) {
+        // it would keep every local binding anyway
+        return frame;
+    }
+    Frame *flat = talloc(sizeof(Frame));
+    flat->bindings = makeNull();
+    flat->parent = globalEnvironment();
+    for (i = entry->count - 1; i >= 0; i--) {
+        flat->bindings = cons(entry->found[i], flat->bindings);
+    }
+    return flat;
+}
@@ -0,0 +1,13 @@
+#include "value.h"
+
+#ifndef _CLOSURE
+#define _CLOSURE
+
+// Returns the frame to keep in a closure made in frame from a lambda, args
+// being its parts after the head: a frame holding only the local bindings
+// its body can refer to, whose parent is the global frame, or the global
+// frame itself if there are none. frame itself is kept while a let* is
+// adding bindings to it or to a frame around it.
+Frame *closureFrame(Value *args, Frame *frame);
+
+#endif
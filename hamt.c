@@ -0,0 +1,700 @@
+/*
+Persistent hash-array-mapped tries for Scheme interpreter
+Created by Tom Choi, Kaya Govek, Jonah Tuchow
+
+Maps and sets are 32-way tries indexed by 5 bits of the key's hash per
+level. Each node only stores its populated branches, found through a
+bitmap and a popcount, so lookup, insert and delete touch O(log32 n) nodes.
+Updates copy the path from the root to the changed slot and share every
+other node with the previous version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hamt.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "primitives.h"
+#include "talloc.h"
+#include "value.h"
+
+#define HAMT_BITS 5
+#define HAMT_MASK 31
+
+// Mixes the bits of a 32 bit integer (murmur3 finalizer)
+unsigned int mixHash(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// FNV-1a over a NUL-terminated string
+unsigned int hashString(char *s) {
+    unsigned int h = 2166136261u;
+    while (*s != '\0') {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+        s++;
+    }
+    return h;
+}
+
+// FNV-1a over length bytes
+unsigned int hashBytes(char *s, int length) {
+    unsigned int h = 2166136261u;
+    int i;
+    for (i = 0; i < length; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Hashes a value so that values which are equal? hash the same
+unsigned int hashValue(Value *value) {
+    unsigned int h;
+    switch (value->type) {
+        case INT_TYPE:
+            return mixHash((unsigned int)value->i);
+        case DOUBLE_TYPE: {
+            unsigned int words[2];
+            double d = value->d;
+            if (d == 0.0) {
+                d = 0.0; // -0.0 and 0.0 are equal
+            }
+            memcpy(words, &d, sizeof(double));
+            return mixHash(words[0] ^ mixHash(words[1]));
+        }
+        case STR_TYPE:
+            return mixHash(hashBytes(value->str.chars, value->str.length + 1));
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+            return mixHash(hashString(value->s) + value->type);
+        case NULL_TYPE:
+            return 0x9e3779b9;
+        case CONS_TYPE:
+            h = 0x811c9dc5;
+            while (value->type == CONS_TYPE) {
+                h = (h * 31) + hashValue(car(value));
+                value = cdr(value);
+            }
+            return mixHash(h + hashValue(value));
+        case HASHMAP_TYPE:
+            return mixHash(value->map->count);
+        default:
+            return mixHash((unsigned int)(size_t)value->p);
+    }
+}
+
+// Looks for the entry of a key, starting at a node at the given depth
+struct HamtEntry *hamtFind(struct HamtNode *node, int shift,
+                           unsigned int hash, Value *key) {
+    while (node != NULL) {
+        if (node->collision) {
+            int i;
+            for (i = 0; i < node->count; i++) {
+                if (valuesEqual(node->slots[i].key, key)) {
+                    return &node->slots[i];
+                }
+            }
+            return NULL;
+        }
+        unsigned int bit = 1u << ((hash >> shift) & HAMT_MASK);
+        if (!(node->bitmap & bit)) {
+            return NULL;
+        }
+        int idx = __builtin_popcount(node->bitmap & (bit - 1));
+        struct HamtEntry *entry = &node->slots[idx];
+        if (entry->key == NULL) {
+            node = entry->child;
+            shift = shift + HAMT_BITS;
+        } else if (entry->hash == hash && valuesEqual(entry->key, key)) {
+            return entry;
+        } else {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Returns 1 if every entry of a is also in b with an equal value
+int hamtSubset(struct HamtNode *a, Hamt *b) {
+    int i;
+    if (a == NULL) {
+        return 1;
+    }
+    for (i = 0; i < a->count; i++) {
+        struct HamtEntry *entry = &a->slots[i];
+        if (entry->key == NULL) {
+            if (!hamtSubset(entry->child, b)) {
+                return 0;
+            }
+        } else {
+            struct HamtEntry *other = hamtFind(b->root, 0, entry->hash,
+                                               entry->key);
+            if (other == NULL || !valuesEqual(entry->value, other->value)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Structural equality, as used by equal?
+int valuesEqual(Value *a, Value *b) {
+    while (a != b) {
+        if (a->type != b->type) {
+            return 0;
+        }
+        switch (a->type) {
+            case INT_TYPE:
+                return a->i == b->i;
+            case DOUBLE_TYPE:
+                return a->d == b->d;
+            case STR_TYPE:
+                // the leading character tells strings from the "." marker
+                return a->str.length == b->str.length &&
+                       !memcmp(a->str.chars, b->str.chars, a->str.length + 1);
+            case SYMBOL_TYPE:
+            case BOOL_TYPE:
+                return !strcmp(a->s, b->s);
+            case NULL_TYPE:
+                return 1;
+            case CONS_TYPE:
+                if (!valuesEqual(car(a), car(b))) {
+                    return 0;
+                }
+                a = cdr(a);
+                b = cdr(b);
+                break;
+            case HASHMAP_TYPE:
+                return a->map->isSet == b->map->isSet &&
+                       a->map->count == b->map->count &&
+                       hamtSubset(a->map->root, b->map);
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Allocates a node with room for capacity slots
+struct HamtNode *newNode(int capacity, struct HamtEdit *edit) {
+    struct HamtNode *node = talloc(sizeof(struct HamtNode));
+    node->bitmap = 0;
+    node->count = 0;
+    node->capacity = capacity;
+    node->collision = 0;
+    node->edit = edit;
+    node->slots = talloc(sizeof(struct HamtEntry) * capacity);
+    return node;
+}
+
+// Returns a node that may be modified under the given edit token, with room
+// for at least extra more slots. Nodes owned by the token are reused; all
+// others are copied.
+struct HamtNode *editableNode(struct HamtNode *node, struct HamtEdit *edit,
+                              int extra) {
+    if (edit != NULL && node->edit == edit &&
+        node->count + extra <= node->capacity) {
+        return node;
+    }
+    int capacity = node->count + extra;
+    if (edit != NULL) {
+        // transients grow geometrically so repeated inserts stay cheap
+        capacity = capacity < 4 ? 4 : capacity * 2;
+        if (capacity > 32 && !node->collision) {
+            capacity = 32;
+        }
+    }
+    struct HamtNode *copy;
+    if (edit != NULL && node->edit == edit) {
+        copy = node;
+        struct HamtEntry *slots = talloc(sizeof(struct HamtEntry) * capacity);
+        memcpy(slots, node->slots, sizeof(struct HamtEntry) * node->count);
+        copy->slots = slots;
+        copy->capacity = capacity;
+        return copy;
+    }
+    copy = newNode(capacity, edit);
+    copy->bitmap = node->bitmap;
+    copy->count = node->count;
+    copy->collision = node->collision;
+    memcpy(copy->slots, node->slots, sizeof(struct HamtEntry) * node->count);
+    return copy;
+}
+
+// Builds the smallest subtrie holding two entries with different keys
+struct HamtNode *makePair(int shift, struct HamtEntry *a, struct HamtEntry *b,
+                          struct HamtEdit *edit) {
+    struct HamtNode *node;
+    if (a->hash == b->hash) {
+        node = newNode(2, edit);
+        node->collision = 1;
+        node->count = 2;
+        node->slots[0] = *a;
+        node->slots[1] = *b;
+        return node;
+    }
+    unsigned int fragA = (a->hash >> shift) & HAMT_MASK;
+    unsigned int fragB = (b->hash >> shift) & HAMT_MASK;
+    if (fragA == fragB) {
+        node = newNode(1, edit);
+        node->bitmap = 1u << fragA;
+        node->count = 1;
+        node->slots[0].hash = 0;
+        node->slots[0].key = NULL;
+        node->slots[0].value = NULL;
+        node->slots[0].child = makePair(shift + HAMT_BITS, a, b, edit);
+        return node;
+    }
+    node = newNode(2, edit);
+    node->bitmap = (1u << fragA) | (1u << fragB);
+    node->count = 2;
+    if (fragA < fragB) {
+        node->slots[0] = *a;
+        node->slots[1] = *b;
+    } else {
+        node->slots[0] = *b;
+        node->slots[1] = *a;
+    }
+    return node;
+}
+
+// Inserts or replaces an entry below node. Returns the new node, which is
+// node itself when nothing changed or when it was updated in place.
+struct HamtNode *assocNode(struct HamtNode *node, int shift,
+                           struct HamtEntry *entry, struct HamtEdit *edit,
+                           int *added) {
+    int i;
+    if (node == NULL) {
+        node = newNode(1, edit);
+        node->bitmap = 1u << ((entry->hash >> shift) & HAMT_MASK);
+        node->count = 1;
+        node->slots[0] = *entry;
+        *added = 1;
+        return node;
+    }
+    if (node->collision) {
+        if (node->slots[0].hash != entry->hash) {
+            // the new key only shares a prefix; push the bucket down a level
+            struct HamtNode *parent = newNode(1, edit);
+            parent->bitmap = 1u << ((node->slots[0].hash >> shift) & HAMT_MASK);
+            parent->count = 1;
+            parent->slots[0].hash = 0;
+            parent->slots[0].key = NULL;
+            parent->slots[0].value = NULL;
+            parent->slots[0].child = node;
+            return assocNode(parent, shift, entry, edit, added);
+        }
+        for (i = 0; i < node->count; i++) {
+            if (valuesEqual(node->slots[i].key, entry->key)) {
+                if (node->slots[i].value == entry->value) {
+                    return node;
+                }
+                node = editableNode(node, edit, 0);
+                node->slots[i].value = entry->value;
+                return node;
+            }
+        }
+        node = editableNode(node, edit, 1);
+        node->slots[node->count] = *entry;
+        node->count = node->count + 1;
+        *added = 1;
+        return node;
+    }
+
+    unsigned int bit = 1u << ((entry->hash >> shift) & HAMT_MASK);
+    int idx = __builtin_popcount(node->bitmap & (bit - 1));
+    if (node->bitmap & bit) {
+        struct HamtEntry *slot = &node->slots[idx];
+        if (slot->key == NULL) {
+            struct HamtNode *child = assocNode(slot->child, shift + HAMT_BITS,
+                                               entry, edit, added);
+            if (child == slot->child) {
+                return node;
+            }
+            node = editableNode(node, edit, 0);
+            node->slots[idx].child = child;
+            return node;
+        }
+        if (slot->hash == entry->hash && valuesEqual(slot->key, entry->key)) {
+            if (slot->value == entry->value) {
+                return node;
+            }
+            node = editableNode(node, edit, 0);
+            node->slots[idx].value = entry->value;
+            return node;
+        }
+        struct HamtNode *child = makePair(shift + HAMT_BITS, slot, entry, edit);
+        node = editableNode(node, edit, 0);
+        node->slots[idx].hash = 0;
+        node->slots[idx].key = NULL;
+        node->slots[idx].value = NULL;
+        node->slots[idx].child = child;
+        *added = 1;
+        return node;
+    }
+    node = editableNode(node, edit, 1);
+    memmove(&node->slots[idx + 1], &node->slots[idx],
+            sizeof(struct HamtEntry) * (node->count - idx));
+    node->slots[idx] = *entry;
+    node->bitmap = node->bitmap | bit;
+    node->count = node->count + 1;
+    *added = 1;
+    return node;
+}
+
+// Removes the slot at idx from a node that may be modified
+void removeSlot(struct HamtNode *node, int idx, unsigned int bit) {
+    memmove(&node->slots[idx], &node->slots[idx + 1],
+            sizeof(struct HamtEntry) * (node->count - idx - 1));
+    node->count = node->count - 1;
+    node->bitmap = node->bitmap & ~bit;
+}
+
+// Removes key from below node. Returns the new node, or NULL if the node
+// became empty.
+struct HamtNode *dissocNode(struct HamtNode *node, int shift,
+                            unsigned int hash, Value *key,
+                            struct HamtEdit *edit, int *removed) {
+    int i;
+    if (node->collision) {
+        for (i = 0; i < node->count; i++) {
+            if (valuesEqual(node->slots[i].key, key)) {
+                *removed = 1;
+                if (node->count == 1) {
+                    return NULL;
+                }
+                node = editableNode(node, edit, 0);
+                removeSlot(node, i, 0);
+                return node;
+            }
+        }
+        return node;
+    }
+
+    unsigned int bit = 1u << ((hash >> shift) & HAMT_MASK);
+    if (!(node->bitmap & bit)) {
+        return node;
+    }
+    int idx = __builtin_popcount(node->bitmap & (bit - 1));
+    struct HamtEntry *slot = &node->slots[idx];
+    if (slot->key == NULL) {
+        struct HamtNode *child = dissocNode(slot->child, shift + HAMT_BITS,
+                                            hash, key, edit, removed);
+        if (child == slot->child) {
+            return node;
+        }
+        node = editableNode(node, edit, 0);
+        if (child == NULL) {
+            removeSlot(node, idx, bit);
+            return node->count == 0 ? NULL : node;
+        }
+        if (child->count == 1 && child->slots[0].key != NULL) {
+            // pull a lone leaf up so the trie stays as shallow as possible
+            node->slots[idx] = child->slots[0];
+        } else {
+            node->slots[idx].child = child;
+        }
+        return node;
+    }
+    if (slot->hash != hash || !valuesEqual(slot->key, key)) {
+        return node;
+    }
+    *removed = 1;
+    if (node->count == 1) {
+        return NULL;
+    }
+    node = editableNode(node, edit, 0);
+    removeSlot(node, idx, bit);
+    return node;
+}
+
+// Creates an empty persistent map (or set)
+Value *makeMap(int isSet) {
+    Hamt *map = talloc(sizeof(Hamt));
+    map->root = NULL;
+    map->count = 0;
+    map->isSet = isSet;
+    map->edit = NULL;
+    Value *value = makeNull();
+    value->type = HASHMAP_TYPE;
+    value->map = map;
+    return value;
+}
+
+// Wraps a Hamt in a new HASHMAP_TYPE value
+Value *wrapMap(Hamt *map) {
+    Value *value = makeNull();
+    value->type = HASHMAP_TYPE;
+    value->map = map;
+    return value;
+}
+
+// Returns the value bound to key, or NULL if there is none
+Value *hamtLookup(Hamt *map, Value *key) {
+    struct HamtEntry *entry = hamtFind(map->root, 0, hashValue(key), key);
+    if (entry == NULL) {
+        return NULL;
+    }
+    return entry->value;
+}
+
+// Returns a new map with key bound to value
+Hamt *hamtAssoc(Hamt *map, Value *key, Value *value) {
+    struct HamtEntry entry;
+    int added = 0;
+    entry.hash = hashValue(key);
+    entry.key = key;
+    entry.value = value;
+    entry.child = NULL;
+    struct HamtNode *root = assocNode(map->root, 0, &entry, NULL, &added);
+    if (root == map->root) {
+        return map;
+    }
+    Hamt *result = talloc(sizeof(Hamt));
+    result->root = root;
+    result->count = map->count + added;
+    result->isSet = map->isSet;
+    result->edit = NULL;
+    return result;
+}
+
+// Returns a new map without key
+Hamt *hamtDissoc(Hamt *map, Value *key) {
+    int removed = 0;
+    if (map->root == NULL) {
+        return map;
+    }
+    struct HamtNode *root = dissocNode(map->root, 0, hashValue(key), key,
+                                       NULL, &removed);
+    if (!removed) {
+        return map;
+    }
+    Hamt *result = talloc(sizeof(Hamt));
+    result->root = root;
+    result->count = map->count - 1;
+    result->isSet = map->isSet;
+    result->edit = NULL;
+    return result;
+}
+
+// Returns a transient copy of a persistent map. The two share all nodes
+// until the transient updates them.
+Hamt *hamtTransient(Hamt *map) {
+    Hamt *result = talloc(sizeof(Hamt));
+    result->root = map->root;
+    result->count = map->count;
+    result->isSet = map->isSet;
+    result->edit = talloc(sizeof(struct HamtEdit));
+    result->edit->active = 1;
+    return result;
+}
+
+// Binds key to value in a transient map
+void hamtAssocInPlace(Hamt *map, Value *key, Value *value) {
+    struct HamtEntry entry;
+    int added = 0;
+    entry.hash = hashValue(key);
+    entry.key = key;
+    entry.value = value;
+    entry.child = NULL;
+    map->root = assocNode(map->root, 0, &entry, map->edit, &added);
+    map->count = map->count + added;
+}
+
+// Removes key from a transient map
+void hamtDissocInPlace(Hamt *map, Value *key) {
+    int removed = 0;
+    if (map->root == NULL) {
+        return;
+    }
+    map->root = dissocNode(map->root, 0, hashValue(key), key, map->edit,
+                           &removed);
+    map->count = map->count - removed;
+}
+
+// Freezes a transient map. The transient cannot be updated afterwards, so
+// the returned persistent map can safely share its nodes.
+Hamt *hamtPersistent(Hamt *map) {
+    map->edit->active = 0;
+    Hamt *result = talloc(sizeof(Hamt));
+    result->root = map->root;
+    result->count = map->count;
+    result->isSet = map->isSet;
+    result->edit = NULL;
+    return result;
+}
+
+// Conses every entry below node onto list
+Value *nodeToList(struct HamtNode *node, int isSet, Value *list) {
+    int i;
+    if (node == NULL) {
+        return list;
+    }
+    for (i = node->count - 1; i >= 0; i--) {
+        struct HamtEntry *entry = &node->slots[i];
+        if (entry->key == NULL) {
+            list = nodeToList(entry->child, isSet, list);
+        } else if (isSet) {
+            list = cons(entry->key, list);
+        } else {
+            Value *pair = makeNull();
+            pair = cons(entry->value, pair);
+            pair = cons(entry->key, pair);
+            list = cons(pair, list);
+        }
+    }
+    return list;
+}
+
+// Returns a list of (key value) lists, or of keys for a set
+Value *hamtToList(Hamt *map) {
+    return nodeToList(map->root, map->isSet, makeNull());
+}
+
+// Exits with a contract violation unless value is a map of the right kind
+void checkMap(Value *value, char *symbol, int wantSet, int wantTransient) {
+    int ok = value->type == HASHMAP_TYPE;
+    if (ok && wantSet >= 0) {
+        ok = value->map->isSet == wantSet;
+    }
+    if (ok && wantTransient >= 0) {
+        ok = (value->map->edit != NULL) == wantTransient;
+    }
+    if (!ok) {
+        printf("%s: contract violation\nexpected: ", symbol);
+        if (wantTransient == 1) {
+            printf("transient ");
+        }
+        printf("%s?\ngiven: ", wantSet == 1 ? "set" : "map");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    if (wantTransient == 1 && !value->map->edit->active) {
+        printf("%s: transient used after persistent!\n", symbol);
+        texit(1);
+    }
+}
+
+Value *primitiveHashMap(Value *args) {
+    Hamt *map = hamtTransient(makeMap(0)->map);
+    Value *args_ptr = args;
+    while (args_ptr->type != NULL_TYPE) {
+        if (cdr(args_ptr)->type == NULL_TYPE) {
+            printf("hash-map: expected an even number of arguments\n");
+            texit(1);
+        }
+        hamtAssocInPlace(map, car(args_ptr), car(cdr(args_ptr)));
+        args_ptr = cdr(cdr(args_ptr));
+    }
+    return wrapMap(hamtPersistent(map));
+}
+
+Value *primitiveHashSet(Value *args) {
+    Hamt *set = hamtTransient(makeMap(1)->map);
+    Value *args_ptr = args;
+    while (args_ptr->type != NULL_TYPE) {
+        hamtAssocInPlace(set, car(args_ptr), car(args_ptr));
+        args_ptr = cdr(args_ptr);
+    }
+    return wrapMap(hamtPersistent(set));
+}
+
+Value *primitiveMapRef(Value *args) {
+    int i = length(args);
+    if (i != 2 && i != 3) {
+        printf("map-ref: arity mismatch;\nthe expected number of arguments ");
+        printf("does not match the given number\nexpected: 2 or 3\ngiven: ");
+        printf("%d\n", i);
+        texit(1);
+    }
+    checkMap(car(args), "map-ref", 0, -1);
+    Value *result = hamtLookup(car(args)->map, car(cdr(args)));
+    if (result == NULL) {
+        if (i == 3) {
+            return car(cdr(cdr(args)));
+        }
+        return makeBool(0);
+    }
+    return result;
+}
+
+Value *primitiveMapSet(Value *args) {
+    checkArity(args, 3, "map-set");
+    checkMap(car(args), "map-set", 0, 0);
+    return wrapMap(hamtAssoc(car(args)->map, car(cdr(args)),
+                             car(cdr(cdr(args)))));
+}
+
+Value *primitiveSetAdd(Value *args) {
+    checkArity(args, 2, "set-add");
+    checkMap(car(args), "set-add", 1, 0);
+    return wrapMap(hamtAssoc(car(args)->map, car(cdr(args)), car(cdr(args))));
+}
+
+Value *primitiveMapRemove(Value *args) {
+    checkArity(args, 2, "map-remove");
+    checkMap(car(args), "map-remove", -1, 0);
+    return wrapMap(hamtDissoc(car(args)->map, car(cdr(args))));
+}
+
+Value *primitiveMapContains(Value *args) {
+    checkArity(args, 2, "map-contains?");
+    checkMap(car(args), "map-contains?", -1, -1);
+    return makeBool(hamtLookup(car(args)->map, car(cdr(args))) != NULL);
+}
+
+Value *primitiveMapCount(Value *args) {
+    checkArity(args, 1, "map-count");
+    checkMap(car(args), "map-count", -1, -1);
+    Value *count = makeNull();
+    count->type = INT_TYPE;
+    count->i = car(args)->map->count;
+    return count;
+}
+
+Value *primitiveMapToList(Value *args) {
+    checkArity(args, 1, "map->list");
+    checkMap(car(args), "map->list", -1, -1);
+    return hamtToList(car(args)->map);
+}
+
+Value *primitiveTransient(Value *args) {
+    checkArity(args, 1, "transient");
+    checkMap(car(args), "transient", -1, 0);
+    return wrapMap(hamtTransient(car(args)->map));
+}
+
+Value *primitiveTransientSet(Value *args) {
+    checkArity(args, 3, "transient-set!");
+    checkMap(car(args), "transient-set!", 0, 1);
+    hamtAssocInPlace(car(args)->map, car(cdr(args)), car(cdr(cdr(args))));
+    return car(args);
+}
+
+Value *primitiveTransientAdd(Value *args) {
+    checkArity(args, 2, "transient-add!");
+    checkMap(car(args), "transient-add!", 1, 1);
+    hamtAssocInPlace(car(args)->map, car(cdr(args)), car(cdr(args)));
+    return car(args);
+}
+
+Value *primitiveTransientRemove(Value *args) {
+    checkArity(args, 2, "transient-remove!");
+    checkMap(car(args), "transient-remove!", -1, 1);
+    hamtDissocInPlace(car(args)->map, car(cdr(args)));
+    return car(args);
+}
+
+Value *primitivePersistent(Value *args) {
+    checkArity(args, 1, "persistent!");
+    checkMap(car(args), "persistent!", -1, 1);
+    return wrapMap(hamtPersistent(car(args)->map));
+}
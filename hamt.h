@@ -0,0 +1,77 @@
+#include "value.h"
+
+#ifndef _HAMT
+#define _HAMT
+
+// Persistent hash-array-mapped trie. Every update returns a new Hamt that
+// shares all untouched nodes with the old one, so a version costs O(log32 n)
+// fresh nodes. A transient Hamt owns an edit token; nodes stamped with that
+// token are updated in place, which makes bulk construction cheap.
+struct HamtEdit {
+    int active;
+};
+
+struct HamtEntry {
+    unsigned int hash;
+    struct Value *key;      // NULL when the slot holds a child node
+    struct Value *value;
+    struct HamtNode *child;
+};
+
+struct HamtNode {
+    unsigned int bitmap;    // which of the 32 branches are populated
+    int count;              // number of used slots
+    int capacity;           // number of allocated slots
+    int collision;          // 1 if every slot shares one full hash
+    struct HamtEdit *edit;  // owning transient, or NULL
+    struct HamtEntry *slots;
+};
+
+struct Hamt {
+    struct HamtNode *root;
+    int count;
+    int isSet;
+    struct HamtEdit *edit;  // NULL for a persistent map
+};
+
+typedef struct Hamt Hamt;
+
+// Hashing and equality that agree with equal?
+unsigned int hashValue(Value *value);
+int valuesEqual(Value *a, Value *b);
+
+// Creates an empty persistent map (or set)
+Value *makeMap(int isSet);
+
+// Returns the value bound to key, or NULL if there is none
+Value *hamtLookup(Hamt *map, Value *key);
+
+// Persistent updates; the argument map is left unchanged
+Hamt *hamtAssoc(Hamt *map, Value *key, Value *value);
+Hamt *hamtDissoc(Hamt *map, Value *key);
+
+// Transient updates; the argument map is modified in place
+Hamt *hamtTransient(Hamt *map);
+void hamtAssocInPlace(Hamt *map, Value *key, Value *value);
+void hamtDissocInPlace(Hamt *map, Value *key);
+Hamt *hamtPersistent(Hamt *map);
+
+// Returns a list of (key value) lists, or of keys for a set
+Value *hamtToList(Hamt *map);
+
+Value *primitiveHashMap(Value *args);
+Value *primitiveHashSet(Value *args);
+Value *primitiveMapRef(Value *args);
+Value *primitiveMapSet(Value *args);
+Value *primitiveSetAdd(Value *args);
+Value *primitiveMapRemove(Value *args);
+Value *primitiveMapContains(Value *args);
+Value *primitiveMapCount(Value *args);
+Value *primitiveMapToList(Value *args);
+Value *primitiveTransient(Value *args);
+Value *primitiveTransientSet(Value *args);
+Value *primitiveTransientAdd(Value *args);
+Value *primitiveTransientRemove(Value *args);
+Value *primitivePersistent(Value *args);
+
+#endif
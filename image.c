@@ -0,0 +1,829 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Heap images: the global environment saved to a file after a prelude has
+* been run, so that later runs start from it without evaluating the prelude
+* or binding the primitives again
+*/
+
+/*
+An image holds a copy of everything reachable from the global frame: the
+bindings, the closures with their code and frames, maps, vectors and
+strings. Ports are saved closed, memoized procedures without the results
+they remember, and code the optimizer rewrote or quickened is saved as it
+was written, since the rewrites rely on watches of names that only last
+as long as the process. The copies are laid out in the heap of the image
+exactly as they are in memory, except that every pointer in them has
+been replaced by a number that says what it points to, and a relocation
+names each such pointer:
+
+    heap         pointers hold the offset in the heap of what they point to
+    primitive    pointers hold the number of a primitive (see
+                 primitiveNumber), so an image does not depend on where the
+                 interpreter is loaded
+    symbol       pointers hold the number of a symbol name, so names are
+                 interned again when the image is loaded
+
+The file is a header, which also holds a hash of the rest of the file,
+followed by the heap, the relocations (the offset of each pointer times
+four plus its kind), the offsets of the maps to rehash, the symbol names
+(each followed by a NUL) and the sources the values were read from (see
+packSources), so that errors in saved code still report their locations.
+
+Loading maps the file and goes through the relocations once, turning each
+number back into a pointer; the values are then used where they lie in the
+mapping, which stays until the program exits. Maps with keys that hash by
+their address, such as procedures, are the only thing built again. The
+image is only used if it was made with the same layout and the same
+primitives.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "interpreter.h"
+#include "reader.h"
+#include "cache.h"
+#include "optimize.h"
+#include "intern.h"
+#include "hamt.h"
+#include "numvec.h"
+#include "ports.h"
+#include "memo.h"
+#include "promise.h"
+#include "stringops.h"
+#include "talloc.h"
+#include "value.h"
+
+// "SCMI", read as a little-endian word
+#define IMAGE_MAGIC 0x494d4353
+
+// Kinds of relocation
+#define RELOCATE_HEAP 0
+#define RELOCATE_PRIMITIVE 1
+#define RELOCATE_SYMBOL 2
+
+// Kinds of copied object whose pointers are still to be replaced
+#define OBJECT_VALUE 0
+#define OBJECT_FRAME 1
+#define OBJECT_MAP 2
+#define OBJECT_NODE 3
+#define OBJECT_VECTOR 4
+#define OBJECT_PORT 5
+#define OBJECT_MEMO 7
+#define OBJECT_PROMISE 8
+// an object without pointers
+#define OBJECT_PLAIN 6
+
+struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t valueSize;
+    uint32_t pointerSize;
+    uint64_t primitiveHash;
+    uint64_t heapLength;
+    uint64_t relocationCount;
+    uint64_t rehashCount;
+    uint64_t symbolCount;
+    uint64_t textLength;
+    uint64_t sourcesLength;
+    uint64_t globalFrame;
+    uint64_t bodyHash;
+};
+
+typedef struct ImageHeader ImageHeader;
+
+// A copied object, at offset in the heap
+struct ImageObject {
+    uint64_t offset;
+    int kind;
+};
+
+typedef struct ImageObject ImageObject;
+
+// An image being built. objects lists the objects copied into the heap,
+// of which the first scanned have had their pointers replaced. Objects that
+// can be shared are found by their address in copies.
+struct ImageWriter {
+    char *heap;
+    size_t heapLength;
+    size_t heapCapacity;
+    ImageObject *objects;
+    size_t objectCount;
+    size_t objectCapacity;
+    size_t scanned;
+    uint64_t *relocations;
+    size_t relocationCount;
+    size_t relocationCapacity;
+    uint64_t *rehash;
+    size_t rehashCount;
+    size_t rehashCapacity;
+    // copied objects and their offsets, by address
+    void **addresses;
+    uint64_t *offsets;
+    size_t addressCount;
+    size_t addressSlots;
+    // interned names and their symbol numbers, by address
+    char **names;
+    uint64_t *numbers;
+    size_t nameSlots;
+    uint64_t symbolCount;
+    char *text;
+    size_t textLength;
+    size_t textCapacity;
+    int failed;
+};
+
+typedef struct ImageWriter ImageWriter;
+
+// A heap image that is mapped, kept until the program exits
+void *imageData = NULL;
+size_t imageLength = 0;
+
+// Reports that an image cannot be used and exits
+void imageError(char *message, char *path){
+    printf("%s\npath: %s\n", message, path);
+    texit(1);
+}
+
+// Unmaps the loaded image; registered with atexit
+void releaseImage(){
+    munmap(imageData, imageLength);
+}
+
+// Hashes the names of the primitives, so that an image is not used by an
+// interpreter whose primitives are numbered differently
+uint64_t hashPrimitives(){
+    uint64_t h = 14695981039346656037ull;
+    int id;
+    for (id = 0; id < primitiveCount(); id++){
+        char *name = primitiveAt(id)->name;
+        h = hashCacheBytes(h, name, strlen(name) + 1);
+    }
+    return h;
+}
+
+// Makes room for one more item of size bytes in a growing array
+void *growImageArray(void *array, size_t count, size_t *capacity,
+                     size_t size){
+    if (count == *capacity){
+        *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        array = realloc(array, *capacity * size);
+    }
+    return array;
+}
+
+// Copies size bytes at address to the end of the heap, at an offset that
+// is a multiple of 8, and returns the offset
+uint64_t appendObject(ImageWriter *writer, const void *address, size_t size){
+    size_t offset = writer->heapLength;
+    size_t end = offset + ((size + 7) & ~(size_t)7);
+    if (end > writer->heapCapacity){
+        while (end > writer->heapCapacity){
+            writer->heapCapacity = writer->heapCapacity == 0 ?
+                                   65536 : writer->heapCapacity * 2;
+        }
+        writer->heap = realloc(writer->heap, writer->heapCapacity);
+    }
+    memset(writer->heap + offset, 0, end - offset);
+    memcpy(writer->heap + offset, address, size);
+    writer->heapLength = end;
+    return offset;
+}
+
+// Returns the slot of address in the table of copies, or the empty slot
+// where it belongs
+size_t copySlot(void **addresses, size_t slots, void *address){
+    size_t slot = ((uintptr_t)address >> 3) * 0x9E3779B97F4A7C15ull;
+    slot = slot >> 17 & (slots - 1);
+    while (addresses[slot] != NULL && addresses[slot] != address){
+        slot = (slot + 1) & (slots - 1);
+    }
+    return slot;
+}
+
+// Records that the object at address was copied to offset
+void rememberCopy(ImageWriter *writer, void *address, uint64_t offset){
+    if (2 * (writer->addressCount + 1) > writer->addressSlots){
+        // rehash into a table twice the size
+        size_t slots = writer->addressSlots == 0 ?
+                       4096 : writer->addressSlots * 2;
+        void **addresses = calloc(slots, sizeof(void *));
+        uint64_t *offsets = malloc(sizeof(uint64_t) * slots);
+        size_t i;
+        for (i = 0; i < writer->addressSlots; i++){
+            if (writer->addresses[i] != NULL){
+                size_t slot = copySlot(addresses, slots,
+                                       writer->addresses[i]);
+                addresses[slot] = writer->addresses[i];
+                offsets[slot] = writer->offsets[i];
+            }
+        }
+        free(writer->addresses);
+        free(writer->offsets);
+        writer->addresses = addresses;
+        writer->offsets = offsets;
+        writer->addressSlots = slots;
+    }
+    size_t slot = copySlot(writer->addresses, writer->addressSlots, address);
+    writer->addresses[slot] = address;
+    writer->offsets[slot] = offset;
+    writer->addressCount = writer->addressCount + 1;
+}
+
+// Stores target in the pointer at field of the heap, and records its
+// relocation
+void relocate(ImageWriter *writer, uint64_t field, uint64_t target,
+              int kind){
+    memcpy(writer->heap + field, &target, sizeof(target));
+    writer->relocations = growImageArray(writer->relocations,
+                                         writer->relocationCount,
+                                         &writer->relocationCapacity,
+                                         sizeof(uint64_t));
+    writer->relocations[writer->relocationCount] = field << 2 | kind;
+    writer->relocationCount = writer->relocationCount + 1;
+}
+
+// Points the pointer at field to the copy of the object of size bytes at
+// address, copying it first if it has not been copied yet
+void pointTo(ImageWriter *writer, uint64_t field, void *address,
+             size_t size, int kind){
+    if (address == NULL){
+        memset(writer->heap + field, 0, sizeof(void *));
+        return;
+    }
+    if (kind == OBJECT_VALUE){
+        address = writtenExpression(address);
+    }
+    if (writer->addressSlots > 0){
+        size_t slot = copySlot(writer->addresses, writer->addressSlots,
+                               address);
+        if (writer->addresses[slot] != NULL){
+            relocate(writer, field, writer->offsets[slot], RELOCATE_HEAP);
+            return;
+        }
+    }
+    uint64_t offset = appendObject(writer, address, size);
+    rememberCopy(writer, address, offset);
+    if (kind != OBJECT_PLAIN){
+        writer->objects = growImageArray(writer->objects,
+                                         writer->objectCount,
+                                         &writer->objectCapacity,
+                                         sizeof(ImageObject));
+        writer->objects[writer->objectCount].offset = offset;
+        writer->objects[writer->objectCount].kind = kind;
+        writer->objectCount = writer->objectCount + 1;
+    }
+    relocate(writer, field, offset, RELOCATE_HEAP);
+}
+
+// Points the pointer at field to a copy of its own of size bytes at
+// address, followed by a NUL; used for text and arrays that are not shared
+uint64_t pointToCopy(ImageWriter *writer, uint64_t field, const void *address,
+                     size_t size){
+    if (address == NULL){
+        memset(writer->heap + field, 0, sizeof(void *));
+        return 0;
+    }
+    uint64_t offset = appendObject(writer, address, size + 1);
+    writer->heap[offset + size] = '\0';
+    relocate(writer, field, offset, RELOCATE_HEAP);
+    return offset;
+}
+
+// Points the pointer at field to the symbol name, adding it to the names
+void pointToSymbol(ImageWriter *writer, uint64_t field, char *name){
+    name = intern(name, strlen(name));
+    if (2 * (writer->symbolCount + 1) > writer->nameSlots){
+        // rehash into a table twice the size
+        size_t slots = writer->nameSlots == 0 ? 256 : writer->nameSlots * 2;
+        char **names = calloc(slots, sizeof(char *));
+        uint64_t *numbers = malloc(sizeof(uint64_t) * slots);
+        size_t i;
+        for (i = 0; i < writer->nameSlots; i++){
+            if (writer->names[i] != NULL){
+                size_t slot = ((uintptr_t)writer->names[i] >> 3) & (slots - 1);
+                while (names[slot] != NULL){
+                    slot = (slot + 1) & (slots - 1);
+                }
+                names[slot] = writer->names[i];
+                numbers[slot] = writer->numbers[i];
+            }
+        }
+        free(writer->names);
+        free(writer->numbers);
+        writer->names = names;
+        writer->numbers = numbers;
+        writer->nameSlots = slots;
+    }
+    size_t slot = ((uintptr_t)name >> 3) & (writer->nameSlots - 1);
+    while (writer->names[slot] != NULL && writer->names[slot] != name){
+        slot = (slot + 1) & (writer->nameSlots - 1);
+    }
+    if (writer->names[slot] == NULL){
+        size_t length = strlen(name) + 1;
+        while (writer->textLength + length > writer->textCapacity){
+            writer->textCapacity = writer->textCapacity == 0 ?
+                                   4096 : writer->textCapacity * 2;
+            writer->text = realloc(writer->text, writer->textCapacity);
+        }
+        memcpy(writer->text + writer->textLength, name, length);
+        writer->textLength = writer->textLength + length;
+        writer->names[slot] = name;
+        writer->numbers[slot] = writer->symbolCount;
+        writer->symbolCount = writer->symbolCount + 1;
+    }
+    relocate(writer, field, writer->numbers[slot], RELOCATE_SYMBOL);
+}
+
+// Replaces the pointers of the value copied to offset
+void scanValue(ImageWriter *writer, uint64_t offset){
+    Value value;
+    memcpy(&value, writer->heap + offset, sizeof(Value));
+    switch (value.type){
+        case STR_TYPE:
+            pointToCopy(writer, offset + offsetof(Value, str.chars),
+                        value.str.chars, stringTextLength(&value));
+            break;
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+            pointToSymbol(writer, offset + offsetof(Value, s), value.s);
+            break;
+        case CONS_TYPE:
+            pointTo(writer, offset + offsetof(Value, c.car), value.c.car,
+                    sizeof(Value), OBJECT_VALUE);
+            pointTo(writer, offset + offsetof(Value, c.cdr), value.c.cdr,
+                    sizeof(Value), OBJECT_VALUE);
+            break;
+        case CLOSURE_TYPE:
+            pointTo(writer, offset + offsetof(Value, cl.paramNames),
+                    value.cl.paramNames, sizeof(Value), OBJECT_VALUE);
+            pointTo(writer, offset + offsetof(Value, cl.functionCode),
+                    value.cl.functionCode, sizeof(Value), OBJECT_VALUE);
+            pointTo(writer, offset + offsetof(Value, cl.frame),
+                    value.cl.frame, sizeof(Frame), OBJECT_FRAME);
+            break;
+        case PRIMITIVE_TYPE:{
+            int id = primitiveNumber(value.pf);
+            if (id < 0){
+                writer->failed = 1;
+            }
+            relocate(writer, offset + offsetof(Value, pf), id,
+                     RELOCATE_PRIMITIVE);
+            break;
+        }
+        case HASHMAP_TYPE:
+            pointTo(writer, offset + offsetof(Value, map), value.map,
+                    sizeof(Hamt), OBJECT_MAP);
+            break;
+        case F64VECTOR_TYPE:
+        case S64VECTOR_TYPE:
+            pointTo(writer, offset + offsetof(Value, vec), value.vec,
+                    sizeof(NumVector), OBJECT_VECTOR);
+            break;
+        case PORT_TYPE:
+            pointTo(writer, offset + offsetof(Value, port), value.port,
+                    sizeof(Port), OBJECT_PORT);
+            break;
+        case MEMO_TYPE:
+            pointTo(writer, offset + offsetof(Value, memo), value.memo,
+                    sizeof(Memo), OBJECT_MEMO);
+            break;
+        case PROMISE_TYPE:
+            pointTo(writer, offset + offsetof(Value, promise), value.promise,
+                    sizeof(Promise), OBJECT_PROMISE);
+            break;
+        case VOID_TYPE:
+        case PTR_TYPE:
+            memset(writer->heap + offset + offsetof(Value, p), 0,
+                   sizeof(void *));
+            break;
+        default:
+            break;
+    }
+}
+
+// Replaces the pointers of the frame copied to offset
+void scanFrame(ImageWriter *writer, uint64_t offset){
+    Frame frame;
+    memcpy(&frame, writer->heap + offset, sizeof(Frame));
+    pointTo(writer, offset + offsetof(Frame, bindings), frame.bindings,
+            sizeof(Value), OBJECT_VALUE);
+    pointTo(writer, offset + offsetof(Frame, parent), frame.parent,
+            sizeof(Frame), OBJECT_FRAME);
+}
+
+// Returns 1 if a key hashes the same wherever it is in memory
+int hashIsStable(Value *key){
+    while (key->type == CONS_TYPE){
+        if (!hashIsStable(key->c.car)){
+            return 0;
+        }
+        key = key->c.cdr;
+    }
+    switch (key->type){
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+        case NULL_TYPE:
+        case HASHMAP_TYPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Returns 1 if every key below node hashes the same wherever it is
+int nodeIsStable(struct HamtNode *node){
+    int i;
+    if (node == NULL){
+        return 1;
+    }
+    for (i = 0; i < node->count; i++){
+        if (node->slots[i].key == NULL ? !nodeIsStable(node->slots[i].child)
+                                       : !hashIsStable(node->slots[i].key)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Replaces the pointers of the map copied to offset, and has it rehashed
+// when loaded if its keys hash by address
+void scanMap(ImageWriter *writer, uint64_t offset){
+    Hamt map;
+    memcpy(&map, writer->heap + offset, sizeof(Hamt));
+    if (!nodeIsStable(map.root)){
+        writer->rehash = growImageArray(writer->rehash, writer->rehashCount,
+                                        &writer->rehashCapacity,
+                                        sizeof(uint64_t));
+        writer->rehash[writer->rehashCount] = offset;
+        writer->rehashCount = writer->rehashCount + 1;
+    }
+    pointTo(writer, offset + offsetof(Hamt, root), map.root,
+            sizeof(struct HamtNode), OBJECT_NODE);
+    pointTo(writer, offset + offsetof(Hamt, edit), map.edit,
+            sizeof(struct HamtEdit), OBJECT_PLAIN);
+}
+
+// Replaces the pointers of the map node copied to offset, copying its
+// slots, of which only the used ones are kept
+void scanNode(ImageWriter *writer, uint64_t offset){
+    struct HamtNode node;
+    int i;
+    memcpy(&node, writer->heap + offset, sizeof(node));
+    pointTo(writer, offset + offsetof(struct HamtNode, edit), node.edit,
+            sizeof(struct HamtEdit), OBJECT_PLAIN);
+    if (node.slots == NULL){
+        return;
+    }
+    uint64_t slots = pointToCopy(writer,
+                                 offset + offsetof(struct HamtNode, slots),
+                                 node.slots, sizeof(struct HamtEntry) *
+                                             node.capacity);
+    for (i = 0; i < node.capacity; i++){
+        uint64_t entry = slots + sizeof(struct HamtEntry) * i;
+        if (i >= node.count){
+            memset(writer->heap + entry, 0, sizeof(struct HamtEntry));
+            continue;
+        }
+        pointTo(writer, entry + offsetof(struct HamtEntry, key),
+                node.slots[i].key, sizeof(Value), OBJECT_VALUE);
+        pointTo(writer, entry + offsetof(struct HamtEntry, value),
+                node.slots[i].value, sizeof(Value), OBJECT_VALUE);
+        pointTo(writer, entry + offsetof(struct HamtEntry, child),
+                node.slots[i].child, sizeof(struct HamtNode), OBJECT_NODE);
+    }
+}
+
+// Replaces the pointer of the vector copied to offset, copying its elements
+void scanVector(ImageWriter *writer, uint64_t offset){
+    NumVector vector;
+    memcpy(&vector, writer->heap + offset, sizeof(NumVector));
+    int length = vector.length > 0 ? vector.length : 1;
+    pointToCopy(writer, offset + offsetof(NumVector, f64), vector.f64,
+                sizeof(double) * length);
+}
+
+// Turns the port copied to offset into a closed port with the same path
+void scanPort(ImageWriter *writer, uint64_t offset){
+    Port port;
+    memcpy(&port, writer->heap + offset, sizeof(Port));
+    memset(writer->heap + offset, 0, sizeof(Port));
+    Port *copy = (Port *)(writer->heap + offset);
+    copy->fd = -1;
+    copy->input = port.input;
+    copy->closed = 1;
+    pointToCopy(writer, offset + offsetof(Port, path), port.path,
+                port.path == NULL ? 0 : strlen(port.path));
+}
+
+// Turns the memoized procedure copied to offset into one that remembers
+// nothing yet
+void scanMemo(ImageWriter *writer, uint64_t offset){
+    Memo memo;
+    memcpy(&memo, writer->heap + offset, sizeof(Memo));
+    memset(writer->heap + offset, 0, sizeof(Memo));
+    Memo *copy = (Memo *)(writer->heap + offset);
+    copy->limit = memo.limit;
+    pointTo(writer, offset + offsetof(Memo, function), memo.function,
+            sizeof(Value), OBJECT_VALUE);
+}
+
+// Replaces the pointers of the promise copied to offset
+void scanPromise(ImageWriter *writer, uint64_t offset){
+    Promise promise;
+    memcpy(&promise, writer->heap + offset, sizeof(Promise));
+    pointTo(writer, offset + offsetof(Promise, expr), promise.expr,
+            sizeof(Value), OBJECT_VALUE);
+    pointTo(writer, offset + offsetof(Promise, frame), promise.frame,
+            sizeof(Frame), OBJECT_FRAME);
+    pointTo(writer, offset + offsetof(Promise, value), promise.value,
+            sizeof(Value), OBJECT_VALUE);
+}
+
+// Writes the image file, beside the old one first and then renamed over it
+int writeImage(ImageWriter *writer, ImageHeader *header, char *sources,
+               char *path){
+    size_t length = strlen(path);
+    char *temporary = malloc(length + 32);
+    snprintf(temporary, length + 32, "%s.%d", path, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int written = 0;
+    if (fd >= 0){
+        written = writeCacheData(fd, header, sizeof(ImageHeader)) &&
+                  writeCacheData(fd, writer->heap, writer->heapLength) &&
+                  writeCacheData(fd, writer->relocations, sizeof(uint64_t) *
+                                 writer->relocationCount) &&
+                  writeCacheData(fd, writer->rehash, sizeof(uint64_t) *
+                                 writer->rehashCount) &&
+                  writeCacheData(fd, writer->text, writer->textLength) &&
+                  writeCacheData(fd, sources, header->sourcesLength);
+        close(fd);
+        if (!written || rename(temporary, path) < 0){
+            unlink(temporary);
+            written = 0;
+        }
+    }
+    free(temporary);
+    return written;
+}
+
+// Hashes everything in an image after its header
+uint64_t hashImage(char *heap, uint64_t *relocations, uint64_t *rehash,
+                   char *text, char *sources, ImageHeader *header){
+    uint64_t h = hashCacheBytes(14695981039346656037ull, heap,
+                                header->heapLength);
+    h = hashCacheBytes(h, relocations,
+                       sizeof(uint64_t) * header->relocationCount);
+    h = hashCacheBytes(h, rehash, sizeof(uint64_t) * header->rehashCount);
+    h = hashCacheBytes(h, text, header->textLength);
+    return hashCacheBytes(h, sources, header->sourcesLength);
+}
+
+// Writes everything reachable from the global frame to an image file
+void saveImage(char *path){
+    ImageWriter writer;
+    Frame *global = globalEnvironment();
+    memset(&writer, 0, sizeof(writer));
+
+    // copy the global frame, then everything the copies point to, a breadth
+    // at a time, so that long lists need no deep recursion
+    uint64_t globalFrame = appendObject(&writer, global, sizeof(Frame));
+    rememberCopy(&writer, global, globalFrame);
+    scanFrame(&writer, globalFrame);
+    while (writer.scanned < writer.objectCount){
+        ImageObject object = writer.objects[writer.scanned];
+        writer.scanned = writer.scanned + 1;
+        switch (object.kind){
+            case OBJECT_VALUE:
+                scanValue(&writer, object.offset);
+                break;
+            case OBJECT_FRAME:
+                scanFrame(&writer, object.offset);
+                break;
+            case OBJECT_MAP:
+                scanMap(&writer, object.offset);
+                break;
+            case OBJECT_NODE:
+                scanNode(&writer, object.offset);
+                break;
+            case OBJECT_VECTOR:
+                scanVector(&writer, object.offset);
+                break;
+            case OBJECT_PORT:
+                scanPort(&writer, object.offset);
+                break;
+            case OBJECT_MEMO:
+                scanMemo(&writer, object.offset);
+                break;
+            case OBJECT_PROMISE:
+                scanPromise(&writer, object.offset);
+                break;
+        }
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.valueSize = sizeof(Value);
+    header.pointerSize = sizeof(void *);
+    header.primitiveHash = hashPrimitives();
+    header.heapLength = writer.heapLength;
+    header.relocationCount = writer.relocationCount;
+    header.rehashCount = writer.rehashCount;
+    header.symbolCount = writer.symbolCount;
+    header.textLength = writer.textLength;
+    header.globalFrame = globalFrame;
+    size_t sourcesLength;
+    char *sources = packSources(&sourcesLength);
+    header.sourcesLength = sourcesLength;
+    header.bodyHash = hashImage(writer.heap, writer.relocations,
+                                writer.rehash, writer.text, sources, &header);
+    int written = !writer.failed &&
+                  writeImage(&writer, &header, sources, path);
+
+    free(sources);
+    free(writer.heap);
+    free(writer.objects);
+    free(writer.relocations);
+    free(writer.rehash);
+    free(writer.addresses);
+    free(writer.offsets);
+    free(writer.names);
+    free(writer.numbers);
+    free(writer.text);
+    if (!written){
+        imageError("cannot write image file", path);
+    }
+}
+
+// Interns the names of the symbols of an image; returns NULL if the text
+// does not hold exactly count names
+char **internImageNames(char *text, uint64_t length, uint64_t count){
+    char **names = malloc(sizeof(char *) * (count > 0 ? count : 1));
+    uint64_t number = 0;
+    uint64_t start = 0;
+    uint64_t i;
+    for (i = 0; i < length; i++){
+        if (text[i] == '\0'){
+            if (number == count){
+                free(names);
+                return NULL;
+            }
+            names[number] = intern(text + start, i - start);
+            number = number + 1;
+            start = i + 1;
+        }
+    }
+    if (number != count || start != length){
+        free(names);
+        return NULL;
+    }
+    return names;
+}
+
+// Turns the numbers in the pointers of an image's heap back into pointers;
+// returns 0 if a relocation is out of place
+int relocateImage(char *heap, ImageHeader *header, uint64_t *relocations,
+                  char **names){
+    uint64_t count = primitiveCount();
+    uint64_t i;
+    for (i = 0; i < header->relocationCount; i++){
+        uint64_t field = relocations[i] >> 2;
+        uint64_t target;
+        if (field % 8 != 0 || field + sizeof(void *) > header->heapLength){
+            return 0;
+        }
+        memcpy(&target, heap + field, sizeof(target));
+        switch (relocations[i] & 3){
+            case RELOCATE_HEAP:
+                if (target >= header->heapLength){
+                    return 0;
+                }
+                *(char **)(heap + field) = heap + target;
+                break;
+            case RELOCATE_PRIMITIVE:
+                if (target >= count){
+                    return 0;
+                }
+                *(Value *(**)(Value *))(heap + field) =
+                    primitiveAt(target)->function;
+                break;
+            case RELOCATE_SYMBOL:
+                if (target >= header->symbolCount){
+                    return 0;
+                }
+                *(char **)(heap + field) = names[target];
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Adds every entry below node to a transient map
+void addNodeEntries(Hamt *map, struct HamtNode *node){
+    int i;
+    if (node == NULL){
+        return;
+    }
+    for (i = 0; i < node->count; i++){
+        if (node->slots[i].key == NULL){
+            addNodeEntries(map, node->slots[i].child);
+        } else {
+            hamtAssocInPlace(map, node->slots[i].key, node->slots[i].value);
+        }
+    }
+}
+
+// Rebuilds the nodes of a loaded map whose keys hash by address, since
+// its keys are no longer where they were when it was saved
+void rehashMap(Hamt *map){
+    Hamt *rebuilt = hamtTransient(makeMap(map->isSet)->map);
+    addNodeEntries(rebuilt, map->root);
+    map->root = hamtPersistent(rebuilt)->root;
+}
+
+// Replaces the global frame with the one saved in an image file
+void loadImage(char *path){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        imageError("cannot open image file", path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(ImageHeader)){
+        close(fd);
+        imageError("cannot load image file", path);
+    }
+    size_t size = info.st_size;
+    char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+        imageError("cannot load image file", path);
+    }
+
+    ImageHeader *header = (ImageHeader *)data;
+    uint64_t body = size - sizeof(ImageHeader);
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION ||
+        header->valueSize != sizeof(Value) ||
+        header->pointerSize != sizeof(void *) ||
+        header->primitiveHash != hashPrimitives() ||
+        header->heapLength > body || header->heapLength % 8 != 0 ||
+        header->relocationCount > body / sizeof(uint64_t) ||
+        header->rehashCount > body / sizeof(uint64_t) ||
+        header->textLength > body || header->sourcesLength > body ||
+        header->heapLength + sizeof(uint64_t) * header->relocationCount +
+        sizeof(uint64_t) * header->rehashCount + header->textLength +
+        header->sourcesLength != body ||
+        header->globalFrame % 8 != 0 ||
+        header->globalFrame + sizeof(Frame) > header->heapLength){
+        munmap(data, size);
+        imageError("cannot load image file", path);
+    }
+    char *heap = data + sizeof(ImageHeader);
+    uint64_t *relocations = (uint64_t *)(heap + header->heapLength);
+    uint64_t *rehash = relocations + header->relocationCount;
+    char *text = (char *)(rehash + header->rehashCount);
+    char *sources = text + header->textLength;
+    char **names = NULL;
+    int valid = header->bodyHash == hashImage(heap, relocations, rehash,
+                                              text, sources, header);
+    uint64_t i;
+    for (i = 0; i < header->rehashCount; i++){
+        if (rehash[i] % 8 != 0 ||
+            rehash[i] + sizeof(Hamt) > header->heapLength){
+            valid = 0;
+        }
+    }
+    if (valid){
+        names = internImageNames(text, header->textLength,
+                                 header->symbolCount);
+    }
+    if (names == NULL || !relocateImage(heap, header, relocations, names) ||
+        !unpackSources(sources, header->sourcesLength)){
+        free(names);
+        munmap(data, size);
+        imageError("cannot load image file", path);
+    }
+    free(names);
+    for (i = 0; i < header->rehashCount; i++){
+        rehashMap((Hamt *)(heap + rehash[i]));
+    }
+
+    imageData = data;
+    imageLength = size;
+    atexit(releaseImage);
+    setGlobalEnvironment((Frame *)(heap + header->globalFrame));
+    noteGlobalBindings(globalEnvironment());
+}
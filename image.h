@@ -0,0 +1,16 @@
+#ifndef _IMAGE
+#define _IMAGE
+
+// Bump whenever the layout of values or of the image file changes
+#define IMAGE_VERSION 2
+
+// Writes everything reachable from the global frame to a heap image file at
+// path, so that a later run can start from the same global environment
+void saveImage(char *path);
+
+// Replaces the global frame with the one saved in the heap image file at
+// path. Must be called before any source is read; exits with an error if
+// the file is not an image made by this interpreter.
+void loadImage(char *path);
+
+#endif
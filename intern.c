@@ -0,0 +1,100 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Symbol table that interns symbol names, so the tokenizer only copies a
+* name the first time it sees it
+*
+* The table is shared by every thread behind a lock. Each thread first looks
+* in a small cache of the names it interned recently, so that threads
+* reading source in parallel rarely take the lock.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "intern.h"
+#include "talloc.h"
+
+#define INITIAL_CAPACITY 256
+
+// Entries in each thread's cache
+#define CACHE_SIZE 512
+
+// Open addressing table of interned names
+char **symbolTable = NULL;
+size_t symbolCapacity = 0;
+size_t symbolCount = 0;
+pthread_mutex_t symbolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Names this thread interned recently, by hash
+__thread char *symbolCache[CACHE_SIZE];
+
+// FNV-1a over length bytes
+size_t hashName(const char *name, size_t length) {
+    size_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Returns 1 if the interned name is the length characters at name
+int sameName(char *interned, const char *name, size_t length) {
+    return !strncmp(interned, name, length) && interned[length] == '\0';
+}
+
+// Returns the slot where name is, or the empty slot where it belongs
+size_t findSlot(char **table, size_t capacity, const char *name,
+                size_t length) {
+    size_t slot = hashName(name, length) & (capacity - 1);
+    while (table[slot] != NULL) {
+        if (sameName(table[slot], name, length)) {
+            return slot;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+// Doubles the table once it is half full
+void growSymbolTable() {
+    size_t capacity = symbolCapacity == 0 ? INITIAL_CAPACITY
+                                          : symbolCapacity * 2;
+    char **table = talloc(sizeof(char *) * capacity);
+    size_t i;
+    memset(table, 0, sizeof(char *) * capacity);
+    for (i = 0; i < symbolCapacity; i++) {
+        if (symbolTable[i] != NULL) {
+            char *name = symbolTable[i];
+            table[findSlot(table, capacity, name, strlen(name))] = name;
+        }
+    }
+    symbolTable = table;
+    symbolCapacity = capacity;
+}
+
+// Returns the shared copy of a symbol name
+char *intern(const char *name, size_t length) {
+    size_t hash = hashName(name, length);
+    char **cached = symbolCache + (hash & (CACHE_SIZE - 1));
+    if (*cached != NULL && sameName(*cached, name, length)) {
+        return *cached;
+    }
+
+    pthread_mutex_lock(&symbolLock);
+    if (2 * (symbolCount + 1) > symbolCapacity) {
+        growSymbolTable();
+    }
+    size_t slot = findSlot(symbolTable, symbolCapacity, name, length);
+    if (symbolTable[slot] == NULL) {
+        char *copy = talloc(length + 1);
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+        symbolTable[slot] = copy;
+        symbolCount = symbolCount + 1;
+    }
+    *cached = symbolTable[slot];
+    pthread_mutex_unlock(&symbolLock);
+    return *cached;
+}
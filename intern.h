@@ -0,0 +1,12 @@
+#include <stddef.h>
+
+#ifndef _INTERN
+#define _INTERN
+
+// Returns the one shared, NUL-terminated copy of the symbol name made of the
+// length characters at name. The first occurrence of a name is copied; every
+// later occurrence returns the same pointer, so interned symbols can be
+// compared by address.
+char *intern(const char *name, size_t length);
+
+#endif
@@ -20,12 +20,33 @@ Note: correctly evaluates Knuth's test
 #include "talloc.h"
 #include "value.h"
 #include "tokenizer.h"
+#include "reader.h"
 #include "parser.h"
 #include "primitives.h"
+#include "hamt.h"
+#include "numvec.h"
+#include "stringops.h"
+#include "numfmt.h"
+#include "output.h"
+#include "optimize.h"
+#include "quicken.h"
+#include "jit.h"
+#include "closure.h"
+#include "pipeline.h"
+#include "memo.h"
+#include "promise.h"
+#include "parallel.h"
+#include "ports.h"
 
 Frame *globalFrame;
 int procedureDisplay;
 
+// The frames around the let* forms evaluating their bindings, which
+// meanwhile sit in those frames
+Frame **letStarFrames = NULL;
+int letStarCount = 0;
+int letStarCapacity = 0;
+
 // throws an evaluation error
 void evaluationError(){
     printf("Evaluation Error\n");
@@ -42,6 +63,7 @@ void quoteError(Value *args){
 
 //throws an application error
 void applicationError(Value *tree){
+    printLocation(tree->loc);
     printf("application: not a procedure;\n");
     printf("expected a procedure that can be applied to arguments\n");
     printf("given: ");
@@ -50,66 +72,175 @@ void applicationError(Value *tree){
     texit(1);            
 }
 
-int printInterpTreeHelper(Value *tree, int firstItem) {
-    int i = 0;
+// Nesting depth the printer handles without allocating its stack
+#define PRINT_STACK_SIZE 64
+
+// Writes an atom (anything but a list) to the output buffer
+void writeAtom(Value *tree){
+    int i;
+    char number[NUMFMT_SIZE];
     switch(tree->type){
-        case(CONS_TYPE):
-            if (firstItem) {
-                firstItem = 0;
-            } else {
-                printf("(");
-            }
-            printInterpTreeHelper(car(tree), firstItem);
-            if (car(tree)->type == CONS_TYPE) {
-                printf(")");
-            }
-            if (car(tree)->type == NULL_TYPE) {
-                printf("()"); // empty list
-            }
-            if (cdr(tree)->type != NULL_TYPE) {
-                printf(" ");
-            }
-            printInterpTreeHelper(cdr(tree), 1); 
-            break;
-        case(STR_TYPE):
-            printf("%s", tree->s);
+        case(STR_TYPE):{
+            int length;
+            char *text = writtenString(tree, &length);
+            writeOutput(text, length);
             break;
+        }
         case(INT_TYPE):
-            printf("%i", tree->i);
+            writeOutput(number, formatInt(tree->i, number));
             break;
         case(DOUBLE_TYPE):
-            printf("%lf", tree->d);
+            writeOutput(number, formatDouble(tree->d, number));
             break;
         case(BOOL_TYPE):
-            printf("%s", tree->s);
+            writeOutputString(tree->s);
             break;
         case(SYMBOL_TYPE):
-            printf("%s", tree->s);
+            writeOutputString(tree->s);
             break;
         case(CLOSURE_TYPE):
-            printf("#<procedure>");
-            i = 1;
+        case(MEMO_TYPE):
+            writeOutputString("#<procedure>");
+            break;
+        case(PROMISE_TYPE):
+            writeOutputString("#<promise>");
+            break;
+        case(HASHMAP_TYPE):
+            if (tree->map->isSet) {
+                writeOutputString("#<set>");
+            } else {
+                writeOutputString("#<map>");
+            }
+            break;
+        case(F64VECTOR_TYPE):
+            writeOutputString("#f64(");
+            for (i = 0; i < tree->vec->length; i++) {
+                if (i > 0) {
+                    writeOutputChar(' ');
+                }
+                writeOutput(number, formatDouble(tree->vec->f64[i], number));
+            }
+            writeOutputChar(')');
+            break;
+        case(S64VECTOR_TYPE):
+            writeOutputString("#s64(");
+            for (i = 0; i < tree->vec->length; i++) {
+                if (i > 0) {
+                    writeOutputChar(' ');
+                }
+                writeOutput(number, formatInt(tree->vec->s64[i], number));
+            }
+            writeOutputChar(')');
+            break;
+        case(PORT_TYPE):
+            if (tree->port->input) {
+                writeOutputString("#<input-port>");
+            } else {
+                writeOutputString("#<output-port>");
+            }
+            break;
+        case(EOF_TYPE):
+            writeOutputString("#<eof>");
             break;
         default:
             break;
     }
-    return i;
+}
+
+// Writes an atom, or if displayed is 1 a string as its characters without
+// quotes, the way display shows it
+void writeItem(Value *item, int displayed){
+    if (displayed && item->type == STR_TYPE && item->str.chars[0] == '\"'){
+        writeOutput(stringContents(item), item->str.length);
+    } else {
+        writeAtom(item);
+    }
+}
+
+// Writes a value to the output buffer the way Racket shows it, except that
+// the outermost list has no parentheses, and with strings at any depth
+// shown without quotes if displayed is 1. Walks nested lists with an
+// explicit stack of the rest of each enclosing list, so deep lists cannot
+// overflow the C stack.
+void writeTree(Value *tree, int displayed){
+    Value *initialStack[PRINT_STACK_SIZE];
+    Value **stack = initialStack;
+    int capacity = PRINT_STACK_SIZE;
+    int depth = 0;
+    tree = writtenExpression(tree);
+    Value *rest = tree;
+    if (tree->type != CONS_TYPE) {
+        writeItem(tree, displayed);
+        return;
+    }
+    while (1) {
+        while (rest->type == CONS_TYPE) {
+            Value *item = writtenExpression(car(rest));
+            if (item->type == CONS_TYPE) {
+                // print the nested list, then come back for the rest of this one
+                if (depth == capacity) {
+                    Value **grown = talloc(sizeof(Value *) * capacity * 2);
+                    memcpy(grown, stack, sizeof(Value *) * capacity);
+                    stack = grown;
+                    capacity = capacity * 2;
+                }
+                stack[depth] = cdr(rest);
+                depth = depth + 1;
+                writeOutputChar('(');
+                rest = item;
+                continue;
+            }
+            if (item->type == NULL_TYPE) {
+                writeOutput("()", 2); // empty list
+            } else {
+                writeItem(item, displayed);
+            }
+            if (cdr(rest)->type != NULL_TYPE) {
+                writeOutputChar(' ');
+            }
+            rest = cdr(rest);
+        }
+        if (rest->type != NULL_TYPE) {
+            writeItem(rest, displayed);
+        }
+        if (depth == 0) {
+            return;
+        }
+        depth = depth - 1;
+        rest = stack[depth];
+        writeOutputChar(')');
+        if (rest->type != NULL_TYPE) {
+            writeOutputChar(' ');
+        }
+    }
+}
+
+void writeValue(Value *tree){
+    writeTree(tree, 0);
+}
+
+void displayValue(Value *tree){
+    writeTree(tree, 1);
 }
 
 // Prints the tree to the screen in a readable fashion. Looks just like
 // Racket code; uses parentheses to indicate subtrees.
 void printInterpTree(Value *tree){
-    procedureDisplay = printInterpTreeHelper(tree, 1);
+    writeValue(tree);
+    flushOutput();
+    procedureDisplay = tree->type == CLOSURE_TYPE;
 }
 
 // globally bind a string to a primitive function
 void bind(char *name, Value *(*function)(struct Value *)){
     Value *value = talloc(sizeof(Value));
     value->type = PRIMITIVE_TYPE;
+    value->loc = 0;
     value->pf = function;
 
     Value *symbol = talloc(sizeof(Value));
     symbol->type = SYMBOL_TYPE;
+    symbol->loc = 0;
     symbol->s = name;
     
     Value *list = makeNull();
@@ -145,6 +276,7 @@ Value *lookUpSymbol(Value *symbol, Frame *frame, int modify){
         }
     }
     if (frame->parent == NULL) {
+        printLocation(symbol->loc);
         printf("%s: undefined;\ncannot reference undefined identifier\n",
                symbol->s);
         texit(1);
@@ -152,49 +284,219 @@ Value *lookUpSymbol(Value *symbol, Frame *frame, int modify){
     return lookUpSymbol(symbol, frame->parent, modify);
 }
 
+// The primitives bound in the global frame, numbered by their order here
+Primitive primitiveTable[] = {
+    {"+", primitiveAdd},
+    {"-", primitiveSubtract},
+    {"*", primitiveMult},
+    {"/", primitiveDivide},
+    {"modulo", primitiveModulo},
+    {"null?", primitiveNull},
+    {"cdr", primitiveCdr},
+    {"car", primitiveCar},
+    {"cons", primitiveCons},
+    {"=", primitiveEqual},
+    {">", primitiveGreater},
+    {">=", primitiveGreaterEqual},
+    {"<", primitiveLess},
+    {"<=", primitiveLessEqual},
+    {"list", primitiveList},
+    {"length", primitiveLength},
+    {"reverse", primitiveReverse},
+    {"append", primitiveAppend},
+    {"list-ref", primitiveListRef},
+    {"equal?", primitiveEqualP},
+    {"assoc", primitiveAssoc},
+    {"map", primitiveMap},
+    {"filter", primitiveFilter},
+    {"fold", primitiveFold},
+    {"fold-right", primitiveFoldRight},
+    {"sort", primitiveSort},
+    {"hash-map", primitiveHashMap},
+    {"hash-set", primitiveHashSet},
+    {"map-ref", primitiveMapRef},
+    {"map-set", primitiveMapSet},
+    {"set-add", primitiveSetAdd},
+    {"map-remove", primitiveMapRemove},
+    {"set-remove", primitiveMapRemove},
+    {"map-contains?", primitiveMapContains},
+    {"set-contains?", primitiveMapContains},
+    {"map-count", primitiveMapCount},
+    {"map->list", primitiveMapToList},
+    {"set->list", primitiveMapToList},
+    {"transient", primitiveTransient},
+    {"transient-set!", primitiveTransientSet},
+    {"transient-add!", primitiveTransientAdd},
+    {"transient-remove!", primitiveTransientRemove},
+    {"persistent!", primitivePersistent},
+    {"string-length", primitiveStringLength},
+    {"string-append", primitiveStringAppend},
+    {"substring", primitiveSubstring},
+    {"string=?", primitiveStringEqual},
+    {"string<?", primitiveStringLess},
+    {"string-index", primitiveStringIndex},
+    {"string-search", primitiveStringSearch},
+    {"f64vector", primitiveF64Vector},
+    {"make-f64vector", primitiveMakeF64Vector},
+    {"f64vector-length", primitiveF64VectorLength},
+    {"f64vector-ref", primitiveF64VectorRef},
+    {"f64vector-set!", primitiveF64VectorSet},
+    {"list->f64vector", primitiveListToF64Vector},
+    {"f64vector->list", primitiveF64VectorToList},
+    {"f64vector-add", primitiveF64VectorAdd},
+    {"f64vector-mul", primitiveF64VectorMul},
+    {"f64vector-scale", primitiveF64VectorScale},
+    {"f64vector-sum", primitiveF64VectorSum},
+    {"f64vector-dot", primitiveF64VectorDot},
+    {"f64vector-min", primitiveF64VectorMin},
+    {"f64vector-max", primitiveF64VectorMax},
+    {"s64vector", primitiveS64Vector},
+    {"make-s64vector", primitiveMakeS64Vector},
+    {"s64vector-length", primitiveS64VectorLength},
+    {"s64vector-ref", primitiveS64VectorRef},
+    {"s64vector-set!", primitiveS64VectorSet},
+    {"list->s64vector", primitiveListToS64Vector},
+    {"s64vector->list", primitiveS64VectorToList},
+    {"s64vector-add", primitiveS64VectorAdd},
+    {"s64vector-mul", primitiveS64VectorMul},
+    {"s64vector-scale", primitiveS64VectorScale},
+    {"s64vector-sum", primitiveS64VectorSum},
+    {"s64vector-dot", primitiveS64VectorDot},
+    {"s64vector-min", primitiveS64VectorMin},
+    {"s64vector-max", primitiveS64VectorMax},
+    {"open-input-file", primitiveOpenInputFile},
+    {"open-output-file", primitiveOpenOutputFile},
+    {"close-port", primitiveClosePort},
+    {"read", primitiveRead},
+    {"read-line", primitiveReadLine},
+    {"read-char", primitiveReadChar},
+    {"peek-char", primitivePeekChar},
+    {"write-string", primitiveWriteString},
+    {"display", primitiveDisplay},
+    {"newline", primitiveNewline},
+    {"eof-object?", primitiveEofObject},
+    {"memoize", primitiveMemoize},
+    {"memo-stats", primitiveMemoStats},
+    {"force", primitiveForce},
+    {"make-promise", primitiveMakePromise},
+    {"promise?", primitivePromise},
+    {"stream-car", primitiveStreamCar},
+    {"stream-cdr", primitiveStreamCdr},
+    {"stream-null?", primitiveStreamNull},
+    {"stream-pair?", primitiveStreamPair},
+};
+
+// Returns how many primitives there are
+int primitiveCount(){
+    return sizeof(primitiveTable) / sizeof(Primitive);
+}
+
+// Returns the primitive numbered id
+Primitive *primitiveAt(int id){
+    return primitiveTable + id;
+}
+
+// Returns the number of the primitive implemented by function, or -1
+int primitiveNumber(Value *(*function)(struct Value *)){
+    int id;
+    for (id = 0; id < primitiveCount(); id++){
+        if (primitiveTable[id].function == function){
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Returns the global frame
+Frame *globalEnvironment(){
+    return globalFrame;
+}
+
+// Returns 1 unless a let* has its bindings in frame or one of the depth
+// frames around it. Otherwise the bindings of each of those frames are the
+// ones given by where the code using them is written.
+int framesSettled(Frame *frame, int depth){
+    int i;
+    if (letStarCount == 0){
+        return 1;
+    }
+    while (frame != NULL && depth >= 0){
+        for (i = 0; i < letStarCount; i++){
+            if (letStarFrames[i] == frame){
+                return 0;
+            }
+        }
+        frame = frame->parent;
+        depth = depth - 1;
+    }
+    return 1;
+}
+
+// Replaces the global frame, as when a heap image is loaded
+void setGlobalEnvironment(Frame *frame){
+    globalFrame = frame;
+}
+
 // interprets input parse tree
 // initializes the gloal frame that stores
 // the bindings of variables and expressions of define statements
-void interpret(Value *tree){
+// Creates the global frame and binds the primitives in it
+void initInterpreter(){
+    int id;
     globalFrame = talloc(sizeof(Frame));
     globalFrame->bindings = makeNull();
+    globalFrame->parent = NULL;
     
     // bind primitives to the global frame
-    bind("+", primitiveAdd);
-    bind("-", primitiveSubtract);
-    bind("*", primitiveMult);
-    bind("/", primitiveDivide);
-    bind("modulo", primitiveModulo);
-    bind("null?", primitiveNull);
-    bind("cdr", primitiveCdr);
-    bind("car", primitiveCar);
-    bind("cons", primitiveCons);
-    bind("=", primitiveEqual);
-    bind(">", primitiveGreater);
-    bind(">=", primitiveGreaterEqual);
-    bind("<", primitiveLess);
-    bind("<=", primitiveLessEqual);
-    
-    while(tree->type != NULL_TYPE){
-        Frame *frame = talloc(sizeof(Frame));
-        frame->bindings = makeNull();
-        frame->parent = globalFrame;
-        Value *value = eval(car(tree), frame);
-        printInterpTree(value);
-
-        if (value->type == CLOSURE_TYPE){
-            if (procedureDisplay == 1 && value->type == CONS_TYPE){
-                if (strcmp(car(car(tree))->s, "lambda")){
-                    printf(":");
-                    printInterpTree(car(tree));  
-                }
+    for (id = 0; id < primitiveCount(); id++){
+        bind(primitiveTable[id].name, primitiveTable[id].function);
+    }
+}
+
+// Evaluates one top-level form and prints its value
+void interpretForm(Value *form){
+    Frame *frame = talloc(sizeof(Frame));
+    frame->bindings = makeNull();
+    frame->parent = globalFrame;
+    writeFormValue(form, eval(optimize(form), frame));
+}
+
+// evaluates a top-level form with code compiled from it, which takes the
+// frame to evaluate it in, and prints the result as interpretForm does
+void interpretCompiledForm(Value *form, Value *(*code)(Frame *)){
+    Frame *frame = talloc(sizeof(Frame));
+    frame->bindings = makeNull();
+    frame->parent = globalFrame;
+    writeFormValue(form, code(frame));
+}
+
+// prints the value of a top-level form
+void writeFormValue(Value *form, Value *value){
+    writeValue(value);
+    procedureDisplay = value->type == CLOSURE_TYPE;
+
+    if (value->type == CLOSURE_TYPE){
+        if (procedureDisplay == 1 && value->type == CONS_TYPE){
+            if (strcmp(car(form)->s, "lambda")){
+                writeOutputChar(':');
+                writeValue(form);
             }
-        }else if(value->type == PRIMITIVE_TYPE){
-            printf("#<procedure>:%s",car(tree)->s);
-        }
-        if (value->type != VOID_TYPE && value->type != NULL_TYPE){
-            printf("\n");
         }
+    }else if(value->type == PRIMITIVE_TYPE){
+        writeOutputString("#<procedure>:");
+        writeOutputString(form->s);
+    }
+    if (value->type != VOID_TYPE && value->type != NULL_TYPE){
+        writeOutputChar('\n');
+    }
+    endOutputForm();
+}
+
+// Evaluates every top-level form of a program in order
+void interpret(Value *tree){
+    initInterpreter();
+    while(tree->type != NULL_TYPE){
+        interpretForm(car(tree));
         tree = cdr(tree);
     }
 }
@@ -240,7 +542,9 @@ int checkNestedInput(Value *binding_list, Frame *frame, int letType){
                         break;
                     }
                     case STR_TYPE:{
-                        printf("%s not an identifier\n",nested_ptr->s);
+                        int length;
+                        char *text = writtenString(nested_ptr, &length);
+                        printf("%.*s not an identifier\n", length, text);
                         texit(1);
                         break;
                     }
@@ -357,8 +661,14 @@ Value *evalSet(Value *args, Frame *frame){
         printf("set! doesn't have exactly two arguments");
         texit(1);
     }
-    Value *symbol = car(args);
-    Value *target_value = eval(car(cdr(args)), frame);
+    return setVariable(car(args), eval(car(cdr(args)), frame), frame);
+}
+
+// binds symbol to target_value where set! finds it from frame
+Value *setVariable(Value *symbol, Value *target_value, Frame *frame){
+    if (symbol->type == SYMBOL_TYPE) {
+        noteRebinding(symbol->s);
+    }
     
     // retrieve the value associated with the symbol
     Value *binding = lookUpSymbol(symbol, frame, 1);
@@ -511,18 +821,28 @@ Value *evalCond(Value *args, Frame *frame){
 
 //evaluate let statement
 Value *evalLet(Value *args, Frame *frame){
+    return evalLetValues(args, frame, NULL);
+}
+
+// evaluates a let whose binding expressions have already given values, in
+// order, or evaluates them itself if values is NULL
+Value *evalLetValues(Value *args, Frame *frame, Value **values){
     Value *lastArg = checkLetArgs(args, frame, 0);
     // evaluate the bindings
     Value *binding_list = car(args);
     Value *new_binding_list = makeNull();
+    int i = 0;
     while (binding_list->type != NULL_TYPE) {
         Value *cur_binding = car(binding_list);
         Value *new_binding = makeNull();
-        new_binding = cons(eval(car(cdr(cur_binding)), frame), new_binding);
+        Value *value = values == NULL ? eval(car(cdr(cur_binding)), frame)
+                                      : values[i];
+        new_binding = cons(value, new_binding);
         new_binding = cons(car(cur_binding), new_binding);
         new_binding_list = cons(new_binding, new_binding_list);
         
         binding_list = cdr(binding_list);
+        i = i + 1;
     }
     
     Frame *child_frame = talloc(sizeof(Frame));
@@ -547,6 +867,14 @@ Value *evalLetStar(Value *args, Frame *frame){
     // each time a new binding is evaluated, updates it to temp_binding
     Value *original_binding = frame->bindings;
     Value *temp_binding = frame->bindings;
+    if (letStarCount == letStarCapacity) {
+        letStarCapacity = letStarCapacity == 0 ? 16 : letStarCapacity * 2;
+        Frame **grown = talloc(sizeof(Frame *) * letStarCapacity);
+        memcpy(grown, letStarFrames, sizeof(Frame *) * letStarCount);
+        letStarFrames = grown;
+    }
+    letStarFrames[letStarCount] = frame;
+    letStarCount = letStarCount + 1;
     
     while (binding_list->type != NULL_TYPE) {
         Value *cur_binding = car(binding_list);
@@ -557,6 +885,10 @@ Value *evalLetStar(Value *args, Frame *frame){
         new_binding = cons(car(cur_binding), new_binding);
         new_binding_list = cons(new_binding, new_binding_list);
         
+        // the binding is visible to closures made in this frame meanwhile
+        if (car(cur_binding)->type == SYMBOL_TYPE) {
+            noteRebinding(car(cur_binding)->s);
+        }
         temp_binding = cons(new_binding, temp_binding);
         frame->bindings = temp_binding;
         binding_list = cdr(binding_list);
@@ -564,6 +896,7 @@ Value *evalLetStar(Value *args, Frame *frame){
     
     // change the bindings in the current frame back to what its original binding
     frame->bindings = original_binding;
+    letStarCount = letStarCount - 1;
     
     Frame *child_frame = talloc(sizeof(Frame));
     child_frame->bindings = new_binding_list;
@@ -589,7 +922,8 @@ Value *evalLetRec(Value *args, Frame *frame) {
         Value *dummy_binding = makeNull();
         Value *dummy_value = makeNull();
         dummy_value->type = STR_TYPE;
-        dummy_value->s = "UNDEFINED";
+        dummy_value->str.chars = "UNDEFINED";
+        dummy_value->str.length = 0;
         dummy_binding = cons(dummy_value, dummy_binding);
         dummy_binding = cons(car(cur_binding), dummy_binding);
         dummy_binding_list = cons(dummy_binding, dummy_binding_list);
@@ -600,19 +934,22 @@ Value *evalLetRec(Value *args, Frame *frame) {
     child_frame->parent = frame;
     
     binding_list = car(args);
-    Value *new_binding_list = makeNull();
+    Value *values = makeNull();
     
     while (binding_list->type != NULL_TYPE) {
         Value *cur_binding = car(binding_list);
-        Value *new_binding_value = eval(car(cdr(cur_binding)), child_frame);
-        Value *new_binding = makeNull();
-        new_binding = cons(new_binding_value, new_binding);
-        new_binding = cons(car(cur_binding), new_binding);
-        new_binding_list = cons(new_binding, new_binding_list);
+        values = cons(eval(car(cdr(cur_binding)), child_frame), values);
         binding_list = cdr(binding_list);
     }
     
-    child_frame->bindings = new_binding_list;
+    // fill in the bindings in place, so that closures made above that keep
+    // them see the values (see closure.h); values is in the same order
+    Value *dummy_binding = dummy_binding_list;
+    while (values->type != NULL_TYPE) {
+        car(dummy_binding)->c.cdr->c.car = car(values);
+        dummy_binding = cdr(dummy_binding);
+        values = cdr(values);
+    }
     
     Value *body = evalLetBody(lastArg, child_frame);
     Value *returnEvalLet = eval(car(body), child_frame);
@@ -663,7 +1000,13 @@ Value *evalDefine(Value *args, Frame *frame){
     }
     
     // evaluate expression
-    Value *expression =  eval(car(cdr(args)),frame);
+    return defineVariable(args, eval(car(cdr(args)),frame));
+}
+
+// binds the name in args, the parts of a define after its head, to
+// expression in the global frame
+Value *defineVariable(Value *args, Value *expression){
+    noteDefinition(car(args)->s);
     Value *binding = makeNull();
     binding = cons(expression, binding);
     binding = cons(car(args), binding);
@@ -736,7 +1079,7 @@ Value *evalLambda(Value *args, Frame *frame){
     // creates a closure
     Value *closure = makeNull();
     closure->type = CLOSURE_TYPE;
-    closure->cl.frame = frame;
+    closure->cl.frame = closureFrame(args, frame);
     closure->cl.functionCode = body;
     closure->cl.paramNames = parameters;
 
@@ -746,7 +1089,8 @@ Value *evalLambda(Value *args, Frame *frame){
 // applies a function to arguments (runs body of function)
 Value *apply(Value *function, Value *args) {
     // check that function is function
-    if (function->type != CLOSURE_TYPE && function->type != PRIMITIVE_TYPE) {
+    if (function->type != CLOSURE_TYPE && function->type != PRIMITIVE_TYPE &&
+        function->type != MEMO_TYPE) {
         evaluationError();
     }
     
@@ -754,31 +1098,48 @@ Value *apply(Value *function, Value *args) {
     if (function->type == PRIMITIVE_TYPE){
         return function->pf(args);
     }
+    else if (function->type == MEMO_TYPE){
+        return applyMemo(function->memo, args);
+    }
     // function type is closure type
     else{
-        // create frame
-        Value *binding_list = makeNull();
-        Value *param_list = function->cl.paramNames;    
-        Value *args_list = args;
-        
-        while (param_list->type != NULL_TYPE) {
-            if (args_list->type == NULL_TYPE) {
-                printf("too few arguments to function call\n");
-                texit(1);
-            }
-            Value *binding = makeNull();
-            binding = cons(car(args_list), binding);
-            binding = cons(car(param_list), binding);
-            binding_list = cons(binding, binding_list);
-        
-            param_list = cdr(param_list);
-            args_list = cdr(args_list);
-        }
-        if (args_list->type != NULL_TYPE) {
-            printf("too many arguments to function call\n");
+        return applyClosure(function, bindArguments(function, args));
+    }
+}
+
+// returns the bindings of the parameters of a closure to args, checking
+// that there are as many of each
+Value *bindArguments(Value *function, Value *args) {
+    Value *binding_list = makeNull();
+    Value *param_list = function->cl.paramNames;    
+    Value *args_list = args;
+    
+    while (param_list->type != NULL_TYPE) {
+        if (args_list->type == NULL_TYPE) {
+            printf("too few arguments to function call\n");
             texit(1);
         }
+        Value *binding = makeNull();
+        binding = cons(car(args_list), binding);
+        binding = cons(car(param_list), binding);
+        binding_list = cons(binding, binding_list);
+    
+        param_list = cdr(param_list);
+        args_list = cdr(args_list);
+    }
+    if (args_list->type != NULL_TYPE) {
+        printf("too many arguments to function call\n");
+        texit(1);
+    }
+    return binding_list;
+}
 
+// runs the body of a closure in a new frame holding binding_list, the
+// bindings of its parameters. A compiled body may end in a call it leaves
+// to this loop (see jit.h), so that calls in tail position do not grow the
+// stack.
+Value *applyClosure(Value *function, Value *binding_list) {
+    while (1){
         Frame *new_frame = talloc(sizeof(Frame));
         new_frame->bindings = binding_list;
         new_frame->parent = function->cl.frame;
@@ -801,8 +1162,21 @@ Value *apply(Value *function, Value *args) {
             last_body = car(body_ptr);
             body_ptr = cdr(body_ptr);
         }
-        //evaluate body of function in new frame
-        return eval(car(last_body), new_frame);
+        //evaluate body of function in new frame, as machine code once it
+        //is hot
+        JitCode code = jitCode(car(last_body));
+        if (code == NULL){
+            return eval(car(last_body), new_frame);
+        }
+        Value *result = code(new_frame);
+        Value *args;
+        if (!jitTakeTailCall(result, &function, &args)){
+            return result;
+        }
+        if (function->type != CLOSURE_TYPE){
+            return apply(function, args);
+        }
+        binding_list = bindArguments(function, args);
     }
 }
 
@@ -891,6 +1265,20 @@ Value *eval(Value *tree, Frame *frame){
                     result = evalSet(args, frame);
                 } else if (!strcmp(first->s, "begin")){
                     result = evalBegin(args, frame);
+                } else if (!strcmp(first->s, "pipeline")){
+                    result = evalPipeline(args, frame);
+                } else if (!strcmp(first->s, "define-memoized")){
+                    result = evalDefineMemoized(args, frame);
+                } else if (!strcmp(first->s, "delay")){
+                    result = evalDelay(args, frame, 0);
+                } else if (!strcmp(first->s, "delay-force")){
+                    result = evalDelay(args, frame, 1);
+                } else if (!strcmp(first->s, "stream-cons")){
+                    result = evalStreamCons(args, frame);
+                } else if (!strcmp(first->s, "parallel-let")){
+                    result = evalParallelLet(args, frame);
+                } else if (!strcmp(first->s, "parallel-call")){
+                    result = evalParallelCall(args, frame);
                 } else {
                     Value *evaledOperator = eval(first, frame);
                     Value *evaledArgs = evalEach(args, frame);
@@ -903,7 +1291,8 @@ Value *eval(Value *tree, Frame *frame){
             // or a procedure is used that returns another procedure
             else if (first->type == CONS_TYPE){
                 Value *returned = eval(first, frame);
-                if (returned->type == CLOSURE_TYPE) {
+                if (returned->type == CLOSURE_TYPE ||
+                    returned->type == MEMO_TYPE) {
                     Value *evaledOperator = eval(returned, frame);
                     Value *evaledArgs = evalEach(args, frame);
                     return apply(evaledOperator, evaledArgs);
@@ -928,6 +1317,18 @@ Value *eval(Value *tree, Frame *frame){
             return tree;
             break;
         }
+        case OPTIMIZED_TYPE:{
+            // fall back to the original once a name it relies on changes
+            if (guardsHold(tree->opt)){
+                return eval(tree->opt->code, frame);
+            }
+            return eval(tree->opt->original, frame);
+            break;
+        }
+        case QUICK_TYPE:{
+            return evalQuick(tree->quick, frame);
+            break;
+        }
         default:{
             return tree;
             break;
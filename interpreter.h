@@ -3,11 +3,50 @@
 #ifndef _INTERPRETER
 #define _INTERPRETER
 
+// A primitive and the name it is bound to in the global frame
+struct Primitive {
+    char *name;
+    Value *(*function)(struct Value *);
+};
+
+typedef struct Primitive Primitive;
+
 void interpret(Value *tree);
+void initInterpreter();
+void interpretForm(Value *form);
+void interpretCompiledForm(Value *form, Value *(*code)(Frame *));
+void writeFormValue(Value *form, Value *value);
 Value *eval(Value *expr, Frame *env);
+Value *apply(Value *function, Value *args);
+Value *applyClosure(Value *function, Value *bindings);
+Value *bindArguments(Value *function, Value *args);
+Value *setVariable(Value *symbol, Value *value, Frame *frame);
+Value *defineVariable(Value *args, Value *value);
+Value *checkLetArgs(Value *args, Frame *frame, int star);
+Value *evalLetValues(Value *args, Frame *frame, Value **values);
+Value *evalEach(Value *args, Frame *frame);
+Value *lookUpSymbol(Value *symbol, Frame *frame, int modify);
 void printInterpTree(Value *tree);
+void writeValue(Value *tree);
+// Writes a value as writeValue does, but with every string in it shown
+// without quotes, as display shows it
+void displayValue(Value *tree);
 void printValue(Value *value);
 Value *checkNumArgs(Value *args);
 
+// The primitives are numbered from 0 to primitiveCount() - 1, in the order
+// initInterpreter binds them
+int primitiveCount();
+Primitive *primitiveAt(int id);
+int primitiveNumber(Value *(*function)(struct Value *));
+
+Frame *globalEnvironment();
+void setGlobalEnvironment(Frame *frame);
+int framesSettled(Frame *frame, int depth);
+
+// The number of let* forms evaluating their bindings; while it is 0 every
+// frame is settled
+extern int letStarCount;
+
 #endif
 
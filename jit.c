@@ -0,0 +1,830 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* A template compiler from the bodies of hot procedures to x86-64 machine code
+*/
+
+/*
+applyClosure asks jitCode for the last expression of a body each time it
+runs one. Once procedures ending in that expression have been called
+JIT_THRESHOLD times, it is compiled to a function taking the frame of the
+call, which applyClosure then runs instead of eval. The expression has been
+optimized and has run that many times, so most of its variable references
+and calls have specialized themselves by then (see quicken.h).
+
+Each kind of node has a template of machine code:
+
+    a constant                  the value itself
+    a local or global variable  the binding read by its place, with the
+                                checks readVariable makes
+    car, cdr, null?, cons, +,   the guard on the name, then the arguments,
+    -, *, and the comparisons   then the primitive on integers and pairs
+                                in place: integer arithmetic that would
+                                overflow goes to the slow path
+    any other call              the operator and arguments, then apply
+    if, and, or, cond           the tests and branches, each compiled
+    an optimized expression     its guards, then its code or the original
+    anything else               a call of eval
+
+Every template has a slow path that calls back into the interpreter, which
+does what the interpreter would have done, errors included. The nodes keep
+specializing and deoptimizing as they do when interpreted, and the machine
+code checks each time whatever it assumed, so it never has to be thrown
+away.
+
+The code is built in memory from talloc, then copied into pages of its own
+from mmap that are made executable and no longer writable.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "jit.h"
+#include "interpreter.h"
+#include "optimize.h"
+#include "quicken.h"
+#include "primitives.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "value.h"
+
+#if defined(__x86_64__) && defined(__linux__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define JIT_X86 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Calls of procedures ending in an expression after which it is compiled
+#define JIT_THRESHOLD 64
+
+// The most nested expressions compiled into one function; deeper ones are
+// left to eval
+#define MAX_LEVEL 48
+
+// The most frames and bindings a variable read steps over in machine code
+#define MAX_STEPS 32
+
+// A body procedures have been called with, and its machine code once it has
+// been compiled. calls stops counting past JIT_THRESHOLD.
+struct JitEntry {
+    Value *body;
+    int calls;
+    JitCode code;
+};
+
+typedef struct JitEntry JitEntry;
+
+// The bodies seen, by address, in an open-addressing table
+JitEntry *jitTable = NULL;
+int jitCapacity = 0;
+int jitCount = 0;
+
+// Whether compiling is on: -1 until SCHEME_JIT has been read
+int jitEnabled = -1;
+
+// A call left by compiled code to applyClosure, and the value that says so
+Value *tailFunction = NULL;
+Value *tailArgs = NULL;
+Value tailCallMarker;
+
+// Helpers of compiled code
+
+// Returns a new integer
+Value *jitInteger(int number) {
+    Value *result = makeNull();
+    result->type = INT_TYPE;
+    result->i = number;
+    return result;
+}
+
+// Returns whether the test of an if is true, as evalIf checks it
+int jitIfTest(Value *test) {
+    if (test->type != BOOL_TYPE) {
+        printf("if: test arg is not BOOL_TYPE\n");
+        texit(1);
+    }
+    return !strcmp(test->s, "#t");
+}
+
+// Returns whether an argument of and (or of or) decides it, as evalAnd and
+// evalOr check it
+int jitLogicTest(Value *argument, int isAnd) {
+    if (argument->type != BOOL_TYPE) {
+        printf("%s: bool? expected for arguments\n", isAnd ? "and" : "or");
+        texit(1);
+    }
+    return !strcmp(argument->s, isAnd ? "#f" : "#t");
+}
+
+// Returns whether the test of a cond clause is true, as evalCond checks it
+int jitCondTest(Value *test) {
+    if (test->type != BOOL_TYPE) {
+        printf("cond: bool? expected for conditional arg\n");
+        texit(1);
+    }
+    return !strcmp(test->s, "#t");
+}
+
+// Returns a value that makes applyClosure apply function to args in place
+// of the body that returned it
+Value *jitTailCall(Value *function, Value *args) {
+    tailFunction = function;
+    tailArgs = args;
+    return &tailCallMarker;
+}
+
+// If result is from jitTailCall, sets function and args to the call it
+// asked for and returns 1; otherwise returns 0
+int jitTakeTailCall(Value *result, Value **function, Value **args) {
+    if (result != &tailCallMarker) {
+        return 0;
+    }
+    *function = tailFunction;
+    *args = tailArgs;
+    return 1;
+}
+
+#ifdef JIT_X86
+
+// The registers, numbered as in instructions
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI
+};
+
+// Condition codes of the jumps used, as in the second byte of a jcc
+#define JUMP_ALWAYS 0
+#define JUMP_OVERFLOW 0x80
+#define JUMP_EQUAL 0x84
+#define JUMP_NOT_EQUAL 0x85
+
+// Machine code being built. depth counts the words pushed since the
+// prologue, which keeps calls aligned.
+struct Emitter {
+    unsigned char *bytes;
+    int length;
+    int capacity;
+    int depth;
+};
+
+typedef struct Emitter Emitter;
+
+// Places in the code of jumps to one label
+struct Jumps {
+    int at[MAX_STEPS * 2 + 8];
+    int count;
+};
+
+typedef struct Jumps Jumps;
+
+void emitByte(Emitter *e, int byte) {
+    if (e->length == e->capacity) {
+        e->capacity = e->capacity == 0 ? 1024 : e->capacity * 2;
+        unsigned char *grown = talloc(e->capacity);
+        memcpy(grown, e->bytes, e->length);
+        e->bytes = grown;
+    }
+    e->bytes[e->length] = byte;
+    e->length = e->length + 1;
+}
+
+void emit32(Emitter *e, uint32_t word) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        emitByte(e, (word >> (8 * i)) & 0xff);
+    }
+}
+
+void emit64(Emitter *e, uint64_t word) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        emitByte(e, (word >> (8 * i)) & 0xff);
+    }
+}
+
+// mov reg, imm64
+void emitLoadImmediate(Emitter *e, int reg, uint64_t word) {
+    emitByte(e, 0x48);
+    emitByte(e, 0xb8 + reg);
+    emit64(e, word);
+}
+
+// mov dst, [src + offset]
+void emitLoadField(Emitter *e, int dst, int src, size_t offset) {
+    emitByte(e, 0x48);
+    emitByte(e, 0x8b);
+    emitByte(e, 0x40 | (dst << 3) | src);
+    emitByte(e, offset);
+}
+
+// mov dst32, [src + offset]
+void emitLoadInt(Emitter *e, int dst, int src, size_t offset) {
+    emitByte(e, 0x8b);
+    emitByte(e, 0x40 | (dst << 3) | src);
+    emitByte(e, offset);
+}
+
+// mov dst, src
+void emitMove(Emitter *e, int dst, int src) {
+    emitByte(e, 0x48);
+    emitByte(e, 0x89);
+    emitByte(e, 0xc0 | (src << 3) | dst);
+}
+
+// cmp first, second
+void emitCompare(Emitter *e, int first, int second) {
+    emitByte(e, 0x48);
+    emitByte(e, 0x39);
+    emitByte(e, 0xc0 | (second << 3) | first);
+}
+
+// test reg32, reg32, or the whole register if wide
+void emitTest(Emitter *e, int reg, int wide) {
+    if (wide) {
+        emitByte(e, 0x48);
+    }
+    emitByte(e, 0x85);
+    emitByte(e, 0xc0 | (reg << 3) | reg);
+}
+
+// mov reg32, imm32
+void emitLoadInt32(Emitter *e, int reg, int number) {
+    emitByte(e, 0xb8 + reg);
+    emit32(e, number);
+}
+
+void emitPush(Emitter *e, int reg) {
+    emitByte(e, 0x50 + reg);
+    e->depth = e->depth + 1;
+}
+
+void emitPop(Emitter *e, int reg) {
+    emitByte(e, 0x58 + reg);
+    e->depth = e->depth - 1;
+}
+
+// add rsp, words * 8, dropping words pushed
+void emitDrop(Emitter *e, int words) {
+    emitByte(e, 0x48);
+    emitByte(e, 0x81);
+    emitByte(e, 0xc4);
+    emit32(e, words * 8);
+    e->depth = e->depth - words;
+}
+
+// cmp dword [reg + type], type
+void emitCompareType(Emitter *e, int reg, valueType type) {
+    emitByte(e, 0x83);
+    emitByte(e, 0x78 | reg);
+    emitByte(e, offsetof(Value, type));
+    emitByte(e, type);
+}
+
+// cmp dword [address], number, through rcx
+void emitCompareCounter(Emitter *e, int *address, int number) {
+    emitLoadImmediate(e, RCX, (uintptr_t) address);
+    emitByte(e, 0x81);
+    emitByte(e, 0x39);
+    emit32(e, number);
+}
+
+// Calls function with the arguments already in rdi, rsi and rdx, keeping
+// the stack aligned as the calling convention asks
+void emitCall(Emitter *e, void *function) {
+    if (e->depth % 2) {
+        emitByte(e, 0x48);
+        emitByte(e, 0x81);
+        emitByte(e, 0xec);
+        emit32(e, 8);
+    }
+    emitLoadImmediate(e, RAX, (uintptr_t) function);
+    emitByte(e, 0xff);
+    emitByte(e, 0xd0);
+    if (e->depth % 2) {
+        emitByte(e, 0x48);
+        emitByte(e, 0x81);
+        emitByte(e, 0xc4);
+        emit32(e, 8);
+    }
+}
+
+// Emits a jump to a label not placed yet and returns where to patch it
+int emitJump(Emitter *e, int condition) {
+    if (condition == JUMP_ALWAYS) {
+        emitByte(e, 0xe9);
+    } else {
+        emitByte(e, 0x0f);
+        emitByte(e, condition);
+    }
+    emit32(e, 0);
+    return e->length - 4;
+}
+
+// Places the label of the jump patched at at here
+void landJump(Emitter *e, int at) {
+    uint32_t distance = e->length - (at + 4);
+    int i;
+    for (i = 0; i < 4; i++) {
+        e->bytes[at + i] = (distance >> (8 * i)) & 0xff;
+    }
+}
+
+void addJump(Jumps *jumps, int at) {
+    jumps->at[jumps->count] = at;
+    jumps->count = jumps->count + 1;
+}
+
+void landJumps(Emitter *e, Jumps *jumps) {
+    int i;
+    for (i = 0; i < jumps->count; i++) {
+        landJump(e, jumps->at[i]);
+    }
+}
+
+// The slow paths the machine code calls
+
+// Finishes a one-argument core primitive that was not done in place
+Value *jitPrimitiveOne(Quick *quick, Value *first) {
+    return corePrimitiveOne(quick->operation, quick->function, first);
+}
+
+// Finishes a two-argument core primitive that was not done in place
+Value *jitPrimitiveTwo(Quick *quick, Value *first, Value *second) {
+    return corePrimitiveTwo(quick->operation, quick->function, first,
+                            second);
+}
+
+// Applies the operator of a call to its arguments. stack holds the
+// arguments last first, then the operator, as the machine code pushed them.
+Value *jitApply(Value **stack, int count) {
+    Value *args = makeNull();
+    int i;
+    for (i = 0; i < count; i++) {
+        args = cons(stack[i], args);
+    }
+    return apply(stack[count], args);
+}
+
+void compileExpression(Emitter *e, Value *expr, int level);
+
+// Leaves in rax what eval gives for expr
+void compileEval(Emitter *e, Value *expr) {
+    emitLoadImmediate(e, RDI, (uintptr_t) expr);
+    emitMove(e, RSI, RBX);
+    emitCall(e, eval);
+}
+
+// Leaves in rax what evalQuick gives for quick
+void compileQuickEval(Emitter *e, Quick *quick) {
+    emitLoadImmediate(e, RDI, (uintptr_t) quick);
+    emitMove(e, RSI, RBX);
+    emitCall(e, evalQuick);
+}
+
+// A variable reference: reads the binding where the node found it, making
+// the checks readVariable and variableValue make
+void compileVariable(Emitter *e, Quick *quick) {
+    int i;
+    if ((quick->kind != QUICK_LOCAL && quick->kind != QUICK_GLOBAL) ||
+        quick->depth + quick->index > MAX_STEPS) {
+        compileQuickEval(e, quick);
+        return;
+    }
+    Jumps slow;
+    slow.count = 0;
+    // no let* is evaluating its bindings (see framesSettled)
+    emitCompareCounter(e, &letStarCount, 0);
+    addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+    if (quick->kind == QUICK_GLOBAL) {
+        emitCompareCounter(e, &quick->watch->definitions,
+                           quick->definitions);
+        addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+        emitLoadImmediate(e, RDX, (uintptr_t) quick->binding);
+    } else {
+        emitMove(e, RAX, RBX);
+        for (i = 0; i < quick->depth; i++) {
+            emitLoadField(e, RAX, RAX, offsetof(Frame, parent));
+            emitTest(e, RAX, 1);
+            addJump(&slow, emitJump(e, JUMP_EQUAL));
+        }
+        // a local binding is never found in the global frame
+        emitLoadField(e, RCX, RAX, offsetof(Frame, parent));
+        emitTest(e, RCX, 1);
+        addJump(&slow, emitJump(e, JUMP_EQUAL));
+        emitLoadField(e, RAX, RAX, offsetof(Frame, bindings));
+        for (i = 0; i < quick->index; i++) {
+            emitCompareType(e, RAX, CONS_TYPE);
+            addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+            emitLoadField(e, RAX, RAX, offsetof(Value, c.cdr));
+        }
+        emitCompareType(e, RAX, CONS_TYPE);
+        addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+        // the binding still has the name, by its interned text
+        emitLoadField(e, RDX, RAX, offsetof(Value, c.car));
+        emitLoadField(e, RCX, RDX, offsetof(Value, c.car));
+        emitLoadField(e, RCX, RCX, offsetof(Value, s));
+        emitLoadImmediate(e, RAX, (uintptr_t) quick->original->s);
+        emitCompare(e, RCX, RAX);
+        addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+    }
+    emitLoadField(e, RAX, RDX, offsetof(Value, c.cdr));
+    emitLoadField(e, RAX, RAX, offsetof(Value, c.car));
+    // a symbol is looked up further, and a quoted value unwrapped, by eval
+    emitCompareType(e, RAX, SYMBOL_TYPE);
+    addJump(&slow, emitJump(e, JUMP_EQUAL));
+    emitCompareType(e, RAX, CONS_TYPE);
+    int done = emitJump(e, JUMP_NOT_EQUAL);
+    emitLoadField(e, RCX, RAX, offsetof(Value, c.car));
+    emitCompareType(e, RCX, SYMBOL_TYPE);
+    addJump(&slow, emitJump(e, JUMP_EQUAL));
+    int fast = emitJump(e, JUMP_ALWAYS);
+    landJumps(e, &slow);
+    compileQuickEval(e, quick);
+    landJump(e, done);
+    landJump(e, fast);
+}
+
+// A core primitive done in place while its name is bound to it
+void compilePrimitive(Emitter *e, Quick *quick, int level) {
+    int operation = quick->operation;
+    if (quick->argCount != (operation <= INLINE_NULL ? 1 : 2)) {
+        compileQuickEval(e, quick);
+        return;
+    }
+    Jumps slow;
+    Jumps done;
+    slow.count = 0;
+    done.count = 0;
+    emitCompareCounter(e, &quick->guard->changes, quick->changes);
+    int general = emitJump(e, JUMP_NOT_EQUAL);
+    compileExpression(e, car(quick->args), level + 1);
+    if (operation <= INLINE_NULL) {
+        if (operation == INLINE_NULL) {
+            emitCompareType(e, RAX, NULL_TYPE);
+            // sete al; movzx edi, al
+            emitByte(e, 0x0f);
+            emitByte(e, 0x94);
+            emitByte(e, 0xc0);
+            emitByte(e, 0x0f);
+            emitByte(e, 0xb6);
+            emitByte(e, 0xf8);
+            emitCall(e, makeBool);
+            addJump(&done, emitJump(e, JUMP_ALWAYS));
+        } else {
+            emitCompareType(e, RAX, CONS_TYPE);
+            addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+            if (operation == INLINE_CAR) {
+                emitLoadField(e, RAX, RAX, offsetof(Value, c.car));
+            } else {
+                // a dotted pair keeps its dot marker in the list
+                emitLoadField(e, RDX, RAX, offsetof(Value, c.cdr));
+                emitCompareType(e, RDX, NULL_TYPE);
+                int empty = emitJump(e, JUMP_EQUAL);
+                emitCompareType(e, RDX, CONS_TYPE);
+                addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+                emitLoadField(e, RCX, RDX, offsetof(Value, c.car));
+                emitCompareType(e, RCX, STR_TYPE);
+                addJump(&slow, emitJump(e, JUMP_EQUAL));
+                landJump(e, empty);
+                emitMove(e, RAX, RDX);
+            }
+            addJump(&done, emitJump(e, JUMP_ALWAYS));
+        }
+        landJumps(e, &slow);
+        emitMove(e, RSI, RAX);
+        emitLoadImmediate(e, RDI, (uintptr_t) quick);
+        emitCall(e, jitPrimitiveOne);
+        addJump(&done, emitJump(e, JUMP_ALWAYS));
+    } else {
+        emitPush(e, RAX);
+        compileExpression(e, car(cdr(quick->args)), level + 1);
+        emitMove(e, RSI, RAX);
+        emitPop(e, RDI);
+        if (operation == INLINE_CONS) {
+            emitCompareType(e, RSI, CONS_TYPE);
+            int list = emitJump(e, JUMP_EQUAL);
+            emitCompareType(e, RSI, NULL_TYPE);
+            addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+            landJump(e, list);
+            emitCall(e, cons);
+            addJump(&done, emitJump(e, JUMP_ALWAYS));
+        } else {
+            emitCompareType(e, RDI, INT_TYPE);
+            addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+            emitCompareType(e, RSI, INT_TYPE);
+            addJump(&slow, emitJump(e, JUMP_NOT_EQUAL));
+            emitLoadInt(e, RAX, RDI, offsetof(Value, i));
+            emitLoadInt(e, RCX, RSI, offsetof(Value, i));
+            if (operation <= INLINE_MULTIPLY) {
+                // add, sub or imul eax, ecx; in range the result is the
+                // one computing in double would give
+                if (operation == INLINE_ADD) {
+                    emitByte(e, 0x01);
+                    emitByte(e, 0xc8);
+                } else if (operation == INLINE_SUBTRACT) {
+                    emitByte(e, 0x29);
+                    emitByte(e, 0xc8);
+                } else {
+                    emitByte(e, 0x0f);
+                    emitByte(e, 0xaf);
+                    emitByte(e, 0xc1);
+                }
+                addJump(&slow, emitJump(e, JUMP_OVERFLOW));
+                // mov edi, eax
+                emitByte(e, 0x89);
+                emitByte(e, 0xc7);
+                emitCall(e, jitInteger);
+            } else {
+                // cmp eax, ecx; setcc al; movzx edi, al
+                int conditions[] = {0x94, 0x9c, 0x9f, 0x9e, 0x9d};
+                emitByte(e, 0x39);
+                emitByte(e, 0xc8);
+                emitByte(e, 0x0f);
+                emitByte(e, conditions[operation - INLINE_EQUAL]);
+                emitByte(e, 0xc0);
+                emitByte(e, 0x0f);
+                emitByte(e, 0xb6);
+                emitByte(e, 0xf8);
+                emitCall(e, makeBool);
+            }
+            addJump(&done, emitJump(e, JUMP_ALWAYS));
+        }
+        landJumps(e, &slow);
+        emitMove(e, RDX, RSI);
+        emitMove(e, RSI, RDI);
+        emitLoadImmediate(e, RDI, (uintptr_t) quick);
+        emitCall(e, jitPrimitiveTwo);
+        addJump(&done, emitJump(e, JUMP_ALWAYS));
+    }
+    // the name was bound again: evalQuick makes the node an ordinary call
+    landJump(e, general);
+    compileQuickEval(e, quick);
+    landJumps(e, &done);
+}
+
+// A call: the operator, then the arguments in order, then apply
+void compileCall(Emitter *e, Quick *quick, int level) {
+    compileExpression(e, quick->head, level + 1);
+    emitPush(e, RAX);
+    Value *args = quick->args;
+    while (args->type == CONS_TYPE) {
+        compileExpression(e, car(args), level + 1);
+        emitPush(e, RAX);
+        args = cdr(args);
+    }
+    emitMove(e, RDI, RSP);
+    emitLoadInt32(e, RSI, quick->argCount);
+    emitCall(e, jitApply);
+    emitDrop(e, quick->argCount + 1);
+}
+
+// if with exactly three arguments
+void compileIf(Emitter *e, Value *args, int level) {
+    compileExpression(e, car(args), level + 1);
+    emitMove(e, RDI, RAX);
+    emitCall(e, jitIfTest);
+    emitTest(e, RAX, 0);
+    int otherwise = emitJump(e, JUMP_EQUAL);
+    compileExpression(e, car(cdr(args)), level + 1);
+    int done = emitJump(e, JUMP_ALWAYS);
+    landJump(e, otherwise);
+    compileExpression(e, car(cdr(cdr(args))), level + 1);
+    landJump(e, done);
+}
+
+// and or or on a proper list of arguments, giving a new boolean
+void compileLogic(Emitter *e, Value *args, int isAnd, int level) {
+    Jumps decided;
+    decided.count = 0;
+    while (args->type == CONS_TYPE) {
+        compileExpression(e, car(args), level + 1);
+        emitMove(e, RDI, RAX);
+        emitLoadInt32(e, RSI, isAnd);
+        emitCall(e, jitLogicTest);
+        emitTest(e, RAX, 0);
+        addJump(&decided, emitJump(e, JUMP_NOT_EQUAL));
+        args = cdr(args);
+    }
+    emitLoadInt32(e, RDI, isAnd);
+    emitCall(e, makeBool);
+    int done = emitJump(e, JUMP_ALWAYS);
+    landJumps(e, &decided);
+    emitLoadInt32(e, RDI, !isAnd);
+    emitCall(e, makeBool);
+    landJump(e, done);
+}
+
+// Returns whether every clause of a cond is a list of at least two
+// elements, so that compiling it cannot skip an error evalCond reports
+int wellFormedCond(Value *clauses) {
+    int count = 0;
+    while (clauses->type == CONS_TYPE) {
+        Value *clause = car(clauses);
+        if (clause->type != CONS_TYPE || cdr(clause)->type != CONS_TYPE) {
+            return 0;
+        }
+        count = count + 1;
+        clauses = cdr(clauses);
+    }
+    return clauses->type == NULL_TYPE && count <= MAX_STEPS;
+}
+
+// cond, testing its clauses as evalCond does
+void compileCond(Emitter *e, Value *clauses, int level) {
+    Jumps done;
+    done.count = 0;
+    int matched = 0;
+    while (clauses->type == CONS_TYPE && !matched) {
+        Value *clause = car(clauses);
+        Value *test = car(clause);
+        if (test->type == SYMBOL_TYPE) {
+            // evalCond only looks at else among symbols
+            if (!strcmp(test->s, "else")) {
+                compileExpression(e, car(cdr(clause)), level + 1);
+                matched = 1;
+            }
+        } else {
+            compileExpression(e, test, level + 1);
+            emitMove(e, RDI, RAX);
+            emitCall(e, jitCondTest);
+            emitTest(e, RAX, 0);
+            int next = emitJump(e, JUMP_EQUAL);
+            compileExpression(e, car(cdr(clause)), level + 1);
+            addJump(&done, emitJump(e, JUMP_ALWAYS));
+            landJump(e, next);
+        }
+        clauses = cdr(clauses);
+    }
+    if (!matched) {
+        emitCall(e, makeNull);
+    }
+    landJumps(e, &done);
+}
+
+// Emits code leaving in rax what eval gives for expr in the frame in rbx
+void compileExpression(Emitter *e, Value *expr, int level) {
+    if (level > MAX_LEVEL) {
+        compileEval(e, expr);
+        return;
+    }
+    switch (expr->type) {
+        case QUICK_TYPE: {
+            Quick *quick = expr->quick;
+            if (quick->kind == QUICK_VARIABLE || quick->kind == QUICK_LOCAL ||
+                quick->kind == QUICK_GLOBAL) {
+                compileVariable(e, quick);
+            } else if (quick->kind == QUICK_PRIMITIVE) {
+                compilePrimitive(e, quick, level);
+            } else {
+                compileCall(e, quick, level);
+            }
+            break;
+        }
+        case OPTIMIZED_TYPE: {
+            emitLoadImmediate(e, RDI, (uintptr_t) expr->opt);
+            emitCall(e, guardsHold);
+            emitTest(e, RAX, 0);
+            int original = emitJump(e, JUMP_EQUAL);
+            compileExpression(e, expr->opt->code, level + 1);
+            int done = emitJump(e, JUMP_ALWAYS);
+            landJump(e, original);
+            compileEval(e, expr->opt->original);
+            landJump(e, done);
+            break;
+        }
+        case CONS_TYPE: {
+            Value *first = car(expr);
+            Value *args = cdr(expr);
+            if (first->type == SYMBOL_TYPE && !strcmp(first->s, "if") &&
+                properLength(args) == 3) {
+                compileIf(e, args, level);
+            } else if (first->type == SYMBOL_TYPE &&
+                       (!strcmp(first->s, "and") ||
+                        !strcmp(first->s, "or")) &&
+                       properLength(args) >= 0 &&
+                       properLength(args) <= MAX_STEPS) {
+                compileLogic(e, args, !strcmp(first->s, "and"), level);
+            } else if (first->type == SYMBOL_TYPE &&
+                       !strcmp(first->s, "cond") && wellFormedCond(args)) {
+                compileCond(e, args, level);
+            } else {
+                compileEval(e, expr);
+            }
+            break;
+        }
+        case SYMBOL_TYPE:
+            compileEval(e, expr);
+            break;
+        default:
+            // everything else evaluates to itself
+            emitLoadImmediate(e, RAX, (uintptr_t) expr);
+            break;
+    }
+}
+
+// Returns a function evaluating body, or NULL if no executable memory can
+// be had
+JitCode compileBody(Value *body) {
+    Emitter emitter;
+    Emitter *e = &emitter;
+    memset(e, 0, sizeof(Emitter));
+    // push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rdi
+    emitByte(e, 0x55);
+    emitMove(e, RBP, RSP);
+    emitByte(e, 0x53);
+    emitByte(e, 0x41);
+    emitByte(e, 0x54);
+    emitMove(e, RBX, RDI);
+    compileExpression(e, body, 0);
+    // pop r12; pop rbx; pop rbp; ret
+    emitByte(e, 0x41);
+    emitByte(e, 0x5c);
+    emitByte(e, 0x5b);
+    emitByte(e, 0x5d);
+    emitByte(e, 0xc3);
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (e->length + page - 1) / page * page;
+    void *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(code, e->bytes, e->length);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return NULL;
+    }
+    return (JitCode) code;
+}
+
+#endif
+
+// Returns the entry of body in the table, adding it if it is not there and
+// add is 1; otherwise returns NULL if it is not there
+JitEntry *jitEntry(Value *body, int add) {
+    if (add && jitCount * 2 >= jitCapacity) {
+        JitEntry *old = jitTable;
+        int oldCapacity = jitCapacity;
+        jitCapacity = jitCapacity == 0 ? 256 : jitCapacity * 2;
+        jitTable = talloc(sizeof(JitEntry) * jitCapacity);
+        memset(jitTable, 0, sizeof(JitEntry) * jitCapacity);
+        jitCount = 0;
+        int i;
+        for (i = 0; i < oldCapacity; i++) {
+            if (old[i].body != NULL) {
+                *jitEntry(old[i].body, 1) = old[i];
+            }
+        }
+    }
+    if (jitCapacity == 0) {
+        return NULL;
+    }
+    size_t slot = (((uintptr_t) body >> 4) * 2654435761u) &
+                  (jitCapacity - 1);
+    while (jitTable[slot].body != NULL && jitTable[slot].body != body) {
+        slot = (slot + 1) & (jitCapacity - 1);
+    }
+    if (jitTable[slot].body == NULL) {
+        if (!add) {
+            return NULL;
+        }
+        jitTable[slot].body = body;
+        jitCount = jitCount + 1;
+    }
+    return &jitTable[slot];
+}
+
+// Counts a call of a procedure whose body ends in body, and returns its
+// machine code once it is hot
+JitCode jitCode(Value *body) {
+    if (jitEnabled < 0) {
+        char *setting = getenv("SCHEME_JIT");
+        jitEnabled = setting == NULL || strcmp(setting, "0") != 0;
+#ifndef JIT_X86
+        jitEnabled = 0;
+#endif
+    }
+    if (!jitEnabled) {
+        JitEntry *entry = jitEntry(body, 0);
+        return entry == NULL ? NULL : entry->code;
+    }
+    JitEntry *entry = jitEntry(body, 1);
+#ifdef JIT_X86
+    if (entry->calls <= JIT_THRESHOLD) {
+        entry->calls = entry->calls + 1;
+        if (entry->calls > JIT_THRESHOLD) {
+            entry->code = compileBody(body);
+        }
+    }
+#endif
+    return entry->code;
+}
+
+// Makes code the code of body from the start
+void jitInstall(Value *body, JitCode code) {
+    JitEntry *entry = jitEntry(body, 1);
+    entry->calls = JIT_THRESHOLD + 1;
+    entry->code = code;
+}
@@ -0,0 +1,47 @@
+#include "value.h"
+
+#ifndef _JIT
+#define _JIT
+
+// Machine code for the last expression of a procedure body: evaluates it in
+// frame, the frame of a call
+typedef Value *(*JitCode)(Frame *frame);
+
+// Counts a call of a procedure whose body ends in the expression body, and
+// returns machine code for body once procedures ending in it have been
+// called often enough, or NULL while it is still interpreted. Nothing is
+// compiled on machines other than x86-64 Linux, or when the environment
+// variable SCHEME_JIT is 0; code given to jitInstall is returned regardless.
+JitCode jitCode(Value *body);
+
+// Makes code, compiled ahead of time, the code of the body expression body
+// from its first call on
+void jitInstall(Value *body, JitCode code);
+
+// Returns a value a compiled body can return to have applyClosure apply
+// function to the list args in its place, so that a call in tail position
+// does not grow the stack
+Value *jitTailCall(Value *function, Value *args);
+
+// If result is the value from jitTailCall, sets function and args to the
+// call it asked for and returns 1; otherwise returns 0
+int jitTakeTailCall(Value *result, Value **function, Value **args);
+
+// Helpers of compiled code
+
+// Returns a new integer
+Value *jitInteger(int number);
+
+// Returns whether the test of an if is true, with the error evalIf gives
+// if it is not a boolean
+int jitIfTest(Value *test);
+
+// Returns whether an argument of and (isAnd is 1) or of or decides it, with
+// the errors evalAnd and evalOr give
+int jitLogicTest(Value *argument, int isAnd);
+
+// Returns whether the test of a cond clause is true, with the error
+// evalCond gives
+int jitCondTest(Value *test);
+
+#endif
@@ -12,11 +12,13 @@
 #include "linkedlist.h"
 #include "value.h"
 #include "talloc.h"
+#include "stringops.h"
 
 // Create a new NULL_TYPE value node.
 Value *makeNull(){
     Value *nulltype = talloc(sizeof(Value));
     nulltype->type = NULL_TYPE;
+    nulltype->loc = 0;
     return nulltype;
 }
 
@@ -31,6 +33,7 @@ bool isNull(Value *value){
 Value *cons(Value *car, Value *cdr){ 
     Value *constype = talloc(sizeof(Value));
     constype->type = CONS_TYPE;
+    constype->loc = 0;
     constype->c.car = car;
     constype->c.cdr = cdr;
     return constype;
@@ -50,9 +53,12 @@ void display(Value *list){
         case (DOUBLE_TYPE):
             printf("%f ", list->d);
             break;
-        case (STR_TYPE):
-            printf("%s ", list->s);
+        case (STR_TYPE): {
+            int length;
+            char *text = writtenString(list, &length);
+            printf("%.*s ", length, text);
             break;
+        }
         case (PTR_TYPE):
             printf("%p ", list->p);
             break;
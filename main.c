@@ -1,15 +1,70 @@
 #include <stdio.h>
-#include "tokenizer.h"
+#include <string.h>
+#include "reader.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "interpreter.h"
+#include "output.h"
+#include "cache.h"
+#include "image.h"
 
-int main() {
-    Value *list = tokenize(stdin);
-    Value *tree = parse(list);
-    interpret(tree);
+// Reads and evaluates a program one top-level datum at a time, so results
+// appear as soon as each form is complete
+void interpretSource(char *path) {
+    Reader *reader = openReader(path);
+    setOutputInteractive(readerIsStream(reader));
+    Value *form = readDatum(reader);
+    while (form != NULL) {
+        interpretForm(form);
+        form = readDatum(reader);
+    }
+}
+
+// Interprets the source files named on the command line in order, or stdin
+// when there are none; "-" names stdin. After --cache, the parsed forms of
+// each source file are kept in a cache file beside it and loaded from there
+// next time. --save-image writes the global environment, as left by the
+// sources before it, to an image file, and --load-image, which must come
+// first, starts from the environment in an image file instead of a fresh
+// one.
+int main(int argc, char *argv[]) {
+    int i = 1;
+    int sources = 0;
+    initOutput();
+    if (argc > 2 && !strcmp(argv[1], "--load-image")) {
+        loadImage(argv[2]);
+        i = 3;
+    } else {
+        initInterpreter();
+    }
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "--cache")) {
+            setCodeCache(1);
+        } else if (!strcmp(argv[i], "--save-image") && i + 1 < argc) {
+            i = i + 1;
+            saveImage(argv[i]);
+            sources = sources + 1;
+        } else if (!strcmp(argv[i], "--save-image") ||
+                   !strcmp(argv[i], "--load-image")) {
+            printf("%s: expects an image file", argv[i]);
+            if (!strcmp(argv[i], "--load-image")) {
+                printf(" as the first argument");
+            }
+            printf("\n");
+            texit(1);
+        } else if (!strcmp(argv[i], "-")) {
+            interpretSource(NULL);
+            sources = sources + 1;
+        } else {
+            interpretSource(argv[i]);
+            sources = sources + 1;
+        }
+    }
+    if (sources == 0) {
+        interpretSource(NULL);
+    }
     tfree();
     return 0;
 }
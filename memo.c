@@ -0,0 +1,260 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Memoized procedures: procedures that remember what their calls returned
+*/
+
+/*
+(memoize f) returns a procedure that does what f does, but remembers what
+each call returned, keyed on its arguments by equal?, and answers a later
+call with equal arguments from there without calling f again. (memoize f n)
+keeps at most n results, n being a positive integer, forgetting the one
+least recently used to make room for another. (define-memoized name expr)
+defines name to expr memoized, so the calls a recursive procedure makes to
+itself by name are answered from the same results; a third expression gives
+the limit.
+(memo-stats m) returns how many calls m answered from its results, how many
+it passed on to f, and how many results it keeps.
+
+f is any procedure, a closure as lambda makes it or a primitive, and is
+called through apply unchanged. The results are kept in a hash table of
+chained entries, hashed as maps hash their keys (see hamt.h), which are
+also linked from the most recently used to the least.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "hamt.h"
+#include "interpreter.h"
+#include "intern.h"
+#include "linkedlist.h"
+#include "memo.h"
+#include "primitives.h"
+#include "talloc.h"
+#include "value.h"
+
+// Number of buckets a table starts with
+#define MEMO_BUCKETS 16
+
+// Returns a memoized procedure calling function, keeping at most limit
+// results, or any number if limit is 0
+Value *makeMemo(Value *function, int limit) {
+    Memo *memo = talloc(sizeof(Memo));
+    memo->function = function;
+    memo->buckets = NULL;
+    memo->bucketCount = 0;
+    memo->count = 0;
+    memo->limit = limit;
+    memo->newest = NULL;
+    memo->oldest = NULL;
+    memo->hits = 0;
+    memo->misses = 0;
+    Value *value = makeNull();
+    value->type = MEMO_TYPE;
+    value->memo = memo;
+    return value;
+}
+
+// Returns the entry of a list of arguments with the given hash, or NULL
+MemoEntry *findEntry(Memo *memo, Value *args, unsigned int hash) {
+    if (memo->bucketCount == 0) {
+        return NULL;
+    }
+    MemoEntry *entry = memo->buckets[hash & (memo->bucketCount - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && valuesEqual(entry->args, args)) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+// Takes an entry out of the list from the most recently used to the least
+void unlinkEntry(Memo *memo, MemoEntry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        memo->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        memo->oldest = entry->newer;
+    }
+}
+
+// Puts an entry first in the list from the most recently used to the least
+void pushEntry(Memo *memo, MemoEntry *entry) {
+    entry->newer = NULL;
+    entry->older = memo->newest;
+    if (memo->newest != NULL) {
+        memo->newest->newer = entry;
+    } else {
+        memo->oldest = entry;
+    }
+    memo->newest = entry;
+}
+
+// Takes the least recently used entry out of the table and returns it
+MemoEntry *evictEntry(Memo *memo) {
+    MemoEntry *entry = memo->oldest;
+    MemoEntry **link = &memo->buckets[entry->hash & (memo->bucketCount - 1)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    unlinkEntry(memo, entry);
+    memo->count = memo->count - 1;
+    return entry;
+}
+
+// Doubles the number of buckets, or makes the first ones
+void growBuckets(Memo *memo) {
+    int count = memo->bucketCount == 0 ? MEMO_BUCKETS
+                                       : memo->bucketCount * 2;
+    MemoEntry **buckets = talloc(sizeof(MemoEntry *) * count);
+    memset(buckets, 0, sizeof(MemoEntry *) * count);
+    int i;
+    for (i = 0; i < memo->bucketCount; i++) {
+        MemoEntry *entry = memo->buckets[i];
+        while (entry != NULL) {
+            MemoEntry *next = entry->next;
+            entry->next = buckets[entry->hash & (count - 1)];
+            buckets[entry->hash & (count - 1)] = entry;
+            entry = next;
+        }
+    }
+    memo->buckets = buckets;
+    memo->bucketCount = count;
+}
+
+// Adds an entry for a list of arguments, making room for it first if the
+// table is full
+MemoEntry *addEntry(Memo *memo, Value *args, unsigned int hash) {
+    MemoEntry *entry;
+    if (memo->limit > 0 && memo->count >= memo->limit) {
+        entry = evictEntry(memo);
+    } else {
+        entry = talloc(sizeof(MemoEntry));
+    }
+    if (memo->count >= memo->bucketCount) {
+        growBuckets(memo);
+    }
+    entry->hash = hash;
+    entry->args = args;
+    entry->next = memo->buckets[hash & (memo->bucketCount - 1)];
+    memo->buckets[hash & (memo->bucketCount - 1)] = entry;
+    pushEntry(memo, entry);
+    memo->count = memo->count + 1;
+    return entry;
+}
+
+Value *applyMemo(Memo *memo, Value *args) {
+    unsigned int hash = hashValue(args);
+    MemoEntry *entry = findEntry(memo, args, hash);
+    if (entry != NULL) {
+        memo->hits = memo->hits + 1;
+        unlinkEntry(memo, entry);
+        pushEntry(memo, entry);
+        return entry->result;
+    }
+    memo->misses = memo->misses + 1;
+    // callers may fill the same argument cells again for their next call
+    Value *key = makeNull();
+    Value *tail = NULL;
+    Value *rest = args;
+    while (rest->type == CONS_TYPE) {
+        appendItem(&key, &tail, car(rest));
+        rest = cdr(rest);
+    }
+    Value *result = apply(memo->function, args);
+    // the call may have made a call with the same arguments itself
+    entry = findEntry(memo, key, hash);
+    if (entry == NULL) {
+        entry = addEntry(memo, key, hash);
+    }
+    entry->result = result;
+    return result;
+}
+
+// Returns the most results a memoized procedure should keep, as given by
+// value, exiting with a contract violation unless it is a positive integer
+int memoLimit(Value *value, char *symbol) {
+    if (value->type != INT_TYPE || value->i < 1) {
+        printf("%s: contract violation\n", symbol);
+        printf("expected: exact-positive-integer?\ngiven: ");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    return value->i;
+}
+
+Value *evalDefineMemoized(Value *args, Frame *frame) {
+    int count = length(args);
+    if (count >= 1 && car(args)->type != SYMBOL_TYPE) {
+        printf("bad syntax in: ");
+        printInterpTree(car(args));
+        printf("\n");
+        texit(1);
+    }
+    if (count < 2 || count > 3) {
+        printf("define-memoized: bad syntax\n");
+        printf("(expected an expression and an optional limit after ");
+        printf("identifier): (define-memoized ");
+        printInterpTree(args);
+        printf(")\n");
+        texit(1);
+    }
+    Value *function = eval(car(cdr(args)), frame);
+    checkProcedure(function, "define-memoized");
+    int limit = 0;
+    if (count == 3) {
+        limit = memoLimit(eval(car(cdr(cdr(args))), frame),
+                          "define-memoized");
+    }
+    return defineVariable(args, makeMemo(function, limit));
+}
+
+Value *primitiveMemoize(Value *args) {
+    int count = length(args);
+    if (count < 1 || count > 2) {
+        printf("memoize: arity mismatch;\nthe expected number of arguments ");
+        printf("does not match the given number\nexpected: 1 or 2\n");
+        printf("given: %d\n", count);
+        texit(1);
+    }
+    checkProcedure(car(args), "memoize");
+    int limit = 0;
+    if (count == 2) {
+        limit = memoLimit(car(cdr(args)), "memoize");
+    }
+    return makeMemo(car(args), limit);
+}
+
+// Returns the list (name number), name being interned
+Value *statistic(char *name, int number) {
+    Value *symbol = makeNull();
+    symbol->type = SYMBOL_TYPE;
+    symbol->s = intern(name, strlen(name));
+    Value *value = makeNull();
+    value->type = INT_TYPE;
+    value->i = number;
+    return cons(symbol, cons(value, makeNull()));
+}
+
+Value *primitiveMemoStats(Value *args) {
+    checkArity(args, 1, "memo-stats");
+    Value *value = car(args);
+    if (value->type != MEMO_TYPE) {
+        printf("memo-stats: contract violation\n");
+        printf("expected: memoized-procedure?\ngiven: ");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    Memo *memo = value->memo;
+    return cons(statistic("hits", memo->hits),
+                cons(statistic("misses", memo->misses),
+                     cons(statistic("size", memo->count), makeNull())));
+}
@@ -0,0 +1,49 @@
+#include "value.h"
+
+#ifndef _MEMO
+#define _MEMO
+
+// A call a memoized procedure remembers: its arguments, as a list, and
+// what it returned. Entries are chained in their bucket by next, and linked
+// from the most recently used to the least by older (and back by newer).
+struct MemoEntry {
+    unsigned int hash;
+    struct Value *args;
+    struct Value *result;
+    struct MemoEntry *next;
+    struct MemoEntry *newer;
+    struct MemoEntry *older;
+};
+
+typedef struct MemoEntry MemoEntry;
+
+// A procedure that answers calls with arguments equal? to those of an
+// earlier call from what function returned then. It keeps at most limit
+// results, or any number if limit is 0. hits counts the calls answered
+// that way and misses the calls passed on to function. There are no
+// buckets until the first result is kept.
+struct Memo {
+    struct Value *function;
+    MemoEntry **buckets;
+    int bucketCount;
+    int count;
+    int limit;
+    MemoEntry *newest;
+    MemoEntry *oldest;
+    int hits;
+    int misses;
+};
+
+typedef struct Memo Memo;
+
+// Calls a memoized procedure on a list of arguments
+Value *applyMemo(Memo *memo, Value *args);
+
+// Evaluates (define-memoized name expr [limit]), args being the part after
+// the head
+Value *evalDefineMemoized(Value *args, Frame *frame);
+
+Value *primitiveMemoize(Value *args);
+Value *primitiveMemoStats(Value *args);
+
+#endif
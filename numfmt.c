@@ -0,0 +1,200 @@
+/*
+Number formatting for Scheme interpreter
+Created by Tom Choi, Kaya Govek, Jonah Tuchow
+
+Doubles are printed with the fewest digits that still read back as the same
+double. Most doubles in practice are short decimals: for those the digits
+come from one exact integer scaling (d * 10^n, checked by dividing back,
+which is correctly rounded for n <= 22), with no printf involved. Doubles
+that need more than 15 significant digits or lie outside the integer range
+fall back to trying 15, 16 and 17 digit renderings, which always finds the
+shortest round-trip form because every decimal of at most 15 digits survives
+a trip through a double. Subnormals have less precision than that, so for
+them every length is tried.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "numfmt.h"
+
+// 2^53: above this not every integer is a double
+#define EXACT_INT_LIMIT 9007199254740992.0
+
+// Fractional digits tried by the fast path
+#define FAST_PATH_DIGITS 17
+
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Writes the digits of n backwards ending at end; returns the first digit
+char *writeDigitsBackwards(unsigned long long n, char *end) {
+    do {
+        end--;
+        *end = '0' + (n % 10);
+        n = n / 10;
+    } while (n != 0);
+    return end;
+}
+
+// Writes the decimal digits of n into buf and returns their length
+int formatInt(long long n, char *buf) {
+    char digits[NUMFMT_SIZE];
+    char *end = digits + NUMFMT_SIZE;
+    unsigned long long magnitude = n < 0 ? 0 - (unsigned long long)n
+                                         : (unsigned long long)n;
+    char *start = writeDigitsBackwards(magnitude, end);
+    int len = 0;
+    if (n < 0) {
+        buf[len++] = '-';
+    }
+    memcpy(buf + len, start, end - start);
+    len = len + (end - start);
+    buf[len] = '\0';
+    return len;
+}
+
+// Finds the shortest digits of a positive finite d with value
+// 0.DIGITS * 10^point using one exact scaling. Returns the number of digits,
+// or 0 if d is out of the fast path's range.
+int shortestDigitsFast(double d, char *digits, int *point) {
+    int n;
+    for (n = 0; n <= FAST_PATH_DIGITS; n++) {
+        double scaled = d * powersOfTen[n];
+        if (scaled >= EXACT_INT_LIMIT) {
+            return 0;
+        }
+        unsigned long long m = (unsigned long long)scaled;
+        // the product may be off by one unit either way; try both neighbours
+        int attempt;
+        for (attempt = 0; attempt < 2; attempt++) {
+            unsigned long long candidate = m + attempt;
+            if (candidate != 0 && (double)candidate / powersOfTen[n] == d) {
+                char buf[NUMFMT_SIZE];
+                char *end = buf + NUMFMT_SIZE;
+                char *start = writeDigitsBackwards(candidate, end);
+                int len = end - start;
+                *point = len - n;
+                while (len > 1 && start[len - 1] == '0') {
+                    len--;
+                }
+                memcpy(digits, start, len);
+                return len;
+            }
+        }
+    }
+    return 0;
+}
+
+// Finds the shortest digits of a positive finite d by trying 15, 16 and 17
+// significant digits (or every length, for subnormals)
+int shortestDigitsSlow(double d, char *digits, int *point) {
+    char buf[NUMFMT_SIZE * 2];
+    int precision = d < DBL_MIN ? 1 : 15;
+    for (; precision < 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*e", precision - 1, d);
+        if (strtod(buf, NULL) == d) {
+            break;
+        }
+    }
+    snprintf(buf, sizeof(buf), "%.*e", precision - 1, d);
+    // buf is d.ddddde[+-]xx
+    int len = 0;
+    char *c = buf;
+    while (*c != 'e') {
+        if (*c != '.') {
+            digits[len++] = *c;
+        }
+        c++;
+    }
+    *point = atoi(c + 1) + 1;
+    while (len > 1 && digits[len - 1] == '0') {
+        len--;
+    }
+    return len;
+}
+
+// Writes the shortest decimal that reads back as exactly d into buf
+int formatDouble(double d, char *buf) {
+    char digits[NUMFMT_SIZE];
+    int point;
+    int count;
+    int len = 0;
+    int i;
+
+    if (isnan(d)) {
+        strcpy(buf, "+nan.0");
+        return 6;
+    }
+    if (signbit(d)) {
+        buf[len++] = '-';
+        d = -d;
+    }
+    if (isinf(d)) {
+        if (len == 0) {
+            buf[len++] = '+';
+        }
+        strcpy(buf + len, "inf.0");
+        return len + 5;
+    }
+    if (d == 0) {
+        strcpy(buf + len, "0.0");
+        return len + 3;
+    }
+
+    count = shortestDigitsFast(d, digits, &point);
+    if (count == 0) {
+        count = shortestDigitsSlow(d, digits, &point);
+    }
+
+    if (point > -6 && point <= 21) {
+        // positional notation: 0.00ddd, ddd.ddd or ddd00.0
+        if (point <= 0) {
+            buf[len++] = '0';
+            buf[len++] = '.';
+            for (i = point; i < 0; i++) {
+                buf[len++] = '0';
+            }
+            memcpy(buf + len, digits, count);
+            len = len + count;
+        } else if (point >= count) {
+            memcpy(buf + len, digits, count);
+            len = len + count;
+            for (i = count; i < point; i++) {
+                buf[len++] = '0';
+            }
+            buf[len++] = '.';
+            buf[len++] = '0';
+        } else {
+            memcpy(buf + len, digits, point);
+            len = len + point;
+            buf[len++] = '.';
+            memcpy(buf + len, digits + point, count - point);
+            len = len + count - point;
+        }
+    } else {
+        // scientific notation: d.ddde-XX
+        int exponent = point - 1;
+        buf[len++] = digits[0];
+        if (count > 1) {
+            buf[len++] = '.';
+            memcpy(buf + len, digits + 1, count - 1);
+            len = len + count - 1;
+        }
+        buf[len++] = 'e';
+        buf[len++] = exponent < 0 ? '-' : '+';
+        if (exponent < 0) {
+            exponent = -exponent;
+        }
+        if (exponent < 10) {
+            buf[len++] = '0';
+        }
+        len = len + formatInt(exponent, buf + len);
+    }
+    buf[len] = '\0';
+    return len;
+}
@@ -0,0 +1,14 @@
+#ifndef _NUMFMT
+#define _NUMFMT
+
+// Large enough for any number written by the functions below, plus a NUL
+#define NUMFMT_SIZE 32
+
+// Writes the shortest decimal that reads back as exactly d into buf, in
+// Scheme notation (3.0, 0.1, 1e-09, +inf.0), and returns its length.
+int formatDouble(double d, char *buf);
+
+// Writes the decimal digits of n into buf and returns their length.
+int formatInt(long long n, char *buf);
+
+#endif
@@ -0,0 +1,969 @@
+/*
+Homogeneous numeric vectors for Scheme interpreter
+Created by Tom Choi, Kaya Govek, Jonah Tuchow
+
+f64vectors and s64vectors keep their elements unboxed in a flat array.
+The bulk operations (elementwise add and multiply, scale, sum, dot product,
+min and max) run through a table of kernels that is picked once at startup:
+AVX2 when the CPU has it, SSE2 otherwise on x86-64, and plain loops
+everywhere else.
+
+s64vector arithmetic wraps around modulo 2^64, as 64-bit machine integers
+do, so every kernel gives the same result whatever order it adds in. The
+scalar kernels compute in unsigned long long to get that without undefined
+behavior. Neither SSE2 nor AVX2 multiplies 64-bit lanes, so the SIMD
+kernels build the low 64 bits of each product from three 32-bit
+multiplies. Elements are read back as exact integers, and one that does
+not fit in one is an error rather than a double.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "numvec.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "primitives.h"
+#include "talloc.h"
+#include "value.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NUMVEC_X86 1
+#include <immintrin.h>
+#endif
+
+// One implementation of every bulk operation
+struct NumKernels {
+    void (*addF64)(double *dst, double *a, double *b, int n);
+    void (*mulF64)(double *dst, double *a, double *b, int n);
+    void (*scaleF64)(double *dst, double *a, double k, int n);
+    double (*sumF64)(double *a, int n);
+    double (*dotF64)(double *a, double *b, int n);
+    double (*minF64)(double *a, int n);
+    double (*maxF64)(double *a, int n);
+    void (*addS64)(long long *dst, long long *a, long long *b, int n);
+    void (*mulS64)(long long *dst, long long *a, long long *b, int n);
+    void (*scaleS64)(long long *dst, long long *a, long long k, int n);
+    long long (*sumS64)(long long *a, int n);
+    long long (*dotS64)(long long *a, long long *b, int n);
+    long long (*minS64)(long long *a, int n);
+    long long (*maxS64)(long long *a, int n);
+};
+
+// Portable kernels; the SIMD versions use them for their tails
+
+void addF64Scalar(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+void mulF64Scalar(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] * b[i];
+    }
+}
+
+void scaleF64Scalar(double *dst, double *a, double k, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] * k;
+    }
+}
+
+double sumF64Scalar(double *a, int n) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum = sum + a[i];
+    }
+    return sum;
+}
+
+double dotF64Scalar(double *a, double *b, int n) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum = sum + a[i] * b[i];
+    }
+    return sum;
+}
+
+double minF64Scalar(double *a, int n) {
+    double min = a[0];
+    int i;
+    for (i = 1; i < n; i++) {
+        if (a[i] < min) {
+            min = a[i];
+        }
+    }
+    return min;
+}
+
+double maxF64Scalar(double *a, int n) {
+    double max = a[0];
+    int i;
+    for (i = 1; i < n; i++) {
+        if (a[i] > max) {
+            max = a[i];
+        }
+    }
+    return max;
+}
+
+// Wrapping 64-bit arithmetic: unsigned overflow is defined, signed is not
+#define WRAP_ADD(a, b) \
+    ((long long)((unsigned long long)(a) + (unsigned long long)(b)))
+#define WRAP_MUL(a, b) \
+    ((long long)((unsigned long long)(a) * (unsigned long long)(b)))
+
+void addS64Scalar(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = WRAP_ADD(a[i], b[i]);
+    }
+}
+
+void mulS64Scalar(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = WRAP_MUL(a[i], b[i]);
+    }
+}
+
+void scaleS64Scalar(long long *dst, long long *a, long long k, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = WRAP_MUL(a[i], k);
+    }
+}
+
+long long sumS64Scalar(long long *a, int n) {
+    long long sum = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum = WRAP_ADD(sum, a[i]);
+    }
+    return sum;
+}
+
+long long dotS64Scalar(long long *a, long long *b, int n) {
+    long long sum = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum = WRAP_ADD(sum, WRAP_MUL(a[i], b[i]));
+    }
+    return sum;
+}
+
+long long minS64Scalar(long long *a, int n) {
+    long long min = a[0];
+    int i;
+    for (i = 1; i < n; i++) {
+        if (a[i] < min) {
+            min = a[i];
+        }
+    }
+    return min;
+}
+
+long long maxS64Scalar(long long *a, int n) {
+    long long max = a[0];
+    int i;
+    for (i = 1; i < n; i++) {
+        if (a[i] > max) {
+            max = a[i];
+        }
+    }
+    return max;
+}
+
+struct NumKernels scalarKernels = {
+    addF64Scalar, mulF64Scalar, scaleF64Scalar, sumF64Scalar, dotF64Scalar,
+    minF64Scalar, maxF64Scalar, addS64Scalar, mulS64Scalar, scaleS64Scalar,
+    sumS64Scalar, dotS64Scalar, minS64Scalar, maxS64Scalar
+};
+
+#ifdef NUMVEC_X86
+
+// SSE2 is part of the x86-64 baseline, so these need no target attribute
+
+void addF64Sse2(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(a + i),
+                                          _mm_loadu_pd(b + i)));
+    }
+    addF64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+void mulF64Sse2(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                          _mm_loadu_pd(b + i)));
+    }
+    mulF64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+void scaleF64Sse2(double *dst, double *a, double k, int n) {
+    __m128d factor = _mm_set1_pd(k);
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    }
+    scaleF64Scalar(dst + i, a + i, k, n - i);
+}
+
+double sumF64Sse2(double *a, int n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    double lanes[2];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sumF64Scalar(a + i, n - i);
+}
+
+double dotF64Sse2(double *a, double *b, int n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    double lanes[2];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                           _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                           _mm_loadu_pd(b + i + 2)));
+    }
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + dotF64Scalar(a + i, b + i, n - i);
+}
+
+double minF64Sse2(double *a, int n) {
+    double lanes[2];
+    int i;
+    if (n < 2) {
+        return minF64Scalar(a, n);
+    }
+    __m128d acc = _mm_loadu_pd(a);
+    for (i = 2; i + 2 <= n; i += 2) {
+        acc = _mm_min_pd(acc, _mm_loadu_pd(a + i));
+    }
+    _mm_storeu_pd(lanes, acc);
+    double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) {
+        if (a[i] < min) {
+            min = a[i];
+        }
+    }
+    return min;
+}
+
+double maxF64Sse2(double *a, int n) {
+    double lanes[2];
+    int i;
+    if (n < 2) {
+        return maxF64Scalar(a, n);
+    }
+    __m128d acc = _mm_loadu_pd(a);
+    for (i = 2; i + 2 <= n; i += 2) {
+        acc = _mm_max_pd(acc, _mm_loadu_pd(a + i));
+    }
+    _mm_storeu_pd(lanes, acc);
+    double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) {
+        if (a[i] > max) {
+            max = a[i];
+        }
+    }
+    return max;
+}
+
+void addS64Sse2(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((__m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((__m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(x, y));
+    }
+    addS64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+// The low 64 bits of the products of the lanes of x and y
+static inline __m128i mulLowS64Sse2(__m128i x, __m128i y) {
+    __m128i low = _mm_mul_epu32(x, y);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y),
+                                  _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+void mulS64Sse2(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((__m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((__m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), mulLowS64Sse2(x, y));
+    }
+    mulS64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+void scaleS64Sse2(long long *dst, long long *a, long long k, int n) {
+    __m128i factor = _mm_set1_epi64x(k);
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((__m128i *)(a + i));
+        _mm_storeu_si128((__m128i *)(dst + i), mulLowS64Sse2(x, factor));
+    }
+    scaleS64Scalar(dst + i, a + i, k, n - i);
+}
+
+long long sumS64Sse2(long long *a, int n) {
+    __m128i acc = _mm_setzero_si128();
+    long long lanes[2];
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((__m128i *)(a + i)));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return WRAP_ADD(WRAP_ADD(lanes[0], lanes[1]),
+                    sumS64Scalar(a + i, n - i));
+}
+
+long long dotS64Sse2(long long *a, long long *b, int n) {
+    __m128i acc = _mm_setzero_si128();
+    long long lanes[2];
+    int i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((__m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((__m128i *)(b + i));
+        acc = _mm_add_epi64(acc, mulLowS64Sse2(x, y));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return WRAP_ADD(WRAP_ADD(lanes[0], lanes[1]),
+                    dotS64Scalar(a + i, b + i, n - i));
+}
+
+struct NumKernels sse2Kernels = {
+    addF64Sse2, mulF64Sse2, scaleF64Sse2, sumF64Sse2, dotF64Sse2,
+    minF64Sse2, maxF64Sse2, addS64Sse2, mulS64Sse2, scaleS64Sse2,
+    sumS64Sse2, dotS64Sse2, minS64Scalar, maxS64Scalar
+};
+
+// AVX2 kernels, only called after the CPU reported support for them
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void addF64Avx2(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                                _mm256_loadu_pd(b + i)));
+    }
+    addF64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+AVX2 void mulF64Avx2(double *dst, double *a, double *b, int n) {
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                _mm256_loadu_pd(b + i)));
+    }
+    mulF64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+AVX2 void scaleF64Avx2(double *dst, double *a, double k, int n) {
+    __m256d factor = _mm256_set1_pd(k);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                factor));
+    }
+    scaleF64Scalar(dst + i, a + i, k, n - i);
+}
+
+AVX2 double sumF64Avx2(double *a, int n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    double lanes[4];
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+           sumF64Scalar(a + i, n - i);
+}
+
+AVX2 double dotF64Avx2(double *a, double *b, int n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    double lanes[4];
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                 _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                                 _mm256_loadu_pd(b + i + 4)));
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+           dotF64Scalar(a + i, b + i, n - i);
+}
+
+AVX2 double minF64Avx2(double *a, int n) {
+    double lanes[4];
+    int i;
+    if (n < 4) {
+        return minF64Scalar(a, n);
+    }
+    __m256d acc = _mm256_loadu_pd(a);
+    for (i = 4; i + 4 <= n; i += 4) {
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(a + i));
+    }
+    _mm256_storeu_pd(lanes, acc);
+    double min = minF64Scalar(lanes, 4);
+    for (; i < n; i++) {
+        if (a[i] < min) {
+            min = a[i];
+        }
+    }
+    return min;
+}
+
+AVX2 double maxF64Avx2(double *a, int n) {
+    double lanes[4];
+    int i;
+    if (n < 4) {
+        return maxF64Scalar(a, n);
+    }
+    __m256d acc = _mm256_loadu_pd(a);
+    for (i = 4; i + 4 <= n; i += 4) {
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(a + i));
+    }
+    _mm256_storeu_pd(lanes, acc);
+    double max = maxF64Scalar(lanes, 4);
+    for (; i < n; i++) {
+        if (a[i] > max) {
+            max = a[i];
+        }
+    }
+    return max;
+}
+
+AVX2 void addS64Avx2(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((__m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi64(x, y));
+    }
+    addS64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+// The low 64 bits of the products of the lanes of x and y
+AVX2 static inline __m256i mulLowS64Avx2(__m256i x, __m256i y) {
+    __m256i low = _mm256_mul_epu32(x, y);
+    __m256i cross = _mm256_add_epi64(
+        _mm256_mul_epu32(_mm256_srli_epi64(x, 32), y),
+        _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 void mulS64Avx2(long long *dst, long long *a, long long *b, int n) {
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((__m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), mulLowS64Avx2(x, y));
+    }
+    mulS64Scalar(dst + i, a + i, b + i, n - i);
+}
+
+AVX2 void scaleS64Avx2(long long *dst, long long *a, long long k, int n) {
+    __m256i factor = _mm256_set1_epi64x(k);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), mulLowS64Avx2(x, factor));
+    }
+    scaleS64Scalar(dst + i, a + i, k, n - i);
+}
+
+AVX2 long long sumS64Avx2(long long *a, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    long long lanes[4];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc = _mm256_add_epi64(acc, _mm256_loadu_si256((__m256i *)(a + i)));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return WRAP_ADD(sumS64Scalar(lanes, 4), sumS64Scalar(a + i, n - i));
+}
+
+AVX2 long long dotS64Avx2(long long *a, long long *b, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    long long lanes[4];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((__m256i *)(b + i));
+        acc = _mm256_add_epi64(acc, mulLowS64Avx2(x, y));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return WRAP_ADD(sumS64Scalar(lanes, 4),
+                    dotS64Scalar(a + i, b + i, n - i));
+}
+
+AVX2 long long minS64Avx2(long long *a, int n) {
+    long long lanes[4];
+    int i;
+    if (n < 4) {
+        return minS64Scalar(a, n);
+    }
+    __m256i acc = _mm256_loadu_si256((__m256i *)a);
+    for (i = 4; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    long long min = minS64Scalar(lanes, 4);
+    for (; i < n; i++) {
+        if (a[i] < min) {
+            min = a[i];
+        }
+    }
+    return min;
+}
+
+AVX2 long long maxS64Avx2(long long *a, int n) {
+    long long lanes[4];
+    int i;
+    if (n < 4) {
+        return maxS64Scalar(a, n);
+    }
+    __m256i acc = _mm256_loadu_si256((__m256i *)a);
+    for (i = 4; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(a + i));
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    long long max = maxS64Scalar(lanes, 4);
+    for (; i < n; i++) {
+        if (a[i] > max) {
+            max = a[i];
+        }
+    }
+    return max;
+}
+
+struct NumKernels avx2Kernels = {
+    addF64Avx2, mulF64Avx2, scaleF64Avx2, sumF64Avx2, dotF64Avx2,
+    minF64Avx2, maxF64Avx2, addS64Avx2, mulS64Avx2, scaleS64Avx2,
+    sumS64Avx2, dotS64Avx2, minS64Avx2, maxS64Avx2
+};
+
+#endif
+
+struct NumKernels *kernels = NULL;
+
+// Picks the best kernels the running CPU supports
+struct NumKernels *numKernels() {
+    if (kernels == NULL) {
+#ifdef NUMVEC_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernels = &avx2Kernels;
+        } else {
+            kernels = &sse2Kernels;
+        }
+#else
+        kernels = &scalarKernels;
+#endif
+    }
+    return kernels;
+}
+
+// Creates an uninitialized vector of the given type and length
+Value *makeNumVector(valueType type, int length) {
+    NumVector *vec = talloc(sizeof(NumVector));
+    vec->length = length;
+    if (type == F64VECTOR_TYPE) {
+        vec->f64 = talloc(sizeof(double) * (length > 0 ? length : 1));
+    } else {
+        vec->s64 = talloc(sizeof(long long) * (length > 0 ? length : 1));
+    }
+    Value *value = makeNull();
+    value->type = type;
+    value->vec = vec;
+    return value;
+}
+
+// Name of a vector type, for error messages
+char *vectorTypeName(valueType type) {
+    if (type == F64VECTOR_TYPE) {
+        return "f64vector";
+    }
+    return "s64vector";
+}
+
+// Exits with a contract violation unless value is a vector of the type
+NumVector *checkVector(Value *value, valueType type, char *symbol) {
+    if (value->type != type) {
+        printf("%s: contract violation\nexpected: %s?\ngiven: ", symbol,
+               vectorTypeName(type));
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    return value->vec;
+}
+
+// Exits unless two vectors have the same length
+void checkSameLength(NumVector *a, NumVector *b, char *symbol) {
+    if (a->length != b->length) {
+        printf("%s: vectors have different lengths\ngiven: %d and %d\n",
+               symbol, a->length, b->length);
+        texit(1);
+    }
+}
+
+// Exits unless value is an exact integer, which is returned
+int checkIndex(Value *value, NumVector *vec, char *symbol) {
+    if (value->type != INT_TYPE) {
+        printf("%s: contract violation\nexpected: exact-nonnegative-integer?"
+               "\ngiven: ", symbol);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    if (vec != NULL && (value->i < 0 || value->i >= vec->length)) {
+        printf("%s: index is out of range\nindex: %d\nvalid range: [0, %d]\n",
+               symbol, value->i, vec->length - 1);
+        texit(1);
+    }
+    return value->i;
+}
+
+// Converts a number to an element of the given vector type
+void storeElement(NumVector *vec, valueType type, int index, Value *value,
+                  char *symbol) {
+    if (type == F64VECTOR_TYPE && value->type == DOUBLE_TYPE) {
+        vec->f64[index] = value->d;
+    } else if (type == F64VECTOR_TYPE && value->type == INT_TYPE) {
+        vec->f64[index] = value->i;
+    } else if (type == S64VECTOR_TYPE && value->type == INT_TYPE) {
+        vec->s64[index] = value->i;
+    } else {
+        printf("%s: contract violation\nexpected: %s?\ngiven: ", symbol,
+               type == F64VECTOR_TYPE ? "real" : "exact-integer");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+}
+
+// Boxes a double
+Value *makeDouble(double d) {
+    Value *value = makeNull();
+    value->type = DOUBLE_TYPE;
+    value->d = d;
+    return value;
+}
+
+// Boxes a 64 bit integer, exiting if it does not fit in an exact integer
+Value *makeS64(long long n, char *symbol) {
+    if (n < INT_MIN || n > INT_MAX) {
+        printf("%s: value is out of the range of exact integers\n", symbol);
+        printf("given: %lld\nvalid range: [%d, %d]\n", n, INT_MIN, INT_MAX);
+        texit(1);
+    }
+    Value *value = makeNull();
+    value->type = INT_TYPE;
+    value->i = n;
+    return value;
+}
+
+// Boxes element index of a vector
+Value *loadElement(NumVector *vec, valueType type, int index, char *symbol) {
+    if (type == F64VECTOR_TYPE) {
+        return makeDouble(vec->f64[index]);
+    }
+    return makeS64(vec->s64[index], symbol);
+}
+
+// (f64vector x ...) and (list->f64vector list) for either type
+Value *vectorFromList(Value *list, valueType type, char *symbol) {
+    Value *vector = makeNumVector(type, checkList(list, symbol));
+    int i = 0;
+    while (list->type == CONS_TYPE) {
+        storeElement(vector->vec, type, i, car(list), symbol);
+        list = cdr(list);
+        i = i + 1;
+    }
+    return vector;
+}
+
+// (make-f64vector n [fill])
+Value *makeVector(Value *args, valueType type, char *symbol) {
+    int i = length(args);
+    if (i != 1 && i != 2) {
+        printf("%s: arity mismatch;\nthe expected number of arguments ", symbol);
+        printf("does not match the given number\nexpected: 1 or 2\ngiven: ");
+        printf("%d\n", i);
+        texit(1);
+    }
+    int n = checkIndex(car(args), NULL, symbol);
+    if (n < 0) {
+        printf("%s: contract violation\nexpected: exact-nonnegative-integer?"
+               "\ngiven: %d\n", symbol, n);
+        texit(1);
+    }
+    Value *vector = makeNumVector(type, n);
+    if (i == 2) {
+        storeElement(vector->vec, type, 0, car(cdr(args)), symbol);
+        for (i = 1; i < n; i++) {
+            if (type == F64VECTOR_TYPE) {
+                vector->vec->f64[i] = vector->vec->f64[0];
+            } else {
+                vector->vec->s64[i] = vector->vec->s64[0];
+            }
+        }
+    } else if (type == F64VECTOR_TYPE) {
+        memset(vector->vec->f64, 0, sizeof(double) * n);
+    } else {
+        memset(vector->vec->s64, 0, sizeof(long long) * n);
+    }
+    return vector;
+}
+
+Value *vectorLength(Value *args, valueType type, char *symbol) {
+    checkArity(args, 1, symbol);
+    NumVector *vec = checkVector(car(args), type, symbol);
+    Value *result = makeNull();
+    result->type = INT_TYPE;
+    result->i = vec->length;
+    return result;
+}
+
+Value *vectorRef(Value *args, valueType type, char *symbol) {
+    checkArity(args, 2, symbol);
+    NumVector *vec = checkVector(car(args), type, symbol);
+    int index = checkIndex(car(cdr(args)), vec, symbol);
+    return loadElement(vec, type, index, symbol);
+}
+
+Value *vectorSet(Value *args, valueType type, char *symbol) {
+    checkArity(args, 3, symbol);
+    NumVector *vec = checkVector(car(args), type, symbol);
+    int index = checkIndex(car(cdr(args)), vec, symbol);
+    storeElement(vec, type, index, car(cdr(cdr(args))), symbol);
+    Value *void_ptr = makeNull();
+    void_ptr->type = VOID_TYPE;
+    return void_ptr;
+}
+
+Value *vectorToList(Value *args, valueType type, char *symbol) {
+    checkArity(args, 1, symbol);
+    NumVector *vec = checkVector(car(args), type, symbol);
+    Value *list = makeNull();
+    int i;
+    for (i = vec->length - 1; i >= 0; i--) {
+        list = cons(loadElement(vec, type, i, symbol), list);
+    }
+    return list;
+}
+
+// Elementwise add (op 0) or multiply (op 1) into a fresh vector
+Value *vectorElementwise(Value *args, valueType type, int op, char *symbol) {
+    checkArity(args, 2, symbol);
+    NumVector *a = checkVector(car(args), type, symbol);
+    NumVector *b = checkVector(car(cdr(args)), type, symbol);
+    checkSameLength(a, b, symbol);
+    Value *result = makeNumVector(type, a->length);
+    NumVector *dst = result->vec;
+    if (type == F64VECTOR_TYPE && op == 0) {
+        numKernels()->addF64(dst->f64, a->f64, b->f64, a->length);
+    } else if (type == F64VECTOR_TYPE) {
+        numKernels()->mulF64(dst->f64, a->f64, b->f64, a->length);
+    } else if (op == 0) {
+        numKernels()->addS64(dst->s64, a->s64, b->s64, a->length);
+    } else {
+        numKernels()->mulS64(dst->s64, a->s64, b->s64, a->length);
+    }
+    return result;
+}
+
+Value *vectorScale(Value *args, valueType type, char *symbol) {
+    checkArity(args, 2, symbol);
+    NumVector *a = checkVector(car(args), type, symbol);
+    Value *result = makeNumVector(type, a->length);
+    NumVector *dst = result->vec;
+    // dst always has room for one element, so it converts the factor too
+    storeElement(dst, type, 0, car(cdr(args)), symbol);
+    if (type == F64VECTOR_TYPE) {
+        numKernels()->scaleF64(dst->f64, a->f64, dst->f64[0], a->length);
+    } else {
+        numKernels()->scaleS64(dst->s64, a->s64, dst->s64[0], a->length);
+    }
+    return result;
+}
+
+Value *vectorSum(Value *args, valueType type, char *symbol) {
+    checkArity(args, 1, symbol);
+    NumVector *a = checkVector(car(args), type, symbol);
+    if (type == F64VECTOR_TYPE) {
+        return makeDouble(numKernels()->sumF64(a->f64, a->length));
+    }
+    return makeS64(numKernels()->sumS64(a->s64, a->length), symbol);
+}
+
+Value *vectorDot(Value *args, valueType type, char *symbol) {
+    checkArity(args, 2, symbol);
+    NumVector *a = checkVector(car(args), type, symbol);
+    NumVector *b = checkVector(car(cdr(args)), type, symbol);
+    checkSameLength(a, b, symbol);
+    if (type == F64VECTOR_TYPE) {
+        return makeDouble(numKernels()->dotF64(a->f64, b->f64, a->length));
+    }
+    return makeS64(numKernels()->dotS64(a->s64, b->s64, a->length), symbol);
+}
+
+// Minimum (op 0) or maximum (op 1) of a non-empty vector
+Value *vectorExtreme(Value *args, valueType type, int op, char *symbol) {
+    checkArity(args, 1, symbol);
+    NumVector *a = checkVector(car(args), type, symbol);
+    if (a->length == 0) {
+        printf("%s: contract violation\nexpected: non-empty %s\n", symbol,
+               vectorTypeName(type));
+        texit(1);
+    }
+    struct NumKernels *k = numKernels();
+    if (type == F64VECTOR_TYPE) {
+        return makeDouble(op == 0 ? k->minF64(a->f64, a->length)
+                                  : k->maxF64(a->f64, a->length));
+    }
+    return makeS64(op == 0 ? k->minS64(a->s64, a->length)
+                           : k->maxS64(a->s64, a->length), symbol);
+}
+
+Value *primitiveF64Vector(Value *args) {
+    return vectorFromList(args, F64VECTOR_TYPE, "f64vector");
+}
+
+Value *primitiveMakeF64Vector(Value *args) {
+    return makeVector(args, F64VECTOR_TYPE, "make-f64vector");
+}
+
+Value *primitiveF64VectorLength(Value *args) {
+    return vectorLength(args, F64VECTOR_TYPE, "f64vector-length");
+}
+
+Value *primitiveF64VectorRef(Value *args) {
+    return vectorRef(args, F64VECTOR_TYPE, "f64vector-ref");
+}
+
+Value *primitiveF64VectorSet(Value *args) {
+    return vectorSet(args, F64VECTOR_TYPE, "f64vector-set!");
+}
+
+Value *primitiveListToF64Vector(Value *args) {
+    checkArity(args, 1, "list->f64vector");
+    return vectorFromList(car(args), F64VECTOR_TYPE, "list->f64vector");
+}
+
+Value *primitiveF64VectorToList(Value *args) {
+    return vectorToList(args, F64VECTOR_TYPE, "f64vector->list");
+}
+
+Value *primitiveF64VectorAdd(Value *args) {
+    return vectorElementwise(args, F64VECTOR_TYPE, 0, "f64vector-add");
+}
+
+Value *primitiveF64VectorMul(Value *args) {
+    return vectorElementwise(args, F64VECTOR_TYPE, 1, "f64vector-mul");
+}
+
+Value *primitiveF64VectorScale(Value *args) {
+    return vectorScale(args, F64VECTOR_TYPE, "f64vector-scale");
+}
+
+Value *primitiveF64VectorSum(Value *args) {
+    return vectorSum(args, F64VECTOR_TYPE, "f64vector-sum");
+}
+
+Value *primitiveF64VectorDot(Value *args) {
+    return vectorDot(args, F64VECTOR_TYPE, "f64vector-dot");
+}
+
+Value *primitiveF64VectorMin(Value *args) {
+    return vectorExtreme(args, F64VECTOR_TYPE, 0, "f64vector-min");
+}
+
+Value *primitiveF64VectorMax(Value *args) {
+    return vectorExtreme(args, F64VECTOR_TYPE, 1, "f64vector-max");
+}
+
+Value *primitiveS64Vector(Value *args) {
+    return vectorFromList(args, S64VECTOR_TYPE, "s64vector");
+}
+
+Value *primitiveMakeS64Vector(Value *args) {
+    return makeVector(args, S64VECTOR_TYPE, "make-s64vector");
+}
+
+Value *primitiveS64VectorLength(Value *args) {
+    return vectorLength(args, S64VECTOR_TYPE, "s64vector-length");
+}
+
+Value *primitiveS64VectorRef(Value *args) {
+    return vectorRef(args, S64VECTOR_TYPE, "s64vector-ref");
+}
+
+Value *primitiveS64VectorSet(Value *args) {
+    return vectorSet(args, S64VECTOR_TYPE, "s64vector-set!");
+}
+
+Value *primitiveListToS64Vector(Value *args) {
+    checkArity(args, 1, "list->s64vector");
+    return vectorFromList(car(args), S64VECTOR_TYPE, "list->s64vector");
+}
+
+Value *primitiveS64VectorToList(Value *args) {
+    return vectorToList(args, S64VECTOR_TYPE, "s64vector->list");
+}
+
+Value *primitiveS64VectorAdd(Value *args) {
+    return vectorElementwise(args, S64VECTOR_TYPE, 0, "s64vector-add");
+}
+
+Value *primitiveS64VectorMul(Value *args) {
+    return vectorElementwise(args, S64VECTOR_TYPE, 1, "s64vector-mul");
+}
+
+Value *primitiveS64VectorScale(Value *args) {
+    return vectorScale(args, S64VECTOR_TYPE, "s64vector-scale");
+}
+
+Value *primitiveS64VectorSum(Value *args) {
+    return vectorSum(args, S64VECTOR_TYPE, "s64vector-sum");
+}
+
+Value *primitiveS64VectorDot(Value *args) {
+    return vectorDot(args, S64VECTOR_TYPE, "s64vector-dot");
+}
+
+Value *primitiveS64VectorMin(Value *args) {
+    return vectorExtreme(args, S64VECTOR_TYPE, 0, "s64vector-min");
+}
+
+Value *primitiveS64VectorMax(Value *args) {
+    return vectorExtreme(args, S64VECTOR_TYPE, 1, "s64vector-max");
+}
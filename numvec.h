@@ -0,0 +1,52 @@
+#include "value.h"
+
+#ifndef _NUMVEC
+#define _NUMVEC
+
+// SRFI-4 style homogeneous vector. The elements are stored unboxed in one
+// contiguous array, so the numeric kernels can stream over them with SIMD.
+struct NumVector {
+    int length;
+    union {
+        double *f64;
+        long long *s64;
+    };
+};
+
+typedef struct NumVector NumVector;
+
+// Creates an uninitialized vector of the given type (F64VECTOR_TYPE or
+// S64VECTOR_TYPE) and length
+Value *makeNumVector(valueType type, int length);
+
+Value *primitiveF64Vector(Value *args);
+Value *primitiveMakeF64Vector(Value *args);
+Value *primitiveF64VectorLength(Value *args);
+Value *primitiveF64VectorRef(Value *args);
+Value *primitiveF64VectorSet(Value *args);
+Value *primitiveListToF64Vector(Value *args);
+Value *primitiveF64VectorToList(Value *args);
+Value *primitiveF64VectorAdd(Value *args);
+Value *primitiveF64VectorMul(Value *args);
+Value *primitiveF64VectorScale(Value *args);
+Value *primitiveF64VectorSum(Value *args);
+Value *primitiveF64VectorDot(Value *args);
+Value *primitiveF64VectorMin(Value *args);
+Value *primitiveF64VectorMax(Value *args);
+
+Value *primitiveS64Vector(Value *args);
+Value *primitiveMakeS64Vector(Value *args);
+Value *primitiveS64VectorLength(Value *args);
+Value *primitiveS64VectorRef(Value *args);
+Value *primitiveS64VectorSet(Value *args);
+Value *primitiveListToS64Vector(Value *args);
+Value *primitiveS64VectorToList(Value *args);
+Value *primitiveS64VectorAdd(Value *args);
+Value *primitiveS64VectorMul(Value *args);
+Value *primitiveS64VectorScale(Value *args);
+Value *primitiveS64VectorSum(Value *args);
+Value *primitiveS64VectorDot(Value *args);
+Value *primitiveS64VectorMin(Value *args);
+Value *primitiveS64VectorMax(Value *args);
+
+#endif
@@ -0,0 +1,1533 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Optimizer run on every top-level form before it is evaluated
+*/
+
+/*
+The optimizer rewrites a form without changing what it does, down to the
+error messages and the oddities of eval:
+
+    constant folding    a call of +, -, *, /, modulo or a numeric
+                        comparison on literals that cannot fail is
+                        replaced by its result
+    beta-reduction      ((lambda (x) e) 5) becomes e with 5 for x
+    inlining            a call with literal arguments of a small procedure
+                        defined at top level becomes its body, the same way
+    dead branches       an if, cond, and or or whose tests are constant
+                        keeps only what it would evaluate
+    unused bindings     a let binding of a constant that is never used is
+                        dropped
+    fusion              map, filter, fold and fold-right calls given the
+                        result of a map or filter become one pipeline (see
+                        pipeline.c), when no stage but the innermost can
+                        fail or have an effect
+    parallelism         a let whose binding expressions have no effect,
+                        or a call whose arguments have none, becomes a
+                        parallel-let or parallel-call when at least two of
+                        them are costly enough to run on threads of their
+                        own (see parallel.c)
+
+A rewritten expression is an OPTIMIZED_TYPE value holding the new code and
+the original. Names can be bound again at any time, so every rewrite that
+relies on what a global name refers to lists the name among its guards,
+and the original is evaluated instead once any of them has been defined,
+set! or bound by let* (which binds in the enclosing frame for a while).
+Whatever is bound locally around an expression is never assumed to be a
+primitive.
+
+Only well-formed expressions are rewritten, and nothing in a quote. The
+original cells are never changed; the parts that change are copied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "optimize.h"
+#include "quicken.h"
+#include "interpreter.h"
+#include "primitives.h"
+#include "linkedlist.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "talloc.h"
+#include "threadpool.h"
+#include "value.h"
+
+// Largest number of nodes in the body of a procedure that is inlined
+#define INLINE_SIZE 24
+
+// Most names a single rewrite can rely on
+#define MAX_GUARDS 16
+
+// Estimated cost from which an expression is worth evaluating on a thread
+// of its own. A procedure calling itself counts as costing this much.
+#define PARALLEL_COST 1000
+
+// Most procedures looked into one inside another, and most nodes looked at
+// in all, in proving that the expressions of a let or call have no effect
+#define PURE_DEPTH 8
+#define PURE_NODES 4096
+
+// The names a rewrite relies on, each with the number of times it had
+// changed. full is set if there were too many.
+struct Guards {
+    Watch *watches[MAX_GUARDS];
+    int changes[MAX_GUARDS];
+    int count;
+    int full;
+};
+
+typedef struct Guards Guards;
+
+// Watches by name, in an open addressing table
+Watch **watchTable = NULL;
+size_t watchSlots = 0;
+size_t watchCount = 0;
+
+// Special forms that eval recognizes by name
+char *specialForms[] = {"if", "let", "let*", "letrec", "quote", "define",
+                        "lambda", "cond", "and", "or", "set!", "begin",
+                        "pipeline", "define-memoized", "delay",
+                        "delay-force", "stream-cons", "parallel-let",
+                        "parallel-call"};
+
+// What is known of the values an expression in a stage of a pipeline gives
+enum {
+    VALUE_ANY,
+    VALUE_NUMBER,
+    VALUE_BOOL
+};
+
+Value *optimizeExpression(Value *expr, Value *scope, int depth);
+int isWellFormedLambda(Value *args);
+int areWellFormedBindings(Value *bindings);
+Value *bindingNames(Value *bindings);
+
+// FNV-1a over a NUL-terminated name
+size_t hashWatchName(char *name) {
+    size_t h = 2166136261u;
+    while (*name != '\0') {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+        name = name + 1;
+    }
+    return h;
+}
+
+// Returns the slot of the watch of name, or the empty slot where it belongs
+size_t watchSlot(Watch **table, size_t slots, char *name) {
+    size_t slot = hashWatchName(name) & (slots - 1);
+    while (table[slot] != NULL && strcmp(table[slot]->name, name)) {
+        slot = (slot + 1) & (slots - 1);
+    }
+    return slot;
+}
+
+// Puts a watch in the table, in place of any other watch of its name
+void storeWatch(Watch *watch) {
+    if (2 * (watchCount + 1) > watchSlots) {
+        size_t slots = watchSlots == 0 ? 256 : watchSlots * 2;
+        Watch **table = talloc(sizeof(Watch *) * slots);
+        size_t i;
+        memset(table, 0, sizeof(Watch *) * slots);
+        for (i = 0; i < watchSlots; i++) {
+            if (watchTable[i] != NULL) {
+                table[watchSlot(table, slots, watchTable[i]->name)] =
+                    watchTable[i];
+            }
+        }
+        watchTable = table;
+        watchSlots = slots;
+    }
+    size_t slot = watchSlot(watchTable, watchSlots, watch->name);
+    if (watchTable[slot] == NULL) {
+        watchCount = watchCount + 1;
+    }
+    watchTable[slot] = watch;
+}
+
+// Creates a watch of name
+Watch *makeWatch(char *name, int primitive) {
+    Watch *watch = talloc(sizeof(Watch));
+    watch->name = name;
+    watch->primitive = primitive;
+    watch->changes = 0;
+    watch->definitions = 0;
+    storeWatch(watch);
+    return watch;
+}
+
+// Watches every primitive name from the start, so that binding one of them
+// again is noticed even before any code relying on it is optimized
+void watchPrimitives() {
+    int id;
+    if (watchSlots > 0) {
+        return;
+    }
+    for (id = 0; id < primitiveCount(); id++) {
+        makeWatch(primitiveAt(id)->name, id);
+    }
+}
+
+// Returns the watch of name, or NULL if it is not watched
+Watch *findWatch(char *name) {
+    watchPrimitives();
+    return watchTable[watchSlot(watchTable, watchSlots, name)];
+}
+
+// Returns the watch of name, watching it from now on if it was not
+Watch *watchName(char *name) {
+    Watch *watch = findWatch(name);
+    if (watch == NULL) {
+        watch = makeWatch(name, -1);
+    }
+    return watch;
+}
+
+// Records that name is being bound again
+void noteRebinding(char *name) {
+    Watch *watch = findWatch(name);
+    if (watch != NULL) {
+        watch->changes = watch->changes + 1;
+    }
+}
+
+// Records that define is adding a binding of name to the global frame
+void noteDefinition(char *name) {
+    Watch *watch = findWatch(name);
+    if (watch != NULL) {
+        watch->changes = watch->changes + 1;
+        watch->definitions = watch->definitions + 1;
+    }
+}
+
+// Records the primitive names global binds to something else
+void noteGlobalBindings(Frame *global) {
+    Value *bindings = global->bindings;
+    watchPrimitives();
+    while (bindings->type == CONS_TYPE) {
+        Value *name = car(car(bindings));
+        Value *value = car(cdr(car(bindings)));
+        Watch *watch = findWatch(name->s);
+        if (watch != NULL && watch->primitive >= 0 &&
+            (value->type != PRIMITIVE_TYPE ||
+             value->pf != primitiveAt(watch->primitive)->function)) {
+            watch->changes = watch->changes + 1;
+        }
+        bindings = cdr(bindings);
+    }
+}
+
+// Returns the code an optimized or quickened expression was made from, or
+// expr itself if it is neither
+Value *writtenExpression(Value *expr) {
+    while (1) {
+        if (expr->type == OPTIMIZED_TYPE) {
+            expr = expr->opt->original;
+        } else if (expr->type == QUICK_TYPE) {
+            expr = expr->quick->original;
+        } else {
+            return expr;
+        }
+    }
+}
+
+// Returns 1 if none of the names an optimized expression relies on has been
+// bound again
+int guardsHold(Optimized *optimized) {
+    int i;
+    for (i = 0; i < optimized->guardCount; i++) {
+        if (optimized->guards[i]->changes != optimized->changes[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Adds a name to the guards of a rewrite, with the number of times it had
+// changed when the rewrite started relying on it
+void addGuard(Guards *guards, Watch *watch, int changes) {
+    int i;
+    for (i = 0; i < guards->count; i++) {
+        if (guards->watches[i] == watch) {
+            return;
+        }
+    }
+    if (guards->count == MAX_GUARDS) {
+        guards->full = 1;
+        return;
+    }
+    guards->watches[guards->count] = watch;
+    guards->changes[guards->count] = changes;
+    guards->count = guards->count + 1;
+}
+
+// Adds the guards of an optimized expression to those of a rewrite
+void addGuardsOf(Guards *guards, Value *expr) {
+    int i;
+    if (expr->type == OPTIMIZED_TYPE) {
+        for (i = 0; i < expr->opt->guardCount; i++) {
+            addGuard(guards, expr->opt->guards[i], expr->opt->changes[i]);
+        }
+    }
+}
+
+// Returns an expression that evaluates code in place of original while the
+// guards hold, or original if there are too many guards
+Value *makeOptimized(Value *code, Value *original, Guards *guards) {
+    int i;
+    if (code->type == OPTIMIZED_TYPE) {
+        addGuardsOf(guards, code);
+        code = code->opt->code;
+    }
+    if (guards->full) {
+        return original;
+    }
+    Optimized *optimized = talloc(sizeof(Optimized));
+    optimized->code = code;
+    optimized->original = original;
+    optimized->guardCount = guards->count;
+    optimized->guards = talloc(sizeof(Watch *) * (guards->count + 1));
+    optimized->changes = talloc(sizeof(int) * (guards->count + 1));
+    for (i = 0; i < guards->count; i++) {
+        optimized->guards[i] = guards->watches[i];
+        optimized->changes[i] = guards->changes[i];
+    }
+    Value *value = makeNull();
+    value->type = OPTIMIZED_TYPE;
+    value->loc = original->loc;
+    value->opt = optimized;
+    return value;
+}
+
+// Returns the literal an expression always evaluates to, or NULL
+Value *constantOf(Value *expr) {
+    if (expr->type == OPTIMIZED_TYPE) {
+        expr = expr->opt->code;
+    }
+    switch (expr->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case STR_TYPE:
+        case BOOL_TYPE:
+            return expr;
+        default:
+            return NULL;
+    }
+}
+
+// Returns 1 if an expression always evaluates to the boolean written truth
+int isConstantBool(Value *expr, char *truth) {
+    Value *constant = constantOf(expr);
+    return constant != NULL && constant->type == BOOL_TYPE &&
+           !strcmp(constant->s, truth);
+}
+
+// Returns the number of items in a proper list, or -1
+int properLength(Value *list) {
+    int count = 0;
+    while (list->type == CONS_TYPE) {
+        count = count + 1;
+        list = list->c.cdr;
+    }
+    return list->type == NULL_TYPE ? count : -1;
+}
+
+// Returns 1 if name is a special form
+int isSpecialForm(char *name) {
+    size_t i;
+    for (i = 0; i < sizeof(specialForms) / sizeof(char *); i++) {
+        if (!strcmp(specialForms[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns 1 if name is in a list of symbols
+int isNameIn(char *name, Value *names) {
+    while (names->type == CONS_TYPE) {
+        if (!strcmp(names->c.car->s, name)) {
+            return 1;
+        }
+        names = names->c.cdr;
+    }
+    return 0;
+}
+
+// Returns 1 if a symbol named name appears anywhere in tree, quoted or not
+int occursIn(char *name, Value *tree) {
+    while (tree->type == CONS_TYPE) {
+        if (occursIn(name, tree->c.car)) {
+            return 1;
+        }
+        tree = tree->c.cdr;
+    }
+    return tree->type == SYMBOL_TYPE && !strcmp(tree->s, name);
+}
+
+// Returns 1 if tree mentions a form that creates a frame
+int createsFrames(Value *tree) {
+    return occursIn("lambda", tree) || occursIn("let", tree) ||
+           occursIn("let*", tree) || occursIn("letrec", tree);
+}
+
+// Returns 1 if names is a proper list of distinct symbols
+int areDistinctNames(Value *names) {
+    Value *rest = names;
+    if (properLength(names) < 0) {
+        return 0;
+    }
+    while (rest->type == CONS_TYPE) {
+        if (rest->c.car->type != SYMBOL_TYPE) {
+            return 0;
+        }
+        Value *other = rest->c.cdr;
+        while (other->type == CONS_TYPE) {
+            if (other->c.car->type == SYMBOL_TYPE &&
+                !strcmp(other->c.car->s, rest->c.car->s)) {
+                return 0;
+            }
+            other = other->c.cdr;
+        }
+        rest = rest->c.cdr;
+    }
+    return 1;
+}
+
+// Adds the names in a list of symbols to a scope
+Value *extendScope(Value *scope, Value *names) {
+    while (names->type == CONS_TYPE) {
+        scope = cons(names->c.car, scope);
+        names = names->c.cdr;
+    }
+    return scope;
+}
+
+// Returns a cell like original but holding first and rest, or original
+// itself if they are the ones it holds
+Value *rebuild(Value *original, Value *first, Value *rest) {
+    if (original->c.car == first && original->c.cdr == rest) {
+        return original;
+    }
+    Value *cell = cons(first, rest);
+    cell->loc = original->loc;
+    return cell;
+}
+
+// Optimizes every expression of a proper list, copying the list only if
+// one of them changes
+Value *optimizeEach(Value *list, Value *scope, int depth) {
+    int count = properLength(list);
+    int changed = 0;
+    int i;
+    if (count <= 0) {
+        return list;
+    }
+    Value **items = talloc(sizeof(Value *) * count);
+    Value **cells = talloc(sizeof(Value *) * count);
+    Value *rest = list;
+    for (i = 0; i < count; i++) {
+        cells[i] = rest;
+        items[i] = optimizeExpression(rest->c.car, scope, depth);
+        changed = changed || items[i] != rest->c.car;
+        rest = rest->c.cdr;
+    }
+    if (!changed) {
+        return list;
+    }
+    for (i = count - 1; i >= 0; i--) {
+        rest = rebuild(cells[i], items[i], rest);
+    }
+    return rest;
+}
+
+// Returns a list of the literals that a list of expressions always
+// evaluates to, adding their guards, or NULL if one is not constant
+Value *constantArguments(Value *args, Guards *guards) {
+    Value *constants = makeNull();
+    while (args->type == CONS_TYPE) {
+        Value *constant = constantOf(args->c.car);
+        if (constant == NULL) {
+            return NULL;
+        }
+        addGuardsOf(guards, args->c.car);
+        constants = cons(constant, constants);
+        args = args->c.cdr;
+    }
+    return reverse(constants);
+}
+
+// Returns 1 if every item of a list of literals is a number, and, when
+// nonzero is set, is not zero
+int areNumbers(Value *constants, int nonzero) {
+    while (constants->type == CONS_TYPE) {
+        Value *number = constants->c.car;
+        if (number->type == INT_TYPE) {
+            if (nonzero && number->i == 0) {
+                return 0;
+            }
+        } else if (number->type == DOUBLE_TYPE) {
+            if (nonzero && number->d == 0.0) {
+                return 0;
+            }
+        } else {
+            return 0;
+        }
+        constants = constants->c.cdr;
+    }
+    return 1;
+}
+
+// Returns 1 if applying a primitive to a list of literals is certain to
+// return a value without any error or other effect
+int canFold(Value *(*function)(struct Value *), Value *constants) {
+    int count = properLength(constants);
+    if (function == primitiveAdd || function == primitiveMult) {
+        return areNumbers(constants, 0);
+    }
+    if (function == primitiveSubtract) {
+        return count >= 1 && areNumbers(constants, 0);
+    }
+    if (function == primitiveDivide) {
+        return (count == 1 && areNumbers(constants, 1)) ||
+               (count > 1 && areNumbers(constants, 0) &&
+                areNumbers(constants->c.cdr, 1));
+    }
+    if (function == primitiveEqual || function == primitiveGreater ||
+        function == primitiveGreaterEqual || function == primitiveLess ||
+        function == primitiveLessEqual) {
+        return count == 2 && areNumbers(constants, 0);
+    }
+    if (function == primitiveModulo) {
+        return count == 2 && constants->c.car->type == INT_TYPE &&
+               constants->c.cdr->c.car->type == INT_TYPE &&
+               constants->c.cdr->c.car->i != 0;
+    }
+    return 0;
+}
+
+// Returns 1 if an expression can be inlined with literals for the names in
+// params: it is made only of literals, variables and calls, if, and and or,
+// with no more than *size nodes, and no parameter is called
+int isInlinable(Value *expr, Value *params, int *size) {
+    expr = writtenExpression(expr);
+    *size = *size - 1;
+    if (*size < 0) {
+        return 0;
+    }
+    switch (expr->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case STR_TYPE:
+        case BOOL_TYPE:
+        case NULL_TYPE:
+        case SYMBOL_TYPE:
+            return 1;
+        case CONS_TYPE:{
+            Value *head = expr->c.car;
+            Value *args = expr->c.cdr;
+            if (head->type != SYMBOL_TYPE || isNameIn(head->s, params) ||
+                properLength(args) < 0) {
+                return 0;
+            }
+            if (isSpecialForm(head->s) && strcmp(head->s, "if") &&
+                strcmp(head->s, "and") && strcmp(head->s, "or")) {
+                return 0;
+            }
+            while (args->type == CONS_TYPE) {
+                if (!isInlinable(args->c.car, params, size)) {
+                    return 0;
+                }
+                args = args->c.cdr;
+            }
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Replaces the parameters in an inlinable expression by their literals. The
+// result is all written code, so it can be optimized again from scratch.
+Value *substitute(Value *expr, Value *params, Value *constants) {
+    expr = writtenExpression(expr);
+    if (expr->type == SYMBOL_TYPE) {
+        while (params->type == CONS_TYPE) {
+            if (!strcmp(params->c.car->s, expr->s)) {
+                return constants->c.car;
+            }
+            params = params->c.cdr;
+            constants = constants->c.cdr;
+        }
+        return expr;
+    }
+    if (expr->type != CONS_TYPE) {
+        return expr;
+    }
+    Value *rest = expr->c.cdr;
+    if (rest->type == CONS_TYPE) {
+        rest = substitute(rest, params, constants);
+    }
+    Value *head = writtenExpression(expr->c.car);
+    if (head->type == CONS_TYPE || head->type == SYMBOL_TYPE) {
+        head = substitute(head, params, constants);
+    }
+    return rebuild(expr, head, rest);
+}
+
+// Returns 1 if the names an inlined expression uses, other than its
+// parameters, are not bound around the call, and adds them to the guards
+int guardFreeNames(Value *expr, Value *params, Value *scope,
+                   Guards *guards) {
+    expr = writtenExpression(expr);
+    if (expr->type == SYMBOL_TYPE) {
+        if (isNameIn(expr->s, params)) {
+            return 1;
+        }
+        if (isNameIn(expr->s, scope)) {
+            return 0;
+        }
+        Watch *watch = watchName(expr->s);
+        addGuard(guards, watch, watch->changes);
+        return 1;
+    }
+    if (expr->type != CONS_TYPE) {
+        return 1;
+    }
+    Value *rest = expr;
+    if (isSpecialForm(expr->c.car->s)) {
+        rest = expr->c.cdr;
+    }
+    while (rest->type == CONS_TYPE) {
+        if (!guardFreeNames(rest->c.car, params, scope, guards)) {
+            return 0;
+        }
+        rest = rest->c.cdr;
+    }
+    return 1;
+}
+
+// Returns the value name is bound to in the global frame, or NULL
+Value *globalValue(char *name) {
+    Value *bindings = globalEnvironment()->bindings;
+    while (bindings->type == CONS_TYPE) {
+        if (!strcmp(car(car(bindings))->s, name)) {
+            return car(cdr(car(bindings)));
+        }
+        bindings = cdr(bindings);
+    }
+    return NULL;
+}
+
+// Returns the closure name is bound to in the global frame if it was made
+// there, so that the names in its body other than its parameters are
+// global, or NULL
+Value *topLevelProcedure(char *name) {
+    Value *closure = globalValue(name);
+    if (closure == NULL || closure->type != CLOSURE_TYPE ||
+        (closure->cl.frame != globalEnvironment() &&
+         (closure->cl.frame->parent != globalEnvironment() ||
+          closure->cl.frame->bindings->type != NULL_TYPE))) {
+        return NULL;
+    }
+    return closure;
+}
+
+// Inlines a call with literal arguments of a small procedure defined at top
+// level, or returns NULL. Its body must refer to the same bindings at the
+// call as where it was defined, so no name in it may be bound around the
+// call, and the call relies on none of them being bound again.
+Value *inlineCall(Value *expr, Value *args, Value *scope, int depth) {
+    Value *closure = topLevelProcedure(expr->c.car->s);
+    int size = INLINE_SIZE;
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    if (closure == NULL) {
+        return NULL;
+    }
+    // the body of a closure is its set! and begin forms, which are always
+    // run, followed by the cell holding its last expression
+    Value *code = closure->cl.functionCode;
+    Value *params = closure->cl.paramNames;
+    if (properLength(code) != 1 || code->c.car->type != CONS_TYPE ||
+        !areDistinctNames(params) ||
+        properLength(params) != properLength(args)) {
+        return NULL;
+    }
+    Value *body = code->c.car->c.car;
+    Value *constants = constantArguments(args, &guards);
+    if (constants == NULL || !isInlinable(body, params, &size)) {
+        return NULL;
+    }
+    Watch *watch = watchName(expr->c.car->s);
+    addGuard(&guards, watch, watch->changes);
+    if (!guardFreeNames(body, params, scope, &guards)) {
+        return NULL;
+    }
+    Value *inlined = substitute(body, params, constants);
+    return makeOptimized(optimizeExpression(inlined, scope, depth + 1),
+                         expr, &guards);
+}
+
+// Returns what a primitive gives when called on count arguments of which
+// what is known is in given, and clears *safe unless it is certain to
+// return without an error
+int primitiveResult(Value *(*function)(struct Value *), int *given,
+                    int count, int *safe) {
+    int numbers = 1;
+    int i;
+    for (i = 0; i < count; i++) {
+        numbers = numbers && given[i] == VALUE_NUMBER;
+    }
+    if (function == primitiveAdd || function == primitiveMult ||
+        function == primitiveSubtract) {
+        *safe = *safe && numbers &&
+                (count >= 1 || function != primitiveSubtract);
+        return VALUE_NUMBER;
+    }
+    if (function == primitiveEqual || function == primitiveGreater ||
+        function == primitiveGreaterEqual || function == primitiveLess ||
+        function == primitiveLessEqual) {
+        *safe = *safe && numbers && count == 2;
+        return VALUE_BOOL;
+    }
+    if (function == primitiveNull) {
+        *safe = *safe && count == 1;
+        return VALUE_BOOL;
+    }
+    if (function == primitiveCons) {
+        *safe = *safe && count == 2;
+        return VALUE_ANY;
+    }
+    if (function != primitiveList) {
+        *safe = 0;
+    }
+    return VALUE_ANY;
+}
+
+// Returns what expr gives in the body of a stage procedure whose parameters
+// params hold values of which what is known is in given, and clears *safe
+// unless it is certain to return without an error or any other effect. The
+// primitive names it relies on are added to guards.
+int bodyResult(Value *expr, Value *params, int *given, Value *scope,
+               Guards *guards, int *safe) {
+    int i = 0;
+    switch (expr->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+            return VALUE_NUMBER;
+        case BOOL_TYPE:
+            return VALUE_BOOL;
+        case STR_TYPE:
+            return VALUE_ANY;
+        case SYMBOL_TYPE:
+            while (params->type == CONS_TYPE) {
+                if (!strcmp(params->c.car->s, expr->s)) {
+                    // lookUpSymbol goes on from a binding to a symbol
+                    *safe = *safe && given[i] != VALUE_ANY;
+                    return given[i];
+                }
+                params = params->c.cdr;
+                i = i + 1;
+            }
+            *safe = 0;
+            return VALUE_ANY;
+        case CONS_TYPE:
+            break;
+        default:
+            *safe = 0;
+            return VALUE_ANY;
+    }
+    Value *head = expr->c.car;
+    Value *args = expr->c.cdr;
+    int count = properLength(args);
+    if (head->type != SYMBOL_TYPE || count < 0 || count > 8 ||
+        isNameIn(head->s, params) || isNameIn(head->s, scope)) {
+        *safe = 0;
+        return VALUE_ANY;
+    }
+    int results[8];
+    for (i = 0; i < count; i++) {
+        results[i] = bodyResult(args->c.car, params, given, scope, guards,
+                                safe);
+        args = args->c.cdr;
+    }
+    if (!strcmp(head->s, "if") && count == 3) {
+        *safe = *safe && results[0] == VALUE_BOOL;
+        return results[1] == results[2] ? results[1] : VALUE_ANY;
+    }
+    if (!strcmp(head->s, "and") || !strcmp(head->s, "or")) {
+        for (i = 0; i < count; i++) {
+            *safe = *safe && results[i] == VALUE_BOOL;
+        }
+        return VALUE_BOOL;
+    }
+    Watch *watch = findWatch(head->s);
+    if (isSpecialForm(head->s) || watch == NULL || watch->primitive < 0 ||
+        watch->changes != 0) {
+        *safe = 0;
+        return VALUE_ANY;
+    }
+    addGuard(guards, watch, watch->changes);
+    return primitiveResult(primitiveAt(watch->primitive)->function, results,
+                           count, safe);
+}
+
+// Returns what the procedure a stage of a pipeline is given returns when
+// called on count arguments of which what is known is in given, and clears
+// *safe as bodyResult does. Only a name still bound to a primitive and a
+// lambda of one expression are looked into.
+int stageResult(Value *function, int *given, int count, Value *scope,
+                Guards *guards, int *safe) {
+    if (function->type == SYMBOL_TYPE && !isNameIn(function->s, scope)) {
+        Watch *watch = findWatch(function->s);
+        if (watch != NULL && watch->primitive >= 0 && watch->changes == 0) {
+            addGuard(guards, watch, watch->changes);
+            return primitiveResult(primitiveAt(watch->primitive)->function,
+                                   given, count, safe);
+        }
+    }
+    if (function->type == CONS_TYPE &&
+        function->c.car->type == SYMBOL_TYPE &&
+        !strcmp(function->c.car->s, "lambda") &&
+        isWellFormedLambda(function->c.cdr) &&
+        properLength(function->c.cdr) == 2 &&
+        properLength(function->c.cdr->c.car) == count) {
+        return bodyResult(function->c.cdr->c.cdr->c.car,
+                          function->c.cdr->c.car, given, scope, guards,
+                          safe);
+    }
+    *safe = 0;
+    return VALUE_ANY;
+}
+
+// Returns what the items of the list expr evaluates to are known to be
+int itemsResult(Value *expr) {
+    if (expr->type != CONS_TYPE || properLength(expr) != 2 ||
+        expr->c.car->type != SYMBOL_TYPE ||
+        strcmp(expr->c.car->s, "quote")) {
+        return VALUE_ANY;
+    }
+    Value *items = expr->c.cdr->c.car;
+    if (properLength(items) < 0) {
+        return VALUE_ANY;
+    }
+    while (items->type == CONS_TYPE) {
+        if (items->c.car->type != INT_TYPE &&
+            items->c.car->type != DOUBLE_TYPE) {
+            return VALUE_ANY;
+        }
+        items = items->c.cdr;
+    }
+    return VALUE_NUMBER;
+}
+
+// Optimizes the procedures and initial values of a stage of a pipeline and
+// of the stages within it, and the list the innermost one is given
+Value *optimizeStages(Value *stage, Value *scope, int depth) {
+    Value *args = stage->c.cdr;
+    Value *list = stageList(stage);
+    if (isStage(list, 0)) {
+        list = optimizeStages(list, scope, depth);
+    } else {
+        list = optimizeExpression(list, scope, depth);
+    }
+    Value *rest = cons(list, makeNull());
+    if (properLength(args) == 3) {
+        rest = cons(optimizeExpression(args->c.cdr->c.car, scope, depth),
+                    rest);
+    }
+    rest = cons(optimizeExpression(args->c.car, scope, depth), rest);
+    Value *code = cons(stage->c.car, rest);
+    code->loc = stage->loc;
+    return code;
+}
+
+// Optimizes a pipeline, keeping its stages as they are
+Value *optimizePipeline(Value *expr, Value *scope, int depth) {
+    Value *args = expr->c.cdr;
+    if (properLength(args) != 1 || !isStage(args->c.car, 1)) {
+        return expr;
+    }
+    return rebuild(expr, expr->c.car,
+                   rebuild(args, optimizeStages(args->c.car, scope, depth),
+                           args->c.cdr));
+}
+
+// Turns a map, filter, fold or fold-right of the result of a map or filter,
+// and so on, into a pipeline, or returns NULL. The names of the stages must
+// still be bound to those primitives, and every stage but the innermost
+// certain to return without an error or any other effect, as the pipeline
+// calls each stage on an item as soon as the one before is done with it.
+Value *fuseStages(Value *expr, Value *scope, int depth) {
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    int count = 0;
+    Value *stage = expr;
+    while (isStage(stage, count == 0)) {
+        count = count + 1;
+        stage = stageList(stage);
+    }
+    if (count < 2) {
+        return NULL;
+    }
+    Value **stages = talloc(sizeof(Value *) * count);
+    int i;
+    stage = expr;
+    for (i = 0; i < count; i++) {
+        Watch *watch = findWatch(stage->c.car->s);
+        if (isNameIn(stage->c.car->s, scope) || watch == NULL ||
+            watch->primitive < 0 || watch->changes != 0) {
+            return NULL;
+        }
+        addGuard(&guards, watch, watch->changes);
+        stages[i] = stage;
+        stage = stageList(stage);
+    }
+
+    // follow what is known of the items from the innermost stage out
+    int items = itemsResult(stage);
+    for (i = count - 1; i >= 0; i--) {
+        Value *args = stages[i]->c.cdr;
+        int given[2];
+        int safe = 1;
+        given[0] = items;
+        if (properLength(args) == 3) {
+            Value *init = args->c.cdr->c.car;
+            given[1] = init->type == INT_TYPE || init->type == DOUBLE_TYPE
+                       ? VALUE_NUMBER : VALUE_ANY;
+            int result = stageResult(args->c.car, given, 2, scope, &guards,
+                                     &safe);
+            safe = safe && (given[1] == VALUE_ANY || result == given[1]);
+        } else if (!strcmp(stages[i]->c.car->s, "map")) {
+            items = stageResult(args->c.car, given, 1, scope, &guards,
+                                &safe);
+        } else {
+            stageResult(args->c.car, given, 1, scope, &guards, &safe);
+        }
+        if (i < count - 1 && !safe) {
+            return NULL;
+        }
+    }
+
+    Value *keyword = makeNull();
+    keyword->type = SYMBOL_TYPE;
+    keyword->s = "pipeline";
+    Value *code = cons(keyword, cons(optimizeStages(expr, scope, depth),
+                                     makeNull()));
+    code->loc = expr->loc;
+    return makeOptimized(code, expr, &guards);
+}
+
+// Returns an estimate of the steps evaluating expr takes, at most
+// PARALLEL_COST, or -1 unless it is certain to have no effect. It must be
+// made only of literals, variables, quote, if, and, or, lets of one body
+// expression and calls of names not bound in scope, each still bound to a
+// primitive isPurePrimitive accepts or to a procedure made at top level
+// whose body is one expression made the same way; the names called are
+// added to guards. calling lists the procedures being looked into, a call
+// of one of which counts as PARALLEL_COST, and *budget counts down the
+// nodes left to look at.
+int pureCost(Value *expr, Value *scope, Value *calling, Guards *guards,
+             int *budget) {
+    expr = writtenExpression(expr);
+    *budget = *budget - 1;
+    if (*budget < 0) {
+        return -1;
+    }
+    switch (expr->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case STR_TYPE:
+        case BOOL_TYPE:
+        case NULL_TYPE:
+        case SYMBOL_TYPE:
+            return 1;
+        case CONS_TYPE:
+            break;
+        default:
+            return -1;
+    }
+    Value *head = expr->c.car;
+    Value *args = expr->c.cdr;
+    int count = properLength(args);
+    int cost = 1;
+    int branch = 0;
+    int i;
+    if (head->type != SYMBOL_TYPE || count < 0) {
+        return -1;
+    }
+    char *name = head->s;
+    if (!strcmp(name, "quote")) {
+        return count == 1 ? 1 : -1;
+    }
+    if (!strcmp(name, "let")) {
+        if (count != 2 || !areWellFormedBindings(args->c.car)) {
+            return -1;
+        }
+        Value *bindings = args->c.car;
+        while (bindings->type == CONS_TYPE) {
+            int init = pureCost(bindings->c.car->c.cdr->c.car, scope,
+                                calling, guards, budget);
+            if (init < 0) {
+                return -1;
+            }
+            cost = cost + init;
+            bindings = bindings->c.cdr;
+        }
+        int body = pureCost(args->c.cdr->c.car,
+                            extendScope(scope, bindingNames(args->c.car)),
+                            calling, guards, budget);
+        return body < 0 ? -1 : (cost + body < PARALLEL_COST
+                                ? cost + body : PARALLEL_COST);
+    }
+    int isIf = !strcmp(name, "if");
+    int isLogic = !strcmp(name, "and") || !strcmp(name, "or");
+    if ((isIf && count != 3) ||
+        (isSpecialForm(name) && !isIf && !isLogic)) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        int arg = pureCost(args->c.car, scope, calling, guards, budget);
+        if (arg < 0) {
+            return -1;
+        }
+        // an if takes one branch
+        if (isIf && i > 0) {
+            branch = arg > branch ? arg : branch;
+        } else {
+            cost = cost + arg;
+        }
+        args = args->c.cdr;
+    }
+    cost = cost + branch;
+    if (isIf || isLogic) {
+        return cost < PARALLEL_COST ? cost : PARALLEL_COST;
+    }
+    if (isNameIn(name, scope)) {
+        return -1;
+    }
+    Watch *watch = findWatch(name);
+    if (watch != NULL && watch->primitive >= 0 && watch->changes == 0) {
+        if (!isPurePrimitive(primitiveAt(watch->primitive)->function)) {
+            return -1;
+        }
+        addGuard(guards, watch, watch->changes);
+        return cost < PARALLEL_COST ? cost : PARALLEL_COST;
+    }
+    Value *closure = topLevelProcedure(name);
+    // the body of a closure is the cell holding its one expression
+    if (closure == NULL || properLength(closure->cl.functionCode) != 1 ||
+        closure->cl.functionCode->c.car->type != CONS_TYPE ||
+        !(closure->cl.paramNames->type == NULL_TYPE ||
+          areDistinctNames(closure->cl.paramNames))) {
+        return -1;
+    }
+    watch = watchName(name);
+    addGuard(guards, watch, watch->changes);
+    if (isNameIn(name, calling)) {
+        return PARALLEL_COST;
+    }
+    if (properLength(calling) >= PURE_DEPTH) {
+        return -1;
+    }
+    int body = pureCost(closure->cl.functionCode->c.car->c.car,
+                        closure->cl.paramNames, cons(head, calling), guards,
+                        budget);
+    if (body < 0) {
+        return -1;
+    }
+    return cost + body < PARALLEL_COST ? cost + body : PARALLEL_COST;
+}
+
+// Returns the positions of the expressions of a list worth evaluating on
+// threads of their own, as a list of integers, adding the names that relies
+// on to guards, or NULL. Every expression must have no effect, at least
+// two must cost PARALLEL_COST, and the pool must have more than one thread.
+Value *spreadPositions(Value *exprs, Value *scope, Guards *guards) {
+    int budget = PURE_NODES;
+    int calls = 0;
+    int position = 0;
+    Value *rest = exprs;
+    while (rest->type == CONS_TYPE) {
+        calls = calls + (writtenExpression(rest->c.car)->type == CONS_TYPE);
+        rest = rest->c.cdr;
+    }
+    if (calls < 2 || poolSize() == 1) {
+        return NULL;
+    }
+    Value *positions = makeNull();
+    int spread = 0;
+    while (exprs->type == CONS_TYPE) {
+        int cost = pureCost(exprs->c.car, scope, makeNull(), guards,
+                            &budget);
+        if (cost < 0) {
+            return NULL;
+        }
+        if (cost >= PARALLEL_COST) {
+            Value *number = makeNull();
+            number->type = INT_TYPE;
+            number->i = position;
+            positions = cons(number, positions);
+            spread = spread + 1;
+        }
+        position = position + 1;
+        exprs = exprs->c.cdr;
+    }
+    if (spread < 2 || guards->full) {
+        return NULL;
+    }
+    return reverse(positions);
+}
+
+// Returns (keyword positions . rest), made in place of expr
+Value *parallelForm(char *name, Value *positions, Value *rest, Value *expr) {
+    Value *keyword = makeNull();
+    keyword->type = SYMBOL_TYPE;
+    keyword->s = name;
+    Value *code = cons(keyword, cons(positions, rest));
+    code->loc = expr->loc;
+    return code;
+}
+
+// Turns a call whose arguments have no effect into a parallel-call when at
+// least two of them are worth evaluating on threads of their own, or
+// returns NULL. args are its arguments, optimized.
+Value *parallelCall(Value *expr, Value *args, Value *scope) {
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    Value *positions = spreadPositions(expr->c.cdr, scope, &guards);
+    if (positions == NULL) {
+        return NULL;
+    }
+    return makeOptimized(parallelForm("parallel-call", positions,
+                                      cons(quickVariable(expr->c.car), args),
+                                      expr),
+                         expr, &guards);
+}
+
+// Turns a let whose binding expressions have no effect into a parallel-let
+// when at least two of them are worth evaluating on threads of their own,
+// or returns NULL. bindings and body are its parts, optimized.
+Value *parallelLet(Value *expr, Value *bindings, Value *body,
+                   Value *scope) {
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    Value *inits = makeNull();
+    Value *rest = expr->c.cdr->c.car;
+    while (rest->type == CONS_TYPE) {
+        inits = cons(rest->c.car->c.cdr->c.car, inits);
+        rest = rest->c.cdr;
+    }
+    Value *positions = spreadPositions(reverse(inits), scope, &guards);
+    if (positions == NULL) {
+        return NULL;
+    }
+    return makeOptimized(parallelForm("parallel-let", positions,
+                                      cons(bindings, body), expr),
+                         expr, &guards);
+}
+
+// Optimizes a call of a named procedure. A call of a primitive through a
+// name still bound to it is folded if it can be, and otherwise done in
+// place while the name stays bound to it.
+Value *optimizeCall(Value *expr, Value *scope, int depth) {
+    Value *fused = fuseStages(expr, scope, depth);
+    if (fused != NULL) {
+        return fused;
+    }
+    Value *head = expr->c.car;
+    Value *args = optimizeEach(expr->c.cdr, scope, depth);
+    if (properLength(args) < 0) {
+        return rebuild(expr, head, args);
+    }
+    Value *parallel = parallelCall(expr, args, scope);
+    if (parallel != NULL) {
+        return parallel;
+    }
+    if (!isNameIn(head->s, scope)) {
+        Watch *watch = findWatch(head->s);
+        if (watch != NULL && watch->primitive >= 0 && watch->changes == 0) {
+            Value *(*function)(struct Value *) =
+                primitiveAt(watch->primitive)->function;
+            Guards guards;
+            guards.count = 0;
+            guards.full = 0;
+            Value *constants = constantArguments(args, &guards);
+            if (constants != NULL && canFold(function, constants)) {
+                addGuard(&guards, watch, watch->changes);
+                return makeOptimized(function(constants), expr, &guards);
+            }
+            return quickPrimitive(expr, quickVariable(head), args,
+                                  watch->primitive, watch);
+        } else if (depth == 0) {
+            Value *inlined = inlineCall(expr, args, scope, depth);
+            if (inlined != NULL) {
+                return inlined;
+            }
+        }
+    }
+    return quickCall(expr, quickVariable(head), args);
+}
+
+// Returns 1 if evalLambda accepts the parts of a lambda: at least a list of
+// distinct parameter names and a body, none of them a list that does not
+// start with a name
+int isWellFormedLambda(Value *args) {
+    Value *rest = args;
+    if (properLength(args) < 2 || !(args->c.car->type == NULL_TYPE ||
+                                    areDistinctNames(args->c.car))) {
+        return 0;
+    }
+    while (rest->type == CONS_TYPE) {
+        if (rest->c.car->type == CONS_TYPE &&
+            rest->c.car->c.car->type != SYMBOL_TYPE) {
+            return 0;
+        }
+        rest = rest->c.cdr;
+    }
+    return 1;
+}
+
+// Optimizes the body of a lambda expression
+Value *optimizeLambda(Value *expr, Value *scope, int depth) {
+    Value *args = expr->c.cdr;
+    if (!isWellFormedLambda(args)) {
+        return expr;
+    }
+    Value *body = optimizeEach(args->c.cdr,
+                               extendScope(scope, args->c.car), depth);
+    return rebuild(expr, expr->c.car, rebuild(args, args->c.car, body));
+}
+
+// Optimizes a call of a lambda expression, substituting literal arguments
+// into a small body
+Value *optimizeApplication(Value *expr, Value *scope, int depth) {
+    Value *function = expr->c.car;
+    Value *args = optimizeEach(expr->c.cdr, scope, depth);
+    if (function->c.car->type != SYMBOL_TYPE ||
+        strcmp(function->c.car->s, "lambda") || properLength(args) < 0) {
+        return rebuild(expr, function, args);
+    }
+    Value *parts = function->c.cdr;
+    if (isWellFormedLambda(parts) && properLength(parts) == 2 &&
+        properLength(parts->c.car) == properLength(args)) {
+        Value *body = parts->c.cdr->c.car;
+        int size = INLINE_SIZE;
+        Guards guards;
+        guards.count = 0;
+        guards.full = 0;
+        Value *constants = constantArguments(args, &guards);
+        if (constants != NULL && isInlinable(body, parts->c.car, &size)) {
+            Value *inlined = substitute(body, parts->c.car, constants);
+            return makeOptimized(optimizeExpression(inlined, scope, depth),
+                                 expr, &guards);
+        }
+    }
+    return rebuild(expr, optimizeLambda(function, scope, depth), args);
+}
+
+// Optimizes an if, keeping only the branch it takes if its test is constant
+Value *optimizeIf(Value *expr, Value *scope, int depth) {
+    if (properLength(expr->c.cdr) != 3) {
+        return expr;
+    }
+    Value *args = optimizeEach(expr->c.cdr, scope, depth);
+    Value *test = args->c.car;
+    if (isConstantBool(test, "#t") || isConstantBool(test, "#f")) {
+        Guards guards;
+        guards.count = 0;
+        guards.full = 0;
+        addGuardsOf(&guards, test);
+        Value *branch = args->c.cdr;
+        if (isConstantBool(test, "#f")) {
+            branch = branch->c.cdr;
+        }
+        return makeOptimized(branch->c.car, expr, &guards);
+    }
+    return rebuild(expr, expr->c.car, args);
+}
+
+// Optimizes an and (or an or, if isAnd is 0), dropping the leading tests
+// that are constant and do not decide it
+Value *optimizeLogic(Value *expr, Value *scope, int depth, int isAnd) {
+    char *pass = isAnd ? "#t" : "#f";
+    char *decide = isAnd ? "#f" : "#t";
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    if (properLength(expr->c.cdr) < 0) {
+        return expr;
+    }
+    Value *args = optimizeEach(expr->c.cdr, scope, depth);
+    Value *rest = args;
+    while (rest->type == CONS_TYPE && isConstantBool(rest->c.car, pass)) {
+        addGuardsOf(&guards, rest->c.car);
+        rest = rest->c.cdr;
+    }
+    if (rest->type == NULL_TYPE || isConstantBool(rest->c.car, decide)) {
+        if (rest->type == CONS_TYPE) {
+            addGuardsOf(&guards, rest->c.car);
+        }
+        return makeOptimized(makeBool(rest->type == NULL_TYPE ? isAnd
+                                                              : !isAnd),
+                             expr, &guards);
+    }
+    if (rest != args) {
+        return makeOptimized(rebuild(expr, expr->c.car, rest), expr,
+                             &guards);
+    }
+    return rebuild(expr, expr->c.car, args);
+}
+
+// Optimizes a cond, dropping clauses whose tests are constant #f and those
+// after one that is constant #t
+Value *optimizeCond(Value *expr, Value *scope, int depth) {
+    Value *clauses = expr->c.cdr;
+    int count = properLength(clauses);
+    int changed = 0;
+    int truncated = 0;
+    int kept = 0;
+    int i;
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    if (count < 0) {
+        return expr;
+    }
+    Value *rest = clauses;
+    while (rest->type == CONS_TYPE) {
+        if (rest->c.car->type != CONS_TYPE ||
+            properLength(rest->c.car) < 2) {
+            return expr;
+        }
+        rest = rest->c.cdr;
+    }
+
+    Value **live = talloc(sizeof(Value *) * (count + 1));
+    rest = clauses;
+    for (i = 0; i < count; i++) {
+        Value *clause = rest->c.car;
+        Value *test = clause->c.car;
+        Value *result = clause->c.cdr;
+        rest = rest->c.cdr;
+        if (test->type == SYMBOL_TYPE) {
+            // a clause led by a name other than else is passed over
+            if (strcmp(test->s, "else")) {
+                live[kept] = clause;
+                kept = kept + 1;
+                continue;
+            }
+        } else {
+            test = optimizeExpression(test, scope, depth);
+        }
+        result = rebuild(result, optimizeExpression(result->c.car, scope,
+                                                    depth),
+                         result->c.cdr);
+        Value *optimized = rebuild(clause, test, result);
+        changed = changed || optimized != clause;
+        if (isConstantBool(test, "#f")) {
+            addGuardsOf(&guards, test);
+            truncated = 1;
+            continue;
+        }
+        int always = test->type == SYMBOL_TYPE ||
+                     isConstantBool(test, "#t");
+        if (always) {
+            addGuardsOf(&guards, test);
+            if (kept == 0) {
+                return makeOptimized(result->c.car, expr, &guards);
+            }
+            truncated = truncated || rest->type != NULL_TYPE;
+        }
+        live[kept] = optimized;
+        kept = kept + 1;
+        if (always) {
+            break;
+        }
+    }
+    if (!changed && !truncated) {
+        return expr;
+    }
+    Value *list = makeNull();
+    for (i = kept - 1; i >= 0; i--) {
+        list = cons(live[i], list);
+    }
+    Value *code = cons(expr->c.car, list);
+    code->loc = expr->loc;
+    if (truncated) {
+        return makeOptimized(code, expr, &guards);
+    }
+    return code;
+}
+
+// Returns 1 if a list of bindings is a proper, non-empty list of (name
+// expression) lists
+int areWellFormedBindings(Value *bindings) {
+    if (bindings->type != CONS_TYPE || properLength(bindings) < 0) {
+        return 0;
+    }
+    while (bindings->type == CONS_TYPE) {
+        Value *binding = bindings->c.car;
+        if (binding->type != CONS_TYPE || properLength(binding) != 2 ||
+            binding->c.car->type != SYMBOL_TYPE) {
+            return 0;
+        }
+        bindings = bindings->c.cdr;
+    }
+    return 1;
+}
+
+// Returns the names of a list of bindings
+Value *bindingNames(Value *bindings) {
+    Value *names = makeNull();
+    while (bindings->type == CONS_TYPE) {
+        names = cons(bindings->c.car->c.car, names);
+        bindings = bindings->c.cdr;
+    }
+    return names;
+}
+
+// Optimizes the expressions of a list of bindings. A let looks up the
+// variables among them before evaluating any, so those are kept as they are
+// if keepVariables is set.
+Value *optimizeBindings(Value *bindings, Value *scope, int depth,
+                        int keepVariables) {
+    if (bindings->type != CONS_TYPE) {
+        return bindings;
+    }
+    Value *binding = bindings->c.car;
+    Value *rest = optimizeBindings(bindings->c.cdr, scope, depth,
+                                   keepVariables);
+    Value *init = binding->c.cdr;
+    if (!keepVariables || init->c.car->type != SYMBOL_TYPE) {
+        init = optimizeEach(init, scope, depth);
+    }
+    return rebuild(bindings, rebuild(binding, binding->c.car, init), rest);
+}
+
+// Optimizes a let, let* or letrec. A let whose body is one expression that
+// creates no frames loses the bindings of constants it never mentions; a
+// let left with no bindings becomes its body.
+Value *optimizeLet(Value *expr, Value *scope, int depth) {
+    Value *args = expr->c.cdr;
+    if (properLength(args) < 2 || !areWellFormedBindings(args->c.car)) {
+        return expr;
+    }
+    int isLet = !strcmp(expr->c.car->s, "let");
+    Value *inner = extendScope(scope, bindingNames(args->c.car));
+    Value *bindings = optimizeBindings(args->c.car, isLet ? scope : inner,
+                                       depth, isLet);
+    Value *body = optimizeEach(args->c.cdr, inner, depth);
+    Value *parallel = isLet ? parallelLet(expr, bindings, body, scope)
+                            : NULL;
+    if (parallel != NULL) {
+        return parallel;
+    }
+    if (!isLet || properLength(args) != 2 || createsFrames(args->c.cdr)) {
+        return rebuild(expr, expr->c.car, rebuild(args, bindings, body));
+    }
+
+    Guards guards;
+    guards.count = 0;
+    guards.full = 0;
+    Value *kept = makeNull();
+    int dropped = 0;
+    Value *rest = bindings;
+    while (rest->type == CONS_TYPE) {
+        Value *binding = rest->c.car;
+        Value *init = binding->c.cdr->c.car;
+        int isQuote = init->type == CONS_TYPE && properLength(init) == 2 &&
+                      init->c.car->type == SYMBOL_TYPE &&
+                      !strcmp(init->c.car->s, "quote");
+        if ((constantOf(init) != NULL || isQuote) &&
+            !occursIn(binding->c.car->s, args->c.cdr)) {
+            addGuardsOf(&guards, init);
+            dropped = 1;
+        } else {
+            kept = cons(binding, kept);
+        }
+        rest = rest->c.cdr;
+    }
+    if (!dropped) {
+        return rebuild(expr, expr->c.car, rebuild(args, bindings, body));
+    }
+    if (kept->type == NULL_TYPE) {
+        return makeOptimized(body->c.car, expr, &guards);
+    }
+    Value *code = cons(expr->c.car, cons(reverse(kept), body));
+    code->loc = expr->loc;
+    return makeOptimized(code, expr, &guards);
+}
+
+// Optimizes the value of a define or set!, or the value and limit of a
+// define-memoized
+Value *optimizeAssignment(Value *expr, Value *scope, int depth) {
+    Value *args = expr->c.cdr;
+    int count = properLength(args);
+    int memoized = !strcmp(expr->c.car->s, "define-memoized");
+    if ((count != 2 && !(memoized && count == 3)) ||
+        args->c.car->type != SYMBOL_TYPE) {
+        return expr;
+    }
+    return rebuild(expr, expr->c.car,
+                   rebuild(args, args->c.car,
+                           optimizeEach(args->c.cdr, scope, depth)));
+}
+
+// Optimizes an expression in which the names in scope are bound locally.
+// depth counts the procedures inlined around it, which are not inlined into
+// again.
+Value *optimizeExpression(Value *expr, Value *scope, int depth) {
+    if (expr->type == SYMBOL_TYPE) {
+        return quickVariable(expr);
+    }
+    if (expr->type != CONS_TYPE) {
+        return expr;
+    }
+    Value *head = expr->c.car;
+    if (head->type == CONS_TYPE) {
+        return optimizeApplication(expr, scope, depth);
+    }
+    if (head->type != SYMBOL_TYPE) {
+        return expr;
+    }
+    char *name = head->s;
+    if (!strcmp(name, "quote")) {
+        return expr;
+    } else if (!strcmp(name, "if")) {
+        return optimizeIf(expr, scope, depth);
+    } else if (!strcmp(name, "and") || !strcmp(name, "or")) {
+        return optimizeLogic(expr, scope, depth, !strcmp(name, "and"));
+    } else if (!strcmp(name, "cond")) {
+        return optimizeCond(expr, scope, depth);
+    } else if (!strcmp(name, "let") || !strcmp(name, "let*") ||
+               !strcmp(name, "letrec")) {
+        return optimizeLet(expr, scope, depth);
+    } else if (!strcmp(name, "lambda")) {
+        return optimizeLambda(expr, scope, depth);
+    } else if (!strcmp(name, "define") || !strcmp(name, "set!") ||
+               !strcmp(name, "define-memoized")) {
+        return optimizeAssignment(expr, scope, depth);
+    } else if (!strcmp(name, "begin") || !strcmp(name, "delay") ||
+               !strcmp(name, "delay-force") ||
+               !strcmp(name, "stream-cons")) {
+        return rebuild(expr, head, optimizeEach(expr->c.cdr, scope, depth));
+    } else if (!strcmp(name, "pipeline")) {
+        return optimizePipeline(expr, scope, depth);
+    } else if (!strcmp(name, "parallel-let") ||
+               !strcmp(name, "parallel-call")) {
+        return expr;
+    }
+    return optimizeCall(expr, scope, depth);
+}
+
+// Optimizes a top-level form
+Value *optimize(Value *form) {
+    watchPrimitives();
+    return optimizeExpression(form, makeNull(), 0);
+}
@@ -0,0 +1,73 @@
+#include "value.h"
+
+#ifndef _OPTIMIZE
+#define _OPTIMIZE
+
+// A global name that optimized code relies on. primitive is the number of
+// the primitive the name is bound to when the interpreter starts, or -1.
+// changes counts the times the name may have been bound to something else,
+// and definitions the times define has bound it in the global frame.
+struct Watch {
+    char *name;
+    int primitive;
+    int changes;
+    int definitions;
+};
+
+typedef struct Watch Watch;
+
+// An expression rewritten by the optimizer. code is evaluated in place of
+// original, the expression as written, for as long as none of the names in
+// guards has changed from the count in changes; after that original is. It
+// prints as original, so error messages show the code as it was written.
+struct Optimized {
+    Value *code;
+    Value *original;
+    int guardCount;
+    Watch **guards;
+    int *changes;
+};
+
+typedef struct Optimized Optimized;
+
+// Returns a top-level form with constant primitive calls folded, small
+// known procedures inlined, and dead branches and unused bindings dropped.
+// The form itself is left unchanged.
+Value *optimize(Value *form);
+
+// Returns the number of items in a proper list, or -1
+int properLength(Value *list);
+
+// Returns 1 if applying a primitive to a list of values is certain to
+// return a value without any error or other effect
+int canFold(Value *(*function)(struct Value *), Value *constants);
+
+// Returns 1 if name is a special form
+int isSpecialForm(char *name);
+
+// Returns 1 if name is in a list of symbols
+int isNameIn(char *name, Value *names);
+
+// Returns the code an optimized or quickened expression was made from, or
+// expr itself if it is neither
+Value *writtenExpression(Value *expr);
+
+// Returns 1 if none of the names an optimized expression relies on has been
+// bound again
+int guardsHold(Optimized *optimized);
+
+// Returns the watch of name, watching it from now on if it was not
+Watch *watchName(char *name);
+
+// Records that name is being bound by set! or let*, which may change what
+// it refers to in code that has been optimized
+void noteRebinding(char *name);
+
+// Records that define is adding a binding of name to the global frame
+void noteDefinition(char *name);
+
+// Records every primitive name that global is found to bind to something
+// else, as after a heap image has been loaded
+void noteGlobalBindings(Frame *global);
+
+#endif
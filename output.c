@@ -0,0 +1,112 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Output buffer for printing results
+*
+* The printer appends text to a buffer instead of calling printf for every
+* atom, parenthesis and space. For stdout that buffer is stdout's own, so
+* printed values stay in order with error messages printed with printf
+* without any flushing in between. Interactive sessions push stdout out at
+* every newline and at the end of every form; otherwise stdout is given a
+* large buffer and written in large blocks. The printer can also be pointed
+* at another sink, which is how values are displayed on output ports; text
+* for a sink is gathered in a buffer here and handed over in one block.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "output.h"
+
+// Size of the stdio buffer under the output buffer when output is batched
+#define STDOUT_BUFFER_SIZE (1 << 18)
+
+char outputBuffer[OUTPUT_BUFFER_SIZE];
+size_t outputLength = 0;
+int outputInteractive = 0;
+OutputSink outputSink = NULL;
+
+// Sets up standard output; called once before anything is printed
+void initOutput(){
+    if (!isatty(STDOUT_FILENO)){
+        setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFFER_SIZE);
+    }
+}
+
+// Sends text to the current sink
+void sendOutput(const char *text, size_t length){
+    if (outputSink == NULL){
+        fwrite(text, 1, length, stdout);
+    } else {
+        outputSink(text, length);
+    }
+}
+
+// Hands everything in the output buffer to the sink in one write
+void flushOutput(){
+    if (outputLength > 0){
+        sendOutput(outputBuffer, outputLength);
+        outputLength = 0;
+    }
+}
+
+// Appends length characters of text to the output buffer
+void writeOutput(const char *text, size_t length){
+    if (outputSink == NULL){
+        fwrite(text, 1, length, stdout);
+        return;
+    }
+    if (outputLength + length > OUTPUT_BUFFER_SIZE){
+        flushOutput();
+        if (length > OUTPUT_BUFFER_SIZE){
+            sendOutput(text, length);
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, text, length);
+    outputLength = outputLength + length;
+}
+
+// Appends a NUL-terminated string to the output buffer
+void writeOutputString(const char *text){
+    writeOutput(text, strlen(text));
+}
+
+// Appends one character to the output buffer
+void writeOutputChar(char c){
+    if (outputSink == NULL){
+        putc_unlocked(c, stdout);
+        if (c == '\n' && outputInteractive){
+            fflush(stdout);
+        }
+        return;
+    }
+    if (outputLength == OUTPUT_BUFFER_SIZE){
+        flushOutput();
+    }
+    outputBuffer[outputLength] = c;
+    outputLength = outputLength + 1;
+    if (c == '\n' && outputInteractive){
+        flushOutput();
+        fflush(stdout);
+    }
+}
+
+// Sends flushed output to sink, or to stdout if sink is NULL
+OutputSink setOutputSink(OutputSink sink){
+    OutputSink previous = outputSink;
+    outputSink = sink;
+    return previous;
+}
+
+// Flushes the output at the end of a top-level form
+void endOutputForm(){
+    flushOutput();
+    if (outputInteractive){
+        fflush(stdout);
+    }
+}
+
+// Chooses whether output is flushed at every newline and form
+void setOutputInteractive(int interactive){
+    outputInteractive = interactive;
+}
@@ -0,0 +1,42 @@
+#ifndef _OUTPUT
+#define _OUTPUT
+
+#include <stddef.h>
+
+// Size of the buffer results are printed into
+#define OUTPUT_BUFFER_SIZE 65536
+
+// Where flushed output goes
+typedef void (*OutputSink)(const char *text, size_t length);
+
+// Sets up standard output; called once before anything is printed
+void initOutput();
+
+// Appends length characters of text to the output buffer
+void writeOutput(const char *text, size_t length);
+
+// Appends a NUL-terminated string to the output buffer
+void writeOutputString(const char *text);
+
+// Appends one character to the output buffer. In interactive mode a newline
+// flushes the output.
+void writeOutputChar(char c);
+
+// Hands everything in the output buffer to the sink in one write. Text for
+// stdout is not kept in the buffer, so it is always in order with anything
+// printed with printf.
+void flushOutput();
+
+// Sends output flushed from the buffer to sink, or to stdout if sink is
+// NULL, and returns the sink it replaces. Flush before switching.
+OutputSink setOutputSink(OutputSink sink);
+
+// Flushes the output at the end of a top-level form; in interactive mode it
+// is pushed all the way to the terminal or pipe
+void endOutputForm();
+
+// Chooses whether output is flushed at every newline and form (1) or only
+// when the buffer fills up (0)
+void setOutputInteractive(int interactive);
+
+#endif
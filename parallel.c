@@ -0,0 +1,438 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Parallel evaluation of let bindings and arguments that have no effect
+*/
+
+/*
+The optimizer turns a let whose binding expressions have no effect, and
+call arguments the same, into a parallel-let or parallel-call when at least
+two of the expressions are costly enough to be worth another thread (see
+optimize.c). The positions of those come first:
+
+    (parallel-let (0 1) ((a (fib 25)) (b (fib 26)) (c 3)) (+ a b c))
+
+evaluates (fib 25) and (fib 26) at the same time on the threads of the pool
+(see threadpool.h), then 3 on the calling thread, and the body as let
+would.
+
+The interpreter itself cannot run on two threads at once: variable
+references and calls specialize themselves as they run (see quicken.h),
+hot bodies are compiled and counted (see jit.h), and lambda looks closures
+up in a table (see closure.h). So the expressions are evaluated here by
+evalPure, which reads the code, the frames and what the optimizer watches
+and writes nothing but the values it makes: the literals, variables, quote,
+if, and, or and let that the optimizer proved them to be made of, calls of
+the primitives isPurePrimitive accepts and calls of closures whose body is
+a single such expression. It gives up, returning NULL, on anything else,
+on a call that would fail (an error, a primitive that would print one or a
+closure given the wrong number of arguments), and once the expressions are
+nested too deeply. Whatever was evaluated so far had no effect, so when one
+of the expressions gives up, the others stop at their next step and the
+whole let or call is evaluated again as written, on the calling thread,
+which does and reports exactly what it would have without this.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "optimize.h"
+#include "parallel.h"
+#include "primitives.h"
+#include "quicken.h"
+#include "talloc.h"
+#include "threadpool.h"
+#include "value.h"
+
+// Most stack one level of evalPure takes, counting the pureCall or pureLet
+// between it and the next; about 250 bytes were measured without
+// optimization
+#define NESTING_BYTES 512
+
+// Most expressions evalPure goes into, one inside another, before it gives
+// up: enough to fill half the stack of a pool thread
+#define MAX_NESTING (POOL_STACK_SIZE / 2 / NESTING_BYTES)
+
+// The expressions of a let or call evaluated together, and the values they
+// gave. failed is set once one of them gives up.
+struct Batch {
+    Value **exprs;
+    Value **values;
+    int *spread;
+    Frame *frame;
+    int failed;
+};
+
+typedef struct Batch Batch;
+
+Value *evalPure(Value *expr, Frame *frame, Batch *batch, int nesting);
+
+int isPurePrimitive(Value *(*function)(struct Value *)) {
+    return function == primitiveAdd || function == primitiveSubtract ||
+           function == primitiveMult || function == primitiveDivide ||
+           function == primitiveModulo || function == primitiveEqual ||
+           function == primitiveGreater ||
+           function == primitiveGreaterEqual ||
+           function == primitiveLess || function == primitiveLessEqual ||
+           function == primitiveNull || function == primitiveCar ||
+           function == primitiveCdr || function == primitiveCons ||
+           function == primitiveList;
+}
+
+// Returns 1 if calling a primitive isPurePrimitive accepts on args is
+// certain to return without an error or anything printed
+int isSafeCall(Value *(*function)(struct Value *), Value *args) {
+    int count = properLength(args);
+    if (canFold(function, args)) {
+        return 1;
+    }
+    if (function == primitiveCar || function == primitiveCdr) {
+        return count == 1 && args->c.car->type == CONS_TYPE;
+    }
+    if (function == primitiveNull) {
+        return count == 1;
+    }
+    if (function == primitiveCons) {
+        return count == 2;
+    }
+    return function == primitiveList;
+}
+
+// Returns 1 if expr is a set! or begin, which the body of a let evaluates
+// once more before its last expression
+int isBodyForm(Value *expr) {
+    return expr->type == CONS_TYPE && expr->c.car->type == SYMBOL_TYPE &&
+           (!strcmp(expr->c.car->s, "set!") ||
+            !strcmp(expr->c.car->s, "begin"));
+}
+
+// Returns what lookUpSymbol gives for symbol in frame, or NULL if it is not
+// bound
+Value *pureLookUp(Value *symbol, Frame *frame) {
+    while (frame != NULL) {
+        Value *bindings = frame->bindings;
+        while (bindings->type == CONS_TYPE) {
+            Value *binding = bindings->c.car;
+            if (!strcmp(binding->c.car->s, symbol->s)) {
+                Value *value = binding->c.cdr->c.car;
+                if (value->type == SYMBOL_TYPE) {
+                    return pureLookUp(value, frame->parent);
+                }
+                return value;
+            }
+            bindings = bindings->c.cdr;
+        }
+        frame = frame->parent;
+    }
+    return NULL;
+}
+
+// Returns what eval gives for a variable, or NULL if it is not bound
+Value *pureVariable(Value *symbol, Frame *frame) {
+    Value *value = pureLookUp(symbol, frame);
+    if (value != NULL && value->type == CONS_TYPE &&
+        value->c.car->type == SYMBOL_TYPE &&
+        !strcmp(value->c.car->s, "quote")) {
+        return value->c.cdr;
+    }
+    return value;
+}
+
+// Evaluates a call of head on the proper list args
+Value *pureCall(Value *head, Value *args, Frame *frame, Batch *batch,
+                int nesting) {
+    Value *function = evalPure(head, frame, batch, nesting);
+    if (function == NULL) {
+        return NULL;
+    }
+    Value *values = makeNull();
+    Value *tail = NULL;
+    while (args->type == CONS_TYPE) {
+        Value *value = evalPure(args->c.car, frame, batch, nesting);
+        if (value == NULL) {
+            return NULL;
+        }
+        appendItem(&values, &tail, value);
+        args = args->c.cdr;
+    }
+    if (function->type == PRIMITIVE_TYPE) {
+        int operation = inlineOperation(function->pf);
+        // integer arithmetic and comparisons as quickened calls do them
+        if (operation >= INLINE_ADD && properLength(values) == 2 &&
+            values->c.car->type == INT_TYPE &&
+            values->c.cdr->c.car->type == INT_TYPE) {
+            return arithmetic(operation, values->c.car->i,
+                              values->c.cdr->c.car->i);
+        }
+        if (!isPurePrimitive(function->pf) ||
+            !isSafeCall(function->pf, values)) {
+            return NULL;
+        }
+        return function->pf(values);
+    }
+    if (function->type != CLOSURE_TYPE) {
+        return NULL;
+    }
+    // the body must be one expression, held in the one cell of the code
+    // (see applyClosure), and the parameters bound as bindArguments binds
+    // them
+    Value *code = function->cl.functionCode;
+    Value *params = function->cl.paramNames;
+    if (properLength(code) != 1 || code->c.car->type != CONS_TYPE ||
+        properLength(params) != properLength(values)) {
+        return NULL;
+    }
+    Value *body = code->c.car->c.car;
+    if (body->type == SYMBOL_TYPE &&
+        (!strcmp(body->s, "set!") || !strcmp(body->s, "begin"))) {
+        return NULL;
+    }
+    Value *bindings = makeNull();
+    while (params->type == CONS_TYPE) {
+        bindings = cons(cons(params->c.car, cons(values->c.car, makeNull())),
+                        bindings);
+        params = params->c.cdr;
+        values = values->c.cdr;
+    }
+    Frame *inner = talloc(sizeof(Frame));
+    inner->bindings = bindings;
+    inner->parent = function->cl.frame;
+    return evalPure(body, inner, batch, nesting);
+}
+
+// Evaluates a let of one body expression whose bindings are all (name
+// expression)
+Value *pureLet(Value *args, Frame *frame, Batch *batch, int nesting) {
+    if (properLength(args) != 2 || args->c.car->type != CONS_TYPE ||
+        properLength(args->c.car) < 0 || isBodyForm(args->c.cdr->c.car)) {
+        return NULL;
+    }
+    Value *bindings = makeNull();
+    Value *rest = args->c.car;
+    while (rest->type == CONS_TYPE) {
+        Value *binding = rest->c.car;
+        if (binding->type != CONS_TYPE || properLength(binding) != 2 ||
+            binding->c.car->type != SYMBOL_TYPE) {
+            return NULL;
+        }
+        Value *value = evalPure(binding->c.cdr->c.car, frame, batch,
+                                nesting);
+        if (value == NULL) {
+            return NULL;
+        }
+        bindings = cons(cons(binding->c.car, cons(value, makeNull())),
+                        bindings);
+        rest = rest->c.cdr;
+    }
+    Frame *inner = talloc(sizeof(Frame));
+    inner->bindings = bindings;
+    inner->parent = frame;
+    return evalPure(args->c.cdr->c.car, inner, batch, nesting);
+}
+
+// Returns what eval gives for expr in frame, or NULL if it gives up
+Value *evalPure(Value *expr, Frame *frame, Batch *batch, int nesting) {
+    nesting = nesting + 1;
+    if (nesting > MAX_NESTING ||
+        __atomic_load_n(&batch->failed, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    switch (expr->type) {
+        case SYMBOL_TYPE:
+            return pureVariable(expr, frame);
+        case OPTIMIZED_TYPE:
+            if (guardsHold(expr->opt)) {
+                return evalPure(expr->opt->code, frame, batch, nesting);
+            }
+            return evalPure(expr->opt->original, frame, batch, nesting);
+        case QUICK_TYPE:
+            // a node is read but never changed
+            if (expr->quick->head == NULL) {
+                Value *value = NULL;
+                if (expr->quick->kind != QUICK_VARIABLE) {
+                    value = readVariable(expr->quick, frame);
+                }
+                return value != NULL ? value
+                                     : pureVariable(expr->quick->original,
+                                                    frame);
+            }
+            return pureCall(expr->quick->head, expr->quick->args, frame,
+                            batch, nesting);
+        case CONS_TYPE:
+            break;
+        default:
+            return expr;
+    }
+    Value *head = expr->c.car;
+    Value *args = expr->c.cdr;
+    int count = properLength(args);
+    int i;
+    if (head->type != SYMBOL_TYPE || count < 0) {
+        return NULL;
+    }
+    char *name = head->s;
+    if (!strcmp(name, "quote")) {
+        return count == 1 ? args->c.car : NULL;
+    } else if (!strcmp(name, "if")) {
+        if (count != 3) {
+            return NULL;
+        }
+        Value *test = evalPure(args->c.car, frame, batch, nesting);
+        if (test == NULL || test->type != BOOL_TYPE) {
+            return NULL;
+        }
+        Value *branch = args->c.cdr;
+        if (strcmp(test->s, "#t")) {
+            branch = branch->c.cdr;
+        }
+        return evalPure(branch->c.car, frame, batch, nesting);
+    } else if (!strcmp(name, "and") || !strcmp(name, "or")) {
+        char *decide = !strcmp(name, "and") ? "#f" : "#t";
+        for (i = 0; i < count; i++) {
+            Value *test = evalPure(args->c.car, frame, batch, nesting);
+            if (test == NULL || test->type != BOOL_TYPE) {
+                return NULL;
+            }
+            if (!strcmp(test->s, decide)) {
+                return makeBool(!strcmp(decide, "#t"));
+            }
+            args = args->c.cdr;
+        }
+        return makeBool(strcmp(decide, "#t"));
+    } else if (!strcmp(name, "let")) {
+        return pureLet(args, frame, batch, nesting);
+    } else if (!strcmp(name, "parallel-let") && count >= 1) {
+        return pureLet(args->c.cdr, frame, batch, nesting);
+    } else if (!strcmp(name, "parallel-call") && count >= 2) {
+        return pureCall(args->c.cdr->c.car, args->c.cdr->c.cdr, frame,
+                        batch, nesting);
+    } else if (isSpecialForm(name)) {
+        return NULL;
+    }
+    return pureCall(head, args, frame, batch, nesting);
+}
+
+// Evaluates the expression at a position in the spread of a batch
+void evalSpread(void *arg, int index) {
+    Batch *batch = arg;
+    int position = batch->spread[index];
+    Value *value = evalPure(batch->exprs[position], batch->frame, batch, 0);
+    batch->values[position] = value;
+    if (value == NULL) {
+        __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Evaluates count expressions in frame, those at the positions listed in
+// spread on the threads of the pool and the rest after them on this
+// thread, and returns their values, or NULL if one of them gave up
+Value **evalBatch(Value **exprs, int count, Value *spread, Frame *frame) {
+    Batch batch;
+    int spreadCount = 0;
+    int i;
+    if (poolSize() == 1) {
+        return NULL;
+    }
+    batch.exprs = exprs;
+    batch.values = talloc(sizeof(Value *) * count);
+    batch.spread = talloc(sizeof(int) * count);
+    batch.frame = frame;
+    batch.failed = 0;
+    for (i = 0; i < count; i++) {
+        batch.values[i] = NULL;
+    }
+    while (spread->type == CONS_TYPE) {
+        batch.spread[spreadCount] = spread->c.car->i;
+        spreadCount = spreadCount + 1;
+        spread = spread->c.cdr;
+    }
+    parallelFor(spreadCount, evalSpread, &batch);
+    for (i = 0; i < count && !batch.failed; i++) {
+        if (batch.values[i] == NULL) {
+            batch.values[i] = evalPure(exprs[i], frame, &batch, 0);
+            batch.failed = batch.values[i] == NULL;
+        }
+    }
+    return batch.failed ? NULL : batch.values;
+}
+
+// Returns 1 if positions is a list of increasing positions in a list of
+// count expressions
+int arePositions(Value *positions, int count) {
+    int last = -1;
+    if (properLength(positions) < 0) {
+        return 0;
+    }
+    while (positions->type == CONS_TYPE) {
+        Value *position = positions->c.car;
+        if (position->type != INT_TYPE || position->i <= last ||
+            position->i >= count) {
+            return 0;
+        }
+        last = position->i;
+        positions = positions->c.cdr;
+    }
+    return 1;
+}
+
+// Exits with a syntax error in the parallel form named name
+void parallelSyntaxError(char *name, Value *args) {
+    printf("%s: bad syntax in (%s ", name, name);
+    printInterpTree(args);
+    printf(")\n");
+    texit(1);
+}
+
+Value *evalParallelLet(Value *args, Frame *frame) {
+    if (properLength(args) < 3) {
+        parallelSyntaxError("parallel-let", args);
+    }
+    Value *let = args->c.cdr;
+    int count = properLength(let->c.car);
+    Value *rest = let->c.car;
+    while (rest->type == CONS_TYPE) {
+        if (rest->c.car->type != CONS_TYPE ||
+            properLength(rest->c.car) != 2) {
+            parallelSyntaxError("parallel-let", args);
+        }
+        rest = rest->c.cdr;
+    }
+    if (count < 0 || !arePositions(args->c.car, count)) {
+        parallelSyntaxError("parallel-let", args);
+    }
+    Value **exprs = talloc(sizeof(Value *) * count);
+    Value *bindings = let->c.car;
+    int i;
+    for (i = 0; i < count; i++) {
+        exprs[i] = bindings->c.car->c.cdr->c.car;
+        bindings = bindings->c.cdr;
+    }
+    // anything that gave up is evaluated again, in order, by let itself
+    return evalLetValues(let, frame,
+                         evalBatch(exprs, count, args->c.car, frame));
+}
+
+Value *evalParallelCall(Value *args, Frame *frame) {
+    if (properLength(args) < 2 ||
+        !arePositions(args->c.car, properLength(args) - 2)) {
+        parallelSyntaxError("parallel-call", args);
+    }
+    Value *function = eval(args->c.cdr->c.car, frame);
+    Value *rest = args->c.cdr->c.cdr;
+    int count = properLength(rest);
+    Value **exprs = talloc(sizeof(Value *) * count);
+    int i;
+    for (i = 0; i < count; i++) {
+        exprs[i] = rest->c.car;
+        rest = rest->c.cdr;
+    }
+    Value **values = evalBatch(exprs, count, args->c.car, frame);
+    if (values == NULL) {
+        return apply(function, evalEach(args->c.cdr->c.cdr, frame));
+    }
+    Value *list = makeNull();
+    for (i = count - 1; i >= 0; i--) {
+        list = cons(values[i], list);
+    }
+    return apply(function, list);
+}
@@ -0,0 +1,22 @@
+#include "value.h"
+
+#ifndef _PARALLEL
+#define _PARALLEL
+
+// Returns 1 if function is a primitive that has no effect beyond its
+// result, so that a call of it may be made on any thread
+int isPurePrimitive(Value *(*function)(struct Value *));
+
+// Evaluates (parallel-let positions bindings body ...), args being the part
+// after the head: a let whose binding expressions have no effect, those at
+// the positions listed being evaluated at the same time on the threads of
+// the pool
+Value *evalParallelLet(Value *args, Frame *frame);
+
+// Evaluates (parallel-call positions operator argument ...), args being the
+// part after the head: a call whose arguments have no effect, those at the
+// positions listed being evaluated at the same time on the threads of the
+// pool
+Value *evalParallelCall(Value *args, Frame *frame);
+
+#endif
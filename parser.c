@@ -10,10 +10,28 @@
 #include "talloc.h"
 #include "linkedlist.h"
 #include "interpreter.h"
+#include "numfmt.h"
+#include "stringops.h"
+#include "parser.h"
+#include "reader.h"
+
+// Nesting depth the parser handles without allocating its stack
+#define PARSE_STACK_SIZE 64
+
+// A list being read: its first and last cells and the location of its open
+// parenthesis
+struct OpenList {
+    Value *head;
+    Value *tail;
+    unsigned int loc;
+};
+
+typedef struct OpenList OpenList;
 
 // helper for print function that avoids printing first open paren at first
 // new depth
 void printTreeHelper(Value *tree, int firstItem) {
+    char number[NUMFMT_SIZE];
     switch(tree->type){
         case(CONS_TYPE):
             if (firstItem) {
@@ -30,14 +48,17 @@ void printTreeHelper(Value *tree, int firstItem) {
             }
             printTreeHelper(cdr(tree), 1);
             break;
-        case(STR_TYPE):
-            printf("%s", tree->s);
+        case(STR_TYPE):{
+            int length;
+            char *text = writtenString(tree, &length);
+            fwrite(text, 1, length, stdout);
             break;
+        }
         case(INT_TYPE):
-            printf("%d", tree->i);
+            fwrite(number, 1, formatInt(tree->i, number), stdout);
             break;
         case(DOUBLE_TYPE):
-            printf("%lf", tree->d);
+            fwrite(number, 1, formatDouble(tree->d, number), stdout);
             break;
         case(BOOL_TYPE):
             printf("%s", tree->s);
@@ -56,77 +77,79 @@ void printTree(Value *tree) {
     printTreeHelper(tree, 1);
 }
 
-// Displays a syntax error and exits parser (could be expanded in future)
-void syntaxError(int error) {
-    printf("Syntax Error: ");
+// Displays a syntax error at a location and exits parser
+void syntaxError(int error, unsigned int loc) {
     switch (error) {
         case(1):
-            printf("premature close parenthesis");
+            sourceError(loc, "Syntax Error: premature close parenthesis");
             break;
         case(2):
-            printf("unclosed parenthesis");
+            sourceError(loc, "Syntax Error: unclosed parenthesis");
             break;
     }
-    printf("\n");
-    texit(1);
 }
-    
-// Add a token to the parse tree. If it's a close paren, pop off all tokens
-// up to the last open paren, and add the poped tokens as a new subtree.
-Value *addToParseTree(Value *tree, int *depth, Value *token) {
-    if (token->type == CLOSE_TYPE) {
-        Value *stack = makeNull();
-        *depth = *depth - 1;
-        if (*depth < 0) {
-            syntaxError(1);
+
+// Reads the next datum from the lexer in one pass and returns it, or NULL at
+// the end of the text. Lists still open are kept on an explicit stack with
+// their last cell, so elements are appended in order as they are read and
+// deep nesting cannot overflow the C stack.
+Value *parseDatum(Lexer *lexer) {
+    OpenList initial[PARSE_STACK_SIZE];
+    OpenList *stack = initial;
+    int capacity = PARSE_STACK_SIZE;
+    int depth = 0;
+
+    while (1) {
+        Value *token = nextToken(lexer);
+        Value *datum;
+        if (token == NULL) {
+            if (depth > 0) {
+                syntaxError(2, stack[depth - 1].loc);
+            }
+            return NULL;
+        }
+        if (token->type == OPEN_TYPE) {
+            if (depth == capacity) {
+                OpenList *larger = talloc(sizeof(OpenList) * capacity * 2);
+                memcpy(larger, stack, sizeof(OpenList) * capacity);
+                stack = larger;
+                capacity = capacity * 2;
+            }
+            stack[depth].head = NULL;
+            stack[depth].tail = NULL;
+            stack[depth].loc = token->loc;
+            depth = depth + 1;
+            continue;
         }
-        while (token->type != OPEN_TYPE) {
-            if (token->type != CLOSE_TYPE) {
-                stack = cons(token, stack);
-                tree = cdr(tree);
+        if (token->type == CLOSE_TYPE) {
+            if (depth == 0) {
+                syntaxError(1, token->loc);
             }
-            if (tree->type == CONS_TYPE) {
-                token = car(tree);
-            } else {
-                token = tree;
+            depth = depth - 1;
+            datum = stack[depth].head;
+            if (datum == NULL) {
+                datum = makeNull(); // empty list
+                datum->loc = stack[depth].loc;
             }
+        } else {
+            datum = token;
         }
-        if (tree->type == CONS_TYPE) {
-            tree = cdr(tree); //remove open paren from tree
+        if (depth == 0) {
+            return datum;
         }
-        tree = cons(stack, tree);
-    } else {
-        if (token->type == OPEN_TYPE) {
-            *depth = *depth + 1;
+
+        // append to the innermost open list; its first cell is located at
+        // the open parenthesis
+        OpenList *list = stack + depth - 1;
+        if (list->head == NULL) {
+            list->head = cons(datum, makeNull());
+            list->head->loc = list->loc;
+            list->tail = list->head;
+        } else {
+            Value *cell = cons(datum, list->tail->c.cdr);
+            cell->loc = datum->loc;
+            list->tail->c.cdr = cell;
+            list->tail = cell;
         }
-        tree = cons(token, tree);
     }
-    return tree;
 }
-
-// Takes a list of tokens from a Racket program, and returns a pointer to a
-// parse tree representing that program.
-Value *parse(Value *list) {
-    Value *tree = makeNull();
-    int depth = 0;
-    Value *current = list;
-    assert(current != NULL && "Error (parse): null pointer");
-    
-    while (current->type != NULL_TYPE) {
-        Value *token = car(current);
-        tree = addToParseTree(tree,&depth,token);
-        current = cdr(current);
-    }
-    
-    if (depth > 0) {
-        syntaxError(2);
-    }
-    
-    Value *newTree = makeNull();
-    while (tree->type == CONS_TYPE) { //reverse multiline program
-        newTree = cons(car(tree), newTree);
-        tree = cdr(tree);
-    }
-    
-    return newTree;
-}
\ No newline at end of file
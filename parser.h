@@ -1,11 +1,12 @@
 #include "value.h"
+#include "tokenizer.h"
 
 #ifndef _PARSER
 #define _PARSER
 
-// Takes a list of tokens from a Racket program, and returns a pointer to a
-// parse tree representing that program.
-Value *parse(Value *tokens);
+// Reads the next datum from the lexer and returns its parse tree, or NULL at
+// the end of the text
+Value *parseDatum(Lexer *lexer);
 
 
 // Prints the tree to the screen in a readable fashion. It should look just like
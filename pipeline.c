@@ -0,0 +1,166 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Pipelines: nested map, filter and fold calls done in one traversal
+*/
+
+/*
+(pipeline e) evaluates e, a map, filter, fold or fold-right whose list is
+given by a map or filter, whose list is given by another, and so on, without
+building the lists in between:
+
+    (pipeline (fold + 0 (filter even? (map square xs))))
+
+walks xs once, squaring each item, testing the square and adding it to the
+sum before taking the next item. A map is a stage only if it has one list;
+whatever the innermost stage is given is evaluated like any expression.
+
+The procedures and initial values of the stages are evaluated in the order
+the nested calls would evaluate them, outermost first, then the list, and
+each stage is checked as map, filter and fold check their arguments,
+innermost first, before any item is taken. What differs is the order of the
+calls: each item goes through every stage in turn, where the nested calls
+apply the innermost procedure to every item before the next stage applies
+its own to any. The optimizer turns nested calls into a pipeline by itself
+only where no stage after the first can fail or have any other effect, so
+that the order cannot be told apart (see optimize.c).
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "optimize.h"
+#include "pipeline.h"
+#include "primitives.h"
+#include "talloc.h"
+#include "value.h"
+
+// What a stage does with each item that reaches it
+enum {
+    STAGE_MAP,
+    STAGE_FILTER,
+    STAGE_FOLD,
+    STAGE_FOLD_RIGHT
+};
+
+// The names of the stages, by kind
+char *stageNames[] = {"map", "filter", "fold", "fold-right"};
+
+// Returns the kind of a stage named name, or -1
+int stageKind(char *name) {
+    int kind;
+    for (kind = STAGE_MAP; kind <= STAGE_FOLD_RIGHT; kind++) {
+        if (!strcmp(stageNames[kind], name)) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+// Returns 1 if expr is a stage of a pipeline: a map of one list or a
+// filter, or, if outermost is set, also a fold or fold-right
+int isStage(Value *expr, int outermost) {
+    if (expr->type != CONS_TYPE || car(expr)->type != SYMBOL_TYPE) {
+        return 0;
+    }
+    int kind = stageKind(car(expr)->s);
+    int count = properLength(cdr(expr));
+    if (kind == STAGE_MAP || kind == STAGE_FILTER) {
+        return count == 2;
+    }
+    return outermost && kind >= 0 && count == 3;
+}
+
+// Returns the expression a stage takes its list from
+Value *stageList(Value *stage) {
+    Value *args = cdr(stage);
+    while (cdr(args)->type == CONS_TYPE) {
+        args = cdr(args);
+    }
+    return car(args);
+}
+
+Value *evalPipeline(Value *args, Frame *frame) {
+    if (properLength(args) != 1 || !isStage(car(args), 1)) {
+        printf("pipeline: bad syntax in (pipeline ");
+        printInterpTree(args);
+        printf(")\n");
+        texit(1);
+    }
+    int count = 1;
+    Value *stage = car(args);
+    while (isStage(stageList(stage), 0)) {
+        count = count + 1;
+        stage = stageList(stage);
+    }
+
+    // the stages from the innermost out, evaluated from the outermost in
+    int *kinds = talloc(sizeof(int) * count);
+    Value **functions = talloc(sizeof(Value *) * count);
+    Value **cells = talloc(sizeof(Value *) * count);
+    Value *result = NULL;
+    int i;
+    stage = car(args);
+    for (i = count - 1; i >= 0; i--) {
+        kinds[i] = stageKind(car(stage)->s);
+        functions[i] = eval(car(cdr(stage)), frame);
+        cells[i] = NULL;
+        if (kinds[i] == STAGE_FOLD || kinds[i] == STAGE_FOLD_RIGHT) {
+            result = eval(car(cdr(cdr(stage))), frame);
+        }
+        if (i > 0) {
+            stage = stageList(stage);
+        }
+    }
+    Value *list = eval(stageList(stage), frame);
+    int n = 0;
+    for (i = 0; i < count; i++) {
+        checkProcedure(functions[i], stageNames[kinds[i]]);
+        if (i == 0) {
+            n = checkList(list, stageNames[kinds[i]]);
+        }
+    }
+
+    int last = kinds[count - 1];
+    Value *head = makeNull();
+    Value *tail = NULL;
+    Value **items = NULL;
+    int kept = 0;
+    if (last == STAGE_FOLD_RIGHT) {
+        items = talloc(sizeof(Value *) * (n > 0 ? n : 1));
+    }
+    while (list->type == CONS_TYPE) {
+        Value *item = car(list);
+        int passed = 1;
+        list = cdr(list);
+        for (i = 0; i < count && passed; i++) {
+            switch (kinds[i]) {
+                case STAGE_MAP:
+                    item = callWith1(functions[i], &cells[i], item);
+                    break;
+                case STAGE_FILTER:
+                    passed = isTrue(callWith1(functions[i], &cells[i],
+                                              item));
+                    break;
+                case STAGE_FOLD:
+                    result = callWith2(functions[i], &cells[i], item,
+                                       result);
+                    break;
+                default:
+                    items[kept] = item;
+                    kept = kept + 1;
+                    break;
+            }
+        }
+        if (passed && (last == STAGE_MAP || last == STAGE_FILTER)) {
+            appendItem(&head, &tail, item);
+        }
+    }
+    if (last == STAGE_FOLD_RIGHT) {
+        for (i = kept - 1; i >= 0; i--) {
+            result = callWith2(functions[count - 1], &cells[count - 1],
+                               items[i], result);
+        }
+    }
+    return last == STAGE_MAP || last == STAGE_FILTER ? head : result;
+}
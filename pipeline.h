@@ -0,0 +1,17 @@
+#include "value.h"
+
+#ifndef _PIPELINE
+#define _PIPELINE
+
+// Returns 1 if expr is a stage of a pipeline: a map of one list or a
+// filter, or, if outermost is set, also a fold or fold-right
+int isStage(Value *expr, int outermost);
+
+// Returns the expression a stage takes its list from
+Value *stageList(Value *stage);
+
+// Evaluates (pipeline stage), args being the part after the head, in one
+// traversal of the innermost list
+Value *evalPipeline(Value *args, Frame *frame);
+
+#endif
@@ -0,0 +1,450 @@
+/*
+Ports for Scheme interpreter
+Created by Tom Choi, Kaya Govek, Jonah Tuchow
+
+A port reads or writes a file through its own 64KB buffer with plain read
+and write calls, so reading a line or writing a string is a memchr or a
+memcpy almost every time. An input port reads a whole buffer at a time and
+only grows its buffer for a line longer than that. An output port that
+cannot fit a string into its buffer writes the buffer and the string
+together with one writev, without copying the string. Ports live until the
+program exits, when any that are still open are flushed and closed.
+
+read parses data with the same lexer and parser as programs. It scans the
+buffer for the end of the next datum the way a piped program is read, then
+lexes and parses just that datum straight into values; symbols are
+interned and strings copied out, so the buffer can be reused and a file of
+any size is read through the same 64KB.
+
+The interpreter has no character type, so read-char and peek-char return
+strings of one character, as string-index takes them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "ports.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "primitives.h"
+#include "stringops.h"
+#include "output.h"
+#include "parser.h"
+#include "reader.h"
+#include "talloc.h"
+#include "value.h"
+
+// Every port opened so far
+Port *ports = NULL;
+
+// The port that display is printing a value to
+Port *displayPort = NULL;
+
+// Flushes and closes every port that is still open, and frees them all;
+// registered with atexit
+void releasePorts(){
+    while (ports != NULL){
+        Port *port = ports;
+        if (!port->closed){
+            if (!port->input){
+                size_t written = 0;
+                while (written < port->end){
+                    ssize_t count = write(port->fd, port->buffer + written,
+                                          port->end - written);
+                    if (count <= 0){
+                        break;
+                    }
+                    written = written + count;
+                }
+            }
+            close(port->fd);
+            free(port->buffer);
+        }
+        ports = port->next;
+        free(port->path);
+        free(port);
+    }
+}
+
+// Exits after a failed system call on a port
+void portError(Port *port, char *symbol, char *action){
+    printf("%s: error %s port\npath: %s\nsystem error: %s; errno=%d\n",
+           symbol, action, port->path, strerror(errno), errno);
+    port->end = 0;
+    texit(1);
+}
+
+// Writes all of length bytes of text to the port's file
+void writeAll(Port *port, const char *text, size_t length, char *symbol){
+    while (length > 0){
+        ssize_t count = write(port->fd, text, length);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            portError(port, symbol, "writing to");
+        }
+        text = text + count;
+        length = length - count;
+    }
+}
+
+// Writes out what is in an output port's buffer
+void flushPort(Port *port, char *symbol){
+    writeAll(port, port->buffer, port->end, symbol);
+    port->end = 0;
+}
+
+// Writes text to an output port, through its buffer if it fits there and
+// together with what is buffered in one writev if it does not
+void writePort(Port *port, const char *text, size_t length, char *symbol){
+    if (port->end + length <= port->capacity){
+        memcpy(port->buffer + port->end, text, length);
+        port->end = port->end + length;
+        return;
+    }
+    struct iovec parts[2];
+    parts[0].iov_base = port->buffer;
+    parts[0].iov_len = port->end;
+    parts[1].iov_base = (void *)text;
+    parts[1].iov_len = length;
+    ssize_t count = writev(port->fd, parts, 2);
+    if (count < 0 && errno != EINTR){
+        portError(port, symbol, "writing to");
+    }
+    if (count < 0){
+        count = 0;
+    }
+
+    // finish whatever the writev left over
+    if ((size_t)count < port->end){
+        writeAll(port, port->buffer + count, port->end - count, symbol);
+        count = port->end;
+    }
+    count = count - port->end;
+    port->end = 0;
+    writeAll(port, text + count, length - count, symbol);
+}
+
+// Sends the printer's output to displayPort
+void writeDisplayPort(const char *text, size_t length){
+    writePort(displayPort, text, length, "display");
+}
+
+// Reads more of an input port's file into its buffer, moving the unread
+// bytes to the front first and growing the buffer if they fill it. Returns
+// the number of bytes read, which is 0 at the end of the file.
+size_t fillPort(Port *port, char *symbol){
+    if (port->start > 0){
+        memmove(port->buffer, port->buffer + port->start,
+                port->end - port->start);
+        port->end = port->end - port->start;
+        port->start = 0;
+    }
+    if (port->end == port->capacity){
+        port->capacity = port->capacity * 2;
+        port->buffer = realloc(port->buffer, port->capacity);
+    }
+    while (1){
+        ssize_t count = read(port->fd, port->buffer + port->end,
+                             port->capacity - port->end);
+        if (count >= 0){
+            port->end = port->end + count;
+            return count;
+        }
+        if (errno != EINTR){
+            portError(port, symbol, "reading from");
+        }
+    }
+}
+
+// Creates the end-of-file object returned by the read primitives
+Value *makeEof(){
+    Value *eof = makeNull();
+    eof->type = EOF_TYPE;
+    return eof;
+}
+
+// Creates the value of a primitive that returns nothing
+Value *makeVoid(){
+    Value *void_ptr = makeNull();
+    void_ptr->type = VOID_TYPE;
+    return void_ptr;
+}
+
+// Exits with a contract violation unless value is an open port of the
+// given direction
+Port *checkPort(Value *value, int input, char *symbol){
+    char *direction = input ? "input" : "output";
+    if (value->type != PORT_TYPE || value->port->input != input){
+        printf("%s: contract violation\nexpected: %s-port?\ngiven: ",
+               symbol, direction);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    if (value->port->closed){
+        printf("%s: %s port is closed\nport: ", symbol, direction);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    return value->port;
+}
+
+// Returns the port given as the last of count arguments, or NULL if there
+// are only count - 1, meaning stdout
+Port *optionalOutputPort(Value *args, int count, char *symbol){
+    int i = length(args);
+    if (i != count && i != count - 1){
+        printf("%s: arity mismatch;\nthe expected number of arguments ",
+               symbol);
+        printf("does not match the given number\nexpected: %d or %d\n",
+               count - 1, count);
+        printf("given: %d\n", i);
+        texit(1);
+    }
+    if (i == count - 1){
+        return NULL;
+    }
+    while (cdr(args)->type != NULL_TYPE){
+        args = cdr(args);
+    }
+    return checkPort(car(args), 0, symbol);
+}
+
+// Writes text to an output port, or to stdout if port is NULL
+void writeText(Port *port, const char *text, size_t length, char *symbol){
+    if (port == NULL){
+        writeOutput(text, length);
+    } else {
+        writePort(port, text, length, symbol);
+    }
+}
+
+// Opens the file named by a string argument as a new port
+Value *openPort(Value *args, int input, char *symbol){
+    checkArity(args, 1, symbol);
+    checkString(car(args), symbol);
+    Value *name = car(args);
+    char *path = malloc(name->str.length + 1);
+    memcpy(path, stringContents(name), name->str.length);
+    path[name->str.length] = '\0';
+
+    int fd;
+    if (input){
+        fd = open(path, O_RDONLY);
+    } else {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd < 0){
+        printf("%s: cannot open %s file\npath: %s\n", symbol,
+               input ? "input" : "output", path);
+        printf("system error: %s; errno=%d\n", strerror(errno), errno);
+        free(path);
+        texit(1);
+    }
+    if (ports == NULL){
+        atexit(releasePorts);
+    }
+    Port *port = malloc(sizeof(Port));
+    port->path = path;
+    port->fd = fd;
+    port->input = input;
+    port->closed = 0;
+    port->buffer = malloc(PORT_BUFFER_SIZE);
+    port->capacity = PORT_BUFFER_SIZE;
+    port->start = 0;
+    port->end = 0;
+    initLexer(&port->lexer, port->buffer, 0, 0, 1);
+    port->next = ports;
+    ports = port;
+
+    Value *value = makeNull();
+    value->type = PORT_TYPE;
+    value->port = port;
+    return value;
+}
+
+Value *primitiveOpenInputFile(Value *args){
+    return openPort(args, 1, "open-input-file");
+}
+
+Value *primitiveOpenOutputFile(Value *args){
+    return openPort(args, 0, "open-output-file");
+}
+
+Value *primitiveClosePort(Value *args){
+    checkArity(args, 1, "close-port");
+    Value *value = car(args);
+    if (value->type != PORT_TYPE){
+        printf("close-port: contract violation\nexpected: port?\ngiven: ");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    Port *port = value->port;
+    if (!port->closed){
+        if (!port->input){
+            flushPort(port, "close-port");
+        }
+        close(port->fd);
+        free(port->buffer);
+        port->buffer = NULL;
+        port->closed = 1;
+    }
+    return makeVoid();
+}
+
+// Drops what read had scanned but not yet parsed, before the port's buffer is
+// read some other way
+void dropReadAhead(Port *port){
+    port->lexer.length = 0;
+    port->lexer.pos = 0;
+    port->lexer.pendingOpen = 0;
+}
+
+// (read port) parses the next datum of an input port into a value, or
+// returns the end-of-file object once only space and comments are left
+Value *primitiveRead(Value *args){
+    checkArity(args, 1, "read");
+    Port *port = checkPort(car(args), 1, "read");
+
+    // the text scanned last time may hold more than one datum, as in 'x
+    Value *datum = parseDatum(&port->lexer);
+    if (datum != NULL){
+        return datum;
+    }
+    DatumScan scan;
+    size_t end;
+    int atEnd = 0;
+    startDatumScan(&scan);
+    while (!scanDatum(&scan, port->buffer + port->start,
+                      port->end - port->start, atEnd, &end)){
+        if (atEnd){
+            port->start = port->end;
+            return makeEof();
+        }
+        atEnd = fillPort(port, "read") == 0;
+    }
+    Lexer *lexer = &port->lexer;
+    lexer->text = port->buffer + port->start;
+    lexer->length = end;
+    lexer->pos = 0;
+    port->start = port->start + end;
+    return primitiveRead(args);
+}
+
+// (read-line port) returns the next line without its newline, or the
+// end-of-file object once the file is used up
+Value *primitiveReadLine(Value *args){
+    checkArity(args, 1, "read-line");
+    Port *port = checkPort(car(args), 1, "read-line");
+    dropReadAhead(port);
+    size_t scanned = 0;
+    while (1){
+        char *text = port->buffer + port->start;
+        char *newline = memchr(text + scanned, '\n',
+                               port->end - port->start - scanned);
+        if (newline != NULL){
+            Value *line = makeString(text, newline - text);
+            port->start = port->start + (newline - text) + 1;
+            return line;
+        }
+        scanned = port->end - port->start;
+        if (fillPort(port, "read-line") == 0){
+            if (scanned == 0){
+                return makeEof();
+            }
+            // the last line has no newline
+            Value *line = makeString(port->buffer + port->start, scanned);
+            port->start = port->end;
+            return line;
+        }
+    }
+}
+
+// Returns the next character of an input port as a string, or the
+// end-of-file object, consuming it if consume is set
+Value *nextChar(Value *args, int consume, char *symbol){
+    checkArity(args, 1, symbol);
+    Port *port = checkPort(car(args), 1, symbol);
+    dropReadAhead(port);
+    if (port->start == port->end && fillPort(port, symbol) == 0){
+        return makeEof();
+    }
+    Value *character = makeString(port->buffer + port->start, 1);
+    if (consume){
+        port->start = port->start + 1;
+    }
+    return character;
+}
+
+Value *primitiveReadChar(Value *args){
+    return nextChar(args, 1, "read-char");
+}
+
+Value *primitivePeekChar(Value *args){
+    return nextChar(args, 0, "peek-char");
+}
+
+// (write-string string [port]) writes the characters of a string
+Value *primitiveWriteString(Value *args){
+    Port *port = optionalOutputPort(args, 2, "write-string");
+    checkString(car(args), "write-string");
+    writeText(port, stringContents(car(args)), car(args)->str.length,
+              "write-string");
+    return makeVoid();
+}
+
+// Writes a value the way display shows it: strings, in lists or not,
+// without their quotes, and lists in parentheses
+void writeDisplayed(Value *value){
+    if (value->type == CONS_TYPE){
+        writeOutputChar('(');
+        displayValue(value);
+        writeOutputChar(')');
+    } else if (value->type == NULL_TYPE){
+        writeOutput("()", 2);
+    } else if (value->type != VOID_TYPE){
+        displayValue(value);
+    }
+}
+
+// (display value [port])
+Value *primitiveDisplay(Value *args){
+    Port *port = optionalOutputPort(args, 2, "display");
+    if (port == NULL){
+        writeDisplayed(car(args));
+        return makeVoid();
+    }
+
+    // point the printer at the port for this one value
+    flushOutput();
+    displayPort = port;
+    OutputSink previous = setOutputSink(writeDisplayPort);
+    writeDisplayed(car(args));
+    flushOutput();
+    setOutputSink(previous);
+    return makeVoid();
+}
+
+// (newline [port])
+Value *primitiveNewline(Value *args){
+    Port *port = optionalOutputPort(args, 1, "newline");
+    if (port == NULL){
+        writeOutputChar('\n');
+    } else {
+        writePort(port, "\n", 1, "newline");
+    }
+    return makeVoid();
+}
+
+Value *primitiveEofObject(Value *args){
+    checkArity(args, 1, "eof-object?");
+    return makeBool(car(args)->type == EOF_TYPE);
+}
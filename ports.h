@@ -0,0 +1,44 @@
+#include "value.h"
+#include "tokenizer.h"
+
+#ifndef _PORTS
+#define _PORTS
+
+// Size of the buffer behind every port
+#define PORT_BUFFER_SIZE 65536
+
+// A file opened for reading or writing. An input port holds the unread
+// bytes buffer[start, end); an output port holds end bytes not yet written.
+// read lexes data with lexer, so its token blocks last from one datum to the
+// next.
+struct Port {
+    char *path;
+    int fd;
+    int input;
+    int closed;
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    Lexer lexer;
+    struct Port *next;
+};
+
+typedef struct Port Port;
+
+// Creates the end-of-file object returned by the read primitives
+Value *makeEof();
+
+Value *primitiveOpenInputFile(Value *args);
+Value *primitiveOpenOutputFile(Value *args);
+Value *primitiveClosePort(Value *args);
+Value *primitiveRead(Value *args);
+Value *primitiveReadLine(Value *args);
+Value *primitiveReadChar(Value *args);
+Value *primitivePeekChar(Value *args);
+Value *primitiveWriteString(Value *args);
+Value *primitiveDisplay(Value *args);
+Value *primitiveNewline(Value *args);
+Value *primitiveEofObject(Value *args);
+
+#endif
@@ -13,6 +13,42 @@ Created by Tom Choi, Kaya Govek, Jonah Tuchow
 #include "value.h"
 #include "tokenizer.h"
 #include "parser.h"
+#include "primitives.h"
+#include "hamt.h"
+#include "stringops.h"
+
+// Exits with an arity mismatch error unless args has exactly expected items
+void checkArity(Value *args, int expected, char *symbol) {
+    int i = 0;
+    Value *args_ptr = args;
+    while (args_ptr->type != NULL_TYPE){
+        i = i + 1;
+        args_ptr = cdr(args_ptr);
+    }
+    if (i != expected){
+        printf("%s: arity mismatch;\nthe expected number of arguments ", symbol);
+        printf("does not match the given number\nexpected: %d\ngiven: ", expected);
+        printf("%d\n", i);
+        texit(1);
+    }
+}
+
+// Creates a new BOOL_TYPE value
+Value *makeBool(int truth) {
+    Value *boolValue = makeNull();
+    boolValue->type = BOOL_TYPE;
+    if (truth){
+        boolValue->s = "#t";
+    }else{
+        boolValue->s = "#f";
+    }
+    return boolValue;
+}
+
+// Returns 0 only for #f; every other value counts as true
+int isTrue(Value *value) {
+    return !(value->type == BOOL_TYPE && !strcmp(value->s, "#f"));
+}
 
 Value *checkMathArgs(Value *args, char *symbol) {
     Value *numArgs = car(checkNumArgs(args));
@@ -440,10 +476,7 @@ Value *primitiveCons(Value *args){
     
     // improper list: add a dot
     if (cdrPart->type != CONS_TYPE && cdrPart->type != NULL_TYPE){
-        Value *dot = makeNull();
-        dot->type = STR_TYPE;
-        dot->s = ".";
-        consReturn = cons(dot, consReturn);
+        consReturn = cons(makeDot(), consReturn);
     }
     
     consReturn = cons(carPart, consReturn);
@@ -531,3 +564,343 @@ Value *primitiveLessEqual(Value *args) {
     return lessEqualReturn;
 }
 
+
+/*
+Native list library. Results are built front to back in a single pass by
+keeping a pointer to the last cell, so no intermediate list is reversed.
+*/
+
+// Appends item to the list that ends at *tail; *head is the first cell
+void appendItem(Value **head, Value **tail, Value *item) {
+    Value *cell = cons(item, makeNull());
+    if (*tail == NULL) {
+        *head = cell;
+    } else {
+        (*tail)->c.cdr = cell;
+    }
+    *tail = cell;
+}
+
+// Exits with a contract violation unless value is a proper list
+int checkList(Value *value, char *symbol) {
+    int i = 0;
+    Value *list = value;
+    while (list->type == CONS_TYPE) {
+        i = i + 1;
+        list = cdr(list);
+    }
+    if (list->type != NULL_TYPE) {
+        printf("%s: contract violation\nexpected: list?\ngiven: ", symbol);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    return i;
+}
+
+// Exits with a contract violation unless value can be applied
+void checkProcedure(Value *value, char *symbol) {
+    if (value->type != CLOSURE_TYPE && value->type != PRIMITIVE_TYPE &&
+        value->type != MEMO_TYPE) {
+        printf("%s: contract violation\nexpected: procedure?\ngiven: ", symbol);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+}
+
+// Returns a list of n argument cells for calling function repeatedly.
+// Closures copy their arguments into a new frame, so the same cells can be
+// refilled for every call; primitives may keep their argument list, so they
+// get fresh cells each time.
+Value *argumentCells(Value *function, Value *cells, int n) {
+    if (cells != NULL && function->type == CLOSURE_TYPE) {
+        return cells;
+    }
+    Value *list = makeNull();
+    int i;
+    for (i = 0; i < n; i++) {
+        list = cons(makeNull(), list);
+    }
+    return list;
+}
+
+// Calls function on one argument
+Value *callWith1(Value *function, Value **cells, Value *a) {
+    *cells = argumentCells(function, *cells, 1);
+    (*cells)->c.car = a;
+    return apply(function, *cells);
+}
+
+// Calls function on two arguments
+Value *callWith2(Value *function, Value **cells, Value *a, Value *b) {
+    *cells = argumentCells(function, *cells, 2);
+    (*cells)->c.car = a;
+    cdr(*cells)->c.car = b;
+    return apply(function, *cells);
+}
+
+Value *primitiveList(Value *args) {
+    return args;
+}
+
+Value *primitiveLength(Value *args) {
+    checkArity(args, 1, "length");
+    Value *result = makeNull();
+    result->type = INT_TYPE;
+    result->i = checkList(car(args), "length");
+    return result;
+}
+
+Value *primitiveReverse(Value *args) {
+    checkArity(args, 1, "reverse");
+    checkList(car(args), "reverse");
+    Value *result = makeNull();
+    Value *list = car(args);
+    while (list->type == CONS_TYPE) {
+        result = cons(car(list), result);
+        list = cdr(list);
+    }
+    return result;
+}
+
+Value *primitiveAppend(Value *args) {
+    Value *head = makeNull();
+    Value *tail = NULL;
+    Value *args_ptr = args;
+    if (args->type == NULL_TYPE) {
+        return head;
+    }
+    // copy every list but the last one, which is shared
+    while (cdr(args_ptr)->type != NULL_TYPE) {
+        checkList(car(args_ptr), "append");
+        Value *list = car(args_ptr);
+        while (list->type == CONS_TYPE) {
+            appendItem(&head, &tail, car(list));
+            list = cdr(list);
+        }
+        args_ptr = cdr(args_ptr);
+    }
+    Value *last = car(args_ptr);
+    // improper list: add a dot, as cons does
+    if (last->type != CONS_TYPE && last->type != NULL_TYPE && tail != NULL) {
+        last = cons(makeDot(), last);
+    }
+    if (tail == NULL) {
+        return last;
+    }
+    tail->c.cdr = last;
+    return head;
+}
+
+Value *primitiveListRef(Value *args) {
+    checkArity(args, 2, "list-ref");
+    Value *list = car(args);
+    Value *index = car(cdr(args));
+    if (index->type != INT_TYPE || index->i < 0) {
+        printf("list-ref: contract violation\n");
+        printf("expected: exact-nonnegative-integer?\ngiven: ");
+        printInterpTree(index);
+        printf("\n");
+        texit(1);
+    }
+    int i;
+    for (i = 0; i < index->i && list->type == CONS_TYPE; i++) {
+        list = cdr(list);
+    }
+    if (list->type != CONS_TYPE) {
+        printf("list-ref: index too large for list\nindex: %d\n", index->i);
+        texit(1);
+    }
+    return car(list);
+}
+
+Value *primitiveEqualP(Value *args) {
+    checkArity(args, 2, "equal?");
+    return makeBool(valuesEqual(car(args), car(cdr(args))));
+}
+
+Value *primitiveAssoc(Value *args) {
+    checkArity(args, 2, "assoc");
+    Value *key = car(args);
+    Value *list = car(cdr(args));
+    checkList(list, "assoc");
+    while (list->type == CONS_TYPE) {
+        Value *pair = car(list);
+        if (pair->type != CONS_TYPE) {
+            printf("assoc: non-pair found in list: ");
+            printInterpTree(pair);
+            printf("\n");
+            texit(1);
+        }
+        if (valuesEqual(car(pair), key)) {
+            return pair;
+        }
+        list = cdr(list);
+    }
+    return makeBool(0);
+}
+
+Value *primitiveMap(Value *args) {
+    int i = length(args);
+    if (i < 2) {
+        printf("map: arity mismatch;\nthe expected number of arguments ");
+        printf("does not match the given number\nexpected: at least 2\n");
+        printf("given: %d\n", i);
+        texit(1);
+    }
+    Value *function = car(args);
+    checkProcedure(function, "map");
+    Value *head = makeNull();
+    Value *tail = NULL;
+    Value *cells = NULL;
+
+    if (i == 2) {
+        Value *list = car(cdr(args));
+        checkList(list, "map");
+        while (list->type == CONS_TYPE) {
+            appendItem(&head, &tail, callWith1(function, &cells, car(list)));
+            list = cdr(list);
+        }
+        return head;
+    }
+
+    // several lists: walk them in step, stopping at the shortest
+    int n = i - 1;
+    Value **lists = talloc(sizeof(Value *) * n);
+    Value *args_ptr = cdr(args);
+    int j;
+    for (j = 0; j < n; j++) {
+        checkList(car(args_ptr), "map");
+        lists[j] = car(args_ptr);
+        args_ptr = cdr(args_ptr);
+    }
+    while (1) {
+        for (j = 0; j < n; j++) {
+            if (lists[j]->type != CONS_TYPE) {
+                return head;
+            }
+        }
+        cells = argumentCells(function, cells, n);
+        Value *cell = cells;
+        for (j = 0; j < n; j++) {
+            cell->c.car = car(lists[j]);
+            lists[j] = cdr(lists[j]);
+            cell = cdr(cell);
+        }
+        appendItem(&head, &tail, apply(function, cells));
+    }
+}
+
+Value *primitiveFilter(Value *args) {
+    checkArity(args, 2, "filter");
+    Value *function = car(args);
+    Value *list = car(cdr(args));
+    checkProcedure(function, "filter");
+    checkList(list, "filter");
+    Value *head = makeNull();
+    Value *tail = NULL;
+    Value *cells = NULL;
+    while (list->type == CONS_TYPE) {
+        if (isTrue(callWith1(function, &cells, car(list)))) {
+            appendItem(&head, &tail, car(list));
+        }
+        list = cdr(list);
+    }
+    return head;
+}
+
+Value *primitiveFold(Value *args) {
+    checkArity(args, 3, "fold");
+    Value *function = car(args);
+    Value *result = car(cdr(args));
+    Value *list = car(cdr(cdr(args)));
+    checkProcedure(function, "fold");
+    checkList(list, "fold");
+    Value *cells = NULL;
+    while (list->type == CONS_TYPE) {
+        result = callWith2(function, &cells, car(list), result);
+        list = cdr(list);
+    }
+    return result;
+}
+
+Value *primitiveFoldRight(Value *args) {
+    checkArity(args, 3, "fold-right");
+    Value *function = car(args);
+    Value *result = car(cdr(args));
+    Value *list = car(cdr(cdr(args)));
+    checkProcedure(function, "fold-right");
+    int n = checkList(list, "fold-right");
+    // walk the list once into an array instead of recursing on its length
+    Value **items = talloc(sizeof(Value *) * (n > 0 ? n : 1));
+    Value *cells = NULL;
+    int i;
+    for (i = 0; i < n; i++) {
+        items[i] = car(list);
+        list = cdr(list);
+    }
+    for (i = n - 1; i >= 0; i--) {
+        result = callWith2(function, &cells, items[i], result);
+    }
+    return result;
+}
+
+Value *primitiveSort(Value *args) {
+    checkArity(args, 2, "sort");
+    Value *list = car(args);
+    Value *function = car(cdr(args));
+    checkProcedure(function, "sort");
+    int n = checkList(list, "sort");
+    Value **items = talloc(sizeof(Value *) * (n > 0 ? n : 1));
+    Value **scratch = talloc(sizeof(Value *) * (n > 0 ? n : 1));
+    Value *cells = NULL;
+    int i;
+    for (i = 0; i < n; i++) {
+        items[i] = car(list);
+        list = cdr(list);
+    }
+
+    // bottom-up merge sort; taking from the left run on ties keeps it stable
+    int width;
+    for (width = 1; width < n; width = width * 2) {
+        int lo;
+        for (lo = 0; lo < n; lo = lo + 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int left = lo;
+            int right = mid;
+            int out = lo;
+            while (left < mid && right < hi) {
+                if (isTrue(callWith2(function, &cells, items[right],
+                                     items[left]))) {
+                    scratch[out] = items[right];
+                    right = right + 1;
+                } else {
+                    scratch[out] = items[left];
+                    left = left + 1;
+                }
+                out = out + 1;
+            }
+            while (left < mid) {
+                scratch[out] = items[left];
+                left = left + 1;
+                out = out + 1;
+            }
+            while (right < hi) {
+                scratch[out] = items[right];
+                right = right + 1;
+                out = out + 1;
+            }
+        }
+        Value **swap = items;
+        items = scratch;
+        scratch = swap;
+    }
+
+    Value *result = makeNull();
+    for (i = n - 1; i >= 0; i--) {
+        result = cons(items[i], result);
+    }
+    return result;
+}
@@ -17,5 +17,27 @@ Value *primitiveGreater(Value *args);
 Value *primitiveGreaterEqual(Value *args);
 Value *primitiveLess(Value *args);
 Value *primitiveLessEqual(Value *args);
+Value *primitiveList(Value *args);
+Value *primitiveLength(Value *args);
+Value *primitiveReverse(Value *args);
+Value *primitiveAppend(Value *args);
+Value *primitiveListRef(Value *args);
+Value *primitiveEqualP(Value *args);
+Value *primitiveAssoc(Value *args);
+Value *primitiveMap(Value *args);
+Value *primitiveFilter(Value *args);
+Value *primitiveFold(Value *args);
+Value *primitiveFoldRight(Value *args);
+Value *primitiveSort(Value *args);
+
+// Helpers shared by the primitive functions of every module
+void checkArity(Value *args, int expected, char *symbol);
+Value *makeBool(int truth);
+int isTrue(Value *value);
+void appendItem(Value **head, Value **tail, Value *item);
+int checkList(Value *value, char *symbol);
+void checkProcedure(Value *value, char *symbol);
+Value *callWith1(Value *function, Value **cells, Value *a);
+Value *callWith2(Value *function, Value **cells, Value *a, Value *b);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Promises and streams: expressions evaluated when their value is needed
+*/
+
+/*
+(delay expr) returns a promise of what expr evaluates to, without
+evaluating it. (force p) evaluates it in the frame the delay was evaluated
+in the first time it is asked for, and the promise remembers the value, so
+later forces return it again. (make-promise v) is a promise already forced
+to v.
+
+(delay-force expr) is a promise of what the promise expr evaluates to
+evaluates to. A procedure that walks a sequence one promise at a time
+delays its next step this way:
+
+    (define drop
+      (lambda (s n)
+        (delay-force (if (= n 0) (delay s) (drop (stream-cdr s) (- n 1))))))
+
+As R7RS describes it, forcing such a promise evaluates expr and then makes
+the promise share the state of the one it got, so the next step is taken
+by the same loop in force rather than by a call inside it, and a chain of
+any length is forced without the stack growing or the promises along it
+being kept.
+
+(stream-cons head tail) is the pair of head and a promise of tail, which is
+not evaluated until stream-cdr asks for it, so a stream is only made as far
+as it is read. stream-car and stream-cdr take its parts, stream-pair? tells
+a stream pair from anything else, and stream-null? the empty stream, (),
+from anything else.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "primitives.h"
+#include "promise.h"
+#include "stringops.h"
+#include "talloc.h"
+#include "value.h"
+
+// Returns a promise of what expr evaluates to in frame, or of what the
+// promise it evaluates to evaluates to if lazy is 1
+Value *makePromise(Value *expr, Frame *frame, int lazy) {
+    Promise *promise = talloc(sizeof(Promise));
+    promise->done = 0;
+    promise->lazy = lazy;
+    promise->expr = expr;
+    promise->frame = frame;
+    promise->value = NULL;
+    Value *value = makeNull();
+    value->type = PROMISE_TYPE;
+    value->promise = promise;
+    return value;
+}
+
+Value *force(Value *value) {
+    if (value->type != PROMISE_TYPE) {
+        return value;
+    }
+    Promise *promise = value->promise;
+    while (!promise->done) {
+        Value *result = eval(promise->expr, promise->frame);
+        // forcing expr may have forced this promise already
+        if (promise->done) {
+            break;
+        }
+        if (!promise->lazy) {
+            promise->done = 1;
+            promise->value = result;
+            promise->expr = NULL;
+            promise->frame = NULL;
+        } else if (result->type != PROMISE_TYPE) {
+            printf("delay-force: contract violation\nexpected: promise?\n");
+            printf("given: ");
+            printInterpTree(result);
+            printf("\n");
+            texit(1);
+        } else {
+            // take on the state of the promise expr gave, and have that
+            // promise share this one's from now on
+            *promise = *result->promise;
+            result->promise = promise;
+        }
+    }
+    return promise->value;
+}
+
+Value *evalDelay(Value *args, Frame *frame, int lazy) {
+    if (length(args) != 1) {
+        printf("%s: bad syntax in (%s ", lazy ? "delay-force" : "delay",
+               lazy ? "delay-force" : "delay");
+        printInterpTree(args);
+        printf(")\n");
+        texit(1);
+    }
+    return makePromise(car(args), frame, lazy);
+}
+
+Value *evalStreamCons(Value *args, Frame *frame) {
+    if (length(args) != 2) {
+        printf("stream-cons: bad syntax in (stream-cons ");
+        printInterpTree(args);
+        printf(")\n");
+        texit(1);
+    }
+    Value *head = eval(car(args), frame);
+    Value *tail = makePromise(car(cdr(args)), frame, 0);
+    // an improper pair, as cons makes it
+    return cons(head, cons(makeDot(), tail));
+}
+
+Value *primitiveForce(Value *args) {
+    checkArity(args, 1, "force");
+    return force(car(args));
+}
+
+Value *primitiveMakePromise(Value *args) {
+    checkArity(args, 1, "make-promise");
+    if (car(args)->type == PROMISE_TYPE) {
+        return car(args);
+    }
+    Value *promise = makePromise(NULL, NULL, 0);
+    promise->promise->done = 1;
+    promise->promise->value = car(args);
+    return promise;
+}
+
+Value *primitivePromise(Value *args) {
+    checkArity(args, 1, "promise?");
+    return makeBool(car(args)->type == PROMISE_TYPE);
+}
+
+// Returns the promise of the tail of a stream pair, or NULL if value is
+// not one
+Value *streamTail(Value *value) {
+    if (value->type != CONS_TYPE || cdr(value)->type != CONS_TYPE) {
+        return NULL;
+    }
+    Value *dot = car(cdr(value));
+    Value *tail = cdr(cdr(value));
+    if (dot->type != STR_TYPE || strcmp(dot->s, ".") ||
+        tail->type != PROMISE_TYPE) {
+        return NULL;
+    }
+    return tail;
+}
+
+// Exits with a contract violation unless value is a stream pair, and
+// returns the promise of its tail
+Value *checkStreamPair(Value *value, char *symbol) {
+    Value *tail = streamTail(value);
+    if (tail == NULL) {
+        printf("%s: contract violation\nexpected: stream-pair?\ngiven: ",
+               symbol);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    return tail;
+}
+
+Value *primitiveStreamCar(Value *args) {
+    checkArity(args, 1, "stream-car");
+    checkStreamPair(car(args), "stream-car");
+    return car(car(args));
+}
+
+Value *primitiveStreamCdr(Value *args) {
+    checkArity(args, 1, "stream-cdr");
+    return force(checkStreamPair(car(args), "stream-cdr"));
+}
+
+Value *primitiveStreamNull(Value *args) {
+    checkArity(args, 1, "stream-null?");
+    return makeBool(car(args)->type == NULL_TYPE);
+}
+
+Value *primitiveStreamPair(Value *args) {
+    checkArity(args, 1, "stream-pair?");
+    return makeBool(streamTail(car(args)) != NULL);
+}
@@ -0,0 +1,39 @@
+#include "value.h"
+
+#ifndef _PROMISE
+#define _PROMISE
+
+// What a promise evaluates to once it is forced. Until then done is 0 and
+// expr is to be evaluated in frame, giving the value if lazy is 0, or
+// another promise whose value is this one's if lazy is 1. Promises chained
+// by delay-force come to share one of these (see promise.c).
+struct Promise {
+    int done;
+    int lazy;
+    struct Value *expr;
+    struct Frame *frame;
+    struct Value *value;
+};
+
+typedef struct Promise Promise;
+
+// Returns what value evaluates to if it is a promise, forcing it, or value
+// itself if it is not
+Value *force(Value *value);
+
+// Evaluates (delay expr), or (delay-force expr) if lazy is 1, args being
+// the part after the head
+Value *evalDelay(Value *args, Frame *frame, int lazy);
+
+// Evaluates (stream-cons head tail), args being the part after the head
+Value *evalStreamCons(Value *args, Frame *frame);
+
+Value *primitiveForce(Value *args);
+Value *primitiveMakePromise(Value *args);
+Value *primitivePromise(Value *args);
+Value *primitiveStreamCar(Value *args);
+Value *primitiveStreamCdr(Value *args);
+Value *primitiveStreamNull(Value *args);
+Value *primitiveStreamPair(Value *args);
+
+#endif
@@ -0,0 +1,411 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Quickened nodes: variable references and calls that specialize themselves
+* to what they meet the first time they run
+*/
+
+/*
+The optimizer puts a quickened node in place of each variable reference and
+each call of a named procedure. The first time a node runs it evaluates the
+way eval would and notes what it found:
+
+    a variable found in a local frame   reads that binding by its place,
+                                        without comparing names on the way
+    a variable found in the global      keeps the binding itself, since
+    frame                               global bindings stay put
+    +, -, * or a comparison applied     does integer arithmetic directly,
+    to two integers                     without building a list of the
+                                        arguments
+    a procedure with as many            binds the arguments as they are
+    parameters as there are arguments   evaluated, without checking arity
+
+The optimizer also makes nodes for calls of the core list and arithmetic
+primitives through names it knows are still bound to them. Those do the
+primitive in place, without looking the name up or building a list of the
+arguments, for as long as the watch of the name shows no change; after one
+they are calls like any other.
+
+Where a name is found is fixed by where it is written, except for the
+bindings a let* puts in the frame around it while it evaluates them (see
+framesSettled) and for define adding to the global frame, so a node relies
+on neither. Each specialized node checks what it assumed every time and goes
+back to the general kind if that no longer holds, before evaluating
+anything twice; after MAX_MISSES such failures it stays general.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "quicken.h"
+#include "interpreter.h"
+#include "primitives.h"
+#include "linkedlist.h"
+#include "stringops.h"
+#include "talloc.h"
+#include "value.h"
+
+// Failed assumptions after which a node stops specializing
+#define MAX_MISSES 8
+
+// Returns a node of kind made from original
+Value *makeQuick(int kind, Value *original) {
+    Quick *quick = talloc(sizeof(Quick));
+    memset(quick, 0, sizeof(Quick));
+    quick->kind = kind;
+    quick->original = original;
+    Value *value = makeNull();
+    value->type = QUICK_TYPE;
+    value->loc = original->loc;
+    value->quick = quick;
+    return value;
+}
+
+// Returns a node for a reference to the variable symbol
+Value *quickVariable(Value *symbol) {
+    return makeQuick(QUICK_VARIABLE, symbol);
+}
+
+// Returns a node for call, a call of head on the proper list args
+Value *quickCall(Value *call, Value *head, Value *args) {
+    Value *node = makeQuick(QUICK_CALL, call);
+    node->quick->head = head;
+    node->quick->args = args;
+    node->quick->argCount = length(args);
+    return node;
+}
+
+// Sends a specialized node back to its general kind
+void deoptimize(Quick *quick) {
+    if (quick->kind == QUICK_LOCAL || quick->kind == QUICK_GLOBAL) {
+        quick->kind = QUICK_VARIABLE;
+    } else {
+        quick->kind = QUICK_CALL;
+    }
+    quick->misses = quick->misses + 1;
+}
+
+// Returns what eval gives for a variable bound to value, or NULL if eval
+// would look further (see lookUpSymbol)
+Value *variableValue(Value *value) {
+    if (value->type == SYMBOL_TYPE) {
+        return NULL;
+    }
+    if (value->type == CONS_TYPE && car(value)->type == SYMBOL_TYPE &&
+        !strcmp(car(value)->s, "quote")) {
+        return cdr(value);
+    }
+    return value;
+}
+
+// Notes where the variable of a node is bound, as seen from frame
+void specializeVariable(Quick *quick, Frame *frame) {
+    char *name = quick->original->s;
+    int depth = 0;
+    while (frame != NULL) {
+        Value *bindings = frame->bindings;
+        int index = 0;
+        while (bindings->type == CONS_TYPE) {
+            Value *binding = car(bindings);
+            if (!strcmp(car(binding)->s, name)) {
+                if (variableValue(car(cdr(binding))) == NULL ||
+                    !framesSettled(frame, 0)) {
+                    return;
+                }
+                quick->depth = depth;
+                if (frame->parent == NULL) {
+                    quick->kind = QUICK_GLOBAL;
+                    quick->binding = binding;
+                    quick->watch = watchName(name);
+                    quick->definitions = quick->watch->definitions;
+                } else {
+                    quick->kind = QUICK_LOCAL;
+                    quick->index = index;
+                }
+                return;
+            }
+            bindings = cdr(bindings);
+            index = index + 1;
+        }
+        if (!framesSettled(frame, 0)) {
+            return;
+        }
+        frame = frame->parent;
+        depth = depth + 1;
+    }
+}
+
+// Returns the value of the variable of a specialized node, or NULL if what
+// the node assumed no longer holds
+Value *readVariable(Quick *quick, Frame *frame) {
+    int i;
+    if (!framesSettled(frame, quick->depth)) {
+        return NULL;
+    }
+    if (quick->kind == QUICK_GLOBAL) {
+        if (quick->watch->definitions != quick->definitions) {
+            return NULL;
+        }
+        return variableValue(car(cdr(quick->binding)));
+    }
+    // closures of one lambda need not keep frames of one shape (see
+    // closure.c), so the place is checked as it is walked, as compiled code
+    // does
+    for (i = 0; i < quick->depth; i++) {
+        if (frame->parent == NULL) {
+            return NULL;
+        }
+        frame = frame->parent;
+    }
+    if (frame->parent == NULL) {
+        return NULL;
+    }
+    Value *bindings = frame->bindings;
+    for (i = 0; i < quick->index && bindings->type == CONS_TYPE; i++) {
+        bindings = cdr(bindings);
+    }
+    if (bindings->type != CONS_TYPE ||
+        car(car(bindings))->s != quick->original->s) {
+        return NULL;
+    }
+    return variableValue(car(cdr(car(bindings))));
+}
+
+// Evaluates a variable reference
+Value *evalVariable(Quick *quick, Frame *frame) {
+    if (quick->kind != QUICK_VARIABLE) {
+        Value *value = readVariable(quick, frame);
+        if (value != NULL) {
+            return value;
+        }
+        deoptimize(quick);
+    }
+    Value *value = eval(quick->original, frame);
+    if (quick->misses < MAX_MISSES) {
+        specializeVariable(quick, frame);
+    }
+    return value;
+}
+
+// Returns which core primitive function is, or INLINE_NONE
+int inlineOperation(Value *(*function)(struct Value *)) {
+    if (function == primitiveCar) {
+        return INLINE_CAR;
+    } else if (function == primitiveCdr) {
+        return INLINE_CDR;
+    } else if (function == primitiveNull) {
+        return INLINE_NULL;
+    } else if (function == primitiveCons) {
+        return INLINE_CONS;
+    } else if (function == primitiveAdd) {
+        return INLINE_ADD;
+    } else if (function == primitiveSubtract) {
+        return INLINE_SUBTRACT;
+    } else if (function == primitiveMult) {
+        return INLINE_MULTIPLY;
+    } else if (function == primitiveEqual) {
+        return INLINE_EQUAL;
+    } else if (function == primitiveLess) {
+        return INLINE_LESS;
+    } else if (function == primitiveGreater) {
+        return INLINE_GREATER;
+    } else if (function == primitiveLessEqual) {
+        return INLINE_LESS_EQUAL;
+    } else if (function == primitiveGreaterEqual) {
+        return INLINE_GREATER_EQUAL;
+    }
+    return INLINE_NONE;
+}
+
+// Applies an arithmetic operation to two integers. The primitives compute
+// in double and convert back, and so does this.
+Value *arithmetic(int operation, int a, int b) {
+    double first = a;
+    double second = b;
+    double number;
+    switch (operation) {
+        case INLINE_ADD:
+            number = first + second;
+            break;
+        case INLINE_SUBTRACT:
+            number = first - second;
+            break;
+        case INLINE_MULTIPLY:
+            number = first * second;
+            break;
+        case INLINE_EQUAL:
+            return makeBool(first == second);
+        case INLINE_LESS:
+            return makeBool(first < second);
+        case INLINE_GREATER:
+            return makeBool(first > second);
+        case INLINE_LESS_EQUAL:
+            return makeBool(first <= second);
+        default:
+            return makeBool(first >= second);
+    }
+    Value *result = makeNull();
+    result->type = INT_TYPE;
+    result->i = number;
+    return result;
+}
+
+// Notes what a call applied, and to what
+void specializeCall(Quick *quick, Value *function, Value *args) {
+    if (function->type == PRIMITIVE_TYPE && quick->argCount == 2 &&
+        inlineOperation(function->pf) >= INLINE_ADD &&
+        car(args)->type == INT_TYPE && car(cdr(args))->type == INT_TYPE) {
+        quick->kind = QUICK_ARITHMETIC;
+        quick->function = function->pf;
+        quick->operation = inlineOperation(function->pf);
+    } else if (function->type == CLOSURE_TYPE) {
+        Value *params = function->cl.paramNames;
+        int count = 0;
+        while (params->type == CONS_TYPE) {
+            count = count + 1;
+            params = cdr(params);
+        }
+        if (params->type == NULL_TYPE && count == quick->argCount) {
+            quick->kind = QUICK_CLOSURE;
+            quick->params = function->cl.paramNames;
+        }
+    }
+}
+
+// Evaluates a call
+Value *evalCall(Quick *quick, Frame *frame) {
+    Value *function = eval(quick->head, frame);
+    if (quick->kind == QUICK_ARITHMETIC) {
+        if (function->type == PRIMITIVE_TYPE &&
+            function->pf == quick->function) {
+            Value *first = eval(car(quick->args), frame);
+            Value *second = eval(car(cdr(quick->args)), frame);
+            if (first->type == INT_TYPE && second->type == INT_TYPE) {
+                return arithmetic(quick->operation, first->i, second->i);
+            }
+            deoptimize(quick);
+            return quick->function(cons(first, cons(second, makeNull())));
+        }
+        deoptimize(quick);
+    } else if (quick->kind == QUICK_CLOSURE) {
+        if (function->type == CLOSURE_TYPE &&
+            function->cl.paramNames == quick->params) {
+            // bound in the same order as apply binds them
+            Value *bindings = makeNull();
+            Value *params = quick->params;
+            Value *args = quick->args;
+            while (params->type == CONS_TYPE) {
+                Value *binding = cons(eval(car(args), frame), makeNull());
+                bindings = cons(cons(car(params), binding), bindings);
+                params = cdr(params);
+                args = cdr(args);
+            }
+            return applyClosure(function, bindings);
+        }
+        deoptimize(quick);
+    }
+    Value *args = evalEach(quick->args, frame);
+    if (quick->misses < MAX_MISSES) {
+        specializeCall(quick, function, args);
+    }
+    return apply(function, args);
+}
+
+// Returns a node for call, a call of the primitive numbered primitive,
+// which watch says head is still bound to, on the proper list args
+Value *quickPrimitive(Value *call, Value *head, Value *args, int primitive,
+                      Watch *watch) {
+    Value *node = quickCall(call, head, args);
+    Quick *quick = node->quick;
+    int operation = inlineOperation(primitiveAt(primitive)->function);
+    int arity = quick->argCount;
+    if (operation == INLINE_NONE ||
+        (operation <= INLINE_NULL && arity != 1) ||
+        (operation == INLINE_CONS && arity != 2) ||
+        (operation >= INLINE_EQUAL && arity != 2)) {
+        return node;
+    }
+    quick->kind = QUICK_PRIMITIVE;
+    quick->function = primitiveAt(primitive)->function;
+    quick->operation = operation;
+    quick->guard = watch;
+    quick->changes = watch->changes;
+    return node;
+}
+
+// Does the core primitive function, numbered operation, on one evaluated
+// argument. Anything it does not handle directly, errors included, is left
+// to the primitive itself.
+Value *corePrimitiveOne(int operation, Value *(*function)(struct Value *),
+                        Value *first) {
+    switch (operation) {
+        case INLINE_CAR:
+            if (first->type == CONS_TYPE) {
+                return car(first);
+            }
+            break;
+        case INLINE_CDR:
+            if (first->type == CONS_TYPE) {
+                Value *rest = cdr(first);
+                // a dotted pair keeps its dot marker in the list
+                if (rest->type == NULL_TYPE ||
+                    (rest->type == CONS_TYPE &&
+                     car(rest)->type != STR_TYPE)) {
+                    return rest;
+                }
+            }
+            break;
+        default:
+            return makeBool(first->type == NULL_TYPE);
+    }
+    return function(cons(first, makeNull()));
+}
+
+// Does the core primitive function, numbered operation, on two evaluated
+// arguments, leaving to it what corePrimitiveOne would
+Value *corePrimitiveTwo(int operation, Value *(*function)(struct Value *),
+                        Value *first, Value *second) {
+    if (operation == INLINE_CONS) {
+        if (second->type == CONS_TYPE || second->type == NULL_TYPE) {
+            return cons(first, second);
+        }
+    } else if (first->type == INT_TYPE && second->type == INT_TYPE) {
+        return arithmetic(operation, first->i, second->i);
+    }
+    return function(cons(first, cons(second, makeNull())));
+}
+
+// Does a core primitive in place
+Value *evalPrimitive(Quick *quick, Frame *frame) {
+    if (quick->argCount == 0) {
+        return quick->function(makeNull());
+    }
+    Value *first = eval(car(quick->args), frame);
+    if (quick->operation <= INLINE_NULL) {
+        return corePrimitiveOne(quick->operation, quick->function, first);
+    }
+    if (quick->argCount != 2) {
+        return quick->function(cons(first, evalEach(cdr(quick->args),
+                                                    frame)));
+    }
+    Value *second = eval(car(cdr(quick->args)), frame);
+    return corePrimitiveTwo(quick->operation, quick->function, first,
+                            second);
+}
+
+// Evaluates a quickened node in frame, specializing it as it goes
+Value *evalQuick(Quick *quick, Frame *frame) {
+    switch (quick->kind) {
+        case QUICK_VARIABLE:
+        case QUICK_LOCAL:
+        case QUICK_GLOBAL:
+            return evalVariable(quick, frame);
+        case QUICK_PRIMITIVE:
+            if (quick->guard->changes == quick->changes) {
+                return evalPrimitive(quick, frame);
+            }
+            // the name was bound again: from now on an ordinary call
+            quick->kind = QUICK_CALL;
+            return evalCall(quick, frame);
+        default:
+            return evalCall(quick, frame);
+    }
+}
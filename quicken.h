@@ -0,0 +1,112 @@
+#include "value.h"
+#include "optimize.h"
+
+#ifndef _QUICKEN
+#define _QUICKEN
+
+// What a quickened node does. A node starts as QUICK_VARIABLE or QUICK_CALL,
+// which evaluate like the code it was made from, and rewrites itself into
+// one of the others after running once.
+enum {
+    QUICK_VARIABLE,   // a variable reference
+    QUICK_LOCAL,      // a variable read from binding index of the frame
+                      // depth frames out
+    QUICK_GLOBAL,     // a variable read from a binding in the global frame
+    QUICK_CALL,       // a call
+    QUICK_ARITHMETIC, // a call of an arithmetic primitive on two integers
+    QUICK_CLOSURE,    // a call of a procedure with known parameters
+    QUICK_PRIMITIVE   // a call of a core primitive, done in place for as
+                      // long as its name is bound to it
+};
+
+// The core primitives a node can do in place
+enum {
+    INLINE_NONE = -1,
+    INLINE_CAR,
+    INLINE_CDR,
+    INLINE_NULL,
+    INLINE_CONS,
+    INLINE_ADD,
+    INLINE_SUBTRACT,
+    INLINE_MULTIPLY,
+    INLINE_EQUAL,
+    INLINE_LESS,
+    INLINE_GREATER,
+    INLINE_LESS_EQUAL,
+    INLINE_GREATER_EQUAL
+};
+
+// A variable reference or call that specializes itself to what it meets.
+// original is the code as written, which the node prints as. A specialized
+// node checks what it assumed each time it runs and goes back to the
+// general kind when that fails, giving up on specializing after a few
+// failures.
+struct Quick {
+    int kind;
+    int misses;
+    Value *original;
+
+    // the operator and argument expressions of a call
+    Value *head;
+    Value *args;
+    int argCount;
+
+    // QUICK_LOCAL and QUICK_GLOBAL: where the binding was found
+    int depth;
+    int index;
+    Value *binding;
+    Watch *watch;
+    int definitions;
+
+    // QUICK_ARITHMETIC and QUICK_PRIMITIVE: the primitive and which one it
+    // is; QUICK_CLOSURE: the parameters of the procedure
+    Value *(*function)(struct Value *);
+    int operation;
+    Value *params;
+
+    // QUICK_PRIMITIVE: the watch of the operator name and its count of
+    // changes when the node was made
+    Watch *guard;
+    int changes;
+};
+
+typedef struct Quick Quick;
+
+// Returns a node for a reference to the variable symbol
+Value *quickVariable(Value *symbol);
+
+// Returns a node for call, a call of head on the proper list args, which
+// are the operator and arguments of call after optimizing
+Value *quickCall(Value *call, Value *head, Value *args);
+
+// Returns a node for call, a call of the primitive numbered primitive,
+// which watch says head is still bound to, on the proper list args. The
+// core primitives are done in place without looking head up; any other is
+// called like a procedure.
+Value *quickPrimitive(Value *call, Value *head, Value *args, int primitive,
+                      Watch *watch);
+
+// Returns which core primitive function is, or INLINE_NONE
+int inlineOperation(Value *(*function)(struct Value *));
+
+// Applies an arithmetic primitive or comparison, numbered operation, to two
+// integers, computing in double as the primitives do
+Value *arithmetic(int operation, int a, int b);
+
+// Do the core primitive function, numbered operation, on one or two
+// evaluated arguments, in place where they are of the kinds it works on
+// directly; anything else, errors included, is left to function itself
+Value *corePrimitiveOne(int operation, Value *(*function)(struct Value *),
+                        Value *first);
+Value *corePrimitiveTwo(int operation, Value *(*function)(struct Value *),
+                        Value *first, Value *second);
+
+// Returns the value of the variable of a node specialized to where it is
+// bound, or NULL if what the node assumed no longer holds. The node is not
+// changed.
+Value *readVariable(Quick *quick, Frame *frame);
+
+// Evaluates a quickened node in frame, specializing it as it goes
+Value *evalQuick(Quick *quick, Frame *frame);
+
+#endif
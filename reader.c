@@ -0,0 +1,777 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* Reads programs from source files and streams one datum at a time, and
+* keeps track of where in the source every datum came from
+*/
+
+/*
+Regular files are mapped into memory with mmap (stdin too, when it is a
+regular file), and one lexer walks the whole mapping; because string tokens
+point into it, loaded sources stay mapped until the program exits. A Reader
+over a pipe or terminal keeps only the unread text in its buffer. It scans
+for the end of the next datum with a small state machine that resumes where
+it stopped after each read, then lexes just that datum, so a form is
+evaluated as soon as it is complete. Strings read from a stream are copied,
+since the buffer is reused.
+
+Large mapped files are read ahead in parallel. A pre-scan that only looks at
+parentheses, strings and comments (16 bytes at a time with SSE2) splits the
+file after top-level lists, the chunks are lexed and parsed on the thread
+pool, and their forms are handed out in file order once all are read. A
+chunk with an error in it is abandoned by its thread and read again by the
+main thread when its turn comes, so that the forms before the error are
+evaluated and the error is reported just as a sequential read would.
+
+A location is a 32-bit index into the text of every source read so far:
+each source is given the range after the previous one, so the loc of a
+value is its source's base plus its offset in that source. Line tables are
+only built when a location is described. A mapped source is scanned for
+line starts on demand; a stream records the line starts of text before it
+is discarded from the buffer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include "reader.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "talloc.h"
+#include "value.h"
+#include "linkedlist.h"
+#include "threadpool.h"
+#include "cache.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define READER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Initial size of the buffer a stream is read into
+#define READ_BUFFER_SIZE 65536
+
+// Mapped files at least this large are read ahead in parallel
+#define PARALLEL_READ_SIZE (1 << 20)
+
+// Smallest chunk a file is split into for reading ahead
+#define MIN_CHUNK_SIZE (256 * 1024)
+
+// Chunks per thread, so that threads finishing early can take more
+#define CHUNKS_PER_THREAD 4
+
+// States of a scan for the end of a datum
+#define SCAN_NORMAL 0
+#define SCAN_COMMENT 1
+#define SCAN_STRING 2
+#define SCAN_ATOM 3
+
+// A source that has been read. Its text from offset windowStart to
+// windowEnd is at window in memory. lines holds the offsets of the starts of
+// lines, recorded up to offset scanned.
+struct Source {
+    char *name;
+    unsigned int base;
+    char *mapping;
+    size_t mappedLength;
+    const char *window;
+    size_t windowStart;
+    size_t windowEnd;
+    unsigned int *lines;
+    int lineCount;
+    int lineCapacity;
+    size_t scanned;
+    struct Source *next;
+};
+
+typedef struct Source Source;
+
+// A part of a mapped source, ending after a top-level list, that is read
+// ahead into the list of its forms. failed is set if it has an error.
+struct Chunk {
+    size_t start;
+    size_t end;
+    Value *forms;
+    int failed;
+};
+
+typedef struct Chunk Chunk;
+
+// Reads top-level data from a mapped source or an input stream. The unread
+// text is text[pos, length), which starts at offset consumed + pos in the
+// source; scan records how far the scan for the end of the pending datum has
+// got, relative to pos. lexer reads the text of the current datum, or all of
+// a mapped source. A source read ahead has chunkCount chunks; forms holds
+// the forms of the current one, or of a cache file, that are still to come.
+// cache collects the forms read, when they are to be cached.
+struct Reader {
+    Source *source;
+    int fd;
+    int stream;
+    char *buffer;
+    size_t capacity;
+    size_t consumed;
+    const char *text;
+    size_t length;
+    size_t pos;
+    DatumScan scan;
+    Lexer lexer;
+    Chunk *chunks;
+    int chunkCount;
+    int chunkIndex;
+    Value *forms;
+    CacheWriter *cache;
+};
+
+Source *sources = NULL;
+
+// Location given to the first character of the next source; 0 is reserved
+// for values that have no location
+size_t nextBase = 1;
+
+// Where a thread reading a chunk ahead jumps when the chunk has an error
+__thread jmp_buf *chunkAbort = NULL;
+
+// Unmaps every mapped source and frees the line tables; registered with
+// atexit
+void releaseSources(){
+    while (sources != NULL){
+        Source *source = sources;
+        if (source->mapping != NULL){
+            munmap(source->mapping, source->mappedLength);
+        }
+        free(source->lines);
+        sources = source->next;
+        free(source);
+    }
+}
+
+// Registers a new source, starting at the next free location
+Source *addSource(char *name){
+    if (sources == NULL){
+        atexit(releaseSources);
+    }
+    Source *source = malloc(sizeof(Source));
+    source->name = name;
+    source->base = nextBase > UINT_MAX ? 0 : nextBase;
+    source->mapping = NULL;
+    source->mappedLength = 0;
+    source->window = NULL;
+    source->windowStart = 0;
+    source->windowEnd = 0;
+    source->lines = malloc(sizeof(unsigned int) * 64);
+    source->lines[0] = 0;
+    source->lineCount = 1;
+    source->lineCapacity = 64;
+    source->scanned = 0;
+    source->next = sources;
+    sources = source;
+    return source;
+}
+
+// Records the starts of the lines in the source's text up to offset upTo,
+// which must be in its window
+void recordLines(Source *source, size_t upTo){
+    if (upTo > source->windowEnd){
+        upTo = source->windowEnd;
+    }
+    while (source->scanned < upTo){
+        const char *from = source->window + (source->scanned -
+                                             source->windowStart);
+        const char *newline = memchr(from, '\n', upTo - source->scanned);
+        if (newline == NULL){
+            source->scanned = upTo;
+            break;
+        }
+        if (source->lineCount == source->lineCapacity){
+            source->lineCapacity = source->lineCapacity * 2;
+            source->lines = realloc(source->lines, sizeof(unsigned int) *
+                                                   source->lineCapacity);
+        }
+        source->scanned = source->scanned + (newline - from) + 1;
+        source->lines[source->lineCount] = source->scanned;
+        source->lineCount = source->lineCount + 1;
+    }
+}
+
+// Finds the source file, line and column of a location
+int describeLocation(unsigned int loc, char **name, int *line, int *column){
+    Source *source = sources;
+    while (source != NULL && (source->base == 0 || source->base > loc)){
+        source = source->next;
+    }
+    if (loc == 0 || source == NULL){
+        return 0;
+    }
+    size_t offset = loc - source->base;
+    if (offset >= source->windowEnd){
+        return 0;
+    }
+    recordLines(source, offset + 1);
+
+    // the last line that starts at or before offset
+    int low = 0;
+    int high = source->lineCount - 1;
+    while (low < high){
+        int middle = (low + high + 1) / 2;
+        if (source->lines[middle] <= offset){
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    *name = source->name;
+    *line = low + 1;
+    *column = offset - source->lines[low] + 1;
+    return 1;
+}
+
+// Prints a location in front of an error message
+void printLocation(unsigned int loc){
+    char *name;
+    int line;
+    int column;
+    if (describeLocation(loc, &name, &line, &column)){
+        printf("%s:%d:%d: ", name, line, column);
+    }
+}
+
+// Reports an error in the source text at loc and exits
+void sourceError(unsigned int loc, char *message){
+    if (chunkAbort != NULL){
+        longjmp(*chunkAbort, 1);
+    }
+    printLocation(loc);
+    printf("%s\n", message);
+    texit(1);
+}
+
+// Returns the location of an offset in a source, or 0 if it has none
+unsigned int sourceLocation(Source *source, size_t offset){
+    size_t loc = source->base + offset;
+    if (source->base == 0 || loc > UINT_MAX){
+        return 0;
+    }
+    return loc;
+}
+
+// Appends length bytes to a block of packed sources
+char *packBytes(char *block, const void *data, size_t length){
+    memcpy(block, data, length);
+    return block + length;
+}
+
+// Appends a number to a block of packed sources
+char *packNumber(char *block, uint64_t number){
+    return packBytes(block, &number, sizeof(number));
+}
+
+// Takes a number from a block of packed sources; returns 0 if it runs out
+int unpackNumber(const char **block, const char *end, uint64_t *number){
+    if ((size_t)(end - *block) < sizeof(*number)){
+        return 0;
+    }
+    memcpy(number, *block, sizeof(*number));
+    *block = *block + sizeof(*number);
+    return 1;
+}
+
+// Packs what is needed to describe locations in the sources read so far:
+// the next free location, then the base, length, line starts and name of
+// each source, oldest first. Returns the block, allocated with malloc.
+char *packSources(size_t *length){
+    Source *source;
+    int count = 0;
+    size_t size = 2 * sizeof(uint64_t);
+    for (source = sources; source != NULL; source = source->next){
+        recordLines(source, source->windowEnd);
+        size = size + 4 * sizeof(uint64_t) +
+               sizeof(unsigned int) * source->lineCount + strlen(source->name);
+        count = count + 1;
+    }
+    Source **order = malloc(sizeof(Source *) * (count + 1));
+    int i = count;
+    for (source = sources; source != NULL; source = source->next){
+        i = i - 1;
+        order[i] = source;
+    }
+
+    char *block = malloc(size);
+    char *end = packNumber(block, nextBase);
+    end = packNumber(end, count);
+    for (i = 0; i < count; i++){
+        source = order[i];
+        end = packNumber(end, source->base);
+        end = packNumber(end, source->scanned);
+        end = packNumber(end, source->lineCount);
+        end = packNumber(end, strlen(source->name));
+        end = packBytes(end, source->lines,
+                        sizeof(unsigned int) * source->lineCount);
+        end = packBytes(end, source->name, strlen(source->name));
+    }
+    free(order);
+    *length = size;
+    return block;
+}
+
+// Registers the sources packed by packSources, without their text, so that
+// locations in values read from them are described as before. Must be
+// called before any source is read. Returns 0 if the block is malformed.
+int unpackSources(const char *block, size_t length){
+    const char *end = block + length;
+    uint64_t base;
+    uint64_t count;
+    uint64_t i;
+    if (!unpackNumber(&block, end, &base) ||
+        !unpackNumber(&block, end, &count) || base > UINT_MAX + 1ull){
+        return 0;
+    }
+    for (i = 0; i < count; i++){
+        uint64_t sourceBase;
+        uint64_t sourceLength;
+        uint64_t lineCount;
+        uint64_t nameLength;
+        if (!unpackNumber(&block, end, &sourceBase) ||
+            !unpackNumber(&block, end, &sourceLength) ||
+            !unpackNumber(&block, end, &lineCount) ||
+            !unpackNumber(&block, end, &nameLength) ||
+            sourceBase > UINT_MAX || lineCount == 0 || lineCount > INT_MAX ||
+            lineCount > (size_t)(end - block) / sizeof(unsigned int) ||
+            nameLength > (size_t)(end - block) -
+                         lineCount * sizeof(unsigned int)){
+            return 0;
+        }
+        char *name = malloc(nameLength + 1);
+        memcpy(name, block + lineCount * sizeof(unsigned int), nameLength);
+        name[nameLength] = '\0';
+        Source *source = addSource(name);
+        source->base = sourceBase;
+        source->window = "";
+        source->windowEnd = sourceLength;
+        source->scanned = sourceLength;
+        source->lines = realloc(source->lines,
+                                sizeof(unsigned int) * lineCount);
+        memcpy(source->lines, block, sizeof(unsigned int) * lineCount);
+        source->lineCount = lineCount;
+        source->lineCapacity = lineCount;
+        block = block + lineCount * sizeof(unsigned int) + nameLength;
+    }
+    nextBase = base;
+    return block == end;
+}
+
+// Maps the regular file open as fd into source; returns 0 if it cannot be
+// mapped
+int mapSource(int fd, Source *source){
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)){
+        return 0;
+    }
+    size_t length = info.st_size;
+    source->window = "";
+    if (length > 0){
+        char *text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED){
+            return 0;
+        }
+        madvise(text, length, MADV_SEQUENTIAL);
+        source->mapping = text;
+        source->mappedLength = length;
+        source->window = text;
+    }
+    source->windowEnd = length;
+    return 1;
+}
+
+// Returns 1 and sets end if the scan has reached the end of the text and the
+// rest of it is the pending datum; that is only so once the input has ended
+int scanReachedEnd(DatumScan *scan, size_t pos, size_t length, int atEnd,
+                   size_t *end){
+    scan->pos = pos;
+    if (atEnd && scan->started){
+        *end = length;
+        return 1;
+    }
+    return 0;
+}
+
+// Starts a scan for the end of the next datum
+void startDatumScan(DatumScan *scan){
+    scan->pos = 0;
+    scan->state = SCAN_NORMAL;
+    scan->depth = 0;
+    scan->started = 0;
+}
+
+// Scans text for the end of the datum it starts with, resuming where the
+// last scan stopped. Returns 1 and sets end once it is complete.
+int scanDatum(DatumScan *scan, const char *text, size_t length, int atEnd,
+              size_t *end){
+    size_t pos = scan->pos;
+    while (pos < length){
+        if (scan->state == SCAN_COMMENT){
+            const char *newline = memchr(text + pos, '\n', length - pos);
+            if (newline == NULL){
+                pos = length;
+            } else {
+                pos = newline - text;
+                scan->state = SCAN_NORMAL;
+            }
+        } else if (scan->state == SCAN_STRING){
+            pos = findStringEnd(text, pos, length);
+            if (pos < length && text[pos] == '\\'){
+                if (pos + 1 >= length){
+                    // the escaped character has not been read yet
+                    return scanReachedEnd(scan, pos, length, atEnd, end);
+                }
+                pos = pos + 2;
+            } else if (pos < length){
+                pos = pos + 1;
+                scan->state = SCAN_NORMAL;
+                if (scan->depth == 0){
+                    *end = pos;
+                    return 1;
+                }
+            }
+        } else if (scan->state == SCAN_ATOM){
+            while (pos < length && !isAtomEnd((unsigned char)text[pos])){
+                pos = pos + 1;
+            }
+            if (pos < length){
+                scan->state = SCAN_NORMAL;
+                if (scan->depth == 0){
+                    *end = pos;
+                    return 1;
+                }
+            }
+        } else {
+            int c = (unsigned char)text[pos];
+            if (isSpace(c)){
+                pos = pos + 1;
+            } else if (c == ';'){
+                scan->state = SCAN_COMMENT;
+            } else {
+                scan->started = 1;
+                if (c == '('){
+                    scan->depth = scan->depth + 1;
+                    pos = pos + 1;
+                } else if (c == ')'){
+                    // a close parenthesis at the top is left to the parser
+                    // to report
+                    pos = pos + 1;
+                    if (scan->depth > 0){
+                        scan->depth = scan->depth - 1;
+                    }
+                    if (scan->depth == 0){
+                        *end = pos;
+                        return 1;
+                    }
+                } else if (c == '\"'){
+                    scan->state = SCAN_STRING;
+                    pos = pos + 1;
+                } else if (c == '\''){
+                    pos = pos + 1;
+                } else {
+                    scan->state = SCAN_ATOM;
+                }
+            }
+        }
+    }
+    return scanReachedEnd(scan, pos, length, atEnd, end);
+}
+
+// Reads more of the stream, first moving the unread text to the front of the
+// buffer, or growing the buffer if the pending datum fills it
+void fillReader(Reader *reader){
+    Source *source = reader->source;
+    size_t unread = reader->length - reader->pos;
+    if (reader->pos > 0){
+        // the text before pos is about to be discarded
+        recordLines(source, reader->consumed + reader->pos);
+        memmove(reader->buffer, reader->buffer + reader->pos, unread);
+        reader->consumed = reader->consumed + reader->pos;
+        reader->length = unread;
+        reader->pos = 0;
+    }
+    if (reader->length == reader->capacity){
+        char *buffer = talloc(reader->capacity * 2);
+        memcpy(buffer, reader->buffer, reader->length);
+        reader->buffer = buffer;
+        reader->capacity = reader->capacity * 2;
+    }
+    ssize_t count = read(reader->fd, reader->buffer + reader->length,
+                         reader->capacity - reader->length);
+    if (count <= 0){
+        if (reader->fd != STDIN_FILENO){
+            close(reader->fd);
+        }
+        reader->fd = -1;
+    } else {
+        reader->length = reader->length + count;
+    }
+    reader->text = reader->buffer;
+    source->window = reader->buffer;
+    source->windowStart = reader->consumed;
+    source->windowEnd = reader->consumed + reader->length;
+    if (reader->fd < 0){
+        // the next source's locations start after this one's
+        nextBase = nextBase + source->windowEnd + 1;
+    }
+}
+
+// Returns the position of the first parenthesis, quote or semicolon at or
+// after pos, or length if there is none
+size_t findStructural(const char *text, size_t pos, size_t length){
+#ifdef READER_SSE2
+    __m128i open = _mm_set1_epi8('(');
+    __m128i close = _mm_set1_epi8(')');
+    __m128i quote = _mm_set1_epi8('\"');
+    __m128i comment = _mm_set1_epi8(';');
+    while (pos + 16 <= length){
+        __m128i block = _mm_loadu_si128((__m128i *)(text + pos));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, open),
+                         _mm_cmpeq_epi8(block, close)),
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                         _mm_cmpeq_epi8(block, comment))));
+        if (mask != 0){
+            return pos + __builtin_ctz(mask);
+        }
+        pos = pos + 16;
+    }
+#endif
+    while (pos < length && text[pos] != '(' && text[pos] != ')' &&
+           text[pos] != '\"' && text[pos] != ';'){
+        pos = pos + 1;
+    }
+    return pos;
+}
+
+// Splits text into chunks of at least chunkSize characters that each end
+// after a top-level list (or at the end of the text). Only parentheses,
+// strings and comments are looked at. Returns the number of chunks.
+int splitSource(const char *text, size_t length, size_t chunkSize,
+                Chunk *chunks, int maxChunks){
+    int count = 0;
+    int depth = 0;
+    size_t start = 0;
+    size_t pos = 0;
+    while (count < maxChunks - 1){
+        pos = findStructural(text, pos, length);
+        if (pos >= length){
+            break;
+        }
+        char c = text[pos];
+        if (c == '('){
+            depth = depth + 1;
+            pos = pos + 1;
+        } else if (c == ')'){
+            pos = pos + 1;
+            if (depth > 0){
+                depth = depth - 1;
+            }
+            if (depth == 0 && pos - start >= chunkSize){
+                chunks[count].start = start;
+                chunks[count].end = pos;
+                count = count + 1;
+                start = pos;
+            }
+        } else if (c == '\"'){
+            pos = findStringEnd(text, pos + 1, length);
+            while (pos < length && text[pos] == '\\'){
+                pos = findStringEnd(text, pos + 2, length);
+            }
+            pos = pos + 1;
+        } else {
+            const char *newline = memchr(text + pos, '\n', length - pos);
+            pos = newline == NULL ? length : (size_t)(newline - text);
+        }
+    }
+    chunks[count].start = start;
+    chunks[count].end = length;
+    return count + 1;
+}
+
+// Reads one chunk of a source ahead; run on the thread pool
+void readChunk(void *arg, int index){
+    Reader *reader = arg;
+    Chunk *chunk = reader->chunks + index;
+    jmp_buf abort;
+    chunk->failed = 0;
+    chunkAbort = &abort;
+    if (setjmp(abort) == 0){
+        Lexer lexer;
+        initLexer(&lexer, reader->text + chunk->start,
+                  chunk->end - chunk->start,
+                  sourceLocation(reader->source, chunk->start), 0);
+        Value *forms = makeNull();
+        Value *tail = NULL;
+        Value *datum = parseDatum(&lexer);
+        while (datum != NULL){
+            Value *cell = cons(datum, makeNull());
+            if (tail == NULL){
+                forms = cell;
+            } else {
+                tail->c.cdr = cell;
+            }
+            tail = cell;
+            datum = parseDatum(&lexer);
+        }
+        chunk->forms = forms;
+    } else {
+        chunk->failed = 1;
+    }
+    chunkAbort = NULL;
+}
+
+// Splits a large mapped source into chunks and reads them all in parallel
+void readAhead(Reader *reader){
+    int threads = poolSize();
+    size_t chunkSize = reader->length / (threads * CHUNKS_PER_THREAD);
+    if (chunkSize < MIN_CHUNK_SIZE){
+        chunkSize = MIN_CHUNK_SIZE;
+    }
+    int maxChunks = reader->length / chunkSize + 2;
+    reader->chunks = talloc(sizeof(Chunk) * maxChunks);
+    reader->chunkCount = splitSource(reader->text, reader->length, chunkSize,
+                                     reader->chunks, maxChunks);
+    parallelFor(reader->chunkCount, readChunk, reader);
+}
+
+// Moves on to the next chunk read ahead. A chunk that failed is read again
+// by the lexer, which reports its error when it gets to it.
+void nextChunk(Reader *reader){
+    Chunk *chunk = reader->chunks + reader->chunkIndex;
+    reader->chunkIndex = reader->chunkIndex + 1;
+    if (chunk->failed){
+        initLexer(&reader->lexer, reader->text + chunk->start,
+                  chunk->end - chunk->start,
+                  sourceLocation(reader->source, chunk->start), 0);
+    } else {
+        reader->forms = chunk->forms;
+    }
+}
+
+// Opens a reader over the source file at path, or over stdin if path is NULL
+Reader *openReader(char *path){
+    Reader *reader = talloc(sizeof(Reader));
+    int fd = STDIN_FILENO;
+    if (path != NULL){
+        fd = open(path, O_RDONLY);
+        if (fd < 0){
+            printf("cannot open input file\npath: %s\n", path);
+            texit(1);
+        }
+    }
+    Source *source = addSource(path == NULL ? "stdin" : path);
+    reader->source = source;
+    reader->stream = !mapSource(fd, source);
+    reader->consumed = 0;
+    reader->pos = 0;
+    startDatumScan(&reader->scan);
+    reader->chunks = NULL;
+    reader->chunkCount = 0;
+    reader->chunkIndex = 0;
+    reader->forms = NULL;
+    reader->cache = NULL;
+    if (reader->stream){
+        reader->fd = fd;
+        reader->capacity = READ_BUFFER_SIZE;
+        reader->buffer = talloc(READ_BUFFER_SIZE);
+        reader->text = reader->buffer;
+        reader->length = 0;
+        initLexer(&reader->lexer, reader->text, 0, 0, 1);
+    } else {
+        reader->fd = -1;
+        if (path != NULL){
+            close(fd);
+        }
+        reader->text = source->window;
+        reader->length = source->windowEnd;
+        nextBase = nextBase + reader->length + 1;
+        if (path != NULL && codeCacheEnabled()){
+            reader->forms = loadCodeCache(path, reader->text, reader->length,
+                                          source->base);
+            if (reader->forms == NULL){
+                reader->cache = startCodeCache(path, reader->text,
+                                               reader->length, source->base);
+            }
+        }
+        if (reader->forms != NULL){
+            initLexer(&reader->lexer, reader->text, 0, 0, 0);
+        } else if (reader->length >= PARALLEL_READ_SIZE && poolSize() > 1){
+            initLexer(&reader->lexer, reader->text, 0, 0, 0);
+            readAhead(reader);
+        } else {
+            initLexer(&reader->lexer, reader->text, reader->length,
+                      source->base, 0);
+        }
+    }
+    return reader;
+}
+
+// Returns 1 if the reader reads a stream rather than a mapped file
+int readerIsStream(Reader *reader){
+    return reader->stream;
+}
+
+// Reads the next top-level datum from whichever of the pending forms, the
+// lexer, the chunks read ahead and the stream has it
+Value *nextDatum(Reader *reader){
+    while (1){
+        if (reader->forms != NULL && reader->forms->type != NULL_TYPE){
+            Value *datum = car(reader->forms);
+            reader->forms = cdr(reader->forms);
+            return datum;
+        }
+        Value *datum = parseDatum(&reader->lexer);
+        if (datum != NULL){
+            return datum;
+        }
+        if (reader->chunkIndex < reader->chunkCount){
+            nextChunk(reader);
+            continue;
+        }
+        if (!reader->stream){
+            return NULL;
+        }
+
+        // a stream: wait for the next complete datum and lex just that
+        size_t end;
+        while (!scanDatum(&reader->scan, reader->text + reader->pos,
+                          reader->length - reader->pos, reader->fd < 0,
+                          &end)){
+            if (reader->fd < 0){
+                return NULL;
+            }
+            fillReader(reader);
+        }
+        reader->lexer.text = reader->text + reader->pos;
+        reader->lexer.length = end;
+        reader->lexer.pos = 0;
+        reader->lexer.base = sourceLocation(reader->source,
+                                            reader->consumed + reader->pos);
+        reader->pos = reader->pos + end;
+        startDatumScan(&reader->scan);
+    }
+}
+
+// Reads the next top-level datum and returns it, or NULL at the end
+Value *readDatum(Reader *reader){
+    Value *datum = nextDatum(reader);
+    if (reader->cache != NULL){
+        if (datum != NULL){
+            addCacheForm(reader->cache, datum);
+        } else {
+            finishCodeCache(reader->cache);
+            reader->cache = NULL;
+        }
+    }
+    return datum;
+}
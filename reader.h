@@ -0,0 +1,69 @@
+#include "value.h"
+
+#ifndef _READER
+#define _READER
+
+#include <stddef.h>
+
+// Reads a program one top-level datum at a time
+typedef struct Reader Reader;
+
+// Opens a reader over the source file at path, or over stdin if path is NULL.
+// Regular files are mapped into memory; pipes and terminals are read as a
+// stream, a buffer at a time.
+Reader *openReader(char *path);
+
+// Reads the next top-level datum and returns it, or NULL at the end of the
+// input
+Value *readDatum(Reader *reader);
+
+// How far a scan for the end of a datum has got: the position it stopped at,
+// whether that is in a comment, string or atom, how deep in lists it is, and
+// whether the datum has started
+struct DatumScan {
+    size_t pos;
+    int state;
+    int depth;
+    int started;
+};
+
+typedef struct DatumScan DatumScan;
+
+// Starts a scan for the end of the next datum
+void startDatumScan(DatumScan *scan);
+
+// Scans text[0, length) for the end of the datum it starts with, after any
+// space and comments, resuming where the last call stopped: the text may
+// have grown since, but the part already scanned must be unchanged. atEnd
+// says that no more text will come. Returns 1 and sets end to just past the
+// datum once it is complete.
+int scanDatum(DatumScan *scan, const char *text, size_t length, int atEnd,
+              size_t *end);
+
+// Returns 1 if the reader reads a stream rather than a mapped file
+int readerIsStream(Reader *reader);
+
+// Finds the source file, line and column (both from 1) of a location, as
+// stored in the loc of a value read from source. Returns 0 if the location
+// is unknown.
+int describeLocation(unsigned int loc, char **name, int *line, int *column);
+
+// Prints a location as "name:line:column: " in front of an error message, or
+// nothing if it is unknown
+void printLocation(unsigned int loc);
+
+// Packs into a block, allocated with malloc, what is needed to describe the
+// locations in every source read so far, and sets length to its size
+char *packSources(size_t *length);
+
+// Registers the sources packed by packSources, without their text, so that
+// locations in values read from them are described as before. Must be
+// called before any source is read. Returns 0 if the block is malformed.
+int unpackSources(const char *block, size_t length);
+
+// Reports an error in the source text at loc and exits. A thread reading a
+// chunk ahead abandons the chunk instead, and the error is reported in order
+// when the main thread reads the chunk itself.
+void sourceError(unsigned int loc, char *message);
+
+#endif
@@ -0,0 +1,880 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* schemec: compiles a Scheme program ahead of time to C against the
+* interpreter's runtime
+*/
+
+/*
+schemec reads the source files named on its command line, or stdin, and
+writes to stdout (or the file after -o) a C program that does what the
+interpreter does with them. It is built with the system C compiler and
+libscheme.a, the interpreter without its main; make prog.bin does both for
+prog.scm.
+
+The program holds the forms read as a table of constants (see aot.h), so it
+starts without tokenizing or parsing anything. Each top-level form becomes a
+C function run in order and printed as interpretForm would, and the last
+expression of each lambda body becomes a C function installed for it with
+jitInstall, which applyClosure runs in place of eval when a procedure made
+by that lambda is called.
+
+Within those functions
+
+    if, and, or, cond, begin,   are compiled to C, with the checks and error
+    quote, let, set!, define    messages of the interpreter
+    variable references         go through quickened nodes (see quicken.h)
+    car, cdr, null?, cons, +,   are done in place while the name is neither
+    -, *, and the comparisons   bound around the call nor bound again since
+                                the start (see optimize.h)
+    other calls                 evaluate the operator and arguments, then
+                                apply them; in tail position in a body they
+                                are left to applyClosure, so the stack does
+                                not grow (see jitTailCall)
+    let*, letrec, lambda and    are handed to eval, lambda bodies in them
+    anything else               still being compiled
+
+Nothing is evaluated when compiling, so errors come out when the program
+runs, at the same point and located in the same sources as when the
+interpreter runs them; only syntax errors are reported by schemec itself.
+*/
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "optimize.h"
+#include "output.h"
+#include "quicken.h"
+#include "reader.h"
+#include "talloc.h"
+#include "value.h"
+
+// Text being generated, grown as it is appended to
+struct Text {
+    char *chars;
+    size_t length;
+    size_t capacity;
+};
+
+typedef struct Text Text;
+
+// The names bound around an expression by the lambdas and lets it is in
+struct Scope {
+    char *name;
+    struct Scope *next;
+};
+
+typedef struct Scope Scope;
+
+// A C function being generated. temporaries numbers its variables, and
+// indent is how deep in blocks the next line is.
+struct Function {
+    Text text;
+    int temporaries;
+    int indent;
+};
+
+typedef struct Function Function;
+
+// The constants of the program: the values read, by address, in an
+// open-addressing table, and their entries in the table written out
+static Value **constantKeys = NULL;
+static int *constantIndexes = NULL;
+static int constantSlots = 0;
+static int constantCount = 0;
+static Text constants;
+
+// The number of quickened variable references, and the statements in main
+// that make them
+static int variableCount = 0;
+static Text variables;
+
+// The names whose watches the program reads, and the statements in main
+// that find them
+static char **watchNames = NULL;
+static int watchCount = 0;
+static Text watches;
+
+// The functions compiled, the statements in main that install the ones for
+// lambda bodies and run the ones for top-level forms, and the lambdas whose
+// bodies have been compiled
+static int functionCount = 0;
+static Text functions;
+static Text installs;
+static Text forms;
+static Value **lambdasDone = NULL;
+static int lambdaCount = 0;
+
+static void append(Text *text, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (text->length + length + 1 > text->capacity) {
+        size_t capacity = text->capacity == 0 ? 4096 : text->capacity * 2;
+        while (capacity < text->length + length + 1) {
+            capacity = capacity * 2;
+        }
+        char *grown = talloc(capacity);
+        if (text->length > 0) {
+            memcpy(grown, text->chars, text->length);
+        }
+        text->chars = grown;
+        text->capacity = capacity;
+    }
+    va_start(args, format);
+    vsnprintf(text->chars + text->length, length + 1, format, args);
+    va_end(args);
+    text->length = text->length + length;
+}
+
+// Appends a line of f at its indentation
+static void line(Function *f, const char *format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    append(&f->text, "%*s%s\n", 4 * f->indent, "", buffer);
+}
+
+// Appends length bytes of chars as the inside of a C string literal
+static void appendQuoted(Text *text, const char *chars, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        unsigned char c = chars[i];
+        if (c == '\\' || c == '"' || c == '?') {
+            append(text, "\\%c", c);
+        } else if (c < ' ' || c > '~') {
+            append(text, "\\%03o", c);
+        } else {
+            append(text, "%c", c);
+        }
+    }
+}
+
+// Returns a new variable of f
+static char *temporary(Function *f) {
+    char *name = talloc(16);
+    snprintf(name, 16, "v%d", f->temporaries);
+    f->temporaries = f->temporaries + 1;
+    return name;
+}
+
+// Returns the slot of value in the table of constants
+static size_t constantSlot(Value *value) {
+    size_t slot = (((uintptr_t) value >> 4) * 2654435761u) &
+                  (constantSlots - 1);
+    while (constantKeys[slot] != NULL && constantKeys[slot] != value) {
+        slot = (slot + 1) & (constantSlots - 1);
+    }
+    return slot;
+}
+
+// Returns the index of the constant value, or -1 if it is not one yet
+static int findConstant(Value *value) {
+    if (constantSlots == 0) {
+        return -1;
+    }
+    size_t slot = constantSlot(value);
+    return constantKeys[slot] == NULL ? -1 : constantIndexes[slot];
+}
+
+// Makes value the next constant, writing its entry, and returns its index
+static int addConstant(Value *value, int carIndex, int cdrIndex) {
+    if (constantCount * 2 >= constantSlots) {
+        Value **oldKeys = constantKeys;
+        int *oldIndexes = constantIndexes;
+        int oldSlots = constantSlots;
+        int i;
+        constantSlots = constantSlots == 0 ? 1024 : constantSlots * 2;
+        constantKeys = talloc(sizeof(Value *) * constantSlots);
+        constantIndexes = talloc(sizeof(int) * constantSlots);
+        memset(constantKeys, 0, sizeof(Value *) * constantSlots);
+        for (i = 0; i < oldSlots; i++) {
+            if (oldKeys[i] != NULL) {
+                size_t slot = constantSlot(oldKeys[i]);
+                constantKeys[slot] = oldKeys[i];
+                constantIndexes[slot] = oldIndexes[i];
+            }
+        }
+    }
+    size_t slot = constantSlot(value);
+    constantKeys[slot] = value;
+    constantIndexes[slot] = constantCount;
+
+    switch (value->type) {
+        case INT_TYPE:
+            append(&constants, "    {INT_TYPE, %u, %d, 0, NULL, 0, 0},\n",
+                   value->loc, value->i);
+            break;
+        case DOUBLE_TYPE:
+            append(&constants, "    {DOUBLE_TYPE, %u, 0, ", value->loc);
+            if (isnan(value->d)) {
+                append(&constants, "NAN");
+            } else if (isinf(value->d)) {
+                append(&constants, value->d < 0 ? "-HUGE_VAL" : "HUGE_VAL");
+            } else {
+                // exact, sign of zero included
+                append(&constants, "%a", value->d);
+            }
+            append(&constants, ", NULL, 0, 0},\n");
+            break;
+        case BOOL_TYPE:
+            append(&constants, "    {BOOL_TYPE, %u, 0, 0, \"%s\", 0, 0},\n",
+                   value->loc, value->s);
+            break;
+        case SYMBOL_TYPE:
+            append(&constants, "    {SYMBOL_TYPE, %u, 0, 0, \"", value->loc);
+            appendQuoted(&constants, value->s, strlen(value->s));
+            append(&constants, "\", 0, 0},\n");
+            break;
+        case STR_TYPE: {
+            // the characters of the string, with the quotes
+            size_t length = value->str.chars[0] == '"' ?
+                            (size_t)value->str.length + 2 :
+                            strlen(value->str.chars);
+            append(&constants, "    {STR_TYPE, %u, %d, 0, \"", value->loc,
+                   value->str.length);
+            appendQuoted(&constants, value->str.chars, length);
+            append(&constants, "\", 0, 0},\n");
+            break;
+        }
+        case CONS_TYPE:
+            append(&constants, "    {CONS_TYPE, %u, 0, 0, NULL, %d, %d},\n",
+                   value->loc, carIndex, cdrIndex);
+            break;
+        case NULL_TYPE:
+            append(&constants, "    {NULL_TYPE, %u, 0, 0, NULL, 0, 0},\n",
+                   value->loc);
+            break;
+        default:
+            printf("schemec: cannot compile a value of type %d\n",
+                   value->type);
+            texit(1);
+    }
+    constantCount = constantCount + 1;
+    return constantCount - 1;
+}
+
+// Returns the index of the constant value, making it and what it is made of
+// constants if they are not yet. The cells of a list are added last first,
+// so long lists do not make this recurse deeply.
+static int constantOf(Value *value) {
+    int index = findConstant(value);
+    if (index >= 0) {
+        return index;
+    }
+    if (value->type != CONS_TYPE) {
+        return addConstant(value, 0, 0);
+    }
+    int count = 0;
+    Value *rest = value;
+    while (rest->type == CONS_TYPE && findConstant(rest) < 0) {
+        count = count + 1;
+        rest = rest->c.cdr;
+    }
+    Value **cells = talloc(sizeof(Value *) * count);
+    int i;
+    rest = value;
+    for (i = 0; i < count; i++) {
+        cells[i] = rest;
+        rest = rest->c.cdr;
+    }
+    int cdrIndex = constantOf(rest);
+    for (i = count - 1; i >= 0; i--) {
+        int carIndex = constantOf(cells[i]->c.car);
+        cdrIndex = addConstant(cells[i], carIndex, cdrIndex);
+    }
+    return cdrIndex;
+}
+
+// Returns a new quickened reference to the variable symbol
+static int variableOf(Value *symbol) {
+    append(&variables, "    q[%d] = aotVariable(k[%d]);\n", variableCount,
+           constantOf(symbol));
+    variableCount = variableCount + 1;
+    return variableCount - 1;
+}
+
+// Returns the index of the watch of name
+static int watchOf(char *name) {
+    int i;
+    for (i = 0; i < watchCount; i++) {
+        if (!strcmp(watchNames[i], name)) {
+            return i;
+        }
+    }
+    char **grown = talloc(sizeof(char *) * (watchCount + 1));
+    memcpy(grown, watchNames, sizeof(char *) * watchCount);
+    watchNames = grown;
+    watchNames[watchCount] = name;
+    append(&watches, "    w[%d] = watchName(\"", watchCount);
+    appendQuoted(&watches, name, strlen(name));
+    append(&watches, "\");\n");
+    watchCount = watchCount + 1;
+    return watchCount - 1;
+}
+
+// The functions of the core primitives, by inline operation
+static char *corePrimitives[] = {
+    "primitiveCar", "primitiveCdr", "primitiveNull", "primitiveCons",
+    "primitiveAdd", "primitiveSubtract", "primitiveMult", "primitiveEqual",
+    "primitiveLess", "primitiveGreater", "primitiveLessEqual",
+    "primitiveGreaterEqual"
+};
+
+static Scope *bind(Scope *scope, char *name) {
+    Scope *inner = talloc(sizeof(Scope));
+    inner->name = name;
+    inner->next = scope;
+    return inner;
+}
+
+static int inScope(Scope *scope, char *name) {
+    while (scope != NULL) {
+        if (!strcmp(scope->name, name)) {
+            return 1;
+        }
+        scope = scope->next;
+    }
+    return 0;
+}
+
+// Returns 1 if expr is a list whose head is the symbol name
+static int isForm(Value *expr, char *name) {
+    return expr->type == CONS_TYPE && car(expr)->type == SYMBOL_TYPE &&
+           !strcmp(car(expr)->s, name);
+}
+
+// Returns 1 if bindings is a proper list of lists of a symbol and one more
+// element, as a let, let* or letrec that is not in error has
+static int wellFormedBindings(Value *bindings) {
+    if (properLength(bindings) < 0) {
+        return 0;
+    }
+    while (bindings->type == CONS_TYPE) {
+        Value *binding = car(bindings);
+        if (properLength(binding) != 2 || car(binding)->type != SYMBOL_TYPE) {
+            return 0;
+        }
+        bindings = cdr(bindings);
+    }
+    return 1;
+}
+
+// Returns the expressions a let or lambda body args evaluates, as
+// checkLetArgs and evalLambda pick them: each set! and begin after the
+// first of args, then the last of args
+static Value *bodyExpressions(Value *args) {
+    Value *body = makeNull();
+    Value *rest = cdr(args);
+    Value *last = car(args);
+    while (rest->type == CONS_TYPE) {
+        if (isForm(car(rest), "set!") || isForm(car(rest), "begin")) {
+            body = cons(car(rest), body);
+        }
+        last = car(rest);
+        rest = cdr(rest);
+    }
+    return reverse(cons(last, reverse(body)));
+}
+
+static int compileBody(Value *expr, Scope *scope, int tail);
+static void compileLambda(Value *expr, Scope *scope);
+
+// Compiles the bodies of the lambdas in expr, an expression handed to eval
+// in scope
+static void findLambdas(Value *expr, Scope *scope) {
+    if (expr->type != CONS_TYPE || isForm(expr, "quote")) {
+        return;
+    }
+    if (isForm(expr, "lambda")) {
+        compileLambda(expr, scope);
+        return;
+    }
+    if (isForm(expr, "let") || isForm(expr, "let*") ||
+        isForm(expr, "letrec")) {
+        Value *args = cdr(expr);
+        if (properLength(args) < 2 || !wellFormedBindings(car(args))) {
+            // left to the interpreter, lambdas and all
+            return;
+        }
+        Scope *inner = scope;
+        Value *bindings = car(args);
+        while (bindings->type == CONS_TYPE) {
+            inner = bind(inner, car(car(bindings))->s);
+            bindings = cdr(bindings);
+        }
+        Scope *initScope = isForm(expr, "letrec") ? inner : scope;
+        bindings = car(args);
+        while (bindings->type == CONS_TYPE) {
+            findLambdas(car(cdr(car(bindings))), initScope);
+            if (isForm(expr, "let*")) {
+                // each init sees the names bound before it
+                initScope = bind(initScope, car(car(bindings))->s);
+            }
+            bindings = cdr(bindings);
+        }
+        Value *body = cdr(args);
+        while (body->type == CONS_TYPE) {
+            findLambdas(car(body), inner);
+            body = cdr(body);
+        }
+        return;
+    }
+    while (expr->type == CONS_TYPE) {
+        findLambdas(car(expr), scope);
+        expr = cdr(expr);
+    }
+}
+
+// Compiles the body of a lambda in scope and installs it
+static void compileLambda(Value *expr, Scope *scope) {
+    int i;
+    for (i = 0; i < lambdaCount; i++) {
+        if (lambdasDone[i] == expr) {
+            return;
+        }
+    }
+    Value **grown = talloc(sizeof(Value *) * (lambdaCount + 1));
+    memcpy(grown, lambdasDone, sizeof(Value *) * lambdaCount);
+    lambdasDone = grown;
+    lambdasDone[lambdaCount] = expr;
+    lambdaCount = lambdaCount + 1;
+
+    Value *args = cdr(expr);
+    if (properLength(args) < 2 || properLength(car(args)) < 0) {
+        return;
+    }
+    Value *params = car(args);
+    while (params->type == CONS_TYPE) {
+        if (car(params)->type != SYMBOL_TYPE) {
+            return;
+        }
+        scope = bind(scope, car(params)->s);
+        params = cdr(params);
+    }
+    // applyClosure evaluates the rest of the body itself
+    Value *body = cdr(args);
+    while (cdr(body)->type == CONS_TYPE) {
+        findLambdas(car(body), scope);
+        body = cdr(body);
+    }
+    int function = compileBody(car(body), scope, 1);
+    append(&installs, "    jitInstall(k[%d], code%d);\n",
+           constantOf(car(body)), function);
+}
+
+static char *compileExpression(Function *f, Value *expr, char *frame,
+                               Scope *scope, int tail);
+
+// Emits code handing expr to eval
+static char *compileEval(Function *f, Value *expr, char *frame, Scope *scope) {
+    findLambdas(expr, scope);
+    char *result = temporary(f);
+    line(f, "Value *%s = eval(k[%d], %s);", result, constantOf(expr), frame);
+    return result;
+}
+
+// Assigns value, the result of a branch, to result, unless the branch
+// returned instead
+static void assign(Function *f, char *result, char *value) {
+    if (value != NULL) {
+        line(f, "%s = %s;", result, value);
+    }
+}
+
+static char *compileIf(Function *f, Value *args, char *frame, Scope *scope,
+                       int tail) {
+    char *test = compileExpression(f, car(args), frame, scope, 0);
+    char *result = temporary(f);
+    line(f, "Value *%s = NULL;", result);
+    line(f, "if (jitIfTest(%s)) {", test);
+    f->indent = f->indent + 1;
+    char *then = compileExpression(f, car(cdr(args)), frame, scope, tail);
+    assign(f, result, then);
+    f->indent = f->indent - 1;
+    line(f, "} else {");
+    f->indent = f->indent + 1;
+    char *otherwise = compileExpression(f, car(cdr(cdr(args))), frame, scope,
+                                        tail);
+    assign(f, result, otherwise);
+    f->indent = f->indent - 1;
+    line(f, "}");
+    return then == NULL && otherwise == NULL ? NULL : result;
+}
+
+// and or or, giving a new boolean
+static char *compileLogic(Function *f, Value *args, int isAnd, char *frame,
+                          Scope *scope) {
+    char *result = temporary(f);
+    line(f, "Value *%s;", result);
+    line(f, "do {");
+    f->indent = f->indent + 1;
+    while (args->type == CONS_TYPE) {
+        char *argument = compileExpression(f, car(args), frame, scope, 0);
+        line(f, "if (jitLogicTest(%s, %d)) {", argument, isAnd);
+        line(f, "    %s = makeBool(%d);", result, !isAnd);
+        line(f, "    break;");
+        line(f, "}");
+        args = cdr(args);
+    }
+    line(f, "%s = makeBool(%d);", result, isAnd);
+    f->indent = f->indent - 1;
+    line(f, "} while (0);");
+    return result;
+}
+
+static char *compileCond(Function *f, Value *clauses, char *frame,
+                         Scope *scope, int tail) {
+    char *result = temporary(f);
+    int returns = 1;
+    line(f, "Value *%s = NULL;", result);
+    line(f, "do {");
+    f->indent = f->indent + 1;
+    while (clauses->type == CONS_TYPE) {
+        Value *clause = car(clauses);
+        Value *test = car(clause);
+        if (test->type == SYMBOL_TYPE) {
+            // evalCond only looks at else among symbols
+            if (!strcmp(test->s, "else")) {
+                char *value = compileExpression(f, car(cdr(clause)), frame,
+                                                scope, tail);
+                if (value != NULL) {
+                    assign(f, result, value);
+                    returns = 0;
+                }
+                f->indent = f->indent - 1;
+                line(f, "} while (0);");
+                return returns ? NULL : result;
+            }
+        } else {
+            char *value = compileExpression(f, test, frame, scope, 0);
+            line(f, "if (jitCondTest(%s)) {", value);
+            f->indent = f->indent + 1;
+            value = compileExpression(f, car(cdr(clause)), frame, scope, tail);
+            if (value != NULL) {
+                assign(f, result, value);
+                line(f, "break;");
+                returns = 0;
+            }
+            f->indent = f->indent - 1;
+            line(f, "}");
+        }
+        clauses = cdr(clauses);
+    }
+    line(f, "%s = makeNull();", result);
+    f->indent = f->indent - 1;
+    line(f, "} while (0);");
+    return result;
+}
+
+// Returns 1 if every clause of a cond is a list of at least two elements,
+// so that compiling it cannot skip an error evalCond reports
+static int wellFormedCond(Value *clauses) {
+    if (properLength(clauses) < 0) {
+        return 0;
+    }
+    while (clauses->type == CONS_TYPE) {
+        Value *clause = car(clauses);
+        if (clause->type != CONS_TYPE || cdr(clause)->type != CONS_TYPE) {
+            return 0;
+        }
+        clauses = cdr(clauses);
+    }
+    return 1;
+}
+
+// The expressions of body in order, the last one in tail position if tail
+// is 1
+static char *compileSequence(Function *f, Value *body, char *frame,
+                             Scope *scope, int tail) {
+    char *result = NULL;
+    while (body->type == CONS_TYPE) {
+        int last = cdr(body)->type != CONS_TYPE;
+        result = compileExpression(f, car(body), frame, scope, tail && last);
+        body = cdr(body);
+    }
+    return result;
+}
+
+// let, in a frame of its own
+static char *compileLet(Function *f, Value *args, char *frame, Scope *scope,
+                        int tail) {
+    // the checks and lookups evalLet makes before evaluating anything
+    line(f, "checkLetArgs(k[%d], %s, 0);", constantOf(args), frame);
+    char *bindings = temporary(f);
+    line(f, "Value *%s = makeNull();", bindings);
+    Scope *inner = scope;
+    Value *rest = car(args);
+    while (rest->type == CONS_TYPE) {
+        Value *binding = car(rest);
+        char *value = compileExpression(f, car(cdr(binding)), frame, scope, 0);
+        line(f, "%s = cons(cons(k[%d], cons(%s, makeNull())), %s);",
+             bindings, constantOf(car(binding)), value, bindings);
+        inner = bind(inner, car(binding)->s);
+        rest = cdr(rest);
+    }
+    char *child = temporary(f);
+    line(f, "Frame *%s = talloc(sizeof(Frame));", child);
+    line(f, "%s->bindings = %s;", child, bindings);
+    line(f, "%s->parent = %s;", child, frame);
+    return compileSequence(f, bodyExpressions(args), child, inner, tail);
+}
+
+// A call. A core primitive is done in place while its name is bound to it.
+static char *compileCall(Function *f, Value *expr, char *frame, Scope *scope,
+                         int tail) {
+    Value *head = car(expr);
+    Value *args = cdr(expr);
+    int count = properLength(args);
+    int operation = INLINE_NONE;
+    Watch *watch = watchName(head->s);
+    if (!inScope(scope, head->s) && watch->primitive >= 0) {
+        operation = inlineOperation(primitiveAt(watch->primitive)->function);
+        if (count != (operation <= INLINE_NULL ? 1 : 2)) {
+            operation = INLINE_NONE;
+        }
+    }
+    char *guard = NULL;
+    char *function = temporary(f);
+    if (operation != INLINE_NONE) {
+        guard = temporary(f);
+        line(f, "int %s = w[%d]->changes == 0;", guard, watchOf(head->s));
+        line(f, "Value *%s = %s ? NULL : evalQuick(q[%d], %s);", function,
+             guard, variableOf(head), frame);
+    } else {
+        line(f, "Value *%s = evalQuick(q[%d], %s);", function,
+             variableOf(head), frame);
+    }
+    char *list = talloc(32 * (count + 1) + 16);
+    char *first = NULL;
+    char *second = NULL;
+    list[0] = '\0';
+    while (args->type == CONS_TYPE) {
+        char *value = compileExpression(f, car(args), frame, scope, 0);
+        if (first == NULL) {
+            first = value;
+        } else if (second == NULL) {
+            second = value;
+        }
+        sprintf(list + strlen(list), "cons(%s, ", value);
+        args = cdr(args);
+    }
+    sprintf(list + strlen(list), "makeNull()");
+    int i;
+    for (i = 0; i < count; i++) {
+        strcat(list, ")");
+    }
+    char *result = temporary(f);
+    line(f, "Value *%s;", result);
+    if (operation != INLINE_NONE) {
+        line(f, "if (%s) {", guard);
+        if (operation <= INLINE_NULL) {
+            line(f, "    %s = corePrimitiveOne(%d, %s, %s);", result,
+                 operation, corePrimitives[operation], first);
+        } else {
+            line(f, "    %s = corePrimitiveTwo(%d, %s, %s, %s);", result,
+                 operation, corePrimitives[operation], first, second);
+        }
+        line(f, "} else {");
+        f->indent = f->indent + 1;
+    }
+    if (tail) {
+        line(f, "return jitTailCall(%s, %s);", function, list);
+    } else {
+        line(f, "%s = apply(%s, %s);", result, function, list);
+    }
+    if (operation != INLINE_NONE) {
+        f->indent = f->indent - 1;
+        line(f, "}");
+        return result;
+    }
+    return tail ? NULL : result;
+}
+
+// Emits code evaluating expr in the frame named frame, and returns the
+// variable holding its value, or NULL if the code returns a tail call
+// instead, as it may if tail is 1
+static char *compileExpression(Function *f, Value *expr, char *frame,
+                               Scope *scope, int tail) {
+    if (expr->type == SYMBOL_TYPE) {
+        char *result = temporary(f);
+        line(f, "Value *%s = evalQuick(q[%d], %s);", result, variableOf(expr),
+             frame);
+        return result;
+    }
+    if (expr->type != CONS_TYPE) {
+        // everything else evaluates to itself
+        char *result = temporary(f);
+        line(f, "Value *%s = k[%d];", result, constantOf(expr));
+        return result;
+    }
+    Value *head = car(expr);
+    Value *args = cdr(expr);
+    int count = properLength(args);
+    if (head->type != SYMBOL_TYPE) {
+        return compileEval(f, expr, frame, scope);
+    }
+    if (!strcmp(head->s, "quote") && count == 1) {
+        char *result = temporary(f);
+        line(f, "Value *%s = k[%d];", result, constantOf(car(args)));
+        return result;
+    } else if (!strcmp(head->s, "if") && count == 3) {
+        return compileIf(f, args, frame, scope, tail);
+    } else if ((!strcmp(head->s, "and") || !strcmp(head->s, "or")) &&
+               count >= 0) {
+        return compileLogic(f, args, !strcmp(head->s, "and"), frame, scope);
+    } else if (!strcmp(head->s, "cond") && wellFormedCond(args)) {
+        return compileCond(f, args, frame, scope, tail);
+    } else if (!strcmp(head->s, "begin") && count >= 0) {
+        if (count == 0) {
+            char *result = temporary(f);
+            line(f, "Value *%s = makeNull();", result);
+            return result;
+        }
+        return compileSequence(f, args, frame, scope, tail);
+    } else if (!strcmp(head->s, "let") && count >= 2 &&
+               car(args)->type == CONS_TYPE &&
+               wellFormedBindings(car(args))) {
+        return compileLet(f, args, frame, scope, tail);
+    } else if (!strcmp(head->s, "set!") && count == 2) {
+        char *value = compileExpression(f, car(cdr(args)), frame, scope, 0);
+        char *result = temporary(f);
+        line(f, "Value *%s = setVariable(k[%d], %s, %s);", result,
+             constantOf(car(args)), value, frame);
+        return result;
+    } else if (!strcmp(head->s, "define") && count == 2 &&
+               car(args)->type == SYMBOL_TYPE) {
+        char *value = compileExpression(f, car(cdr(args)), frame, scope, 0);
+        char *result = temporary(f);
+        line(f, "Value *%s = defineVariable(k[%d], %s);", result,
+             constantOf(args), value);
+        return result;
+    } else if (!strcmp(head->s, "quote") || !strcmp(head->s, "if") ||
+               !strcmp(head->s, "and") || !strcmp(head->s, "or") ||
+               !strcmp(head->s, "cond") || !strcmp(head->s, "begin") ||
+               !strcmp(head->s, "let") || !strcmp(head->s, "let*") ||
+               !strcmp(head->s, "letrec") || !strcmp(head->s, "set!") ||
+               !strcmp(head->s, "define") || !strcmp(head->s, "lambda") ||
+               !strcmp(head->s, "pipeline") ||
+               !strcmp(head->s, "define-memoized") ||
+               !strcmp(head->s, "delay") ||
+               !strcmp(head->s, "delay-force") ||
+               !strcmp(head->s, "stream-cons") ||
+               !strcmp(head->s, "parallel-let") ||
+               !strcmp(head->s, "parallel-call") || count < 0) {
+        return compileEval(f, expr, frame, scope);
+    }
+    return compileCall(f, expr, frame, scope, tail);
+}
+
+// Compiles expr, in scope, to a function of the frame to evaluate it in,
+// and returns its number
+static int compileBody(Value *expr, Scope *scope, int tail) {
+    Function function;
+    memset(&function, 0, sizeof(Function));
+    function.indent = 1;
+    char *result = compileExpression(&function, expr, "frame", scope, tail);
+    if (result != NULL) {
+        line(&function, "return %s;", result);
+    }
+    int number = functionCount;
+    functionCount = functionCount + 1;
+    append(&functions, "\nstatic Value *code%d(Frame *frame) {\n", number);
+    if (function.text.length > 0) {
+        append(&functions, "%s", function.text.chars);
+    }
+    append(&functions, "}\n");
+    return number;
+}
+
+// Writes the program to out
+static void writeProgram(FILE *out) {
+    size_t length;
+    char *sources = packSources(&length);
+    size_t i;
+    fprintf(out, "// Compiled by schemec; see schemec.c\n\n");
+    fprintf(out, "#include <math.h>\n#include <stddef.h>\n");
+    fprintf(out, "#include \"aot.h\"\n#include \"interpreter.h\"\n");
+    fprintf(out, "#include \"jit.h\"\n#include \"linkedlist.h\"\n");
+    fprintf(out, "#include \"optimize.h\"\n#include \"primitives.h\"\n");
+    fprintf(out, "#include \"quicken.h\"\n#include \"talloc.h\"\n");
+    fprintf(out, "#include \"value.h\"\n\n");
+    fprintf(out, "static const AotConstant constants[] = {\n%s};\n\n",
+            constantCount > 0 ? constants.chars : "    {NULL_TYPE}\n");
+    fprintf(out, "static const char sources[] = {");
+    for (i = 0; i < length; i++) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ",
+                (signed char) sources[i]);
+    }
+    fprintf(out, "\n};\n\n");
+    free(sources);
+    fprintf(out, "static Value **k;\n");
+    fprintf(out, "static Quick *q[%d];\n", variableCount + 1);
+    fprintf(out, "static Watch *w[%d];\n", watchCount + 1);
+    if (functions.length > 0) {
+        fprintf(out, "%s", functions.chars);
+    }
+    fprintf(out, "\nint main(void) {\n");
+    fprintf(out, "    aotStart(sources, sizeof(sources));\n");
+    fprintf(out, "    k = aotConstants(constants, %d);\n", constantCount);
+    fprintf(out, "%s%s%s%s", variables.length ? variables.chars : "",
+            watches.length ? watches.chars : "",
+            installs.length ? installs.chars : "",
+            forms.length ? forms.chars : "");
+    fprintf(out, "    tfree();\n    return 0;\n}\n");
+}
+
+// Compiles the source files named on the command line, or stdin when there
+// are none ("-" names stdin), to a C program written to stdout or to the
+// file after -o
+int main(int argc, char *argv[]) {
+    char *output = NULL;
+    int sources = 0;
+    int i;
+    initOutput();
+    initInterpreter();
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            i = i + 1;
+            output = argv[i];
+            continue;
+        }
+        Reader *reader = openReader(!strcmp(argv[i], "-") ? NULL : argv[i]);
+        Value *form = readDatum(reader);
+        while (form != NULL) {
+            int function = compileBody(form, NULL, 0);
+            append(&forms, "    interpretCompiledForm(k[%d], code%d);\n",
+                   constantOf(form), function);
+            form = readDatum(reader);
+        }
+        sources = sources + 1;
+    }
+    if (sources == 0) {
+        Reader *reader = openReader(NULL);
+        Value *form = readDatum(reader);
+        while (form != NULL) {
+            int function = compileBody(form, NULL, 0);
+            append(&forms, "    interpretCompiledForm(k[%d], code%d);\n",
+                   constantOf(form), function);
+            form = readDatum(reader);
+        }
+    }
+    FILE *out = output == NULL ? stdout : fopen(output, "w");
+    if (out == NULL) {
+        printf("schemec: cannot write %s\n", output);
+        texit(1);
+    }
+    writeProgram(out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    tfree();
+    return 0;
+}
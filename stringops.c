@@ -0,0 +1,369 @@
+/*
+String primitives for Scheme interpreter
+Created by Tom Choi, Kaya Govek, Jonah Tuchow
+
+Strings carry their length, so string-length is constant time and every
+comparison and search works on known extents with memcmp/memchr, which the C
+library vectorizes. Substring search filters candidate positions 16 at a time
+with SSE2 for short needles and falls back to the C library's two-way memmem
+for long ones, which keeps the worst case linear.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stringops.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "primitives.h"
+#include "talloc.h"
+#include "value.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define STRINGOPS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Needles longer than this go to the two-way search
+#define SIMD_NEEDLE_MAX 16
+
+// Creates a STR_TYPE value holding a copy of length characters of text
+Value *makeString(char *text, int length) {
+    char *chars = talloc(sizeof(char) * (length + 3));
+    chars[0] = '\"';
+    memcpy(chars + 1, text, length);
+    chars[length + 1] = '\"';
+    chars[length + 2] = '\0';
+    Value *value = makeNull();
+    value->type = STR_TYPE;
+    value->str.chars = chars;
+    value->str.length = length;
+    return value;
+}
+
+// Creates the "." marker that cons puts before the cdr of an improper list
+Value *makeDot() {
+    Value *dot = makeNull();
+    dot->type = STR_TYPE;
+    dot->str.chars = ".";
+    dot->str.length = 0;
+    return dot;
+}
+
+// Returns the characters between the quotes of a string
+char *stringContents(Value *string) {
+    return string->str.chars + 1;
+}
+
+// Returns how many characters of str.chars a string prints as
+int stringTextLength(Value *string) {
+    if (string->str.chars[0] != '\"') {
+        return strlen(string->str.chars);
+    }
+    return string->str.length + 2;
+}
+
+// Returns the escape a character of a string is written with, or 0 if it is
+// written as itself. Other control characters are written in hex.
+char escapeLetter(unsigned char c) {
+    switch (c) {
+        case '\n': return 'n';
+        case '\t': return 't';
+        case '\r': return 'r';
+        case '\a': return 'a';
+        case '\b': return 'b';
+        case '\\': return '\\';
+        case '\"': return '\"';
+        default: return c < ' ' || c == 0x7f ? 'x' : 0;
+    }
+}
+
+// Returns the text a string is written as, setting *length to its length
+char *writtenString(Value *string, int *length) {
+    int i;
+    int extra = 0;
+    if (string->str.chars[0] != '\"') {
+        *length = strlen(string->str.chars);
+        return string->str.chars;
+    }
+    unsigned char *contents = (unsigned char *)stringContents(string);
+    for (i = 0; i < string->str.length; i++) {
+        char letter = escapeLetter(contents[i]);
+        if (letter != 0) {
+            extra = extra + (letter == 'x' ? 4 : 1);
+        }
+    }
+    *length = string->str.length + 2 + extra;
+    if (extra == 0) {
+        return string->str.chars;
+    }
+    char *text = talloc(sizeof(char) * (*length + 1));
+    int pos = 1;
+    text[0] = '\"';
+    for (i = 0; i < string->str.length; i++) {
+        char letter = escapeLetter(contents[i]);
+        if (letter == 0) {
+            text[pos] = contents[i];
+            pos = pos + 1;
+        } else if (letter == 'x') {
+            snprintf(text + pos, 6, "\\x%02x;", contents[i]);
+            pos = pos + 5;
+        } else {
+            text[pos] = '\\';
+            text[pos + 1] = letter;
+            pos = pos + 2;
+        }
+    }
+    text[pos] = '\"';
+    text[pos + 1] = '\0';
+    return text;
+}
+
+// Finds needle in haystack; returns the offset or -1
+int stringSearch(char *haystack, int haystackLength,
+                 char *needle, int needleLength) {
+    if (needleLength == 0) {
+        return 0;
+    }
+    if (needleLength > haystackLength) {
+        return -1;
+    }
+    if (needleLength == 1) {
+        char *found = memchr(haystack, needle[0], haystackLength);
+        return found == NULL ? -1 : (int)(found - haystack);
+    }
+#ifdef STRINGOPS_SSE2
+    if (needleLength <= SIMD_NEEDLE_MAX) {
+        // compare the first and last needle byte at 16 positions at once;
+        // only positions where both match are checked in full
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+        int i = 0;
+        for (; i + needleLength - 1 + 16 <= haystackLength; i += 16) {
+            __m128i blockFirst = _mm_loadu_si128((__m128i *)(haystack + i));
+            __m128i blockLast = _mm_loadu_si128(
+                (__m128i *)(haystack + i + needleLength - 1));
+            unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+                              _mm_cmpeq_epi8(last, blockLast)));
+            while (mask != 0) {
+                int bit = __builtin_ctz(mask);
+                if (!memcmp(haystack + i + bit + 1, needle + 1,
+                            needleLength - 2)) {
+                    return i + bit;
+                }
+                mask = mask & (mask - 1);
+            }
+        }
+        for (; i + needleLength <= haystackLength; i++) {
+            if (haystack[i] == needle[0] &&
+                !memcmp(haystack + i, needle, needleLength)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+#endif
+    char *found = memmem(haystack, haystackLength, needle, needleLength);
+    return found == NULL ? -1 : (int)(found - haystack);
+}
+
+// Exits with a contract violation unless value is a string
+void checkString(Value *value, char *symbol) {
+    if (value->type != STR_TYPE) {
+        printf("%s: contract violation\nexpected: string?\ngiven: ", symbol);
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+}
+
+// Exits unless value is an index into a string of the given length
+int checkStringIndex(Value *value, int length, char *symbol) {
+    if (value->type != INT_TYPE || value->i < 0) {
+        printf("%s: contract violation\n", symbol);
+        printf("expected: exact-nonnegative-integer?\ngiven: ");
+        printInterpTree(value);
+        printf("\n");
+        texit(1);
+    }
+    if (value->i > length) {
+        printf("%s: index is out of range\nindex: %d\nvalid range: [0, %d]\n",
+               symbol, value->i, length);
+        texit(1);
+    }
+    return value->i;
+}
+
+// Returns a negative, zero or positive number as a sorts before, with or
+// after b
+int compareStrings(Value *a, Value *b) {
+    int shorter = a->str.length < b->str.length ? a->str.length
+                                                 : b->str.length;
+    int result = memcmp(stringContents(a), stringContents(b), shorter);
+    if (result != 0) {
+        return result;
+    }
+    return a->str.length - b->str.length;
+}
+
+// Boxes an int
+Value *makeIndex(int i) {
+    Value *value = makeNull();
+    value->type = INT_TYPE;
+    value->i = i;
+    return value;
+}
+
+Value *primitiveStringLength(Value *args) {
+    checkArity(args, 1, "string-length");
+    checkString(car(args), "string-length");
+    return makeIndex(car(args)->str.length);
+}
+
+Value *primitiveStringAppend(Value *args) {
+    int total = 0;
+    Value *args_ptr = args;
+    while (args_ptr->type != NULL_TYPE) {
+        checkString(car(args_ptr), "string-append");
+        total = total + car(args_ptr)->str.length;
+        args_ptr = cdr(args_ptr);
+    }
+    char *chars = talloc(sizeof(char) * (total + 3));
+    int offset = 1;
+    chars[0] = '\"';
+    args_ptr = args;
+    while (args_ptr->type != NULL_TYPE) {
+        Value *string = car(args_ptr);
+        memcpy(chars + offset, stringContents(string), string->str.length);
+        offset = offset + string->str.length;
+        args_ptr = cdr(args_ptr);
+    }
+    chars[offset] = '\"';
+    chars[offset + 1] = '\0';
+    Value *result = makeNull();
+    result->type = STR_TYPE;
+    result->str.chars = chars;
+    result->str.length = total;
+    return result;
+}
+
+Value *primitiveSubstring(Value *args) {
+    int i = length(args);
+    if (i != 2 && i != 3) {
+        printf("substring: arity mismatch;\nthe expected number of arguments ");
+        printf("does not match the given number\nexpected: 2 or 3\ngiven: ");
+        printf("%d\n", i);
+        texit(1);
+    }
+    Value *string = car(args);
+    checkString(string, "substring");
+    int start = checkStringIndex(car(cdr(args)), string->str.length,
+                                 "substring");
+    int end = string->str.length;
+    if (i == 3) {
+        end = checkStringIndex(car(cdr(cdr(args))), string->str.length,
+                               "substring");
+    }
+    if (end < start) {
+        printf("substring: ending index is smaller than starting index\n");
+        printf("ending index: %d\nstarting index: %d\n", end, start);
+        texit(1);
+    }
+    return makeString(stringContents(string) + start, end - start);
+}
+
+// Checks that each string is ordered before the next as test requires
+Value *compareChain(Value *args, int (*test)(int), char *symbol) {
+    Value *args_ptr = args;
+    if (args->type == NULL_TYPE) {
+        printf("%s: arity mismatch;\nthe expected number of arguments ",
+               symbol);
+        printf("does not match the given number\nexpected: at least 1\n");
+        printf("given: 0\n");
+        texit(1);
+    }
+    checkString(car(args_ptr), symbol);
+    int result = 1;
+    while (cdr(args_ptr)->type != NULL_TYPE) {
+        Value *a = car(args_ptr);
+        Value *b = car(cdr(args_ptr));
+        checkString(b, symbol);
+        if (result) {
+            if (test == NULL) {
+                // equality needs no ordering, only equal extents
+                result = a->str.length == b->str.length &&
+                         !memcmp(stringContents(a), stringContents(b),
+                                 a->str.length);
+            } else {
+                result = test(compareStrings(a, b));
+            }
+        }
+        args_ptr = cdr(args_ptr);
+    }
+    return makeBool(result);
+}
+
+// Ordering test for string<?
+int isNegative(int comparison) {
+    return comparison < 0;
+}
+
+Value *primitiveStringEqual(Value *args) {
+    return compareChain(args, NULL, "string=?");
+}
+
+Value *primitiveStringLess(Value *args) {
+    return compareChain(args, isNegative, "string<?");
+}
+
+// (string-index string char-string) finds the first occurrence of a
+// one-character string, since the interpreter has no character type
+Value *primitiveStringIndex(Value *args) {
+    checkArity(args, 2, "string-index");
+    Value *string = car(args);
+    Value *target = car(cdr(args));
+    checkString(string, "string-index");
+    checkString(target, "string-index");
+    if (target->str.length != 1) {
+        printf("string-index: contract violation\n");
+        printf("expected: string of length 1\ngiven: ");
+        printInterpTree(target);
+        printf("\n");
+        texit(1);
+    }
+    char *found = memchr(stringContents(string), stringContents(target)[0],
+                         string->str.length);
+    if (found == NULL) {
+        return makeBool(0);
+    }
+    return makeIndex(found - stringContents(string));
+}
+
+// (string-search string pattern [start])
+Value *primitiveStringSearch(Value *args) {
+    int i = length(args);
+    if (i != 2 && i != 3) {
+        printf("string-search: arity mismatch;\n");
+        printf("the expected number of arguments does not match the given ");
+        printf("number\nexpected: 2 or 3\ngiven: %d\n", i);
+        texit(1);
+    }
+    Value *string = car(args);
+    Value *pattern = car(cdr(args));
+    checkString(string, "string-search");
+    checkString(pattern, "string-search");
+    int start = 0;
+    if (i == 3) {
+        start = checkStringIndex(car(cdr(cdr(args))), string->str.length,
+                                 "string-search");
+    }
+    int found = stringSearch(stringContents(string) + start,
+                             string->str.length - start,
+                             stringContents(pattern), pattern->str.length);
+    if (found < 0) {
+        return makeBool(0);
+    }
+    return makeIndex(start + found);
+}
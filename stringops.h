@@ -0,0 +1,40 @@
+#include "value.h"
+
+#ifndef _STRINGOPS
+#define _STRINGOPS
+
+// Creates a STR_TYPE value holding a copy of length characters of text
+Value *makeString(char *text, int length);
+
+// Creates the "." marker that cons puts before the cdr of an improper list
+Value *makeDot();
+
+// Returns the characters between the quotes of a string
+char *stringContents(Value *string);
+
+// Returns how many characters of str.chars a string prints as: its text with
+// the quotes, or all of a marker such as the "." of an improper list. String
+// text is not NUL-terminated when it points into source text.
+int stringTextLength(Value *string);
+
+// Returns the text a string is written as, setting *length to its length:
+// its characters in quotes, with those that need it escaped again as the
+// reader takes them, or all of a marker such as "."
+char *writtenString(Value *string, int *length);
+
+// Exits with a contract violation unless value is a string
+void checkString(Value *value, char *symbol);
+
+// Finds needle in haystack; returns the offset or -1
+int stringSearch(char *haystack, int haystackLength,
+                 char *needle, int needleLength);
+
+Value *primitiveStringLength(Value *args);
+Value *primitiveStringAppend(Value *args);
+Value *primitiveSubstring(Value *args);
+Value *primitiveStringEqual(Value *args);
+Value *primitiveStringLess(Value *args);
+Value *primitiveStringIndex(Value *args);
+Value *primitiveStringSearch(Value *args);
+
+#endif
@@ -3,16 +3,27 @@
 * Implementation of talloc which stores
 * every pointer to memory blocks allocated in the heap,
 * and tfree that frees every memory block in the heap
+*
+* Each thread keeps its own list, so threads never contend in talloc. A
+* worker thread hands its list over when it finishes a task, and tfree frees
+* the lists handed over along with its own.
 */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "value.h"
+#include "talloc.h"
 
-// Global declaration of the head
-Value *head;
+// Head of this thread's list, and its last node, which ends the list
+__thread Value *head;
+__thread Value *last;
 int freed = 0;
 
+// Lists handed over by other threads
+Value *handedOver = NULL;
+pthread_mutex_t handOverLock = PTHREAD_MUTEX_INITIALIZER;
+
 // Helper method for creating a pointer to NULL_TYPE Value
 Value *makeNull_talloc(){
     Value *nulltype = malloc(sizeof(Value));
@@ -35,33 +46,50 @@ void *talloc(size_t size) {
     void *val = malloc(size);
     if (head == NULL){
         head = makeNull_talloc();
+        last = head;
     }
     head = cons_talloc(val, head);
     return val;
 }
 
-// Helper method for tfree
-// Frees car and then recursively frees cdr part
-void tfree_helper(Value *ptr){
-    if (ptr->type == CONS_TYPE){
-        free(ptr->c.car);
-        tfree_helper(ptr->c.cdr);
-        free(ptr);
-    }else{
-        free(ptr);
+// Moves this thread's list onto the lists handed over to tfree
+void tallocHandOver() {
+    if (head == NULL){
+        return;
     }
+    pthread_mutex_lock(&handOverLock);
+    if (handedOver != NULL){
+        // the node that ended this list now links to the others
+        last->type = CONS_TYPE;
+        last->c.car = NULL;
+        last->c.cdr = handedOver;
+    }
+    handedOver = head;
+    pthread_mutex_unlock(&handOverLock);
+    head = NULL;
+    last = NULL;
+}
+
+// Frees every memory block in a list, walking it with a loop so that long
+// lists cannot overflow the stack
+void freeList(Value *list) {
+    while (list != NULL && list->type == CONS_TYPE){
+        Value *next = list->c.cdr;
+        free(list->c.car);
+        free(list);
+        list = next;
+    }
+    free(list);
 }
 
 // Frees every memory block in the heap
 void tfree() {
-    if (head->type == CONS_TYPE){
-        free(head->c.car);
-        tfree_helper(head->c.cdr);
-        free(head);
-    }else{
-        free(head);
-    }
+    tallocHandOver();
+    pthread_mutex_lock(&handOverLock);
+    freeList(handedOver);
+    handedOver = NULL;
     freed = 1;
+    pthread_mutex_unlock(&handOverLock);
 }
 
 // Frees the memory allocated in the heap and then exits
@@ -15,6 +15,10 @@ void *talloc(size_t size);
 // allocated in lists to hold those pointers.
 void tfree();
 
+// Hands the pointers this thread allocated over to tfree. A thread other
+// than the one that calls tfree must call it before it stops allocating.
+void tallocHandOver();
+
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
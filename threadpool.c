@@ -0,0 +1,135 @@
+/*
+* Tom Choi, Kaya Govek, Jonah Tuchow
+* A fixed pool of worker threads that run indexed tasks alongside the
+* calling thread
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+#include "talloc.h"
+
+// At most this many threads are started, whatever the core count
+#define MAX_THREADS 64
+
+// The job the workers are running: the tasks, the next index to hand out,
+// and how many workers have not finished with it yet
+struct Job {
+    void (*task)(void *arg, int index);
+    void *arg;
+    int count;
+    int next;
+    int busy;
+};
+
+typedef struct Job Job;
+
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+Job job;
+unsigned long generation = 0;
+int workerCount = -1;
+
+// Set in pool threads, and in the caller while it runs tasks
+__thread int inPool = 0;
+
+// Runs tasks of the current job until none are left
+void runTasks(){
+    while (1){
+        int index = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED);
+        if (index >= job.count){
+            return;
+        }
+        job.task(job.arg, index);
+    }
+}
+
+// Body of a worker thread: waits for each new job and helps run it
+void *workerMain(void *unused){
+    unsigned long seen = 0;
+    inPool = 1;
+    pthread_mutex_lock(&poolLock);
+    while (1){
+        while (generation == seen){
+            pthread_cond_wait(&jobReady, &poolLock);
+        }
+        seen = generation;
+        pthread_mutex_unlock(&poolLock);
+
+        runTasks();
+        // what the tasks allocated must outlive this thread's part in them
+        tallocHandOver();
+
+        pthread_mutex_lock(&poolLock);
+        job.busy = job.busy - 1;
+        if (job.busy == 0){
+            pthread_cond_signal(&jobDone);
+        }
+    }
+    return unused;
+}
+
+// Returns the number of threads tasks run on, counting the caller
+int poolSize(){
+    if (workerCount < 0){
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        char *setting = getenv("SCHEME_THREADS");
+        if (setting != NULL){
+            threads = atol(setting);
+        }
+        if (threads < 1){
+            threads = 1;
+        }
+        if (threads > MAX_THREADS){
+            threads = MAX_THREADS;
+        }
+        workerCount = 0;
+        // the default stack size differs from one system to another
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, POOL_STACK_SIZE);
+        int i;
+        for (i = 1; i < threads; i++){
+            pthread_t thread;
+            if (pthread_create(&thread, &attributes, workerMain, NULL) != 0){
+                break;
+            }
+            pthread_detach(thread);
+            workerCount = workerCount + 1;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    return workerCount + 1;
+}
+
+// Runs task(arg, i) for i from 0 to count - 1 and waits for all of them
+void parallelFor(int count, void (*task)(void *arg, int index), void *arg){
+    int i;
+    if (inPool || count <= 1 || poolSize() == 1){
+        for (i = 0; i < count; i++){
+            task(arg, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&poolLock);
+    job.task = task;
+    job.arg = arg;
+    job.count = count;
+    job.next = 0;
+    job.busy = workerCount;
+    generation = generation + 1;
+    pthread_cond_broadcast(&jobReady);
+    pthread_mutex_unlock(&poolLock);
+
+    inPool = 1;
+    runTasks();
+    inPool = 0;
+
+    pthread_mutex_lock(&poolLock);
+    while (job.busy > 0){
+        pthread_cond_wait(&jobDone, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+}
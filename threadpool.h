@@ -0,0 +1,18 @@
+#ifndef _THREADPOOL
+#define _THREADPOOL
+
+// Stack size of each pool thread, so that how deep a task may go does not
+// depend on the system's default
+#define POOL_STACK_SIZE (16 * 1024 * 1024)
+
+// Returns the number of threads parallelFor runs tasks on, counting the
+// caller: one per online core, or SCHEME_THREADS if it is set
+int poolSize();
+
+// Runs task(arg, i) for every i from 0 to count - 1 on the pool's threads
+// and the calling thread, and returns once all of them have finished. Tasks
+// are handed out in order, one index at a time. Called from inside a task,
+// it runs the tasks on the calling thread.
+void parallelFor(int count, void (*task)(void *arg, int index), void *arg);
+
+#endif
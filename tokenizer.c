@@ -3,630 +3,547 @@
 * Implementation of tokenizer
 */
 
+/*
+A Lexer walks source text in memory with a cursor and hands out one token
+at a time, so no token list is ever built. Tokens are slices of the text
+rather than copies: strings point straight into the source, quotes
+included, numbers are converted from the digits in place, and symbol names
+are interned so each distinct name is copied once. Only a string with
+escapes is copied, with each escape replaced by the character it stands
+for, so a string's length is always the number of its characters.
+Parentheses carry no data, so the lexer returns the same value for every
+one. Every token records its source location (see reader.h).
+
+Characters are classified by one lookup in a 256-entry class table, and the
+first character of a token picks its scanner. Whitespace runs and string
+bodies are skipped 16 bytes at a time with SSE2 and comments with memchr, so
+input between tokens costs a few vector compares and no allocation.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "value.h"
 #include "talloc.h"
 #include "linkedlist.h"
+#include "tokenizer.h"
+#include "reader.h"
+#include "intern.h"
+#include "stringops.h"
 
-/*
-Vector is for storing information regarding what characters are being read
-and the size of the string for dynamic memory allocation.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TOKENIZER_SSE2 1
+#include <emmintrin.h>
+#endif
 
-In case a close parenthesis is read and terminates tokenizing a double,
-it stores the close parenthesis and later tokenizes the close parenthesis
-seperately.
+// Numbers at most this long are converted from a copy on the stack
+#define NUMBER_BUFFER_SIZE 64
 
-In case it encounters a decimal point while reading digits and
-Vector needs to know what kind of number it is reading, it has type variable.
-Once finished reading numbers, it then converts the digits read to its
-corresponding type.
-*/
-struct Vector{
-    int type; // 0 -> int, 1 -> double, 2 -> string, 3-> bool, 4-> symbol
-    char endChar;
-    char* str;
-    int memorySize;
-    int size;
+// Token values are allocated this many at a time
+#define TOKEN_BLOCK_SIZE 1024
+
+// Character classes, as bits in charClass
+#define CLASS_DIGIT 1
+#define CLASS_INITIAL 2
+#define CLASS_SUBSEQUENT 4
+#define CLASS_DELIMITER 8
+#define CLASS_SPACE 16
+
+// Class of every byte. One lookup replaces the chains of comparisons a
+// character would otherwise go through.
+static const unsigned char charClass[256] = {
+    ['0' ... '9'] = CLASS_DIGIT | CLASS_SUBSEQUENT,
+    ['a' ... 'z'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['A' ... 'Z'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['!'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['$'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['%'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['&'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['*'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['/'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    [':'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['<'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['='] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['>'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['?'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['~'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['_'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['^'] = CLASS_INITIAL | CLASS_SUBSEQUENT,
+    ['.'] = CLASS_SUBSEQUENT,
+    ['+'] = CLASS_SUBSEQUENT,
+    ['-'] = CLASS_SUBSEQUENT,
+    [' '] = CLASS_DELIMITER | CLASS_SPACE,
+    ['\n'] = CLASS_DELIMITER | CLASS_SPACE,
+    ['\t'] = CLASS_DELIMITER | CLASS_SPACE,
+    ['\r'] = CLASS_DELIMITER | CLASS_SPACE,
+    ['('] = CLASS_DELIMITER,
+    [')'] = CLASS_DELIMITER,
+    [';'] = CLASS_DELIMITER
 };
 
-typedef struct Vector Vector;
-
-// Initialize a vector
-Vector *init_vector(char* str_ptr,int size, int memorySize, int type){
-    Vector *v = (Vector *)talloc(sizeof(Vector));
-    v->size = size;
-    v->memorySize = memorySize;
-    v->str = str_ptr;
-    v->endChar = ' ';
-    v->type = type;
-    return v;
+// Returns 1 if c ends a top-level atom. Otherwise, return 0
+int isAtomEnd(int c){
+    return (charClass[c] & CLASS_DELIMITER) != 0;
 }
 
-// Double the memory size of a string in a vector
-void doubleStringMemory(Vector *v){
-    char *new_str = talloc(sizeof(char) * 2 * v->memorySize);
-    int i;
-    for (i = 0; i < v->memorySize; i++){
-        new_str[i] = v->str[i];
-    }
-    v->str = new_str;
-    v->memorySize = (v->memorySize) *2;
+// Returns 1 if c is whitespace. Otherwise, return 0
+int isSpace(int c){
+    return (charClass[c] & CLASS_SPACE) != 0;
 }
 
-// Return 1 if a given char is a digit. Otherwise, return 0
-int isDigit(char c){
-    return (c == '1' || c == '2' || c == '3' || c == '4' || c == '5' ||
-            c == '6' || c == '7' || c == '8' || c == '9' || c == '0');
+// Returns 1 if c (a character or EOF) is in any of the classes
+static inline int hasClass(int c, int classes){
+    return c != EOF && (charClass[c] & classes) != 0;
 }
 
-// Returns 1 if a given char is a letter. Otherwise, return 0
-int isLetter(char c){
-    return (c == 'a' || c == 'b' || c == 'c' || c == 'd' || c == 'e' ||
-            c == 'f' || c == 'g' || c == 'h' || c == 'i' || c == 'j' ||
-            c == 'k' || c == 'l' || c == 'm' || c == 'n' || c == 'o' ||
-            c == 'p' || c == 'q' || c == 'r' || c == 's' || c == 't' ||
-            c == 'u' || c == 'v' || c == 'w' || c == 'x' || c == 'y' ||
-            c == 'z' || c == 'A' || c == 'B' || c == 'C' || c == 'D' ||
-            c == 'E' || c == 'F' || c == 'G' || c == 'H' || c == 'I' ||
-            c == 'J' || c == 'K' || c == 'L' || c == 'M' || c == 'N' ||
-            c == 'O' || c == 'P' || c == 'Q' || c == 'R' || c == 'S' ||
-            c == 'T' || c == 'U' || c == 'V' || c == 'W' || c == 'X' ||
-            c == 'Y' || c == 'Z');
+// Return 1 if a given char is a digit. Otherwise, return 0
+static inline int isDigit(int c){
+    return hasClass(c, CLASS_DIGIT);
 }
 
 // Returns 1 if initial. Otherwise, return 0
-int isInitial(char c){
-    return (isLetter(c) || c == '!' || c == '$' || c == '%' || c == '&' ||
-            c == '*' || c == '/' || c == ':' || c == '<' || c == '=' ||
-            c == '>' || c == '?' || c == '~' || c == '_' || c == '^');
+static inline int isInitial(int c){
+    return hasClass(c, CLASS_INITIAL);
 }
 
 // Returns 1 if subsequent. Otherwise, return 0
-int isSubsequent(char c){
-    return (isInitial(c) || isDigit(c) || c == '.' || c == '+' || c == '-');
+static inline int isSubsequent(int c){
+    return hasClass(c, CLASS_SUBSEQUENT);
 }
 
-// Removes comments
-void removeComments(){
-    char nextCharRead;
-    nextCharRead = fgetc(stdin);
-    while (nextCharRead != EOF && nextCharRead != '\n') {
-        nextCharRead = fgetc(stdin);
+// Returns 1 if c ends the token before it. Otherwise, return 0
+static inline int isDelimiter(int c){
+    return c == EOF || hasClass(c, CLASS_DELIMITER);
+}
+
+// Returns the next character without consuming it, or EOF at the end
+int peekChar(Lexer *lexer){
+    if (lexer->pos >= lexer->length) {
+        return EOF;
     }
+    return (unsigned char)lexer->text[lexer->pos];
 }
 
-// Tokenizes a string
-char *stringTokenize(){        
-    char charRead;
-    char nextCharRead;
-    char *str = talloc(sizeof(char)*10);
-    str[0] = '\"';
-    str[1] = '\0';
-    Vector *stringVector = init_vector(str, 2, 2, 2);
-    
-    do{
-        charRead = fgetc(stdin);
-            
-        //If the next character read after a double quote is the end of the
-        //input, then force quit.
-        if(charRead == EOF){
-            printf("String cannot be tokenized\n");
-            texit(1);
-        } else {
-            if (charRead == '\\'){
-                nextCharRead = fgetc(stdin);
-                if (nextCharRead != EOF){
-                    // If every memory block in str is occupied,
-                    // double its memory size
-                    if (((stringVector->size)+2) > (stringVector->memorySize)){
-                       doubleStringMemory(stringVector);
-                    }
-                    
-                    // Append two characters
-                    stringVector->size = stringVector->size + 2;
-                    stringVector->str[stringVector->size - 3] = charRead;
-                    stringVector->str[stringVector->size - 2] = nextCharRead;
-                    stringVector->str[stringVector->size - 1] = '\0';
-                }
-            } else {
-                if (((stringVector->size)+2) > (stringVector->memorySize)){
-                   doubleStringMemory(stringVector);
-                }
+// Consumes and returns the next character, or EOF at the end
+int readChar(Lexer *lexer){
+    int c = peekChar(lexer);
+    if (c != EOF) {
+        lexer->pos = lexer->pos + 1;
+    }
+    return c;
+}
 
-                // Append a character
-                stringVector->size = stringVector->size + 1;
-                stringVector->str[stringVector->size - 2] = charRead;
-                stringVector->str[stringVector->size - 1] = '\0';
+// Returns the position of the first non-whitespace character at or after pos
+size_t skipSpace(const char *text, size_t pos, size_t length){
+    // most gaps between tokens are a single space
+    while (pos < length && hasClass((unsigned char)text[pos], CLASS_SPACE)){
+        pos = pos + 1;
+        if (pos < length && !hasClass((unsigned char)text[pos], CLASS_SPACE)){
+            return pos;
+        }
+#ifdef TOKENIZER_SSE2
+        // indentation and blank lines: 16 characters per step
+        while (pos + 16 <= length){
+            __m128i block = _mm_loadu_si128((__m128i *)(text + pos));
+            __m128i space = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))),
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\t')),
+                             _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+            unsigned int mask = ~_mm_movemask_epi8(space) & 0xffff;
+            if (mask != 0){
+                return pos + __builtin_ctz(mask);
             }
+            pos = pos + 16;
         }
-    }while(charRead != '\"');
-    return stringVector->str;
+#endif
+    }
+    return pos;
 }
 
-// Tokenizes any digits following a decimal point
-Vector *doubleTokenize(int udecimal){
-    char charRead;
-    char *double_str = talloc(sizeof(char)*10);
-    double_str[0] = '.';
-    double_str[1] = '\0';
-    Vector *doubleVector = init_vector(double_str, 2, 2, 1);
-    
-    // Takes care of  .<digit>+
-    if (udecimal == 0){
-        charRead = fgetc(stdin);
-        if (charRead == EOF || !isDigit(charRead)){
-            printf("Double cannot be tokenized\n");
-            texit(1);
+// Returns the position of the first quote or backslash at or after pos, or
+// length if there is none
+size_t findStringEnd(const char *text, size_t pos, size_t length){
+#ifdef TOKENIZER_SSE2
+    __m128i quote = _mm_set1_epi8('\"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    while (pos + 16 <= length){
+        __m128i block = _mm_loadu_si128((__m128i *)(text + pos));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                         _mm_cmpeq_epi8(block, backslash)));
+        if (mask != 0){
+            return pos + __builtin_ctz(mask);
         }
-    
-        while (charRead != EOF && charRead != '\n' &&
-               charRead != ' '){
-            if (!isDigit(charRead) && charRead != ')' && charRead != '(' &&
-                charRead != ';'){
-                printf("Double cannot be tokenized\n");
-                texit(1);
-            } else if (charRead == ')'){
-                doubleVector->endChar = ')';
-                break;
-            } else if (charRead == '('){
-                doubleVector->endChar = '(';
+        pos = pos + 16;
+    }
+#endif
+    while (pos < length && text[pos] != '\"' && text[pos] != '\\'){
+        pos = pos + 1;
+    }
+    return pos < length ? pos : length;
+}
+
+// Removes comments
+void removeComments(Lexer *lexer){
+    const char *newline = memchr(lexer->text + lexer->pos, '\n',
+                                 lexer->length - lexer->pos);
+    if (newline == NULL) {
+        lexer->pos = lexer->length;
+    } else {
+        lexer->pos = newline - lexer->text;
+    }
+}
+
+// Returns the location of the character at pos, or 0 if it has none
+unsigned int tokenLocation(Lexer *lexer, size_t pos){
+    if (lexer->base == 0 || lexer->base + pos > UINT_MAX){
+        return 0;
+    }
+    return lexer->base + pos;
+}
+
+// Reports a token that cannot be read, starting at pos, and exits
+void lexerError(Lexer *lexer, size_t pos, char *message){
+    sourceError(tokenLocation(lexer, pos), message);
+}
+
+// Returns a fresh token starting at pos. Tokens are allocated a block at a
+// time, so that each does not cost an allocation of its own.
+Value *makeToken(Lexer *lexer, valueType type, size_t pos){
+    if (lexer->free == 0){
+        lexer->block = talloc(sizeof(Value) * TOKEN_BLOCK_SIZE);
+        lexer->free = TOKEN_BLOCK_SIZE;
+    }
+    lexer->free = lexer->free - 1;
+    Value *token = lexer->block + lexer->free;
+    token->type = type;
+    token->loc = tokenLocation(lexer, pos);
+    return token;
+}
+
+// Returns a parenthesis token at pos. Parentheses carry no data, so the
+// lexer's own value is reused for every one.
+Value *makeParen(Lexer *lexer, valueType type, size_t pos){
+    lexer->paren.type = type;
+    lexer->paren.loc = tokenLocation(lexer, pos);
+    return &lexer->paren;
+}
+
+// Returns the value of the hex digit c, or -1 if it is not one
+int hexDigit(int c){
+    if (c >= '0' && c <= '9'){
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Returns a string token holding the text between the quotes at start and
+// end with its escapes replaced by the characters they stand for
+Value *decodeString(Lexer *lexer, size_t start, size_t end){
+    const char *text = lexer->text;
+    // the text never grows as it is decoded
+    char *chars = talloc(sizeof(char) * (end - start + 2));
+    size_t pos = start + 1;
+    int length = 0;
+    while (pos < end){
+        size_t next = findStringEnd(text, pos, end);
+        memcpy(chars + 1 + length, text + pos, next - pos);
+        length = length + (next - pos);
+        if (next >= end){
+            break;
+        }
+        char c = text[next + 1];
+        pos = next + 2;
+        switch (c){
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case '\\':
+            case '\"':
+            case '|':
                 break;
-            } else if (charRead == ';'){
-                removeComments();
+            case 'x': {
+                // \x followed by hex digits and a semicolon
+                int code = 0;
+                while (pos < end && hexDigit((unsigned char)text[pos]) >= 0 &&
+                       code <= 0xff){
+                    code = code * 16 + hexDigit((unsigned char)text[pos]);
+                    pos = pos + 1;
+                }
+                if (pos == next + 2 || pos >= end || text[pos] != ';' ||
+                    code > 0xff){
+                    lexerError(lexer, next, "Bad \\x escape in string");
+                }
+                pos = pos + 1;
+                c = (char)code;
                 break;
             }
-//            else if (charRead == '.') {
-//                break;
-//            }
-        
-            //If every memory block in str is occupied, double its memory size.
-            if (((doubleVector->size)+2) > doubleVector->memorySize){
-                doubleStringMemory(doubleVector);
-            }
-        
-            // Append a digit
-            doubleVector->str[doubleVector->size - 1] = charRead;
-            doubleVector->size = doubleVector->size + 1;
-            doubleVector->str[doubleVector->size - 1] = '\0';
-        
-            charRead = fgetc(stdin);
+            default:
+                lexerError(lexer, next, "Unknown escape in string");
         }
+        chars[1 + length] = c;
+        length = length + 1;
     }
-    
-    // Takes care of <digit>+ . <digit>*
-    else{
-        charRead = fgetc(stdin);
-        
-        if (charRead == EOF || charRead == ' '){
-            doubleVector->str[doubleVector->size - 1] = '0';
-            doubleVector->size = doubleVector->size + 1;
-            doubleVector->str[doubleVector->size - 1] = '\0';
-        }
-        else{
-            while (charRead != EOF && charRead != '\n' && charRead != ' '){
-                if (!isDigit(charRead) && charRead != ')' && charRead != ';'){
-                   printf("Double cannot be tokenized\n");
-                    texit(1);
-                }else if (charRead == ')'){
-                    doubleVector->endChar = ')';
-                    break;
-                }else if (charRead == '('){
-                    doubleVector->endChar = '(';
-                    break;
-                }else if (charRead == ';'){
-                    removeComments();
-                    break;
-                }
-        
-                // If every memory block in str is occupied, double its
-                // memory size.
-                if (((doubleVector->size)+2) > doubleVector->memorySize){
-                    doubleStringMemory(doubleVector);
-                }
-        
-                // Append a digit
-                doubleVector->str[doubleVector->size - 1] = charRead;
-                doubleVector->size = doubleVector->size + 1;
-                doubleVector->str[doubleVector->size - 1] = '\0';
-        
-                charRead = fgetc(stdin);
-            }        
-        }  
+    chars[0] = '\"';
+    chars[length + 1] = '\"';
+    chars[length + 2] = '\0';
+    Value *token = makeToken(lexer, STR_TYPE, start);
+    token->str.chars = chars;
+    token->str.length = length;
+    return token;
+}
+
+// Tokenizes a string whose opening quote was just read. A string with no
+// escapes points into the source text, quotes included; one with escapes is
+// decoded into a copy.
+Value *tokenizeString(Lexer *lexer){
+    size_t start = lexer->pos - 1;
+    size_t pos = findStringEnd(lexer->text, lexer->pos, lexer->length);
+    int escaped = 0;
+    while (pos < lexer->length && lexer->text[pos] == '\\'){
+        escaped = 1;
+        pos = findStringEnd(lexer->text, pos + 2, lexer->length);
+    }
+
+    //If the input ends before the closing double quote, then force quit.
+    if (pos >= lexer->length){
+        lexerError(lexer, start, "String cannot be tokenized");
     }
-    return doubleVector;
+    lexer->pos = pos + 1;
+
+    if (escaped){
+        return decodeString(lexer, start, pos);
+    }
+    if (lexer->copyStrings){
+        // the text will be overwritten by later input
+        Value *copy = makeString((char *)lexer->text + start + 1,
+                                 lexer->pos - start - 2);
+        copy->loc = tokenLocation(lexer, start);
+        return copy;
+    }
+    Value *token = makeToken(lexer, STR_TYPE, start);
+    token->str.chars = (char *)lexer->text + start;
+    token->str.length = lexer->pos - start - 2;
+    return token;
 }
 
-// Tokenizes either int or double upon reading a digit
-Vector *numberTokenize(char firstDigit){
-    char charRead;
-    char *num_str = talloc(sizeof(char)*10);
-    num_str[0] = firstDigit;
-    num_str[1] = '\0';
-    
-    Vector *numVector = init_vector(num_str, 2, 2, 0);
-    
-    do{
-        charRead = fgetc(stdin);
-        
-        // If a digit is read, append it
-        if (isDigit(charRead)){
-            if (((numVector->size)+2) > numVector->memorySize){
-                doubleStringMemory(numVector);
-            }
-            numVector->str[numVector->size - 1] = charRead;
-            numVector->size = numVector->size + 1;
-            numVector->str[numVector->size - 1] = '\0';
-        }
-        
-        // A decimal point is read
-        else if (charRead == '.'){
-            numVector->type = 1;
-            Vector *doubleVector = doubleTokenize(1);
-            int mem_size = (doubleVector->memorySize)+(numVector->memorySize);
-            char *double_str = talloc(sizeof(char) * mem_size);
-            strcpy(double_str, numVector->str);
-            strcat(double_str, doubleVector->str);
-             
-            doubleVector->str = double_str;
-            doubleVector->memorySize = (mem_size);
-            numVector = doubleVector;
-            
-            break;
+// Tokenizes an int or double starting at the cursor; its sign, if any, is
+// at signPos
+Value *tokenizeNumber(Lexer *lexer, int negative, size_t signPos){
+    size_t start = lexer->pos;
+    long long integer = 0;
+    int isDouble = 0;
+
+    while (isDigit(peekChar(lexer))){
+        integer = integer * 10 + (readChar(lexer) - '0');
+    }
+
+    // A decimal point makes it a double; .<digit>+ needs a digit after it
+    if (peekChar(lexer) == '.'){
+        isDouble = 1;
+        readChar(lexer);
+        if (lexer->pos - 1 == start && !isDigit(peekChar(lexer))){
+            lexerError(lexer, signPos, "Double cannot be tokenized");
         }
-        
-        // Store the close parenthesis and exit
-        else if (charRead == ')'){
-            numVector->endChar = ')';
-            break;
-        } else if (charRead == '('){
-            numVector->endChar = '(';
-            break;
-        } else if (charRead == ';'){
-            removeComments();
-            break;
+        while (isDigit(peekChar(lexer))){
+            readChar(lexer);
         }
-        
-        else if (!isDigit(charRead) && charRead != EOF && charRead != '\n'
-                 && charRead != ' ' && charRead != ';'){
-            printf("Cannot tokenize a number\n");
-            texit(1);
-        }     
-    }while (charRead != EOF && charRead != '\n' && charRead != ' ');
-    
-    return numVector;
-}
+    }
 
-// Invoke doubleTokenize or numberTokenize depending on a character read
-Vector *tokenizeDigits(Value *ptr, char charRead, char sign){
-    Vector *digit_vec;
-    
-    // Decimal point (double)
-    if (charRead == '.'){
-        digit_vec = doubleTokenize(0);
-        double double_num = atof(digit_vec->str);
-        if (sign == '-'){
-            double_num = double_num * -1.0;
+    if (!isDelimiter(peekChar(lexer))){
+        if (isDouble){
+            lexerError(lexer, signPos, "Double cannot be tokenized");
         }
-        ptr->type = DOUBLE_TYPE;
-        ptr->d = double_num;
+        lexerError(lexer, signPos, "Cannot tokenize a number");
     }
-        
-    // Digit (int or double)
-    else if (isDigit(charRead)){
-        digit_vec = numberTokenize(charRead);
-        // Integer
-        if (digit_vec->type == 0){
-            int integer = atoi(digit_vec->str);
-            if (sign == '-'){
-                integer = integer * -1;
-            }
-            ptr->type = INT_TYPE;
-            ptr->i = integer;
-        }
-        // Double
-        else{
-            double double_num = atof(digit_vec->str);
-            if (sign == '-'){
-                double_num = double_num * -1;
-            }
-            ptr->type = DOUBLE_TYPE;
-            ptr->d = double_num;
-        }
+
+    Value *token;
+    if (!isDouble){
+        token = makeToken(lexer, INT_TYPE, signPos);
+        token->i = (int)(negative ? -integer : integer);
+        return token;
+    }
+
+    // strtod needs a terminated string; the digits are copied to the stack
+    // unless they are unusually long
+    size_t size = lexer->pos - start;
+    char buffer[NUMBER_BUFFER_SIZE];
+    char *digits = buffer;
+    if (size >= NUMBER_BUFFER_SIZE){
+        digits = talloc(size + 1);
     }
-    if (digit_vec->endChar == ';'){
-        removeComments();
+    memcpy(digits, lexer->text + start, size);
+    digits[size] = '\0';
+    token = makeToken(lexer, DOUBLE_TYPE, signPos);
+    token->d = strtod(digits, NULL);
+    if (negative){
+        token->d = token->d * -1.0;
     }
-    return digit_vec;
+    return token;
 }
 
-// Tokenizes bool
-Vector *tokenizeBool(){
-    char charRead;
-    char nextCharRead;
-    char *bool_str = talloc(sizeof(char)*3);
-    bool_str[0] = '#';
-    bool_str[1] = '\0';
-    
-    Vector *boolVector= init_vector(bool_str, 2, 2, 3);
-    
-    charRead = fgetc(stdin);
-    nextCharRead = fgetc(stdin);
-        
-    if ((charRead == 't' || charRead == 'T' || charRead == 'f' ||
-        charRead == 'F') && (nextCharRead == ' ' || nextCharRead == EOF ||
-                             nextCharRead == '\n' || nextCharRead == ';' ||
-                            nextCharRead == ')' || nextCharRead == '(')){
-        boolVector->str[boolVector->size - 1] = charRead;
-        boolVector->size = boolVector->size + 1;
-        boolVector->str[boolVector->size - 1] = '\0';
-    }else{
-        printf("A bool type cannot be tokenized\n");
-        texit(1);
+// Tokenizes bool after its hash tag
+Value *tokenizeBool(Lexer *lexer){
+    size_t start = lexer->pos - 1;
+    int charRead = readChar(lexer);
+    if ((charRead != 't' && charRead != 'T' && charRead != 'f' &&
+         charRead != 'F') || !isDelimiter(peekChar(lexer))){
+        lexerError(lexer, start, "A bool type cannot be tokenized");
     }
-    // Store the close parenthesis
-    if (nextCharRead == ')'){
-        boolVector->endChar = ')';
-    } else if (nextCharRead == '('){
-        boolVector->endChar = '(';
-    } else if (nextCharRead == ';'){
-        removeComments();
+    Value *token = makeToken(lexer, BOOL_TYPE, start);
+    if (charRead == 't' || charRead == 'T'){
+        token->s = "#t";
+    } else {
+        token->s = "#f";
     }
-    return boolVector;
+    return token;
 }
 
-// Tokenizes symbols
-Vector *tokenizeSymbol(char c1, char c2){
-    char charRead;
-    char *symbol_str = talloc(sizeof(char)*10);
-    symbol_str[0] = c1;
-    symbol_str[1] = c2;
-    symbol_str[2] = '\0';
-    
-    Vector *symbolVector = init_vector(symbol_str, 3, 3, 4);
-    
-    charRead = fgetc(stdin);
-    while(charRead != EOF && charRead != '\n' && charRead != ' '){  
-        if (!isSubsequent(charRead) && charRead != ')'
-            && charRead != '(' && charRead != ';'){
-            printf("Symbol cannot be tokenized\n");
-            texit(1);
-        }else if (charRead == ')'){
-            symbolVector->endChar = ')';
-            break;
-        }else if (charRead == '('){
-            symbolVector->endChar ='(';
-            break;
-        }else if (charRead == ';'){
-            symbolVector->endChar = ';';
-            break;
-        }
-        if (symbolVector->size + 2 > symbolVector->memorySize){
-            doubleStringMemory(symbolVector);
-        }
-        symbolVector->str[symbolVector->size - 1] = charRead;
-        symbolVector->size = symbolVector->size + 1;
-        symbolVector->str[symbolVector->size - 1] = '\0';
-        charRead = fgetc(stdin);
+// Tokenizes a symbol whose initial character was just read
+Value *tokenizeSymbol(Lexer *lexer){
+    size_t start = lexer->pos - 1;
+    size_t pos = lexer->pos;
+    while (pos < lexer->length &&
+           hasClass((unsigned char)lexer->text[pos], CLASS_SUBSEQUENT)){
+        pos = pos + 1;
+    }
+    lexer->pos = pos;
+    if (!isDelimiter(peekChar(lexer))){
+        lexerError(lexer, start, "Symbol cannot be tokenized");
+    }
+    Value *token = makeToken(lexer, SYMBOL_TYPE, start);
+    token->s = intern(lexer->text + start, lexer->pos - start);
+    return token;
+}
+
+// Tokenizes what follows a single quote (string, int, double, or symbol)
+Value *tokenizeQuoted(Lexer *lexer){
+    size_t start = lexer->pos - 1;
+    int nextCharRead = readChar(lexer);
+
+    // string
+    if (nextCharRead == '\"'){
+        return tokenizeString(lexer);
     }
-    return symbolVector;
+
+    // symbol, followed by the open parenthesis on the next call
+    if (nextCharRead == '('){
+        Value *quote = makeToken(lexer, SYMBOL_TYPE, start);
+        quote->s = "'";
+        lexer->pendingOpen = 1;
+        return quote;
+    }
+
+    // '.12, '12, '12.34
+    if (isDigit(nextCharRead) || nextCharRead == '.'){
+        lexer->pos = lexer->pos - 1;
+        return tokenizeNumber(lexer, 0, start);
+    }
+
+    // '+123, '-123, '-12.34, '+12.34, '-.12
+    if ((nextCharRead == '+' || nextCharRead == '-') &&
+        (isDigit(peekChar(lexer)) || peekChar(lexer) == '.')){
+        return tokenizeNumber(lexer, nextCharRead == '-', start);
+    }
+
+    lexerError(lexer, start, "Single quote cannot be tokenized");
+    return NULL;
+}
+
+// Sets up a lexer over length bytes of text whose first character is at
+// location base (0 if it has none)
+void initLexer(Lexer *lexer, const char *text, size_t length,
+               unsigned int base, int copyStrings){
+    lexer->text = text;
+    lexer->length = length;
+    lexer->pos = 0;
+    lexer->base = base;
+    lexer->block = NULL;
+    lexer->free = 0;
+    lexer->pendingOpen = 0;
+    lexer->copyStrings = copyStrings;
 }
 
-// Tokenizes the input text file in accordance with Scheme grammar
-Value *tokenize(){
-    char charRead;
-    char nextCharRead;
-    Value *list = makeNull();
-    charRead = fgetc(stdin);
-    
-    while (charRead != EOF){
-        Value *ptr = talloc(sizeof(Value));
-        
-        // Symbol
-        if (isInitial(charRead) || charRead == '+' || charRead == '-'){
-            nextCharRead = fgetc(stdin);
-            char *str_holder;
-            Vector *vec = init_vector(str_holder,0,0,NULL_TYPE);
-            
+// Returns the next token in accordance with Scheme grammar, or NULL at the
+// end of the text
+Value *nextToken(Lexer *lexer){
+    if (lexer->pendingOpen){
+        lexer->pendingOpen = 0;
+        return makeParen(lexer, OPEN_TYPE, lexer->pos - 1);
+    }
+    while (1){
+        lexer->pos = skipSpace(lexer->text, lexer->pos, lexer->length);
+        size_t start = lexer->pos;
+        int charRead = readChar(lexer);
+        switch (charRead){
+            case EOF:
+                return NULL;
+
+            // Open parenthesis
+            case '(':
+                return makeParen(lexer, OPEN_TYPE, start);
+
+            // Close parenthesis
+            case ')':
+                return makeParen(lexer, CLOSE_TYPE, start);
+
+            // Remove line comments
+            case ';':
+                removeComments(lexer);
+                break;
+
+            // Double quote (string)
+            case '\"':
+                return tokenizeString(lexer);
+
+            // Single quote (string, int, double, or symbol)
+            case '\'':
+                return tokenizeQuoted(lexer);
+
+            // Hash tag (bool)
+            case '#':
+                return tokenizeBool(lexer);
+
             // Tells whether +, - is a sign or an identifier
-            if ((charRead == '+' || charRead == '-') &&
-                (isDigit(nextCharRead) || nextCharRead == '.')){
-                vec = tokenizeDigits(ptr, nextCharRead, charRead);
-                list = cons(ptr, list);
-                Value *ptr2 = talloc(sizeof(Value));
-                if (vec->endChar == ')'){
-                    ptr2->type = CLOSE_TYPE;
-                    list = cons(ptr2, list);
-                }else if(vec->endChar=='('){
-                    ptr2->type = OPEN_TYPE;
-                    list = cons(ptr2, list);
-                }else if(vec->endChar==';'){
-                    removeComments();
-                }
-            }
-            // Tokenize symbols in accordance with the given symbol grammar
-            else if (nextCharRead != ' ' && nextCharRead != EOF &&
-                     nextCharRead != ')' && nextCharRead != '(' &&
-                     nextCharRead != '\n' && nextCharRead != ';'){
-                if (charRead == '+' || charRead == '-') {
-                    printf("Invalid symbol\n");
-                    texit(1);
+            case '+':
+            case '-':{
+                int nextCharRead = peekChar(lexer);
+                if (isDigit(nextCharRead) || nextCharRead == '.'){
+                    return tokenizeNumber(lexer, charRead == '-', start);
                 }
-                vec = tokenizeSymbol(charRead, nextCharRead);
-                ptr->type = SYMBOL_TYPE;
-                ptr->s = vec->str;
-                list = cons(ptr, list);
-                
-                Value *ptr2 = talloc(sizeof(Value));
-                if (vec->endChar == ')'){
-                    ptr2->type = CLOSE_TYPE;
-                    list = cons(ptr2, list);
-                }else if(vec->endChar=='('){
-                    ptr2->type = OPEN_TYPE;
-                    list = cons(ptr2, list);
-                }else if(vec->endChar==';'){
-                    removeComments();
+                if (!isDelimiter(nextCharRead)){
+                    lexerError(lexer, start, "Invalid symbol");
                 }
+                return tokenizeSymbol(lexer);
             }
-             // When symbol length is 1 e.g. >, +, a
-            else{
-                ptr->type = SYMBOL_TYPE;
-                char *str = talloc(sizeof(char)*5);
-                str[0] = charRead;
-                str[1] = '\0';
-                ptr->s = str;
-                list = cons(ptr, list);
-                Value *ptr2 = talloc(sizeof(Value));
-                if (nextCharRead == ')'){    
-                    ptr2->type = CLOSE_TYPE;
-                    list = cons(ptr2, list);
-                }else if(nextCharRead =='('){
-                    ptr2->type = OPEN_TYPE;
-                    list = cons(ptr2, list);
-                }else if(nextCharRead ==';'){
-                    removeComments();
-                }
-            }
-        }
-        
-        // Remove line comments
-        else if (charRead == ';'){
-            removeComments();
-        }
-        
-        // Open parenthesis
-        else if (charRead == '('){
-            ptr->type = OPEN_TYPE;
-            list = cons(ptr, list);
-        }
-        
-        // Close parenthesis
-        else if (charRead == ')'){
-            ptr->type = CLOSE_TYPE;
-            list = cons(ptr, list);
-        }
-        
-        // Double quote (string)
-        else if (charRead == '\"'){
-            char *str = stringTokenize();
-            ptr->type = STR_TYPE;
-            ptr->s = str;
-            list = cons(ptr, list);
-        }
-          
-        // Single quote (string, int, double, or symbol)
-        else if (charRead == '\''){
-            nextCharRead = fgetc(stdin);
-            
-            // string
-            if (nextCharRead == '\"'){
-                char *str = stringTokenize();
-                ptr->type = STR_TYPE;
-                ptr->s = str;
-                list = cons(ptr, list);
-            }
-            
-            // symbol
-            else if (nextCharRead == '('){
-                ptr->type = SYMBOL_TYPE;
-                ptr->s = "'";
-                
-                Value *ptr2 = talloc(sizeof(Value));
-                ptr2->type = OPEN_TYPE;
-                
-                list = cons(ptr, list);
-                list = cons(ptr2, list);
-            }
-            
-            // int or double
-            else if (isDigit(nextCharRead) || nextCharRead =='+' ||
-                     nextCharRead == '-' || nextCharRead == '.'){
-                
-                // '.12, '12, '12.34
-                if (nextCharRead == '.' || isDigit(nextCharRead)){
-                    Vector *num_vec;
-                    num_vec = tokenizeDigits(ptr, nextCharRead, '+');
-                    
-                    list = cons(ptr, list);
-                    
-                    Value *ptr2 = talloc(sizeof(Value));
-                    if (num_vec->endChar == ')'){
-                        ptr2->type = CLOSE_TYPE;
-                        list = cons(ptr2, list);
-                    } else if (num_vec->endChar == '('){
-                        ptr2->type = OPEN_TYPE;
-                        list = cons(ptr2, list);
-                    }
+
+            // Decimal point (double)
+            case '.':
+                lexer->pos = start;
+                return tokenizeNumber(lexer, 0, start);
+
+            default:
+                // Digit (int or double)
+                if (isDigit(charRead)){
+                    lexer->pos = start;
+                    return tokenizeNumber(lexer, 0, start);
                 }
-                // '+123, '-123, '-12.34, '+12.34, '-.12
-                else{
-                    char sign = nextCharRead;
-                    nextCharRead = fgetc(stdin);
-                    
-                    if (isDigit(nextCharRead) || nextCharRead == '.'){
-                        Vector *vec;
-                        vec = tokenizeDigits(ptr, nextCharRead, sign);
-                        list = cons(ptr, list);
-                        Value *ptr2 = talloc(sizeof(Value));
-                        if (vec->endChar == ')'){
-                            ptr2->type = CLOSE_TYPE;
-                            list = cons(ptr2, list);
-                        } else if (vec->endChar == '('){
-                            ptr2->type = OPEN_TYPE;
-                            list = cons(ptr2, list);
-                        }
-                    }else{
-                        printf("Single quote cannot be tokenized\n");
-                        texit(1);
-                    }
+                // Symbol
+                if (isInitial(charRead)){
+                    return tokenizeSymbol(lexer);
                 }
-            }else{
-                printf("Single quote cannot be tokenized\n");
-                texit(1);
-            }
-        }
-        
-        // Decimal point or a digit (int or double)
-        else if (charRead == '.' || isDigit(charRead)){
-            Vector *num_vec;
-            num_vec = tokenizeDigits(ptr, charRead, '+');
-            list = cons(ptr, list);
-            
-            if (num_vec->endChar == ')'){
-                Value *ptr2 = talloc(sizeof(Value));
-                ptr2->type = CLOSE_TYPE;
-                list = cons(ptr2, list);
-            } else if (num_vec->endChar == '('){
-                Value *ptr2 = talloc(sizeof(Value));
-                ptr2->type = OPEN_TYPE;
-                list = cons(ptr2, list);
-            } else if (num_vec->endChar == ';'){
-                removeComments();
-            }
-        }
-                
-        // Hash tag (bool)
-        else if (charRead == '#'){
-            Vector *boolVector = tokenizeBool();
-            ptr->type = BOOL_TYPE;
-            ptr->s = boolVector->str;
-            list = cons(ptr, list);
-            
-            if (boolVector->endChar == ')'){
-                Value *ptr2 = talloc(sizeof(Value));
-                ptr2->type = CLOSE_TYPE;
-                list = cons(ptr2, list);
-            } else if (boolVector->endChar == '('){
-                Value *ptr2 = talloc(sizeof(Value));
-                ptr2->type = OPEN_TYPE;
-                list = cons(ptr2, list);
-            }
+                // anything else is skipped
+                break;
         }
-        charRead = fgetc(stdin);
     }
-    Value *revList  = reverse(list);
-    return revList;
 }
 
 // Displays the contents of the linked list as tokens, with type information
@@ -644,9 +561,12 @@ void displayTokens(Value *list){
         case(CLOSE_TYPE):
             printf(") : close\n");
             break;
-        case(STR_TYPE):
-            printf("%s : string\n", list->s);
+        case(STR_TYPE):{
+            int length;
+            char *text = writtenString(list, &length);
+            printf("%.*s : string\n", length, text);
             break;
+        }
         case(INT_TYPE):
             printf("%d : int\n", list->i);
             break;
@@ -664,4 +584,4 @@ void displayTokens(Value *list){
         default:
             break;
     }
-}
\ No newline at end of file
+}
@@ -1,11 +1,46 @@
+#include <stddef.h>
 #include "value.h"
 
 #ifndef _TOKENIZER
 #define _TOKENIZER
 
-// Read all of the input from stdin, and return a linked list consisting of the
-// tokens.
-Value *tokenize();
+// Source text being tokenized and the position of the next character.
+// Tokens are located relative to base, the location of text[0] (0 if the
+// text has none). Token values come from block, which has free values left;
+// parentheses are returned in paren, which is reused for every one. When
+// copyStrings is set, strings are copied out of text rather than pointing
+// into it.
+struct Lexer {
+    const char *text;
+    size_t length;
+    size_t pos;
+    unsigned int base;
+    Value *block;
+    int free;
+    Value paren;
+    int pendingOpen;
+    int copyStrings;
+};
+
+typedef struct Lexer Lexer;
+
+// Sets up a lexer over length bytes of text whose first character is at
+// location base (0 if it has none). Unless copyStrings is set, string tokens
+// point into text, so it must stay in memory while they are in use.
+void initLexer(Lexer *lexer, const char *text, size_t length,
+               unsigned int base, int copyStrings);
+
+// Returns the next token, or NULL at the end of the text. A parenthesis
+// token is only valid until the next call.
+Value *nextToken(Lexer *lexer);
+
+// Returns the position of the first quote or backslash at or after pos, or
+// length if there is none
+size_t findStringEnd(const char *text, size_t pos, size_t length);
+
+// Return 1 if c ends a top-level atom, or is whitespace
+int isAtomEnd(int c);
+int isSpace(int c);
 
 // Displays the contents of the linked list as tokens, with type information
 void displayTokens(Value *list);
@@ -2,17 +2,29 @@
 #define _VALUE
 
 typedef enum {INT_TYPE,DOUBLE_TYPE,STR_TYPE,CONS_TYPE,NULL_TYPE,PTR_TYPE,
-              OPEN_TYPE,CLOSE_TYPE,BOOL_TYPE,SYMBOL_TYPE,VOID_TYPE,CLOSURE_TYPE, PRIMITIVE_TYPE} 
+              OPEN_TYPE,CLOSE_TYPE,BOOL_TYPE,SYMBOL_TYPE,VOID_TYPE,CLOSURE_TYPE, PRIMITIVE_TYPE,
+              HASHMAP_TYPE, F64VECTOR_TYPE, S64VECTOR_TYPE, PORT_TYPE,
+              EOF_TYPE, OPTIMIZED_TYPE, QUICK_TYPE, MEMO_TYPE,
+              PROMISE_TYPE} 
     valueType;
 
 
 struct Value {
     valueType type;
+    // where the value was read from in the source (see reader.h), or 0
+    unsigned int loc;
     union {
         int i;
         double d;
         char *s;
         void *p;
+        // A string keeps its characters, with any escapes decoded, between a
+        // pair of quotes in chars (the same pointer as s), and the number of
+        // characters between the quotes in length, so it is never rescanned.
+        struct String {
+            char *chars;
+            int length;
+        } str;
         struct ConsCell {
             struct Value *car;
             struct Value *cdr;
@@ -31,6 +43,31 @@ struct Value {
         // A pritimitve style function; just a pointer to it, with the right
         // signature (pf = primitive function)
         struct Value *(*pf)(struct Value *);
+
+        // A persistent hash-array-mapped trie, used for both maps and sets.
+        // The nodes are shared between versions; see hamt.h.
+        struct Hamt *map;
+
+        // A homogeneous numeric vector with unboxed, contiguous elements;
+        // see numvec.h.
+        struct NumVector *vec;
+
+        // A file opened for reading or writing; see ports.h.
+        struct Port *port;
+
+        // An expression rewritten by the optimizer; see optimize.h.
+        struct Optimized *opt;
+
+        // A variable reference or call that specializes itself as it runs;
+        // see quicken.h.
+        struct Quick *quick;
+
+        // A procedure that remembers what its calls returned; see memo.h.
+        struct Memo *memo;
+
+        // An expression to be evaluated when its value is needed; see
+        // promise.h.
+        struct Promise *promise;
     };
 };
 